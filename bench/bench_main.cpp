@@ -0,0 +1,739 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <cctype>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "exclude.h"
+#include "file_reader.h"
+#include "local_deleter.h"
+#include "logger.h"
+#include "path_store.h"
+#include "path_utils.h"
+#include "scanner.h"
+#include "text_kernels.h"
+
+namespace {
+
+// Live heap bytes, tracked by the replacement operator new/delete below so
+// that memory figures include every allocation a representation makes.
+std::atomic<std::int64_t> g_live_bytes{0};
+
+constexpr std::size_t kAllocHeader = alignof(std::max_align_t);
+
+struct BenchContext {
+    std::size_t files = 1000000;
+};
+
+struct BenchCase {
+    std::string name;
+    std::function<void(const BenchContext&)> func;
+};
+
+std::vector<BenchCase>& Registry() {
+    static std::vector<BenchCase> benches;
+    return benches;
+}
+
+struct Registrar {
+    Registrar(const std::string& name, std::function<void(const BenchContext&)> func) {
+        Registry().push_back({name, std::move(func)});
+    }
+};
+
+#define BENCH_CASE(name) \
+    void name(const BenchContext& ctx); \
+    Registrar reg_##name(#name, name); \
+    void name(const BenchContext& ctx)
+
+void Report(const std::string& bench, const std::string& metric, double value,
+            const std::string& unit) {
+    std::cout << std::left << std::setw(28) << bench << std::setw(24) << metric
+              << std::right << std::fixed << std::setprecision(2) << std::setw(14) << value
+              << " " << unit << "\n";
+}
+
+// Synthetic tree shaped like a photo archive (archive/year/month/day with a
+// few hundred files per day), emitted in the same depth-first order a
+// directory scan produces.
+struct TreeVisitor {
+    std::function<void(std::size_t depth, const std::string& name)> on_dir;
+    std::function<void(std::size_t depth, const std::string& name)> on_file;
+};
+
+void WalkSyntheticTree(std::size_t files, const TreeVisitor& visitor) {
+    const std::size_t per_dir = 250;
+    std::size_t emitted = 0;
+    visitor.on_dir(0, "archive");
+    for (int year = 2000; emitted < files; ++year) {
+        visitor.on_dir(1, std::to_string(year));
+        for (int month = 1; month <= 12 && emitted < files; ++month) {
+            visitor.on_dir(2, std::to_string(month));
+            for (int day = 1; day <= 31 && emitted < files; ++day) {
+                visitor.on_dir(3, std::to_string(day));
+                for (std::size_t i = 0; i < per_dir && emitted < files; ++i, ++emitted) {
+                    visitor.on_file(4, "IMG_" + std::to_string(100000 + emitted) + ".jpg");
+                }
+            }
+        }
+    }
+}
+
+// The exclude check as it was before rules were compiled: every pattern is
+// lowercased and every segment re-matched with a backtracking glob per path.
+bool LegacyGlobMatch(const std::string& pattern, const std::string& text) {
+    size_t p = 0;
+    size_t t = 0;
+    size_t star = std::string::npos;
+    size_t match = 0;
+    while (t < text.size()) {
+        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
+            ++p;
+            ++t;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            match = t;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            t = ++match;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern.size();
+}
+
+bool LegacyShouldExclude(const std::string& relative_utf8, const ExcludeRules& rules) {
+    std::string rel = ToLowerAscii(relative_utf8);
+    std::vector<std::string> segments;
+    std::stringstream ss(rel);
+    std::string item;
+    while (std::getline(ss, item, '/')) {
+        if (!item.empty()) {
+            segments.push_back(item);
+        }
+    }
+    for (const auto& raw_pattern : rules.patterns) {
+        std::string pattern = ToLowerAscii(raw_pattern);
+        if (pattern.find('/') != std::string::npos) {
+            if (LegacyGlobMatch(pattern, rel)) {
+                return true;
+            }
+            continue;
+        }
+        for (const auto& segment : segments) {
+            if (LegacyGlobMatch(pattern, segment)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Default rules plus `extra` generated ones spread over exact names, "*.ext"
+// suffixes, general globs and path patterns; none of them match the tree.
+ExcludeRules LargeExcludeRules(std::size_t extra) {
+    ExcludeRules rules = BuildDefaultExcludeRules();
+    for (std::size_t i = 0; i < extra; ++i) {
+        std::string n = std::to_string(i);
+        switch (i % 4) {
+        case 0: rules.patterns.push_back("Cache_" + n); break;
+        case 1: rules.patterns.push_back("*.ext" + n); break;
+        case 2: rules.patterns.push_back("tmp" + n + "_*.?"); break;
+        default: rules.patterns.push_back("archive/" + n + "/*.raw"); break;
+        }
+    }
+    return rules;
+}
+
+// Percent-encoding as it was done per request before the text kernels.
+std::string LegacyUrlEncode(const std::string& path) {
+    std::ostringstream oss;
+    oss << std::hex << std::uppercase;
+    for (unsigned char c : path) {
+        if (c == '/' || std::isalnum(c) || c == '-' || c == '_' || c == '.' || c == '~') {
+            oss << c;
+        } else {
+            oss << '%' << std::setw(2) << std::setfill('0') << static_cast<int>(c);
+        }
+    }
+    return oss.str();
+}
+
+double Seconds(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+}  // namespace
+
+void* operator new(std::size_t size) {
+    void* raw = std::malloc(size + kAllocHeader);
+    if (!raw) {
+        throw std::bad_alloc();
+    }
+    *static_cast<std::size_t*>(raw) = size;
+    g_live_bytes.fetch_add(static_cast<std::int64_t>(size), std::memory_order_relaxed);
+    return static_cast<char*>(raw) + kAllocHeader;
+}
+
+void operator delete(void* ptr) noexcept {
+    if (!ptr) {
+        return;
+    }
+    char* raw = static_cast<char*>(ptr) - kAllocHeader;
+    g_live_bytes.fetch_sub(static_cast<std::int64_t>(*reinterpret_cast<std::size_t*>(raw)),
+                           std::memory_order_relaxed);
+    std::free(raw);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+    operator delete(ptr);
+}
+
+BENCH_CASE(ScanListLegacyPaths) {
+    std::filesystem::path root = std::filesystem::u8path("C:/Data/ToUpload");
+
+    struct FileEntry {
+        std::filesystem::path abs_path;
+        std::filesystem::path rel_path;
+    };
+
+    std::int64_t before = g_live_bytes.load();
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::vector<FileEntry> files;
+        std::vector<std::filesystem::path> directories;
+        std::vector<std::filesystem::path> stack;
+        TreeVisitor visitor;
+        visitor.on_dir = [&](std::size_t depth, const std::string& name) {
+            stack.resize(depth);
+            std::filesystem::path rel = depth == 0 ? std::filesystem::u8path(name)
+                                                   : stack.back() / std::filesystem::u8path(name);
+            directories.push_back(rel);
+            stack.push_back(rel);
+        };
+        visitor.on_file = [&](std::size_t depth, const std::string& name) {
+            std::filesystem::path rel = stack[depth - 1] / std::filesystem::u8path(name);
+            files.push_back({root / rel, rel});
+        };
+        WalkSyntheticTree(ctx.files, visitor);
+        stack.clear();
+        stack.shrink_to_fit();
+
+        double elapsed = Seconds(start);
+        double bytes = static_cast<double>(g_live_bytes.load() - before);
+        Report("ScanListLegacyPaths", "bytes/file", bytes / files.size(), "B");
+        Report("ScanListLegacyPaths", "build time", elapsed * 1000.0, "ms");
+    }
+}
+
+BENCH_CASE(ScanListPathStore) {
+    std::int64_t before = g_live_bytes.load();
+    auto start = std::chrono::steady_clock::now();
+    {
+        PathStore store;
+        std::vector<DirId> stack;
+        TreeVisitor visitor;
+        visitor.on_dir = [&](std::size_t depth, const std::string& name) {
+            DirId parent = depth == 0 ? PathStore::kRootDir : stack[depth - 1];
+            stack.resize(depth);
+            stack.push_back(store.AddDirectory(parent, name));
+        };
+        visitor.on_file = [&](std::size_t depth, const std::string& name) {
+            store.AddFile(stack[depth - 1], name);
+        };
+        WalkSyntheticTree(ctx.files, visitor);
+        stack.clear();
+        stack.shrink_to_fit();
+
+        double elapsed = Seconds(start);
+        double heap = static_cast<double>(g_live_bytes.load() - before);
+        double count = static_cast<double>(store.FileCount());
+        Report("ScanListPathStore", "bytes/file", heap / count, "B");
+        Report("ScanListPathStore", "bytes/file (reported)",
+               static_cast<double>(store.MemoryUsage()) / count, "B");
+        Report("ScanListPathStore", "build time", elapsed * 1000.0, "ms");
+
+        start = std::chrono::steady_clock::now();
+        std::size_t total = 0;
+        for (FileId f = 0; f < store.FileCount(); ++f) {
+            total += store.FileRemotePath("/Backup/p2", f).size();
+        }
+        Report("ScanListPathStore", "remote path/file", Seconds(start) * 1e9 / count, "ns");
+        Report("ScanListPathStore", "avg remote path", static_cast<double>(total) / count, "B");
+    }
+}
+
+// Materialises a small on-disk tree (at most 20000 files) for the scan
+// benchmarks; the synthetic in-memory tree above is too large to write out.
+std::filesystem::path PrepareScanTree(std::size_t files) {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "uploader_bench_scan";
+    std::size_t count = std::min<std::size_t>(files, 20000);
+    std::filesystem::path marker = root.string() + ".count";
+    std::ifstream in(marker);
+    std::size_t existing = 0;
+    if (in >> existing && existing == count) {
+        return root;
+    }
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    TreeVisitor visitor;
+    std::vector<std::filesystem::path> stack;
+    visitor.on_dir = [&](std::size_t depth, const std::string& name) {
+        stack.resize(depth);
+        std::filesystem::path dir = (depth == 0 ? root : stack.back()) / name;
+        std::filesystem::create_directories(dir);
+        stack.push_back(dir);
+    };
+    visitor.on_file = [&](std::size_t depth, const std::string& name) {
+        std::ofstream(stack[depth - 1] / name) << name;
+    };
+    WalkSyntheticTree(count, visitor);
+    std::ofstream(marker) << count;
+    return root;
+}
+
+BENCH_CASE(ScanTreeLegacyIterator) {
+    std::filesystem::path root = PrepareScanTree(ctx.files);
+    ExcludeRules rules = BuildDefaultExcludeRules();
+    auto start = std::chrono::steady_clock::now();
+    std::size_t files = 0;
+    std::uint64_t bytes = 0;
+    std::error_code ec;
+    std::filesystem::recursive_directory_iterator iter(
+        root, std::filesystem::directory_options::skip_permission_denied, ec);
+    for (; iter != std::filesystem::recursive_directory_iterator(); iter.increment(ec)) {
+        const auto& entry = *iter;
+        std::filesystem::path rel = std::filesystem::relative(entry.path(), root, ec);
+        if (LegacyShouldExclude(PathToGenericUtf8(rel), rules)) {
+            if (entry.is_directory()) {
+                iter.disable_recursion_pending();
+            }
+            continue;
+        }
+        if (entry.is_regular_file()) {
+            bytes += std::filesystem::file_size(entry.path(), ec);
+            (void)std::filesystem::last_write_time(entry.path(), ec);
+            files++;
+        }
+    }
+    double elapsed = Seconds(start);
+    Report("ScanTreeLegacyIterator", "us/file", elapsed * 1e6 / files, "us");
+    Report("ScanTreeLegacyIterator", "files", static_cast<double>(files), "");
+    (void)bytes;
+}
+
+BENCH_CASE(ScanTreeScanSource) {
+    std::filesystem::path root = PrepareScanTree(ctx.files);
+    Logger logger(std::filesystem::temp_directory_path() / "uploader_bench_logs");
+    PathStore store;
+    auto start = std::chrono::steady_clock::now();
+    ScanStats stats = ScanSource(root, ExcludeMatcher(BuildDefaultExcludeRules()), logger, &store);
+    double elapsed = Seconds(start);
+    Report("ScanTreeScanSource", "us/file", elapsed * 1e6 / stats.files, "us");
+    Report("ScanTreeScanSource", "files", static_cast<double>(stats.files), "");
+}
+
+// Remote request paths for every file of the synthetic tree (at most 200000),
+// built per file from the relative path as the sync loop used to.
+BENCH_CASE(RemotePathLegacy) {
+    std::vector<std::filesystem::path> stack;
+    std::size_t count = 0;
+    std::size_t bytes = 0;
+    TreeVisitor visitor;
+    visitor.on_dir = [&](std::size_t depth, const std::string& name) {
+        stack.resize(depth);
+        stack.push_back(depth == 0 ? std::filesystem::u8path("Фото " + name)
+                                   : stack.back() / std::filesystem::u8path(name));
+    };
+    visitor.on_file = [&](std::size_t depth, const std::string& name) {
+        std::filesystem::path rel = stack[depth - 1] / std::filesystem::u8path(name);
+        std::string remote = JoinRemotePath("/Backup/p2", rel);
+        bytes += LegacyUrlEncode(remote).size();
+        count++;
+    };
+    auto start = std::chrono::steady_clock::now();
+    WalkSyntheticTree(std::min<std::size_t>(ctx.files, 200000), visitor);
+    double elapsed = Seconds(start);
+    Report("RemotePathLegacy", "ns/file", elapsed * 1e9 / count, "ns");
+    Report("RemotePathLegacy", "avg encoded", static_cast<double>(bytes) / count, "B");
+}
+
+BENCH_CASE(RemotePathCachedPrefix) {
+    PathStore store;
+    std::vector<DirId> stack;
+    TreeVisitor visitor;
+    visitor.on_dir = [&](std::size_t depth, const std::string& name) {
+        DirId parent = depth == 0 ? PathStore::kRootDir : stack[depth - 1];
+        stack.resize(depth);
+        stack.push_back(store.AddDirectory(parent, depth == 0 ? "Фото " + name : name));
+    };
+    visitor.on_file = [&](std::size_t depth, const std::string& name) {
+        store.AddFile(stack[depth - 1], name);
+    };
+    WalkSyntheticTree(std::min<std::size_t>(ctx.files, 200000), visitor);
+
+    auto start = std::chrono::steady_clock::now();
+    RemotePathTable table(store, "/Backup/p2");
+    Report("RemotePathCachedPrefix", "directory table", Seconds(start) * 1000.0, "ms");
+    start = std::chrono::steady_clock::now();
+    std::size_t bytes = 0;
+    for (FileId f = 0; f < store.FileCount(); ++f) {
+        bytes += table.File(f).encoded.size();
+    }
+    double count = static_cast<double>(store.FileCount());
+    Report("RemotePathCachedPrefix", "ns/file", Seconds(start) * 1e9 / count, "ns");
+    Report("RemotePathCachedPrefix", "avg encoded", static_cast<double>(bytes) / count, "B");
+}
+
+// Raw kernel throughput over a buffer of path-like text.
+BENCH_CASE(TextKernels) {
+    (void)ctx;
+    std::string text;
+    while (text.size() < (1u << 20)) {
+        text += "Archive/2024/12/31/IMG_" + std::to_string(text.size()) + ".JPG/";
+    }
+    const int rounds = 200;
+    double mb = static_cast<double>(text.size()) * rounds / (1024.0 * 1024.0);
+    std::cout << "TextKernels using " << ActiveTextKernel() << "\n";
+
+    std::string buffer = text;
+    auto start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        buffer = text;
+        std::transform(buffer.begin(), buffer.end(), buffer.begin(), [](unsigned char c) {
+            return static_cast<char>((c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c);
+        });
+    }
+    Report("TextKernels", "lower scalar", mb / Seconds(start), "MB/s");
+
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        buffer = text;
+        LowerAsciiInPlace(buffer.data(), buffer.size());
+    }
+    Report("TextKernels", "lower kernel", mb / Seconds(start), "MB/s");
+
+    start = std::chrono::steady_clock::now();
+    std::size_t encoded = 0;
+    for (int r = 0; r < rounds / 10; ++r) {
+        encoded += LegacyUrlEncode(text).size();
+    }
+    Report("TextKernels", "encode ostream", mb / 10 / Seconds(start), "MB/s");
+
+    start = std::chrono::steady_clock::now();
+    for (int r = 0; r < rounds; ++r) {
+        encoded += UrlEncodePath(text).size();
+    }
+    Report("TextKernels", "encode kernel", mb / Seconds(start), "MB/s");
+    (void)encoded;
+}
+
+// 16 threads each logging one Skip line per file, as workers do for unchanged
+// files; the log file goes to the temp directory and the console is off.
+void RunLoggerBench(const std::string& name, bool async, std::size_t files) {
+    LoggerOptions options;
+    options.async = async;
+    options.console = false;
+    const int threads = 16;
+    std::size_t per_thread = std::max<std::size_t>(1, std::min<std::size_t>(files, 400000) / threads);
+    auto start = std::chrono::steady_clock::now();
+    double produce = 0;
+    {
+        Logger logger(std::filesystem::temp_directory_path() / "uploader_bench_logs", options);
+        std::vector<std::thread> workers;
+        for (int t = 0; t < threads; ++t) {
+            workers.emplace_back([&logger, per_thread, t]() {
+                for (std::size_t i = 0; i < per_thread; ++i) {
+                    logger.Skip("archive/" + std::to_string(t) + "/IMG_" + std::to_string(i) + ".jpg",
+                                "same size and mtime");
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        produce = Seconds(start);
+    }
+    double total = Seconds(start);
+    double lines = static_cast<double>(per_thread * threads);
+    Report(name, "producer ns/line", produce * 1e9 / lines, "ns");
+    Report(name, "total ns/line", total * 1e9 / lines, "ns");
+}
+
+BENCH_CASE(LoggerSync) {
+    RunLoggerBench("LoggerSync", false, ctx.files);
+}
+
+BENCH_CASE(LoggerAsync) {
+    RunLoggerBench("LoggerAsync", true, ctx.files);
+}
+
+// Writes a fresh copy of the synthetic tree (at most 20000 files) for the
+// deletion benches and records it in `store`.
+std::filesystem::path PrepareDeleteTree(std::size_t files, PathStore* store) {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "uploader_bench_delete";
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    std::vector<std::filesystem::path> stack;
+    std::vector<DirId> ids;
+    TreeVisitor visitor;
+    visitor.on_dir = [&](std::size_t depth, const std::string& name) {
+        stack.resize(depth);
+        ids.resize(depth);
+        std::filesystem::path dir = (depth == 0 ? root : stack.back()) / name;
+        std::filesystem::create_directories(dir);
+        stack.push_back(dir);
+        ids.push_back(store->AddDirectory(depth == 0 ? PathStore::kRootDir : ids.back(), name));
+    };
+    visitor.on_file = [&](std::size_t depth, const std::string& name) {
+        std::ofstream(stack[depth - 1] / name) << name;
+        store->AddFile(ids[depth - 1], name);
+    };
+    WalkSyntheticTree(std::min<std::size_t>(files, 20000), visitor);
+    return root;
+}
+
+// Time an upload worker spends per deleted file: a blocking remove() as
+// before, against handing the file to the deletion stage.
+BENCH_CASE(DeleteInline) {
+    PathStore store;
+    std::filesystem::path root = PrepareDeleteTree(ctx.files, &store);
+    auto start = std::chrono::steady_clock::now();
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        std::error_code ec;
+        std::filesystem::remove(store.FileAbsolutePath(root, file), ec);
+    }
+    double elapsed = Seconds(start);
+    Report("DeleteInline", "worker us/file", elapsed * 1e6 / store.FileCount(), "us");
+}
+
+BENCH_CASE(DeleteDeferred) {
+    PathStore store;
+    std::filesystem::path root = PrepareDeleteTree(ctx.files, &store);
+    LoggerOptions options;
+    options.async = true;
+    options.console = false;
+    Logger logger(std::filesystem::temp_directory_path() / "uploader_bench_logs", options);
+    auto start = std::chrono::steady_clock::now();
+    LocalDeleter deleter(store, root, root.string() + ".deleted.txt", logger);
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        deleter.Enqueue(file, true);
+    }
+    double produce = Seconds(start);
+    DeletionStats stats = deleter.Finish();
+    double total = Seconds(start);
+    Report("DeleteDeferred", "worker us/file", produce * 1e6 / store.FileCount(), "us");
+    Report("DeleteDeferred", "stage us/file", total * 1e6 / store.FileCount(), "us");
+    Report("DeleteDeferred", "errors", static_cast<double>(stats.errors), "");
+}
+
+// Exclude checks for every entry of the synthetic tree (at most 20000 files)
+// against 2000 extra rules, re-checking whole paths as before.
+BENCH_CASE(ExcludeLegacyGlob) {
+    ExcludeRules rules = LargeExcludeRules(2000);
+    std::vector<std::string> stack;
+    std::size_t checked = 0;
+    std::size_t excluded = 0;
+    auto check = [&](const std::string& rel) {
+        checked++;
+        excluded += LegacyShouldExclude(rel, rules) ? 1 : 0;
+    };
+    TreeVisitor visitor;
+    visitor.on_dir = [&](std::size_t depth, const std::string& name) {
+        stack.resize(depth);
+        stack.push_back(depth == 0 ? name : stack.back() + "/" + name);
+        check(stack.back());
+    };
+    visitor.on_file = [&](std::size_t depth, const std::string& name) {
+        check(stack[depth - 1] + "/" + name);
+    };
+    auto start = std::chrono::steady_clock::now();
+    WalkSyntheticTree(std::min<std::size_t>(ctx.files, 20000), visitor);
+    double elapsed = Seconds(start);
+    Report("ExcludeLegacyGlob", "ns/entry", elapsed * 1e9 / checked, "ns");
+    Report("ExcludeLegacyGlob", "excluded", static_cast<double>(excluded), "");
+}
+
+BENCH_CASE(ExcludeCompiledMatcher) {
+    ExcludeRules rules = LargeExcludeRules(2000);
+    auto start = std::chrono::steady_clock::now();
+    ExcludeMatcher matcher(rules);
+    Report("ExcludeCompiledMatcher", "compile", Seconds(start) * 1000.0, "ms");
+
+    std::vector<ExcludeMatcher::State> stack;
+    std::size_t checked = 0;
+    std::size_t excluded = 0;
+    TreeVisitor visitor;
+    visitor.on_dir = [&](std::size_t depth, const std::string& name) {
+        ExcludeMatcher::State parent = depth == 0 ? matcher.RootState() : stack[depth - 1];
+        ExcludeMatcher::State state = GlobAutomaton::kDead;
+        checked++;
+        excluded += matcher.ExcludesChild(parent, name, &state) ? 1 : 0;
+        stack.resize(depth);
+        stack.push_back(state);
+    };
+    visitor.on_file = [&](std::size_t depth, const std::string& name) {
+        checked++;
+        excluded += matcher.ExcludesChild(stack[depth - 1], name, nullptr) ? 1 : 0;
+    };
+    start = std::chrono::steady_clock::now();
+    WalkSyntheticTree(std::min<std::size_t>(ctx.files, 20000), visitor);
+    double elapsed = Seconds(start);
+    Report("ExcludeCompiledMatcher", "ns/entry", elapsed * 1e9 / checked, "ns");
+    Report("ExcludeCompiledMatcher", "excluded", static_cast<double>(excluded), "");
+}
+
+// 256 MB file for the upload read benchmarks, kept between runs.
+std::filesystem::path PrepareReadFile() {
+    const std::uint64_t size = 256ULL << 20;
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "uploader_bench_read.bin";
+    std::error_code ec;
+    if (std::filesystem::file_size(path, ec) == size && !ec) {
+        return path;
+    }
+    std::ofstream out(path, std::ios::binary);
+    std::vector<char> block(1 << 20);
+    for (std::uint64_t written = 0; written < size; written += block.size()) {
+        for (std::size_t i = 0; i < block.size(); i += 64) {
+            block[i] = static_cast<char>((written >> 20) + i);
+        }
+        out.write(block.data(), static_cast<std::streamsize>(block.size()));
+    }
+    return path;
+}
+
+#ifdef __linux__
+// Share of the file's pages in the page cache.
+double CachedShare(const std::filesystem::path& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return -1.0;
+    }
+    std::size_t size = static_cast<std::size_t>(std::filesystem::file_size(path));
+    void* map = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    double share = -1.0;
+    if (map != MAP_FAILED) {
+        std::size_t page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        std::vector<unsigned char> resident((size + page - 1) / page);
+        if (::mincore(map, size, resident.data()) == 0) {
+            std::size_t cached = 0;
+            for (unsigned char flag : resident) {
+                cached += flag & 1;
+            }
+            share = static_cast<double>(cached) / resident.size();
+        }
+        ::munmap(map, size);
+    }
+    ::close(fd);
+    return share;
+}
+
+void EvictFromCache(const std::filesystem::path& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd >= 0) {
+        ::fdatasync(fd);
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    }
+}
+#endif
+
+// Reads the file the way a single-file upload does. "cached before/after"
+// is the share of its pages in the page cache (Linux only): buffered reads
+// leave the whole file cached, evicting the cache of everything else on
+// the host, while drop-behind and direct leave next to none of it. Each
+// run starts cold. Keep TMPDIR on a real disk; tmpfs pages cannot be
+// dropped.
+void RunUploadRead(const std::string& name, ReadCacheMode mode) {
+    std::filesystem::path path = PrepareReadFile();
+#ifdef __linux__
+    EvictFromCache(path);
+    Report(name, "cached before", 100.0 * CachedShare(path), "%");
+#endif
+    FileReader reader(ReadOptions{mode, 64ULL << 20});
+    std::string error;
+    if (!reader.Open(path, &error)) {
+        std::cerr << name << ": " << error << "\n";
+        return;
+    }
+    std::vector<char> buffer(64 * 1024);
+    std::uint64_t total = 0;
+    auto start = std::chrono::steady_clock::now();
+    std::size_t read = 0;
+    do {
+        if (!reader.Read(buffer.data(), buffer.size(), &read, &error)) {
+            std::cerr << name << ": " << error << "\n";
+            return;
+        }
+        total += read;
+    } while (read > 0);
+    double elapsed = Seconds(start);
+    bool direct = reader.Direct();
+    reader.Close();
+    Report(name, "MB/s", total / 1048576.0 / elapsed, "MB/s");
+    Report(name, "direct", direct ? 1.0 : 0.0, "");
+#ifdef __linux__
+    Report(name, "cached after", 100.0 * CachedShare(path), "%");
+#endif
+}
+
+BENCH_CASE(UploadReadBuffered) {
+    (void)ctx;
+    RunUploadRead("UploadReadBuffered", ReadCacheMode::Buffered);
+}
+
+BENCH_CASE(UploadReadDropBehind) {
+    (void)ctx;
+    RunUploadRead("UploadReadDropBehind", ReadCacheMode::DropBehind);
+}
+
+BENCH_CASE(UploadReadDirect) {
+    (void)ctx;
+    RunUploadRead("UploadReadDirect", ReadCacheMode::Direct);
+}
+
+int main(int argc, char** argv) {
+    BenchContext ctx;
+    std::string filter;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--files" && i + 1 < argc) {
+            ctx.files = static_cast<std::size_t>(std::stoull(argv[++i]));
+        } else if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else {
+            std::cerr << "Usage: uploader_bench [--files N] [--filter NAME]\n";
+            return 1;
+        }
+    }
+
+    for (const auto& bench : Registry()) {
+        if (!filter.empty() && bench.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        bench.func(ctx);
+    }
+    return 0;
+}
@@ -0,0 +1,968 @@
+// Multithreaded mock WebDAV server for throughput benchmarks of the
+// uploader, standing in for tests/integration/mock_webdav_server.py where
+// the Python server would be the bottleneck. It serves PROPFIND (Depth 0
+// and 1), MKCOL, PUT, COPY and MOVE with one thread per connection and
+// emulates a WAN link per connection: a fixed latency before every
+// response, a bandwidth cap in both directions, and injected 429, 503 and
+// stalled (timed out) responses. --max-active caps the requests served at
+// once across all connections, like a server's worker limit. Faults are drawn from --seed, the method,
+// the path and how often that request was seen, so a run repeats the same
+// faults however the threads interleave.
+//
+// POSIX only; see README ("Мок-сервер для бенчмарков").
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 19000;
+    // Data is written below root; with discard only the metadata is kept.
+    std::filesystem::path root;
+    bool discard = false;
+    std::string user;
+    std::string password;
+    // Per connection: delay before every response, and bytes per second in
+    // each direction (0 = unlimited).
+    int latency_ms = 0;
+    std::uint64_t bandwidth = 0;
+    // Share of requests answered with 429, with 503, or not at all.
+    double rate_429 = 0.0;
+    double rate_5xx = 0.0;
+    double rate_timeout = 0.0;
+    // How long a stalled request holds its connection before closing it.
+    int stall_ms = 60000;
+    std::uint64_t seed = 1;
+    // Requests handled at once over all connections; the rest wait in
+    // arrival order (0 = unlimited).
+    int max_active = 0;
+};
+
+std::atomic<bool> g_stop{false};
+
+struct Stats {
+    std::atomic<std::uint64_t> connections{0};
+    std::atomic<std::uint64_t> propfind{0};
+    std::atomic<std::uint64_t> mkcol{0};
+    std::atomic<std::uint64_t> put{0};
+    std::atomic<std::uint64_t> copy{0};
+    std::atomic<std::uint64_t> move{0};
+    std::atomic<std::uint64_t> other{0};
+    std::atomic<std::uint64_t> bytes_in{0};
+    std::atomic<std::uint64_t> bytes_out{0};
+    std::atomic<std::uint64_t> injected_429{0};
+    std::atomic<std::uint64_t> injected_5xx{0};
+    std::atomic<std::uint64_t> injected_timeouts{0};
+};
+
+Stats g_stats;
+
+std::uint64_t Fnv1a(const std::string& text) {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::uint64_t SplitMix64(std::uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+std::string Base64(const std::string& in) {
+    static const char kAlphabet[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    std::size_t i = 0;
+    for (; i + 2 < in.size(); i += 3) {
+        std::uint32_t v = (static_cast<unsigned char>(in[i]) << 16) |
+                          (static_cast<unsigned char>(in[i + 1]) << 8) |
+                          static_cast<unsigned char>(in[i + 2]);
+        out += kAlphabet[(v >> 18) & 63];
+        out += kAlphabet[(v >> 12) & 63];
+        out += kAlphabet[(v >> 6) & 63];
+        out += kAlphabet[v & 63];
+    }
+    if (i < in.size()) {
+        std::uint32_t v = static_cast<unsigned char>(in[i]) << 16;
+        if (i + 1 < in.size()) {
+            v |= static_cast<unsigned char>(in[i + 1]) << 8;
+        }
+        out += kAlphabet[(v >> 18) & 63];
+        out += kAlphabet[(v >> 12) & 63];
+        out += i + 1 < in.size() ? kAlphabet[(v >> 6) & 63] : '=';
+        out += '=';
+    }
+    return out;
+}
+
+std::string UrlDecode(const std::string& in) {
+    std::string out;
+    for (std::size_t i = 0; i < in.size(); ++i) {
+        if (in[i] == '%' && i + 2 < in.size() && std::isxdigit(static_cast<unsigned char>(in[i + 1])) &&
+            std::isxdigit(static_cast<unsigned char>(in[i + 2]))) {
+            out += static_cast<char>(std::stoi(in.substr(i + 1, 2), nullptr, 16));
+            i += 2;
+        } else {
+            out += in[i];
+        }
+    }
+    return out;
+}
+
+std::string UrlEncodePath(const std::string& in) {
+    static const char kHex[] = "0123456789ABCDEF";
+    std::string out;
+    for (unsigned char c : in) {
+        if (std::isalnum(c) || c == '/' || c == '-' || c == '_' || c == '.' || c == '~') {
+            out += static_cast<char>(c);
+        } else {
+            out += '%';
+            out += kHex[c >> 4];
+            out += kHex[c & 15];
+        }
+    }
+    return out;
+}
+
+// "/a%20b//c/" -> "/a b/c"; the root is "/". Empty when the path tries to
+// leave the root.
+std::string NormalizePath(const std::string& raw) {
+    std::string decoded = UrlDecode(raw.substr(0, raw.find('?')));
+    std::string out;
+    std::size_t pos = 0;
+    while (pos < decoded.size()) {
+        std::size_t end = decoded.find('/', pos);
+        if (end == std::string::npos) {
+            end = decoded.size();
+        }
+        std::string segment = decoded.substr(pos, end - pos);
+        pos = end + 1;
+        if (segment.empty() || segment == ".") {
+            continue;
+        }
+        if (segment == "..") {
+            return std::string();
+        }
+        out += "/" + segment;
+    }
+    return out.empty() ? "/" : out;
+}
+
+std::string ParentPath(const std::string& path) {
+    std::size_t slash = path.rfind('/');
+    return slash == 0 ? "/" : path.substr(0, slash);
+}
+
+std::string HttpDate(std::int64_t seconds) {
+    std::time_t t = static_cast<std::time_t>(seconds);
+    std::tm tm{};
+    gmtime_r(&t, &tm);
+    char buffer[64];
+    std::strftime(buffer, sizeof(buffer), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buffer;
+}
+
+std::int64_t NowSeconds() {
+    return static_cast<std::int64_t>(std::time(nullptr));
+}
+
+// Bytes per second for one connection and direction; idle time earns no
+// credit.
+class Pacer {
+public:
+    explicit Pacer(std::uint64_t bytes_per_second) : rate_(bytes_per_second) {}
+
+    void Pace(std::size_t bytes) {
+        if (rate_ == 0 || bytes == 0) {
+            return;
+        }
+        Clock::time_point now = Clock::now();
+        if (paid_until_ < now) {
+            paid_until_ = now;
+        }
+        paid_until_ += std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(static_cast<double>(bytes) / rate_));
+        std::this_thread::sleep_until(paid_until_);
+    }
+
+private:
+    std::uint64_t rate_;
+    Clock::time_point paid_until_;
+};
+
+struct Node {
+    bool dir = false;
+    std::uint64_t size = 0;
+    std::int64_t mtime = 0;
+};
+
+// The namespace, always in memory so PROPFIND never touches the disk; with
+// a root the file data lives below it as well.
+class Store {
+public:
+    explicit Store(const Options& options) : options_(options) {
+        nodes_["/"] = Node{true, 0, NowSeconds()};
+    }
+
+    void Load() {
+        if (options_.discard) {
+            return;
+        }
+        std::error_code ec;
+        std::filesystem::create_directories(options_.root, ec);
+        for (auto it = std::filesystem::recursive_directory_iterator(options_.root, ec);
+             it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            struct stat st {};
+            if (::stat(it->path().c_str(), &st) != 0) {
+                continue;
+            }
+            std::string rel = "/" + std::filesystem::relative(it->path(), options_.root).generic_string();
+            nodes_[rel] = Node{S_ISDIR(st.st_mode), S_ISDIR(st.st_mode) ? 0 : static_cast<std::uint64_t>(st.st_size),
+                               static_cast<std::int64_t>(st.st_mtime)};
+        }
+    }
+
+    std::filesystem::path DiskPath(const std::string& path) const {
+        return options_.root / path.substr(1);
+    }
+
+    std::optional<Node> Find(const std::string& path) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto it = nodes_.find(path);
+        if (it == nodes_.end()) {
+            return std::nullopt;
+        }
+        return it->second;
+    }
+
+    std::vector<std::pair<std::string, Node>> Children(const std::string& path) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        std::vector<std::pair<std::string, Node>> out;
+        std::string prefix = path == "/" ? "/" : path + "/";
+        for (auto it = nodes_.lower_bound(prefix);
+             it != nodes_.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+            if (it->first.find('/', prefix.size()) == std::string::npos) {
+                out.emplace_back(it->first.substr(prefix.size()), it->second);
+            }
+        }
+        return out;
+    }
+
+    int MkCol(const std::string& path) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if (nodes_.count(path)) {
+            return 405;
+        }
+        auto parent = nodes_.find(ParentPath(path));
+        if (parent == nodes_.end() || !parent->second.dir) {
+            return 409;
+        }
+        if (!options_.discard) {
+            std::error_code ec;
+            std::filesystem::create_directory(DiskPath(path), ec);
+            if (ec) {
+                return 500;
+            }
+        }
+        nodes_[path] = Node{true, 0, NowSeconds()};
+        return 201;
+    }
+
+    // 0 when a PUT to `path` may go ahead.
+    int CheckPut(const std::string& path) {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        auto parent = nodes_.find(ParentPath(path));
+        if (parent == nodes_.end() || !parent->second.dir) {
+            return 409;
+        }
+        auto it = nodes_.find(path);
+        if (it != nodes_.end() && it->second.dir) {
+            return 405;
+        }
+        return 0;
+    }
+
+    int FinishPut(const std::string& path, std::uint64_t size) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        bool existed = nodes_.count(path) > 0;
+        nodes_[path] = Node{false, size, NowSeconds()};
+        return existed ? 204 : 201;
+    }
+
+    int Transfer(const std::string& from, const std::string& to, bool overwrite, bool move) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto source = nodes_.find(from);
+        if (source == nodes_.end()) {
+            return 404;
+        }
+        if (from == to || to.compare(0, from.size() + 1, from + "/") == 0) {
+            return 403;
+        }
+        auto parent = nodes_.find(ParentPath(to));
+        if (parent == nodes_.end() || !parent->second.dir) {
+            return 409;
+        }
+        bool existed = nodes_.count(to) > 0;
+        if (existed && !overwrite) {
+            return 412;
+        }
+        if (existed) {
+            EraseTree(to);
+        }
+        if (!options_.discard) {
+            std::error_code ec;
+            if (existed) {
+                std::filesystem::remove_all(DiskPath(to), ec);
+            }
+            if (move) {
+                std::filesystem::rename(DiskPath(from), DiskPath(to), ec);
+            } else {
+                std::filesystem::copy(DiskPath(from), DiskPath(to),
+                                      std::filesystem::copy_options::recursive, ec);
+            }
+            if (ec) {
+                return 500;
+            }
+        }
+        std::vector<std::pair<std::string, Node>> moved;
+        moved.emplace_back(to, source->second);
+        std::string prefix = from + "/";
+        for (auto it = nodes_.lower_bound(prefix);
+             it != nodes_.end() && it->first.compare(0, prefix.size(), prefix) == 0; ++it) {
+            moved.emplace_back(to + it->first.substr(from.size()), it->second);
+        }
+        if (move) {
+            EraseTree(from);
+        }
+        for (auto& entry : moved) {
+            nodes_[entry.first] = entry.second;
+        }
+        return existed ? 204 : 201;
+    }
+
+private:
+    void EraseTree(const std::string& path) {
+        nodes_.erase(path);
+        std::string prefix = path + "/";
+        auto it = nodes_.lower_bound(prefix);
+        while (it != nodes_.end() && it->first.compare(0, prefix.size(), prefix) == 0) {
+            it = nodes_.erase(it);
+        }
+    }
+
+    const Options& options_;
+    std::shared_mutex mutex_;
+    std::map<std::string, Node> nodes_;
+};
+
+enum class Fault { None, TooManyRequests, Unavailable, Stall };
+
+// The n-th request with a given method and path gets the same verdict in
+// every run with the same seed.
+// Server-wide request slots for --max-active, handed out first come,
+// first served.
+class RequestSlots {
+public:
+    explicit RequestSlots(int slots) : free_(slots) {}
+
+    void Acquire() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        std::uint64_t ticket = next_ticket_++;
+        ready_.wait(lock, [&]() { return ticket == serving_ && free_ > 0; });
+        ++serving_;
+        --free_;
+        ready_.notify_all();
+    }
+
+    void Release() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++free_;
+        ready_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable ready_;
+    int free_;
+    std::uint64_t next_ticket_ = 0;
+    std::uint64_t serving_ = 0;
+};
+
+class FaultInjector {
+public:
+    explicit FaultInjector(const Options& options) : options_(options) {}
+
+    Fault Pick(const std::string& method, const std::string& path) {
+        double total = options_.rate_429 + options_.rate_5xx + options_.rate_timeout;
+        if (total <= 0.0) {
+            return Fault::None;
+        }
+        std::string key = method + " " + path;
+        std::uint64_t attempt = 0;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            attempt = attempts_[key]++;
+        }
+        std::uint64_t hash = SplitMix64(options_.seed ^ Fnv1a(key) ^ SplitMix64(attempt));
+        double u = static_cast<double>(hash >> 11) / static_cast<double>(1ULL << 53);
+        if (u < options_.rate_429) {
+            return Fault::TooManyRequests;
+        }
+        if (u < options_.rate_429 + options_.rate_5xx) {
+            return Fault::Unavailable;
+        }
+        if (u < total) {
+            return Fault::Stall;
+        }
+        return Fault::None;
+    }
+
+private:
+    const Options& options_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::uint64_t> attempts_;
+};
+
+struct Request {
+    std::string method;
+    std::string target;
+    std::string version;
+    // Lowercased names.
+    std::map<std::string, std::string> headers;
+
+    std::string Header(const std::string& name) const {
+        auto it = headers.find(name);
+        return it == headers.end() ? std::string() : it->second;
+    }
+};
+
+class Connection {
+public:
+    Connection(int fd, const Options& options, Store* store, FaultInjector* faults,
+               RequestSlots* slots)
+        : fd_(fd),
+          options_(options),
+          store_(store),
+          faults_(faults),
+          slots_(slots),
+          in_pacer_(options.bandwidth),
+          out_pacer_(options.bandwidth) {}
+
+    ~Connection() { ::close(fd_); }
+
+    void Serve() {
+        if (options_.latency_ms > 0) {
+            // The handshake costs a round trip too.
+            std::this_thread::sleep_for(std::chrono::milliseconds(options_.latency_ms));
+        }
+        Request request;
+        while (!g_stop && ReadRequest(&request)) {
+            if (slots_) {
+                slots_->Acquire();
+            }
+            bool handled = Handle(request);
+            if (slots_) {
+                slots_->Release();
+            }
+            if (!handled) {
+                return;
+            }
+            std::string connection = request.Header("connection");
+            if (connection == "close" || (request.version == "HTTP/1.0" && connection != "keep-alive")) {
+                return;
+            }
+        }
+    }
+
+private:
+    bool Fill() {
+        char chunk[64 * 1024];
+        while (true) {
+            ssize_t got = ::recv(fd_, chunk, sizeof(chunk), 0);
+            if (got > 0) {
+                in_pacer_.Pace(static_cast<std::size_t>(got));
+                g_stats.bytes_in += static_cast<std::uint64_t>(got);
+                buffer_.append(chunk, static_cast<std::size_t>(got));
+                return true;
+            }
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+    }
+
+    bool ReadLine(std::string* line) {
+        while (true) {
+            std::size_t end = buffer_.find("\r\n", pos_);
+            if (end != std::string::npos) {
+                line->assign(buffer_, pos_, end - pos_);
+                pos_ = end + 2;
+                return true;
+            }
+            Compact();
+            if (buffer_.size() > (1 << 20) || !Fill()) {
+                return false;
+            }
+        }
+    }
+
+    void Compact() {
+        buffer_.erase(0, pos_);
+        pos_ = 0;
+    }
+
+    bool ReadRequest(Request* request) {
+        std::string line;
+        do {
+            if (!ReadLine(&line)) {
+                return false;
+            }
+        } while (line.empty());
+        std::size_t a = line.find(' ');
+        std::size_t b = line.rfind(' ');
+        if (a == std::string::npos || a == b) {
+            return false;
+        }
+        request->method = line.substr(0, a);
+        request->target = line.substr(a + 1, b - a - 1);
+        request->version = line.substr(b + 1);
+        request->headers.clear();
+        while (ReadLine(&line) && !line.empty()) {
+            std::size_t colon = line.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+            std::string name = line.substr(0, colon);
+            std::transform(name.begin(), name.end(), name.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            std::size_t value = line.find_first_not_of(" \t", colon + 1);
+            request->headers[name] = value == std::string::npos ? "" : line.substr(value);
+        }
+        return true;
+    }
+
+    // Hands the body to `sink` as it arrives; Content-Length or chunked.
+    template <typename Sink>
+    bool ReadBody(const Request& request, Sink sink) {
+        if (request.Header("transfer-encoding").find("chunked") != std::string::npos) {
+            std::string line;
+            while (true) {
+                if (!ReadLine(&line)) {
+                    return false;
+                }
+                std::uint64_t size = std::strtoull(line.c_str(), nullptr, 16);
+                if (size == 0) {
+                    while (ReadLine(&line) && !line.empty()) {
+                    }
+                    return true;
+                }
+                if (!ReadExact(size, sink) || !ReadLine(&line)) {
+                    return false;
+                }
+            }
+        }
+        std::string length = request.Header("content-length");
+        return ReadExact(length.empty() ? 0 : std::strtoull(length.c_str(), nullptr, 10), sink);
+    }
+
+    template <typename Sink>
+    bool ReadExact(std::uint64_t size, Sink sink) {
+        while (size > 0) {
+            if (pos_ == buffer_.size()) {
+                buffer_.clear();
+                pos_ = 0;
+                if (!Fill()) {
+                    return false;
+                }
+            }
+            std::size_t n = static_cast<std::size_t>(
+                std::min<std::uint64_t>(size, buffer_.size() - pos_));
+            sink(buffer_.data() + pos_, n);
+            pos_ += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    bool Send(int status, const std::string& body = std::string(),
+              const std::string& extra_headers = std::string()) {
+        if (options_.latency_ms > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(options_.latency_ms));
+        }
+        std::string out = "HTTP/1.1 " + std::to_string(status) + " " + Reason(status) +
+                          "\r\nServer: MockWebDAV-cpp\r\nContent-Length: " +
+                          std::to_string(body.size()) + "\r\n" + extra_headers + "\r\n" + body;
+        std::size_t sent = 0;
+        while (sent < out.size()) {
+            std::size_t n = std::min<std::size_t>(out.size() - sent, 64 * 1024);
+            out_pacer_.Pace(n);
+            ssize_t wrote = ::send(fd_, out.data() + sent, n, MSG_NOSIGNAL);
+            if (wrote < 0 && errno == EINTR) {
+                continue;
+            }
+            if (wrote <= 0) {
+                return false;
+            }
+            sent += static_cast<std::size_t>(wrote);
+        }
+        g_stats.bytes_out += out.size();
+        return true;
+    }
+
+    static const char* Reason(int status) {
+        switch (status) {
+            case 201:
+                return "Created";
+            case 204:
+                return "No Content";
+            case 207:
+                return "Multi-Status";
+            case 400:
+                return "Bad Request";
+            case 401:
+                return "Unauthorized";
+            case 403:
+                return "Forbidden";
+            case 404:
+                return "Not Found";
+            case 405:
+                return "Method Not Allowed";
+            case 409:
+                return "Conflict";
+            case 412:
+                return "Precondition Failed";
+            case 429:
+                return "Too Many Requests";
+            case 503:
+                return "Service Unavailable";
+            default:
+                return status < 300 ? "OK" : "Error";
+        }
+    }
+
+    bool Authorized(const Request& request) const {
+        if (options_.user.empty()) {
+            return true;
+        }
+        return request.Header("authorization") ==
+               "Basic " + Base64(options_.user + ":" + options_.password);
+    }
+
+    // False when the connection has to close.
+    bool Handle(const Request& request) {
+        const std::string& method = request.method;
+        if (method == "PROPFIND") {
+            g_stats.propfind++;
+        } else if (method == "MKCOL") {
+            g_stats.mkcol++;
+        } else if (method == "PUT") {
+            g_stats.put++;
+        } else if (method == "COPY") {
+            g_stats.copy++;
+        } else if (method == "MOVE") {
+            g_stats.move++;
+        } else {
+            g_stats.other++;
+        }
+        std::string path = NormalizePath(request.target);
+
+        // PUT bodies are received first: a disk-backed PUT streams them to
+        // their file, everything else drops them.
+        std::FILE* file = nullptr;
+        int put_status = 0;
+        Fault fault = Fault::None;
+        if (!path.empty() && Authorized(request)) {
+            fault = faults_->Pick(method, path);
+        }
+        if (method == "PUT" && fault == Fault::None && !path.empty() && Authorized(request)) {
+            put_status = store_->CheckPut(path);
+            if (put_status == 0 && !options_.discard) {
+                file = std::fopen(store_->DiskPath(path).c_str(), "wb");
+                put_status = file ? 0 : 500;
+            }
+        }
+        if (request.Header("expect") == "100-continue" &&
+            ::send(fd_, "HTTP/1.1 100 Continue\r\n\r\n", 25, MSG_NOSIGNAL) != 25) {
+            return false;
+        }
+        std::uint64_t received = 0;
+        bool body_ok = ReadBody(request, [&](const char* data, std::size_t size) {
+            received += size;
+            if (file) {
+                std::fwrite(data, 1, size, file);
+            }
+        });
+        if (file) {
+            std::fclose(file);
+        }
+        if (!body_ok) {
+            return false;
+        }
+
+        if (path.empty()) {
+            return Send(400);
+        }
+        if (!Authorized(request)) {
+            return Send(401, "", "WWW-Authenticate: Basic realm=\"Test\"\r\n");
+        }
+        switch (fault) {
+            case Fault::TooManyRequests:
+                g_stats.injected_429++;
+                return Send(429, "", "Retry-After: 1\r\n");
+            case Fault::Unavailable:
+                g_stats.injected_5xx++;
+                return Send(503);
+            case Fault::Stall:
+                g_stats.injected_timeouts++;
+                for (int waited = 0; waited < options_.stall_ms && !g_stop; waited += 100) {
+                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                }
+                return false;
+            case Fault::None:
+                break;
+        }
+
+        if (method == "PROPFIND") {
+            return Propfind(request, path);
+        }
+        if (method == "MKCOL") {
+            return Send(store_->MkCol(path));
+        }
+        if (method == "PUT") {
+            return Send(put_status != 0 ? put_status : store_->FinishPut(path, received));
+        }
+        if (method == "COPY" || method == "MOVE") {
+            std::string destination = request.Header("destination");
+            std::size_t scheme = destination.find("://");
+            if (scheme != std::string::npos) {
+                std::size_t slash = destination.find('/', scheme + 3);
+                destination = slash == std::string::npos ? "/" : destination.substr(slash);
+            }
+            std::string to = NormalizePath(destination);
+            if (destination.empty() || to.empty()) {
+                return Send(400);
+            }
+            bool overwrite = request.Header("overwrite") != "F";
+            return Send(store_->Transfer(path, to, overwrite, method == "MOVE"));
+        }
+        return Send(405);
+    }
+
+    static std::string Entry(const std::string& href, const Node& node) {
+        return "<d:response><d:href>" + UrlEncodePath(href) +
+               "</d:href><d:propstat><d:prop><d:getcontentlength>" +
+               std::to_string(node.dir ? 0 : node.size) + "</d:getcontentlength><d:getlastmodified>" +
+               HttpDate(node.mtime) + "</d:getlastmodified><d:getetag>\"" +
+               std::to_string(node.mtime) + "-" + std::to_string(node.size) + "\"</d:getetag>" +
+               (node.dir ? "<d:resourcetype><d:collection/></d:resourcetype>"
+                         : "<d:resourcetype/>") +
+               "</d:prop><d:status>HTTP/1.1 200 OK</d:status></d:propstat></d:response>";
+    }
+
+    bool Propfind(const Request& request, const std::string& path) {
+        std::optional<Node> node = store_->Find(path);
+        if (!node) {
+            return Send(404);
+        }
+        std::string href = UrlDecode(request.target.substr(0, request.target.find('?')));
+        std::string body =
+            "<?xml version=\"1.0\" encoding=\"utf-8\"?><d:multistatus xmlns:d=\"DAV:\">" +
+            Entry(href, *node);
+        if (node->dir && request.Header("depth") == "1") {
+            std::string base = href;
+            while (!base.empty() && base.back() == '/') {
+                base.pop_back();
+            }
+            for (const auto& child : store_->Children(path)) {
+                body += Entry(base + "/" + child.first, child.second);
+            }
+        }
+        body += "</d:multistatus>";
+        return Send(207, body, "Content-Type: application/xml; charset=utf-8\r\n");
+    }
+
+    int fd_;
+    const Options& options_;
+    Store* store_;
+    FaultInjector* faults_;
+    RequestSlots* slots_;
+    Pacer in_pacer_;
+    Pacer out_pacer_;
+    std::string buffer_;
+    std::size_t pos_ = 0;
+};
+
+void PrintStats() {
+    std::cout << "connections " << g_stats.connections << "\n"
+              << "propfind " << g_stats.propfind << "\n"
+              << "mkcol " << g_stats.mkcol << "\n"
+              << "put " << g_stats.put << "\n"
+              << "copy " << g_stats.copy << "\n"
+              << "move " << g_stats.move << "\n"
+              << "other " << g_stats.other << "\n"
+              << "bytes_in " << g_stats.bytes_in << "\n"
+              << "bytes_out " << g_stats.bytes_out << "\n"
+              << "injected_429 " << g_stats.injected_429 << "\n"
+              << "injected_5xx " << g_stats.injected_5xx << "\n"
+              << "injected_timeouts " << g_stats.injected_timeouts << std::endl;
+}
+
+const char kUsage[] =
+    "Usage: mock_webdav_server (--root <dir> | --discard) [options]\n"
+    "  --host <addr>          Listen address (default: 127.0.0.1).\n"
+    "  --port <n>             Listen port, 0 for any (default: 19000).\n"
+    "  --user <name>          Require Basic auth with this user...\n"
+    "  --password <pass>      ...and password.\n"
+    "  --latency-ms <ms>      Delay per connection and before every response.\n"
+    "  --bandwidth-kbps <KB>  Per-connection cap in each direction, KB/s.\n"
+    "  --rate-429 <p>         Share of requests answered 429 (0..1).\n"
+    "  --rate-5xx <p>         Share of requests answered 503.\n"
+    "  --rate-timeout <p>     Share of requests never answered.\n"
+    "  --stall-ms <ms>        How long an unanswered request holds its connection (default: 60000).\n"
+    "  --seed <n>             Seed of the injected faults (default: 1).\n"
+    "  --max-active <n>       Requests served at once over all connections (default: unlimited).\n";
+
+bool ParseOptions(int argc, char** argv, Options* options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--discard") {
+            options->discard = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--root") {
+            options->root = value;
+        } else if (arg == "--host") {
+            options->host = value;
+        } else if (arg == "--port") {
+            options->port = std::atoi(value.c_str());
+        } else if (arg == "--user") {
+            options->user = value;
+        } else if (arg == "--password") {
+            options->password = value;
+        } else if (arg == "--latency-ms") {
+            options->latency_ms = std::atoi(value.c_str());
+        } else if (arg == "--bandwidth-kbps") {
+            options->bandwidth = std::strtoull(value.c_str(), nullptr, 10) << 10;
+        } else if (arg == "--rate-429") {
+            options->rate_429 = std::atof(value.c_str());
+        } else if (arg == "--rate-5xx") {
+            options->rate_5xx = std::atof(value.c_str());
+        } else if (arg == "--rate-timeout") {
+            options->rate_timeout = std::atof(value.c_str());
+        } else if (arg == "--stall-ms") {
+            options->stall_ms = std::atoi(value.c_str());
+        } else if (arg == "--seed") {
+            options->seed = std::strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--max-active") {
+            options->max_active = std::atoi(value.c_str());
+        } else {
+            return false;
+        }
+    }
+    return options->discard == options->root.empty();
+}
+
+void OnSignal(int) {
+    g_stop = true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, &options)) {
+        std::cerr << kUsage;
+        return 1;
+    }
+
+    int listener = ::socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    ::setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<std::uint16_t>(options.port));
+    if (::inet_pton(AF_INET, options.host.c_str(), &addr.sin_addr) != 1 ||
+        ::bind(listener, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        ::listen(listener, 1024) != 0) {
+        std::cerr << "Cannot listen on " << options.host << ":" << options.port << ": "
+                  << std::strerror(errno) << "\n";
+        return 1;
+    }
+    socklen_t len = sizeof(addr);
+    ::getsockname(listener, reinterpret_cast<sockaddr*>(&addr), &len);
+
+    struct sigaction action {};
+    action.sa_handler = OnSignal;
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+
+    Store store(options);
+    store.Load();
+    FaultInjector faults(options);
+    RequestSlots slots(options.max_active);
+    RequestSlots* limit = options.max_active > 0 ? &slots : nullptr;
+    std::cout << "Mock WebDAV server running on " << options.host << ":" << ntohs(addr.sin_port)
+              << std::endl;
+
+    while (!g_stop) {
+        pollfd pfd{listener, POLLIN, 0};
+        if (::poll(&pfd, 1, 200) <= 0) {
+            continue;
+        }
+        int fd = ::accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        g_stats.connections++;
+        std::thread([fd, &options, &store, &faults, limit]() {
+            Connection connection(fd, options, &store, &faults, limit);
+            connection.Serve();
+        }).detach();
+    }
+    ::close(listener);
+    PrintStats();
+    // Connection threads may still be running; they are not waited for.
+    std::_Exit(0);
+}
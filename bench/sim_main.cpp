@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "app_config.h"
+#include "plan.h"
+#include "run_model.h"
+
+namespace {
+
+const char kUsage[] =
+    "Usage: uploader_sim (--plan FILE | --sizes SIZE:COUNT,...) [options]\n"
+    "Workload:\n"
+    "  --plan FILE             A plan written by --plan-out.\n"
+    "  --sizes SIZE:COUNT,...  Uploads by size, e.g. 4K:10000,2M:500,1G:2.\n"
+    "  --files N               Scanned files (default: the uploads).\n"
+    "  --dirs N                Scanned directories (default: 1).\n"
+    "  --listings N            Directories listed (default: --dirs).\n"
+    "  --missing-dirs N        Collections to create (default: 0).\n"
+    "Network:\n"
+    "  --rtt-ms MS             Round trip per request (default: 30).\n"
+    "  --connect-rtts N        Round trips to open a connection (default: 2).\n"
+    "  --bandwidth-kbps KB     Link bandwidth, KB/s (default: unlimited).\n"
+    "  --connection-kbps KB    Most one connection gets, KB/s (default: unlimited).\n"
+    "  --server-limit N        Requests the server serves at once (default: unlimited).\n"
+    "  --error-rate P          Share of requests failing with a retryable error.\n"
+    "  --scan-rate N           Files scanned per second (default: 50000).\n"
+    "Run:\n"
+    "  --threads N[,N...]      Upload threads; several are compared (default: 1,2,4,8,16,32).\n"
+    "  --probe-threads N       --rate-limit KB  --chunked-min MB  --chunk-size MB\n"
+    "  --bundle-size MB        As for the uploader.\n";
+
+bool ParseCount(const std::string& text, std::uint64_t* out) {
+    if (text.empty() || text.size() > 12 || text.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    *out = std::strtoull(text.c_str(), nullptr, 10);
+    return true;
+}
+
+bool ParseNumber(const std::string& text, double* out) {
+    char* end = nullptr;
+    *out = std::strtod(text.c_str(), &end);
+    return !text.empty() && end && *end == '\0' && *out >= 0.0;
+}
+
+bool ParseThreads(const std::string& text, std::vector<int>* out) {
+    out->clear();
+    std::size_t pos = 0;
+    while (pos <= text.size()) {
+        std::size_t end = text.find(',', pos);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::uint64_t value = 0;
+        if (!ParseCount(text.substr(pos, end - pos), &value) || value == 0 || value > 1024) {
+            return false;
+        }
+        out->push_back(static_cast<int>(value));
+        pos = end + 1;
+    }
+    std::sort(out->begin(), out->end());
+    out->erase(std::unique(out->begin(), out->end()), out->end());
+    return true;
+}
+
+std::string Seconds(double value) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(value < 10.0 ? 2 : 1) << value;
+    return out.str();
+}
+
+std::string Percent(double value) {
+    return std::to_string(static_cast<int>(value * 100.0 + 0.5)) + "%";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::string plan_file;
+    std::string sizes;
+    std::uint64_t files = 0;
+    std::uint64_t dirs = 1;
+    std::uint64_t listings = 0;
+    std::uint64_t missing_dirs = 0;
+    bool files_set = false;
+    bool listings_set = false;
+    NetworkModel network;
+    AppConfig config;
+    std::vector<int> threads = {1, 2, 4, 8, 16, 32};
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << kUsage;
+            return 1;
+        }
+        std::string value = argv[++i];
+        std::uint64_t count = 0;
+        double number = 0.0;
+        bool ok = true;
+        if (arg == "--plan") {
+            plan_file = value;
+        } else if (arg == "--sizes") {
+            sizes = value;
+        } else if (arg == "--files") {
+            ok = ParseCount(value, &files);
+            files_set = true;
+        } else if (arg == "--dirs") {
+            ok = ParseCount(value, &dirs) && dirs > 0;
+        } else if (arg == "--listings") {
+            ok = ParseCount(value, &listings);
+            listings_set = true;
+        } else if (arg == "--missing-dirs") {
+            ok = ParseCount(value, &missing_dirs);
+        } else if (arg == "--rtt-ms") {
+            ok = ParseNumber(value, &network.rtt_ms);
+        } else if (arg == "--connect-rtts") {
+            ok = ParseNumber(value, &network.connect_round_trips);
+        } else if (arg == "--bandwidth-kbps") {
+            ok = ParseNumber(value, &number);
+            network.link_bandwidth = number * 1024.0;
+        } else if (arg == "--connection-kbps") {
+            ok = ParseNumber(value, &number);
+            network.connection_bandwidth = number * 1024.0;
+        } else if (arg == "--server-limit") {
+            ok = ParseCount(value, &count) && count <= 100000;
+            network.server_concurrency = static_cast<int>(count);
+        } else if (arg == "--error-rate") {
+            ok = ParseNumber(value, &network.error_rate) && network.error_rate < 1.0;
+        } else if (arg == "--scan-rate") {
+            ok = ParseNumber(value, &network.scan_files_per_second);
+        } else if (arg == "--threads") {
+            ok = ParseThreads(value, &threads);
+        } else if (arg == "--probe-threads") {
+            ok = ParseCount(value, &count) && count > 0 && count <= 1024;
+            config.probe_threads = static_cast<int>(count);
+        } else if (arg == "--rate-limit") {
+            ok = ParseCount(value, &count);
+            config.rate_limit = count << 10;
+        } else if (arg == "--chunked-min") {
+            ok = ParseCount(value, &count);
+            config.chunked_min = count << 20;
+        } else if (arg == "--chunk-size") {
+            ok = ParseCount(value, &count) && count > 0;
+            config.chunk_size = count << 20;
+        } else if (arg == "--bundle-size") {
+            ok = ParseCount(value, &count) && count > 0;
+            config.bundle_size = count << 20;
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cerr << "Invalid " << arg << " value: " << value << "\n" << kUsage;
+            return 1;
+        }
+    }
+    if (plan_file.empty() == sizes.empty()) {
+        std::cerr << kUsage;
+        return 1;
+    }
+
+    RunWorkload workload;
+    std::string error;
+    if (!plan_file.empty()) {
+        SyncPlan plan;
+        if (!ReadPlanFile(plan_file, &plan, &error)) {
+            std::cerr << "Failed to read plan " << plan_file << ": " << error << "\n";
+            return 1;
+        }
+        workload = WorkloadFromPlan(plan, config.bundle_size);
+    } else {
+        if (!ParseSizeHistogram(sizes, &workload.uploads, &error)) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+        workload.files = files_set ? files : workload.uploads.size();
+        workload.directories = dirs;
+        workload.listings = listings_set ? listings : dirs;
+        workload.collections = missing_dirs;
+    }
+
+    std::uint64_t bytes = 0;
+    for (const RunWorkload::Upload& upload : workload.uploads) {
+        bytes += upload.bytes;
+    }
+    std::cout << "Workload: " << workload.files << " files in " << workload.directories
+              << " directories; " << workload.uploads.size() << " uploads, " << std::fixed
+              << std::setprecision(1) << bytes / 1048576.0 << " MB; " << workload.listings
+              << " listings, " << workload.collections << " collections, " << workload.renames
+              << " renames\n";
+
+    std::vector<RunPrediction> predictions;
+    std::cout << std::left << std::setw(8) << "threads" << std::setw(9) << "total_s"
+              << std::setw(8) << "scan" << std::setw(8) << "warmup" << std::setw(8) << "decide"
+              << std::setw(8) << "prepare" << std::setw(9) << "execute" << std::setw(7) << "link"
+              << std::setw(8) << "server" << "bottleneck\n";
+    for (int count : threads) {
+        config.threads = count;
+        RunPrediction p = SimulateRun(workload, network, config);
+        std::cout << std::setw(8) << count << std::setw(9) << Seconds(p.total) << std::setw(8)
+                  << Seconds(p.scan) << std::setw(8) << Seconds(p.warmup) << std::setw(8)
+                  << Seconds(p.decide) << std::setw(8) << Seconds(p.prepare) << std::setw(9)
+                  << Seconds(p.execute) << std::setw(7) << Percent(p.link_busy) << std::setw(8)
+                  << Percent(p.server_busy) << p.bottleneck << "\n";
+        predictions.push_back(p);
+    }
+
+    // Past the knee more threads only add connections: recommend the
+    // fewest within 5% of the fastest.
+    double fastest = predictions.front().total;
+    for (const RunPrediction& p : predictions) {
+        fastest = (std::min)(fastest, p.total);
+    }
+    std::size_t best = 0;
+    while (predictions[best].total > fastest * 1.05) {
+        ++best;
+    }
+    const RunPrediction& p = predictions[best];
+    std::cout << "Recommended --threads " << threads[best] << ": " << Seconds(p.total)
+              << " s, bottleneck " << p.bottleneck << "\n"
+              << "Requests: " << p.propfinds << " PROPFIND, " << p.mkcols << " MKCOL, " << p.puts
+              << " PUT, " << p.transfers << " COPY/MOVE, " << p.retries << " retries, "
+              << p.failures << " failed; " << p.connections << " connections\n";
+    return 0;
+}
@@ -0,0 +1,178 @@
+"""Compares uploader_sim's predictions with timed uploads to the C++ mock
+server (bench/mock_webdav).
+
+For each scenario the script writes a source tree, starts the mock with
+the scenario's latency, bandwidth, slot limit or error rate, writes a plan
+with --plan-out and hands it to uploader_sim with the same network
+parameters, then times real runs at each thread count, each into a fresh
+remote root. The mock is POSIX only, so the uploader must run on the same
+machine (a native or Wine build).
+"""
+
+import argparse
+import os
+import re
+import signal
+import subprocess
+import tempfile
+import time
+
+KB = 1 << 10
+
+# Network options go to both the mock and the simulator; the mock sleeps
+# its latency once per connection and once per response.
+SCENARIOS = [
+    {
+        "name": "latency",
+        "files": [(4 * KB, 600)],
+        "dirs": 12,
+        "mock": ["--latency-ms", "20"],
+        "sim": ["--rtt-ms", "20"],
+    },
+    {
+        "name": "connection-bandwidth",
+        "files": [(256 * KB, 48)],
+        "dirs": 4,
+        "mock": ["--latency-ms", "5", "--bandwidth-kbps", "1024"],
+        "sim": ["--rtt-ms", "5", "--connection-kbps", "1024"],
+    },
+    {
+        "name": "rate-limit",
+        "files": [(256 * KB, 48)],
+        "dirs": 4,
+        "mock": ["--latency-ms", "5"],
+        "uploader": ["--rate-limit", "4096"],
+        "sim": ["--rtt-ms", "5", "--rate-limit", "4096"],
+    },
+    {
+        "name": "server-limit",
+        "files": [(4 * KB, 600)],
+        "dirs": 12,
+        "mock": ["--latency-ms", "20", "--max-active", "3"],
+        "sim": ["--rtt-ms", "20", "--server-limit", "3"],
+    },
+    {
+        "name": "errors",
+        "files": [(4 * KB, 600)],
+        "dirs": 12,
+        "mock": ["--latency-ms", "20", "--rate-5xx", "0.05"],
+        "sim": ["--rtt-ms", "20", "--error-rate", "0.05"],
+    },
+]
+
+
+def write_tree(root, files, dirs):
+    index = 0
+    for size, count in files:
+        for _ in range(count):
+            directory = os.path.join(root, f"d{index % dirs:03d}")
+            os.makedirs(directory, exist_ok=True)
+            with open(os.path.join(directory, f"f{index:05d}.bin"), "wb") as f:
+                f.write(bytes([index % 251]) * size)
+            index += 1
+
+
+def start_mock(mock, options):
+    process = subprocess.Popen(
+        [mock, "--discard", "--port", "0"] + options, stdout=subprocess.PIPE, text=True
+    )
+    line = process.stdout.readline()
+    match = re.search(r":(\d+)\s*$", line)
+    if not match:
+        process.kill()
+        raise RuntimeError(f"Mock server did not start: {line!r}")
+    return process, int(match.group(1))
+
+
+def stop_mock(process):
+    process.send_signal(signal.SIGINT)
+    try:
+        process.communicate(timeout=10)
+    except subprocess.TimeoutExpired:
+        process.kill()
+
+
+def uploader_command(args, source, port, remote):
+    return [
+        args.uploader,
+        "--source",
+        source,
+        "--remote",
+        remote,
+        "--email",
+        "user",
+        "--app-password",
+        "pass",
+        "--base-url",
+        f"http://127.0.0.1:{port}",
+    ]
+
+
+def predict(args, plan, scenario, threads):
+    cmd = [args.sim, "--plan", plan, "--connect-rtts", "1", "--threads",
+           ",".join(str(t) for t in threads)] + scenario["sim"]
+    output = subprocess.run(cmd, capture_output=True, text=True, check=True).stdout
+    predictions = {}
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) >= 10 and fields[0].isdigit():
+            predictions[int(fields[0])] = (float(fields[1]), " ".join(fields[9:]))
+    return predictions
+
+
+def run_scenario(args, scenario, threads, work):
+    source = os.path.join(work, scenario["name"])
+    write_tree(source, scenario["files"], scenario["dirs"])
+    mock, port = start_mock(args.mock, scenario["mock"])
+    rows = []
+    try:
+        extra = scenario.get("uploader", [])
+        plan = os.path.join(work, scenario["name"] + ".plan")
+        subprocess.run(
+            uploader_command(args, source, port, "/plan") + extra + ["--plan-out", plan],
+            capture_output=True, text=True, cwd=work, check=True,
+        )
+        predictions = predict(args, plan, scenario, threads)
+        for count in threads:
+            cmd = uploader_command(args, source, port, f"/run-{count}") + extra + [
+                "--threads", str(count)]
+            started = time.monotonic()
+            result = subprocess.run(cmd, capture_output=True, text=True, cwd=work)
+            measured = time.monotonic() - started
+            predicted, bottleneck = predictions[count]
+            rows.append((count, predicted, measured, bottleneck, result.returncode))
+    finally:
+        stop_mock(mock)
+    return rows
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--uploader", required=True)
+    parser.add_argument("--sim", required=True)
+    parser.add_argument("--mock", required=True)
+    parser.add_argument("--threads", default="1,2,4,8")
+    parser.add_argument("--scenario", action="append", help="Run only these scenarios.")
+    args = parser.parse_args()
+    threads = [int(t) for t in args.threads.split(",")]
+
+    errors = []
+    with tempfile.TemporaryDirectory() as work:
+        print(f"{'scenario':<22}{'threads':>8}{'predicted':>11}{'measured':>10}{'error':>8}  bottleneck")
+        for scenario in SCENARIOS:
+            if args.scenario and scenario["name"] not in args.scenario:
+                continue
+            for count, predicted, measured, bottleneck, code in run_scenario(
+                args, scenario, threads, work
+            ):
+                error = (predicted - measured) / measured
+                errors.append(abs(error))
+                note = "" if code == 0 else f" (exit {code})"
+                print(f"{scenario['name']:<22}{count:>8}{predicted:>10.2f}s{measured:>9.2f}s"
+                      f"{error:>+8.0%}  {bottleneck}{note}")
+    if errors:
+        print(f"Mean absolute error {sum(errors) / len(errors):.0%}, worst {max(errors):.0%}")
+
+
+if __name__ == "__main__":
+    main()
@@ -1,14 +1,66 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
 #include <string>
 #include <vector>
 
+#include "logger.h"
+
 enum class CompareMode {
     SizeMtime,
     SizeOnly
 };
 
+// How upload reads use the page cache.
+enum class ReadCacheMode : std::uint8_t {
+    // Plain buffered reads; uploaded files stay cached.
+    Buffered,
+    // Sequential read-ahead, and pages already sent are dropped from the
+    // cache behind the read cursor, so an upload does not evict the cache of
+    // other processes on the host.
+    DropBehind,
+    // As DropBehind, but files of at least ReadOptions::direct_min bytes
+    // bypass the cache entirely with aligned unbuffered reads.
+    Direct,
+};
+
+struct ReadOptions {
+    ReadCacheMode mode = ReadCacheMode::Buffered;
+    std::uint64_t direct_min = 256ULL << 20;
+};
+
+// One source -> remote mapping of a run with several jobs.
+struct SyncJob {
+    std::string name;
+    std::filesystem::path source;
+    std::string remote;
+    // Applied in addition to AppConfig::excludes.
+    std::vector<std::string> excludes;
+    CompareMode compare_mode = CompareMode::SizeMtime;
+    // Share of the workers and bandwidth relative to the other jobs.
+    std::uint32_t weight = 1;
+};
+
+// A [rule <name>] section of uploader.conf: what happens to the files that
+// match one of its patterns. The first matching rule applies.
+struct SyncRule {
+    std::string name;
+    // Globs as for --exclude: without '/' matched against the file name,
+    // with '/' against the path relative to the source root.
+    std::vector<std::string> patterns;
+    // Upload even when the remote copy looks the same; the remote state of
+    // such files is never looked up.
+    bool always_upload = false;
+    // Delete the local file after its upload when it was last modified at
+    // least delete_age_hours before the run started.
+    bool delete_after_upload = true;
+    std::uint32_t delete_age_hours = 24;
+    // Overrides the compare mode of the job.
+    bool has_compare = false;
+    CompareMode compare_mode = CompareMode::SizeMtime;
+};
+
 struct AppConfig {
     std::filesystem::path source;
     std::string remote = "/Backup/p2";
@@ -17,6 +69,77 @@ struct AppConfig {
     std::string base_url = "https://webdav.cloud.mail.ru";
     bool dry_run = false;
     int threads = 1;
+    // Concurrent listings of the decision stage, which runs ahead of the
+    // upload workers and needs no bandwidth.
+    int probe_threads = 8;
     CompareMode compare_mode = CompareMode::SizeMtime;
     std::vector<std::string> excludes;
+    // Per-directory ignore file name; empty disables ignore files.
+    std::string ignore_file = ".uploaderignore";
+    bool async_log = false;
+    LogLevel log_level = LogLevel::Info;
+    // Max per-file Skip lines per second; 0 means unlimited.
+    int log_skip_rate = 0;
+    // Write the decided plan here instead of executing it.
+    std::filesystem::path plan_out;
+    // Execute this previously written plan instead of scanning.
+    std::filesystem::path apply_plan;
+    // Every WebDAV request is recorded to trace_record (see http_trace.h);
+    // with trace_replay requests are answered from an earlier recording
+    // instead of the server, and local files are not deleted.
+    std::filesystem::path trace_record;
+    std::filesystem::path trace_replay;
+    // Source subtrees whose small files are uploaded as tar bundles.
+    std::vector<std::string> bundle_dirs;
+    std::uint64_t bundle_size = 64ULL << 20;
+    // Larger files in a bundled subtree are uploaded one by one.
+    std::uint64_t bundle_max_file = 1ULL << 20;
+    // Reuse earlier uploads of renamed files: COPY them, or MOVE with
+    // move_renames.
+    bool detect_renames = false;
+    bool move_renames = false;
+    // Upload one file per group of identical uploads and COPY the rest.
+    bool dedup = false;
+    // Glob patterns of files uploaded gzip-compressed as "<name>.gz".
+    std::vector<std::string> compress_patterns;
+    // Glob patterns of append-only files: when one grew since its last
+    // upload and the uploaded prefix is unchanged, only the new tail is sent.
+    std::vector<std::string> append_patterns;
+    // Local state kept between runs, e.g. bundle manifests.
+    std::filesystem::path state_dir = "state";
+    // Jobs from [job <name>] sections of uploader.conf, run in one process
+    // with shared workers and connections. Empty runs the single mapping
+    // given by source, remote and compare_mode.
+    std::vector<SyncJob> jobs;
+    // With shard_count > 1 only the directories hashed to shard_index
+    // (0-based) are synced, so several processes can split one tree.
+    std::uint32_t shard_index = 0;
+    std::uint32_t shard_count = 1;
+    std::uint32_t shard_depth = 1;
+    // Upload bandwidth in bytes per second shared by all uploads; 0 means
+    // unlimited.
+    std::uint64_t rate_limit = 0;
+    // Free space of the source volume, in percent, below which uploads that
+    // delete their local file go first: within the job at the low
+    // watermark, before every other upload at the critical one. 0 turns a
+    // watermark off.
+    std::uint32_t low_space_percent = 10;
+    std::uint32_t critical_space_percent = 2;
+    // How single-file uploads read their files (see FileReader).
+    ReadOptions read_options;
+    // Files of at least chunked_min bytes are uploaded as chunk_size parts
+    // spread over the workers when the server accepts Content-Range PUTs,
+    // and an interrupted upload resumes with the parts still missing. 0
+    // turns chunked uploads off.
+    std::uint64_t chunked_min = 1ULL << 30;
+    std::uint64_t chunk_size = 64ULL << 20;
+    // Live status of the execution stage: a line kept at the bottom of the
+    // console when it is a terminal, and status_file rewritten as JSON every
+    // status_interval seconds when set.
+    bool progress = true;
+    std::filesystem::path status_file;
+    std::uint32_t status_interval = 1;
+    // Rules from [rule <name>] sections, in priority order; empty keeps the
+    // built-in ones (see DefaultSyncRules).
+    std::vector<SyncRule> rules;
 };
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Little helpers for the on-disk formats. Values are stored in host byte
+// order, which is little-endian on every platform the uploader targets.
+// Columns are length-prefixed arrays copied in one memcpy.
+class BinaryWriter {
+public:
+    explicit BinaryWriter(std::string* out) : out_(out) {}
+
+    template <typename T>
+    void Put(T value) {
+        static_assert(std::is_trivially_copyable<T>::value, "plain values only");
+        out_->append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    void PutString(std::string_view value) {
+        Put<std::uint32_t>(static_cast<std::uint32_t>(value.size()));
+        out_->append(value.data(), value.size());
+    }
+
+    template <typename T>
+    void PutColumn(const std::vector<T>& values) {
+        static_assert(std::is_trivially_copyable<T>::value, "plain values only");
+        Put<std::uint64_t>(values.size());
+        out_->append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+
+private:
+    std::string* out_;
+};
+
+// Reads what BinaryWriter wrote. Any short read or oversized length sets
+// the reader to failed; later reads then return zero values.
+class BinaryReader {
+public:
+    explicit BinaryReader(std::string_view data) : data_(data) {}
+
+    template <typename T>
+    T Get() {
+        static_assert(std::is_trivially_copyable<T>::value, "plain values only");
+        T value{};
+        if (Take(sizeof(T))) {
+            std::memcpy(&value, data_.data() + pos_ - sizeof(T), sizeof(T));
+        }
+        return value;
+    }
+
+    std::string GetString() {
+        std::uint32_t size = Get<std::uint32_t>();
+        if (!Take(size)) {
+            return std::string();
+        }
+        return std::string(data_.substr(pos_ - size, size));
+    }
+
+    template <typename T>
+    bool GetColumn(std::vector<T>* values) {
+        std::uint64_t count = Get<std::uint64_t>();
+        if (!ok_ || count > (data_.size() - pos_) / sizeof(T)) {
+            ok_ = false;
+            return false;
+        }
+        values->resize(static_cast<std::size_t>(count));
+        std::size_t bytes = static_cast<std::size_t>(count) * sizeof(T);
+        if (bytes > 0) {
+            std::memcpy(values->data(), data_.data() + pos_, bytes);
+        }
+        pos_ += bytes;
+        return true;
+    }
+
+    bool Ok() const { return ok_; }
+    bool AtEnd() const { return pos_ == data_.size(); }
+
+private:
+    bool Take(std::size_t size) {
+        if (!ok_ || size > data_.size() - pos_) {
+            ok_ = false;
+            return false;
+        }
+        pos_ += size;
+        return true;
+    }
+
+    std::string_view data_;
+    std::size_t pos_ = 0;
+    bool ok_ = true;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "path_store.h"
+#include "webdav_client.h"
+
+// Remote collection, below each bundle root, that holds the bundles.
+constexpr const char kBundleDirName[] = ".uploader-bundles";
+
+// "./a\\b/" -> "a/b"; "" and "." select the whole source.
+std::string NormalizeBundleRoot(const std::string& root);
+
+struct BundleGroups {
+    // Per directory: 1-based index of the bundle root it lies in, 0 if none.
+    std::vector<std::uint16_t> dir_group;
+    // Per bundle root: its directory, or kInvalidId when it was not scanned.
+    std::vector<DirId> root_dir;
+};
+
+// `roots` must be normalized.
+BundleGroups AssignBundleGroups(const PathStore& store, const std::vector<std::string>& roots);
+
+// Path of a file inside the bundles of `root`, i.e. relative to that root.
+std::string BundleMemberName(const PathStore& store, FileId file, const std::string& root);
+
+// ustar header for one regular file. Names over 100 bytes are carried in a
+// preceding PAX extended header, so the result is 512 or more bytes.
+std::string TarHeader(std::string_view name, std::uint64_t size, std::int64_t mtime_ns);
+inline std::uint64_t TarPaddedSize(std::uint64_t size) {
+    return (size + 511) / 512 * 512;
+}
+
+// A tar archive of scanned files, produced while it is uploaded. A member
+// is read with the size and mtime the scan recorded; if the file is gone or
+// differs before or after it is read, the bytes are zero-filled to keep the
+// archive length and the member is reported as not intact.
+class TarBundleBody : public UploadBody {
+public:
+    TarBundleBody(const PathStore& store, const std::filesystem::path& source,
+                  const std::vector<FileId>& files, const std::string& root);
+    ~TarBundleBody() override;
+
+    TarBundleBody(const TarBundleBody&) = delete;
+    TarBundleBody& operator=(const TarBundleBody&) = delete;
+
+    std::uint64_t Size() const override { return size_; }
+    bool Rewind(std::string* error) override;
+    bool Read(char* buffer, std::size_t capacity, std::size_t* read, std::string* error) override;
+
+    std::size_t MemberCount() const { return members_.size(); }
+    FileId MemberFile(std::size_t index) const { return members_[index].file; }
+    const std::string& MemberName(std::size_t index) const { return members_[index].name; }
+    // Valid once the whole body has been read.
+    bool MemberIntact(std::size_t index) const { return members_[index].intact; }
+
+    // Text index uploaded next to the archive, one intact member per line:
+    // "<data offset>\t<size>\t<mtime ns>\t<name>".
+    std::string BuildIndex() const;
+
+private:
+    struct Member {
+        FileId file = 0;
+        std::string name;
+        std::string header;
+        std::uint64_t size = 0;
+        std::int64_t mtime_ns = 0;
+        std::uint64_t data_offset = 0;
+        bool intact = true;
+    };
+    enum class Phase { Header, Data, Padding, Trailer, Done };
+
+    void OpenMember();
+    void CloseMember(bool check);
+
+    const PathStore& store_;
+    std::filesystem::path source_;
+    std::vector<Member> members_;
+    std::uint64_t size_ = 0;
+
+    std::size_t current_ = 0;
+    Phase phase_ = Phase::Header;
+    std::uint64_t phase_pos_ = 0;
+    std::FILE* file_ = nullptr;
+};
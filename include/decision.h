@@ -21,28 +21,48 @@ struct LocalFileInfo {
     std::filesystem::path path;
     std::uint64_t size = 0;
     std::chrono::system_clock::time_point last_modified{};
-    bool is_jpg = false;
 };
 
-enum class FileActionType {
+enum class FileActionType : std::uint8_t {
     Skip,
     Upload,
     UploadAndDelete
 };
 
+// Why DecideFileAction chose its action. Stored as one byte per file in sync
+// plans, so existing values must keep their numbers.
+enum class DecisionReason : std::uint8_t {
+    Same = 0,
+    Missing = 1,
+    Different = 2,
+    OldMissing = 3,
+    OldDifferent = 4,
+    // Files of a rule with always_upload (by default every .jpg); Overwrite
+    // when the remote copy was known to exist.
+    AlwaysUpload = 5,
+    AlwaysOverwrite = 6
+};
+
 struct FileDecision {
     FileActionType action = FileActionType::Skip;
-    std::string reason;
+    DecisionReason reason = DecisionReason::Same;
 };
 
+const char* DecisionReasonText(DecisionReason reason);
+bool IsAlwaysReason(DecisionReason reason);
+
 bool IsDifferent(const LocalFileInfo& local,
                  const RemoteItemInfo& remote,
                  CompareMode mode);
 
+// Applies `rule` to a file; `mode` is the compare mode of the job, used
+// unless the rule has its own.
 FileDecision DecideFileAction(const LocalFileInfo& local,
                               const RemoteItemInfo& remote,
+                              const SyncRule& rule,
                               CompareMode mode,
                               std::chrono::system_clock::time_point run_start);
 
-bool IsOlderThan24Hours(const LocalFileInfo& local,
-                        std::chrono::system_clock::time_point run_start);
+bool IsOlderThanHours(const LocalFileInfo& local,
+                      std::chrono::system_clock::time_point run_start,
+                      std::uint32_t hours);
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstdint>
+
+#include "logger.h"
+#include "plan.h"
+
+// A COPY is a request of its own, so smaller duplicates are simply uploaded.
+constexpr std::uint64_t kMinDedupSize = 64 * 1024;
+
+struct DedupStats {
+    // Distinct files (hard links count once) whose content was hashed.
+    std::uint64_t hashed = 0;
+    std::uint64_t hashed_bytes = 0;
+    // Copies found by file identity alone.
+    std::uint64_t hard_links = 0;
+    std::uint64_t copies = 0;
+    std::uint64_t saved_bytes = 0;
+    std::uint64_t errors = 0;
+};
+
+// Groups the plan's single-file uploads (not bundled, compressed or renamed) by
+// size and content, and points every upload of a group but the first at it
+// through plan->copy_from. Files of one size that share a LocalFileId are
+// hard links and are grouped without reading them; other same-size files are
+// hashed with SHA-256 on up to `threads` threads. A file that changed while
+// it was hashed stays a plain upload.
+DedupStats FindDuplicateUploads(SyncPlan* plan, int threads, Logger& logger);
@@ -2,11 +2,51 @@
 
 #include <filesystem>
 #include <string>
+#include <string_view>
+#include <unordered_set>
 #include <vector>
 
+#include "glob_automaton.h"
+
 struct ExcludeRules {
     std::vector<std::string> patterns;
 };
 
+// ExcludeRules compiled once for matching. Patterns without '/' are checked
+// against every path segment: exact names through a hash set, "*.ext" style
+// patterns through a suffix table and the remaining globs through one shared
+// automaton. Patterns with '/' are matched against the whole relative path by
+// a second automaton whose state is carried from a directory to its children,
+// so checking an entry only looks at its own name. The automata cache
+// transitions lazily, so a matcher must not be shared between threads.
+class ExcludeMatcher {
+public:
+    using State = GlobAutomaton::State;
+
+    explicit ExcludeMatcher(const ExcludeRules& rules);
+
+    // State for the source root itself.
+    State RootState() const;
+    // Checks the entry `name` inside a directory that is not excluded and whose
+    // state is `parent`. When the entry is kept, `child` receives the state to
+    // pass for its own children.
+    bool ExcludesChild(State parent, std::string_view name, State* child) const;
+    // Checks a '/'-separated UTF-8 path relative to the source root, segment by
+    // segment; a path is excluded when it or any of its parents is.
+    bool Excludes(std::string_view relative_utf8) const;
+
+private:
+    bool MatchesSegment(std::string_view lower_name) const;
+
+    std::vector<std::string> names_;
+    std::unordered_set<std::string_view> literals_;
+    std::unordered_set<std::string_view> suffixes_;
+    std::vector<std::size_t> suffix_lengths_;
+    GlobAutomaton segment_globs_;
+    GlobAutomaton path_globs_;
+};
+
 ExcludeRules BuildDefaultExcludeRules();
+// Convenience wrapper that compiles `rules` for a single check; prefer an
+// ExcludeMatcher when testing many paths.
 bool ShouldExclude(const std::filesystem::path& relative, const ExcludeRules& rules);
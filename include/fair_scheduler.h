@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Every request pays at least this much, so flows of many small files are
+// not favoured over flows of a few large ones.
+constexpr std::uint64_t kMinScheduleCost = 64 * 1024;
+
+// Weighted fair queueing over several flows of work items, e.g. the upload
+// queues of several sync jobs sharing one worker pool. Each flow keeps its
+// own order; Next picks the flow whose next item would finish first if
+// every flow were served at a rate proportional to its weight, so over time
+// a flow of weight 2 gets twice the bytes of a flow of weight 1.
+//
+// Items may be marked urgent, e.g. uploads that free local disk space once
+// done. How far a flow's urgent items move ahead is set per flow and may
+// change while items are handed out.
+class FairScheduler {
+public:
+    struct Pick {
+        std::size_t flow = 0;
+        // Index into the costs the flow was added with.
+        std::size_t item = 0;
+    };
+
+    enum class Promotion : std::uint8_t {
+        // Items go in the order they were added.
+        None,
+        // The flow's urgent items go before its other items.
+        WithinFlow,
+        // As WithinFlow, and the flow's urgent items also go before every
+        // non-urgent item of all flows, regardless of weights.
+        Global,
+    };
+
+    // Adds a flow of items with the given costs (bytes); `weight` > 0.
+    // `urgent` is empty or has a flag per item. Returns its index. All flows
+    // must be added before Next is called.
+    std::size_t AddFlow(std::uint32_t weight, std::vector<std::uint64_t> costs,
+                        const std::vector<std::uint8_t>& urgent = {});
+
+    // Thread-safe.
+    void SetPromotion(std::size_t flow, Promotion promotion);
+
+    // Thread-safe; false once every item has been handed out.
+    bool Next(Pick* pick);
+
+    std::size_t Items() const { return total_; }
+
+private:
+    struct Flow {
+        std::uint32_t weight = 1;
+        std::vector<std::uint64_t> costs;
+        // Item indices in the order they were added: [0] urgent, [1] the
+        // rest, each with the position of its next item.
+        std::vector<std::size_t> queue[2];
+        std::size_t next[2] = {0, 0};
+        Promotion promotion = Promotion::None;
+        // Virtual finish time of the last item handed out.
+        double finish = 0.0;
+    };
+
+    // Queue the flow's next item comes from, or -1 when it has none left.
+    static int HeadQueue(const Flow& flow);
+
+    std::mutex mutex_;
+    std::vector<Flow> flows_;
+    std::size_t total_ = 0;
+};
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+#include "app_config.h"
+#include "webdav_client.h"
+
+// "buffered", "drop-behind" or "direct".
+bool ParseReadCacheMode(const std::string& text, ReadCacheMode* mode);
+const char* ReadCacheModeName(ReadCacheMode mode);
+
+// Upload body over a local file. With DropBehind it uses
+// posix_fadvise(SEQUENTIAL) and POSIX_FADV_DONTNEED every few megabytes
+// behind the cursor, or FILE_FLAG_SEQUENTIAL_SCAN on Windows, which has no
+// per-range equivalent. Direct opens large files with O_DIRECT
+// (FILE_FLAG_NO_BUFFERING) and reads them in aligned chunks through a
+// buffer of its own; where the file system refuses that, it falls back to
+// DropBehind.
+class FileReader : public UploadBody {
+public:
+    explicit FileReader(const ReadOptions& options);
+    ~FileReader() override;
+
+    FileReader(const FileReader&) = delete;
+    FileReader& operator=(const FileReader&) = delete;
+
+    bool Open(const std::filesystem::path& path, std::string* error);
+    void Close();
+    // Limits the body to `length` bytes from `offset` of the open file and
+    // rewinds to its start. With direct I/O `offset` must be a multiple of
+    // 1 MB.
+    bool SetRange(std::uint64_t offset, std::uint64_t length, std::string* error);
+
+    std::uint64_t Size() const override { return end_ - begin_; }
+    std::uint64_t FileSize() const { return size_; }
+    bool Rewind(std::string* error) override;
+    bool Read(char* buffer, std::size_t capacity, std::size_t* read, std::string* error) override;
+
+    // Whether the open file bypasses the page cache.
+    bool Direct() const { return direct_; }
+
+private:
+    // Raw read into `buffer`; with direct I/O `capacity` is a whole chunk.
+    bool ReadRaw(char* buffer, std::size_t capacity, std::size_t* read, std::string* error);
+    void DropBehind(bool all);
+
+    ReadOptions options_;
+#ifdef _WIN32
+    void* handle_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+    std::uint64_t size_ = 0;
+    // The part of the file the body covers, [begin_, end_).
+    std::uint64_t begin_ = 0;
+    std::uint64_t end_ = 0;
+    bool direct_ = false;
+    // Bytes read from the file so far, and the prefix of them already
+    // dropped from the cache.
+    std::uint64_t offset_ = 0;
+    std::uint64_t dropped_ = 0;
+    // Aligned chunk for direct reads: [chunk_pos_, chunk_len_) is unsent.
+    std::unique_ptr<char[]> chunk_storage_;
+    char* chunk_ = nullptr;
+    std::size_t chunk_pos_ = 0;
+    std::size_t chunk_len_ = 0;
+};
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+// Writes `data` to a temporary file next to `path`, flushes it to disk and
+// renames it over `path`, so readers see either the old or the new content.
+bool WriteFileAtomic(const std::filesystem::path& path, std::string_view data, std::string* error);
+
+bool ReadWholeFile(const std::filesystem::path& path, std::string* data, std::string* error);
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <map>
+#include <string_view>
+#include <vector>
+
+// Multi-pattern glob matcher. All patterns are compiled into one NFA which is
+// determinised lazily while matching, so each input byte costs a single table
+// lookup no matter how many patterns were added. Matching is ASCII
+// case-insensitive. The DFA cache grows on first use of a transition, so an
+// automaton must not be shared between threads.
+class GlobAutomaton {
+public:
+    using State = std::uint32_t;
+
+    enum class Syntax {
+        // '*' matches any run of bytes and '?' any byte, '/' included.
+        Anything,
+        // gitignore-style: '*' and '?' stop at '/', "**" spans directories,
+        // "[a-z]"/"[!...]" classes and "\x" escapes are supported.
+        PathSegments
+    };
+
+    static constexpr State kDead = 0;
+    static constexpr int kNoRule = -1;
+
+    explicit GlobAutomaton(Syntax syntax);
+
+    // Patterns must be lower-case for case-insensitive matching. `rule` is
+    // reported by MatchedRule; when several patterns match, the highest rule
+    // wins. `dir_only` patterns only match when the caller says the input is a
+    // directory. Must not be called after matching has started.
+    void AddPattern(std::string_view pattern, int rule, bool dir_only = false);
+
+    bool Empty() const { return pattern_count_ == 0; }
+
+    State Start() const;
+    State Step(State state, unsigned char c) const;
+    State Feed(State state, std::string_view text) const;
+    int MatchedRule(State state, bool is_dir) const;
+
+    std::size_t DfaStateCount() const { return dfa_sets_.size(); }
+
+private:
+    using ByteSet = std::array<std::uint64_t, 4>;
+    static constexpr State kUnknown = 0xFFFFFFFFu;
+
+    struct NfaState {
+        int edge_set = -1;
+        std::uint32_t edge_target = 0;
+        int loop_set = -1;
+        std::vector<std::uint32_t> epsilon;
+        int rule = kNoRule;
+        bool dir_only = false;
+    };
+
+    std::uint32_t NewState();
+    int AddSet(const ByteSet& set);
+    State Intern(std::vector<std::uint32_t> nfa_states) const;
+    void Close(std::vector<std::uint32_t>* nfa_states) const;
+
+    Syntax syntax_;
+    std::size_t pattern_count_ = 0;
+    std::vector<NfaState> nfa_;
+    std::vector<ByteSet> sets_;
+
+    mutable std::map<std::vector<std::uint32_t>, State> dfa_ids_;
+    mutable std::vector<std::vector<std::uint32_t>> dfa_sets_;
+    mutable std::vector<State> dfa_next_;
+    mutable std::vector<int> dfa_rule_dir_;
+    mutable std::vector<int> dfa_rule_file_;
+    mutable State start_ = kUnknown;
+};
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "webdav_client.h"
+
+// Smaller files are not worth the gzip framing and are sent as they are.
+constexpr std::uint64_t kMinCompressSize = 512;
+
+std::uint32_t Crc32(std::uint32_t crc, const unsigned char* data, std::size_t size);
+
+// Streaming gzip writer: LZ77 over a 32 KiB window with hash chains, coded
+// with the fixed deflate Huffman tables so no block has to be buffered. The
+// output depends only on the input bytes, not on how they were split across
+// Write calls, so compressing a file twice gives the same size.
+class GzipEncoder {
+public:
+    GzipEncoder();
+
+    void Reset();
+    // Appends compressed bytes to `out`; up to one maximal match of input is
+    // held back until more data or Finish arrives.
+    void Write(const unsigned char* data, std::size_t size, std::string* out);
+    void Finish(std::string* out);
+
+private:
+    void Encode(bool final, std::string* out);
+    void PutBits(std::uint32_t bits, int count, std::string* out);
+    void PutLiteral(int value, std::string* out);
+    void PutMatch(std::size_t length, std::uint64_t distance, std::string* out);
+    void Insert(std::uint64_t position);
+
+    std::vector<unsigned char> window_;
+    // Absolute input positions of window_[0] and of the next byte to code.
+    std::uint64_t base_ = 0;
+    std::uint64_t pos_ = 0;
+    std::vector<std::int64_t> head_;
+    std::vector<std::int64_t> prev_;
+    std::uint32_t bit_buffer_ = 0;
+    int bit_count_ = 0;
+    std::uint32_t crc_ = 0;
+    std::uint64_t input_size_ = 0;
+    bool started_ = false;
+};
+
+// Order-0 entropy of up to three 16 KiB samples (start, middle, end) below
+// 7 bits per byte; JPEG, ZIP, video and other packed data sit near 8.
+bool LooksCompressible(const std::filesystem::path& path, std::uint64_t size);
+
+// Gzip of a local file, produced while it is uploaded. Open compresses the
+// file once, discarding the output, to learn the Content-Length; the upload
+// then compresses it again, so neither a temporary file nor the compressed
+// data in memory is needed. A file that changes in between fails the read.
+class GzipFileBody : public UploadBody {
+public:
+    explicit GzipFileBody(const std::filesystem::path& path);
+    ~GzipFileBody() override;
+
+    GzipFileBody(const GzipFileBody&) = delete;
+    GzipFileBody& operator=(const GzipFileBody&) = delete;
+
+    bool Open(std::string* error);
+
+    std::uint64_t Size() const override { return size_; }
+    bool Rewind(std::string* error) override;
+    bool Read(char* buffer, std::size_t capacity, std::size_t* read, std::string* error) override;
+
+    // Uncompressed bytes seen by Open.
+    std::uint64_t SourceSize() const { return source_size_; }
+
+private:
+    // Feeds the next chunk of the file, or finishes the stream at its end.
+    bool Pump(std::size_t* got, std::string* error);
+
+    std::filesystem::path path_;
+    std::FILE* file_ = nullptr;
+    GzipEncoder encoder_;
+    std::vector<unsigned char> input_;
+    std::string pending_;
+    std::size_t pending_pos_ = 0;
+    bool finished_ = false;
+    std::uint64_t size_ = 0;
+    std::uint64_t source_size_ = 0;
+    std::uint64_t produced_ = 0;
+};
+
+// Size of the gzip GzipFileBody would upload for `path`.
+bool GzipCompressedSize(const std::filesystem::path& path, std::uint64_t* size, std::string* error);
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "webdav_client.h"
+
+enum class TraceMethod : std::uint8_t {
+    Propfind,
+    Mkcol,
+    Put,
+    Copy,
+    Move,
+    Other,
+};
+
+constexpr std::size_t kTraceMethods = 6;
+
+TraceMethod TraceMethodOf(std::string_view method);
+const char* TraceMethodName(TraceMethod method);
+// FNV-1a of a request path: the same tree gives the same hashes, but a
+// trace names no file.
+std::uint64_t TracePathHash(std::string_view path);
+
+// One request attempt as a trace keeps it; headers and bodies are left out.
+struct TraceRecord {
+    // Since the recording started.
+    std::uint64_t start_us = 0;
+    std::uint64_t path_hash = 0;
+    std::uint64_t request_bytes = 0;
+    std::uint64_t response_bytes = 0;
+    HttpTimings timings;
+    // The transport that sent it, numbered from 0 in order of creation.
+    std::uint32_t client = 0;
+    // 0 when no response arrived.
+    std::uint16_t status = 0;
+    TraceMethod method = TraceMethod::Other;
+};
+
+// Column by column, like the plan and state files; 51 bytes a request.
+bool WriteTraceFile(const std::filesystem::path& path, const std::vector<TraceRecord>& records,
+                    std::string* error);
+bool ReadTraceFile(const std::filesystem::path& path, std::vector<TraceRecord>* records,
+                   std::string* error);
+
+// Collects the requests of every transport it wraps, for one trace file.
+class TraceRecorder {
+public:
+    TraceRecorder() : start_(std::chrono::steady_clock::now()) {}
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    // A transport that sends through `inner` and records every request.
+    std::unique_ptr<WebDavTransport> Wrap(std::unique_ptr<WebDavTransport> inner);
+
+    void Add(const TraceRecord& record);
+    std::uint64_t ElapsedUs() const;
+    std::size_t Size();
+    bool Save(const std::filesystem::path& path, std::string* error);
+
+private:
+    std::chrono::steady_clock::time_point start_;
+    std::mutex mutex_;
+    std::vector<TraceRecord> records_;
+    std::uint32_t next_client_ = 0;
+};
+
+// Answers requests from a trace instead of a server. A request takes the
+// next recorded one with its method and path and sleeps through that one's
+// connect, transfer and wait times before returning its status; the body
+// is still read, at the pace of the rate limiter. Requests the trace lacks
+// get the most common status and the median times of their method, with
+// the transfer time scaled by size. Replayed PROPFINDs list nothing, so
+// every file is decided as missing on the server.
+class TraceReplayer {
+public:
+    explicit TraceReplayer(std::vector<TraceRecord> records);
+
+    TraceReplayer(const TraceReplayer&) = delete;
+    TraceReplayer& operator=(const TraceReplayer&) = delete;
+
+    std::unique_ptr<WebDavTransport> MakeTransport();
+
+    // The record that answers a request; *matched is false when it was
+    // made up from the method's model.
+    TraceRecord Next(TraceMethod method, std::uint64_t path_hash, std::uint64_t request_bytes,
+                     bool* matched);
+
+    std::uint64_t Matched() const { return matched_.load(); }
+    std::uint64_t Modelled() const { return modelled_.load(); }
+
+private:
+    struct MethodModel {
+        std::uint16_t status = 0;
+        std::uint32_t connect_us = 0;
+        std::uint32_t ttfb_us = 0;
+        // Request bytes per microsecond of transfer; 0 when unknown.
+        double bytes_per_us = 0.0;
+    };
+
+    // Records of one method and path in recorded order; those before
+    // `next` are used up.
+    struct Queue {
+        std::vector<std::size_t> records;
+        std::size_t next = 0;
+    };
+
+    std::vector<TraceRecord> records_;
+    std::array<MethodModel, kTraceMethods> models_;
+    std::mutex mutex_;
+    std::unordered_map<std::uint64_t, Queue> queues_;
+    std::atomic<std::uint64_t> matched_{0};
+    std::atomic<std::uint64_t> modelled_{0};
+};
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "glob_automaton.h"
+
+// Rules from one per-directory ignore file (".uploaderignore" by default),
+// with gitignore semantics: a pattern without '/' matches at any depth below
+// the file, a pattern containing '/' is anchored to the file's directory,
+// "**" spans directories, a trailing '/' matches directories only, '!'
+// re-includes, '#' starts a comment and the last matching line wins.
+// Matching is ASCII case-insensitive like the global excludes.
+class IgnoreRuleSet {
+public:
+    using State = GlobAutomaton::State;
+
+    explicit IgnoreRuleSet(std::string_view text);
+
+    std::size_t RuleCount() const { return negated_.size(); }
+    State Start() const { return automaton_.Start(); }
+    // Feeds one path segment; returns the state after it.
+    State Feed(State state, std::string_view name) const { return automaton_.Feed(state, name); }
+    State EnterDirectory(State state) const { return automaton_.Step(state, '/'); }
+    // Index of the last rule matching at `state`, or GlobAutomaton::kNoRule.
+    int MatchedRule(State state, bool is_dir) const { return automaton_.MatchedRule(state, is_dir); }
+    bool Negated(int rule) const { return negated_[static_cast<std::size_t>(rule)]; }
+
+private:
+    GlobAutomaton automaton_;
+    std::vector<bool> negated_;
+};
+
+// An ignore file in effect for a directory, with the automaton state reached
+// by the path from the file's directory down to that directory.
+struct IgnoreLevel {
+    const IgnoreRuleSet* rules = nullptr;
+    IgnoreRuleSet::State state = GlobAutomaton::kDead;
+};
+
+// Ignore files in effect for a directory, outermost first.
+using IgnoreChain = std::vector<IgnoreLevel>;
+
+// Checks the entry `name` of a directory whose chain is `parent`. Deeper
+// files take precedence; within a file the last matching rule decides. For
+// kept directories `child` receives the chain for their entries, without the
+// levels that can no longer match anything.
+bool IsIgnored(const IgnoreChain& parent, std::string_view name, bool is_dir, IgnoreChain* child);
+
+// Compiled rule sets keyed by file contents, so identical ignore files that
+// are repeated across many directories are compiled once per scan.
+class IgnoreFileCache {
+public:
+    // Returns nullptr when `text` holds no rules.
+    const IgnoreRuleSet* Compile(const std::string& text);
+
+    std::size_t FilesLoaded() const { return files_loaded_; }
+    std::size_t DistinctRuleSets() const { return by_content_.size(); }
+
+private:
+    std::unordered_map<std::string, std::unique_ptr<IgnoreRuleSet>> by_content_;
+    std::size_t files_loaded_ = 0;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "logger.h"
+#include "path_store.h"
+
+// Bytes freed by one batch of deletions, `seconds` after the deleter
+// started.
+struct ReclaimSample {
+    double seconds = 0.0;
+    std::uint64_t bytes = 0;
+};
+
+struct DeletionStats {
+    std::uint64_t deleted_jpg = 0;
+    std::uint64_t deleted_old = 0;
+    std::uint64_t errors = 0;
+    // Sizes as scanned, one sample per batch.
+    std::vector<ReclaimSample> reclaimed;
+};
+
+// Deletes uploaded local files on a thread of its own, so upload workers
+// only append to a queue. Each wake-up takes the whole queue, orders it by
+// directory and deletes with unlinkat() against a cached directory fd
+// (DeleteFileW on Windows). Every deleted path is appended to a journal
+// file, one UTF-8 path per line, instead of being kept in memory. With
+// `keep_files` nothing is deleted or journaled, but the files are logged
+// and counted as if they were, for runs against a replayed server.
+class LocalDeleter {
+public:
+    LocalDeleter(const PathStore& store, const std::filesystem::path& root,
+                 const std::filesystem::path& journal_path, Logger& logger,
+                 bool keep_files = false);
+    ~LocalDeleter();
+
+    LocalDeleter(const LocalDeleter&) = delete;
+    LocalDeleter& operator=(const LocalDeleter&) = delete;
+
+    void Enqueue(FileId file, bool jpg);
+
+    // Deletes everything still queued and stops the thread; later calls
+    // return the same totals.
+    DeletionStats Finish();
+
+    const std::filesystem::path& JournalPath() const { return journal_path_; }
+
+private:
+    struct Request {
+        FileId file = 0;
+        bool jpg = false;
+    };
+
+    void Run();
+    void DeleteBatch(std::vector<Request>* batch);
+    bool RemoveFile(FileId file, std::string* error);
+#ifndef _WIN32
+    int DirectoryFd(DirId dir, std::string* error);
+    void CloseDirectoryFds();
+#endif
+
+    const PathStore& store_;
+    std::filesystem::path root_;
+    std::filesystem::path journal_path_;
+    Logger& logger_;
+    bool keep_files_;
+    std::chrono::steady_clock::time_point start_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::vector<Request> queue_;
+    bool stop_ = false;
+    std::thread thread_;
+
+    // Owned by the deletion thread until it is joined.
+    std::FILE* journal_ = nullptr;
+    DeletionStats stats_;
+#ifndef _WIN32
+    std::unordered_map<DirId, int> dir_fds_;
+#endif
+};
@@ -1,26 +1,114 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
 #include <filesystem>
-#include <fstream>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
+
+enum class LogLevel {
+    Info = 0,
+    Warn = 1,
+    Error = 2
+};
+
+struct LoggerOptions {
+    // Producers append to per-thread lock-free rings and a background thread
+    // formats and writes them in batches. Otherwise every line is written and
+    // flushed by the calling thread under a mutex.
+    bool async = false;
+    LogLevel min_level = LogLevel::Info;
+    // Upper bound on Skip lines per second; 0 disables the limit.
+    int skip_lines_per_second = 0;
+    // Async mode: how often the writer wakes up, and how often it fsyncs.
+    std::chrono::milliseconds flush_interval{100};
+    std::chrono::milliseconds sync_interval{1000};
+    bool console = true;
+};
 
 class Logger {
 public:
-    explicit Logger(const std::filesystem::path& log_dir);
+    explicit Logger(const std::filesystem::path& log_dir,
+                    const LoggerOptions& options = LoggerOptions());
+    // Drains every pending line and fsyncs the log file.
+    ~Logger();
+
+    Logger(const Logger&) = delete;
+    Logger& operator=(const Logger&) = delete;
+
+    void Info(std::string message);
+    void Warn(std::string message);
+    void Error(std::string message);
+    // Per-file "Skip <name> (<reason>)" line at Info level. It is formatted by
+    // the writer and subject to skip_lines_per_second.
+    void Skip(std::string name, std::string reason);
 
-    void Info(const std::string& message);
-    void Warn(const std::string& message);
-    void Error(const std::string& message);
+    // Blocks until everything this thread logged before the call is written.
+    void Flush();
+
+    // Keeps `line` below the console output: it is erased before and drawn
+    // again after every write. Empty removes it. Does nothing unless stdout
+    // is a terminal.
+    void SetStatusLine(std::string line);
 
     std::filesystem::path LogPath() const;
+    std::uint64_t SuppressedSkipLines() const { return skip_suppressed_.load(); }
 
 private:
-    void Write(const std::string& level, const std::string& message);
-    static std::string Timestamp();
+    struct Record {
+        std::int64_t time_ns = 0;
+        LogLevel level = LogLevel::Info;
+        bool skip = false;
+        std::string text;
+        std::string detail;
+    };
+    class Ring;
+
+    bool Enabled(LogLevel level) const { return level >= options_.min_level; }
+    bool AdmitSkip(std::int64_t now_ns);
+    void Submit(Record record);
+    Ring* LocalRing();
+    void WriterLoop();
+    void WriteBatch(const Record* records, std::size_t count);
+    void AppendLine(const Record& record, std::string* out);
+    void SyncFile();
+    // Under write_mutex_.
+    void EraseStatusLine();
+    static std::int64_t NowNs();
     static std::filesystem::path BuildLogPath(const std::filesystem::path& log_dir);
 
+    LoggerOptions options_;
     std::filesystem::path log_path_;
-    std::ofstream file_;
-    mutable std::mutex mutex_;
+    std::FILE* file_ = nullptr;
+    std::uint64_t id_ = 0;
+
+    // Sync mode, and the console/file writes of the async writer.
+    std::mutex write_mutex_;
+    std::int64_t cached_second_ = -1;
+    // "YYYY-MM-DD hh:mm:ss", sized for the widest ints snprintf could get.
+    char cached_stamp_[64] = {};
+    bool terminal_ = false;
+    std::size_t status_width_ = 79;
+    std::string status_line_;
+
+    std::atomic<std::int64_t> skip_window_{-1};
+    std::atomic<std::int64_t> skip_in_window_{0};
+    std::atomic<std::uint64_t> skip_dropped_{0};
+    std::atomic<std::uint64_t> skip_suppressed_{0};
+
+    std::mutex rings_mutex_;
+    std::vector<std::unique_ptr<Ring>> rings_;
+    std::mutex wake_mutex_;
+    std::condition_variable wake_;
+    std::condition_variable flushed_;
+    bool stop_ = false;
+    std::atomic<std::uint64_t> flush_requested_{0};
+    std::uint64_t flush_done_ = 0;
+    std::thread writer_;
 };
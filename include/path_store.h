@@ -0,0 +1,98 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "path_utils.h"
+
+using DirId = std::uint32_t;
+using FileId = std::uint32_t;
+
+// Compact representation of a scanned tree. Every directory is interned once
+// with the index of its parent, every leaf name lives in one contiguous UTF-8
+// arena, and files are 32-bit handles into structure-of-arrays columns.
+// Relative, absolute and remote paths are only built when asked for.
+class PathStore {
+public:
+    static constexpr DirId kRootDir = 0;
+    static constexpr std::uint32_t kInvalidId = 0xFFFFFFFFu;
+
+    PathStore();
+
+    // Both return kInvalidId when the 32-bit arena or handle space is exhausted.
+    // File metadata is captured once at scan time; mtime is nanoseconds since
+    // the Unix epoch.
+    DirId AddDirectory(DirId parent, std::string_view name_utf8);
+    FileId AddFile(DirId parent, std::string_view name_utf8,
+                   std::uint64_t size = 0, std::int64_t mtime_ns = 0);
+
+    void ReserveFiles(std::size_t count, std::size_t name_bytes);
+
+    // Includes the root directory, which has id kRootDir and an empty name.
+    std::size_t DirectoryCount() const { return dir_parent_.size(); }
+    std::size_t FileCount() const { return file_dir_.size(); }
+
+    DirId DirectoryParent(DirId dir) const { return dir_parent_[dir]; }
+    int DirectoryDepth(DirId dir) const { return dir_depth_[dir]; }
+    std::string_view DirectoryName(DirId dir) const;
+    DirId FileDirectory(FileId file) const { return file_dir_[file]; }
+    std::string_view FileName(FileId file) const;
+    std::uint64_t FileSize(FileId file) const { return file_size_[file]; }
+    std::int64_t FileMtimeNs(FileId file) const { return file_mtime_[file]; }
+    std::chrono::system_clock::time_point FileModified(FileId file) const;
+
+    // '/'-separated UTF-8 path relative to the scan root ("" for the root).
+    std::string DirectoryRelativeUtf8(DirId dir) const;
+    std::string FileRelativeUtf8(FileId file) const;
+
+    std::filesystem::path DirectoryRelativePath(DirId dir) const;
+    std::filesystem::path FileRelativePath(FileId file) const;
+    std::filesystem::path FileAbsolutePath(const std::filesystem::path& root, FileId file) const;
+
+    std::string DirectoryRemotePath(const std::string& remote_root, DirId dir) const;
+    std::string FileRemotePath(const std::string& remote_root, FileId file) const;
+
+    // Bytes held by the store, counted from container capacities.
+    std::uint64_t MemoryUsage() const;
+
+private:
+    bool AppendName(std::string_view name, std::uint32_t* offset);
+    void AppendDirectoryPath(DirId dir, std::string* out) const;
+
+    std::string arena_;
+
+    std::vector<DirId> dir_parent_;
+    std::vector<std::uint32_t> dir_name_offset_;
+    std::vector<std::uint16_t> dir_name_length_;
+    std::vector<std::uint16_t> dir_depth_;
+
+    std::vector<DirId> file_dir_;
+    std::vector<std::uint32_t> file_name_offset_;
+    std::vector<std::uint16_t> file_name_length_;
+    std::vector<std::uint64_t> file_size_;
+    std::vector<std::int64_t> file_mtime_;
+};
+
+// Plain and percent-encoded remote paths for every directory of a store,
+// built once parent-first so a file path only appends and encodes its own
+// name. Read-only after construction, so worker threads can share it.
+class RemotePathTable {
+public:
+    RemotePathTable(const PathStore& store, const std::string& remote_root);
+
+    const RemotePath& Directory(DirId dir) const { return dirs_[dir]; }
+    RemotePath File(FileId file) const;
+
+private:
+    const PathStore& store_;
+    std::vector<RemotePath> dirs_;
+};
+
+// `name` (UTF-8, may span several '/'-separated segments) below `parent`,
+// joined and encoded as RemotePathTable does, so a path built from a name
+// kept elsewhere gets the same URL as the table's.
+RemotePath AppendRemotePath(const RemotePath& parent, std::string_view name);
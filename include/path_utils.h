@@ -3,6 +3,13 @@
 #include <filesystem>
 #include <string>
 
+// A remote path together with its percent-encoded form, for callers that
+// build the encoding incrementally instead of per request.
+struct RemotePath {
+    std::string plain;
+    std::string encoded;
+};
+
 std::string NormalizeRemoteRoot(const std::string& remote);
 std::string JoinRemotePath(const std::string& remote_root, const std::filesystem::path& relative);
 std::string UrlEncodePath(const std::string& path);
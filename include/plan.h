@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "app_config.h"
+#include "decision.h"
+#include "path_store.h"
+
+// Reason byte of files the decision stage could not decide, e.g. because the
+// remote lookup failed. Such files are neither uploaded nor counted as skipped.
+constexpr std::uint8_t kReasonUndecided = 0xFF;
+
+// dir_missing of a directory the decision stage did not list because none
+// of its files depends on the remote state. Its collection is created unless
+// it exists.
+constexpr std::uint8_t kDirUnlisted = 2;
+
+// How a file's bytes are stored remotely.
+enum class FileEncoding : std::uint8_t {
+    Plain = 0,
+    // Compressed while uploading, stored as "<name>.gz".
+    Gzip = 1,
+};
+
+// Output of the decision stage: the scanned tree plus one column per
+// attribute, indexed by FileId or DirId. A file's remote path is its handle
+// into `store` (see RemotePathTable); size and mtime are the store's columns.
+struct SyncPlan {
+    std::filesystem::path source;
+    std::string remote_root;
+    CompareMode compare_mode = CompareMode::SizeMtime;
+    // Reference time of the 24h rule, nanoseconds since the Unix epoch.
+    std::int64_t created_ns = 0;
+    PathStore store;
+    // Remote root existence; when false its missing ancestors are created too.
+    bool root_exists = false;
+    // Per directory: 1 when the remote collection does not exist yet,
+    // kDirUnlisted when it was not looked up.
+    std::vector<std::uint8_t> dir_missing;
+    // Per file.
+    std::vector<FileActionType> action;
+    std::vector<std::uint8_t> reason;
+    // Normalized --bundle roots, and per file the 1-based root whose bundles
+    // carry it, 0 for files uploaded one by one.
+    std::vector<std::string> bundle_roots;
+    std::vector<std::uint16_t> bundle;
+    // Per file, chosen by the decision stage for --compress matches.
+    std::vector<FileEncoding> encoding;
+    // Per file: the upload with the same content this file is a server-side
+    // COPY of (see FindDuplicateUploads), or PathStore::kInvalidId.
+    std::vector<FileId> copy_from;
+    // Earlier uploads reused after a local rename (see FindRenamedUploads):
+    // old paths relative to the remote root, and per file and per directory
+    // an index into them, or PathStore::kInvalidId.
+    std::vector<std::string> rename_sources;
+    std::vector<std::uint32_t> rename_from;
+    std::vector<std::uint32_t> dir_rename_from;
+};
+
+struct PlanSummary {
+    std::uint64_t uploads = 0;
+    std::uint64_t deletes = 0;
+    std::uint64_t skips = 0;
+    std::uint64_t undecided = 0;
+    std::uint64_t upload_bytes = 0;
+    std::uint64_t missing_dirs = 0;
+    // Uploads that go into bundles.
+    std::uint64_t bundled = 0;
+    // Uploads sent gzip-compressed.
+    std::uint64_t compressed = 0;
+    // Uploads made as a COPY of another upload; not in upload_bytes.
+    std::uint64_t copies = 0;
+    // Uploads reusing an earlier upload of the same file; not in upload_bytes.
+    std::uint64_t renames = 0;
+    // Missing directories recreated by one collection MOVE or COPY.
+    std::uint64_t dir_renames = 0;
+};
+
+PlanSummary SummarizePlan(const SyncPlan& plan);
+
+// Files with an upload action that are neither bundled nor copies, largest first. Workers pull from the front of
+// this list, so the longest transfers start early and the run does not end
+// on one big file started last (LPT scheduling).
+std::vector<FileId> PlanExecutionOrder(const SyncPlan& plan);
+
+// Binary format: magic and version, the roots, the directory and file
+// columns of the store, then the decision columns.
+std::string SerializePlan(const SyncPlan& plan);
+bool DeserializePlan(std::string_view data, SyncPlan* plan, std::string* error);
+
+// Written with WriteFileAtomic.
+bool WritePlanFile(const std::filesystem::path& path, const SyncPlan& plan, std::string* error);
+bool ReadPlanFile(const std::filesystem::path& path, SyncPlan* plan, std::string* error);
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+
+// Token bucket shared by every upload of a run. Callers ask for the bytes
+// they are about to send and are held back until the average rate stays at
+// or below the limit; up to a quarter second of tokens may be spent at once.
+class RateLimiter {
+public:
+    // `bytes_per_second` > 0.
+    explicit RateLimiter(std::uint64_t bytes_per_second);
+
+    RateLimiter(const RateLimiter&) = delete;
+    RateLimiter& operator=(const RateLimiter&) = delete;
+
+    // Blocks until `bytes` may be sent.
+    void Acquire(std::uint64_t bytes);
+
+    std::uint64_t BytesPerSecond() const { return bytes_per_second_; }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    std::uint64_t bytes_per_second_;
+    Clock::duration burst_;
+    std::mutex mutex_;
+    // When the bytes granted so far have been paid for.
+    Clock::time_point paid_until_;
+};
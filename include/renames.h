@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+
+#include "plan.h"
+#include "state_manifest.h"
+
+struct RenameStats {
+    std::uint64_t files = 0;
+    std::uint64_t dirs = 0;
+};
+
+// Matches the plan's single-file uploads against `uploads`, the record of
+// earlier uploads keyed by relative path. An upload whose LocalFileId, size
+// and mtime equal an entry recorded under a path that no longer exists
+// locally is that file renamed, and gets the old path in plan->rename_from.
+// A missing directory whose whole subtree renames from one old directory,
+// with the same names below it and as many files as were recorded there,
+// gets that directory in plan->dir_rename_from; only the topmost such
+// directory of a subtree is marked. Entries of other paths that no longer
+// exist locally are dropped from `uploads`.
+RenameStats FindRenamedUploads(SyncPlan* plan, StateManifest* uploads);
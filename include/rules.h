@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "app_config.h"
+#include "glob_automaton.h"
+#include "path_store.h"
+
+// At most this many rules besides the fallback, so a rule index fits a byte.
+constexpr std::size_t kMaxSyncRules = 254;
+
+// The rules used when uploader.conf has no [rule] section: every .jpg is
+// uploaded and then deleted.
+std::vector<SyncRule> DefaultSyncRules();
+// The rule of files no other rule matches: uploaded when missing or
+// different, deleted once older than 24 hours.
+SyncRule FallbackSyncRule();
+
+// SyncRules compiled for matching. "*.ext" patterns go into an extension
+// table addressed by a perfect hash, so most files are matched with one
+// probe and without building a lower-case copy of the name; other patterns
+// share one automaton for names and one for relative paths. The automata
+// cache transitions lazily, so a table must not be shared between threads.
+class RuleTable {
+public:
+    // `rules` in priority order; the fallback rule is appended.
+    explicit RuleTable(const std::vector<SyncRule>& rules);
+
+    // Index of the first rule matching `file`, the fallback when none does.
+    std::uint8_t Match(const PathStore& store, FileId file) const;
+    const SyncRule& Rule(std::uint8_t index) const { return rules_[index]; }
+    std::size_t Size() const { return rules_.size(); }
+    // Whether the remote state of a file can change the decision of rule
+    // `index`; when it cannot, the file needs no remote lookup.
+    bool NeedsRemote(std::uint8_t index) const { return !rules_[index].always_upload; }
+
+private:
+    struct Extension {
+        std::string lower;
+        std::uint8_t rule = 0;
+    };
+
+    std::uint8_t MatchExtension(std::string_view name) const;
+    std::size_t Slot(std::string_view extension) const;
+
+    std::vector<SyncRule> rules_;
+    // Open slots have an empty `lower`; size is a power of two.
+    std::vector<Extension> extensions_;
+    std::uint32_t seed_ = 0;
+    std::size_t longest_extension_ = 0;
+    GlobAutomaton name_globs_;
+    GlobAutomaton path_globs_;
+};
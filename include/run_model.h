@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "app_config.h"
+#include "plan.h"
+
+// What a run has to do, in the terms the run-time model counts.
+struct RunWorkload {
+    struct Upload {
+        std::uint64_t bytes = 0;
+        // Server-side COPYs of the same content sent after it.
+        std::uint32_t copies = 0;
+    };
+
+    std::uint64_t files = 0;
+    std::uint64_t directories = 0;
+    // Depth: 1 PROPFINDs of the decision stage.
+    std::uint64_t listings = 0;
+    // MKCOLs and collection renames, sent one by one before the uploads.
+    std::uint64_t collections = 0;
+    // Whole files and bundles; files of at least chunked_min are cut into
+    // chunks by the model.
+    std::vector<Upload> uploads;
+    // Uploads made by moving or copying an earlier one: one request each.
+    std::uint64_t renames = 0;
+};
+
+// The work of an existing plan (see --plan-out), with bundles cut at
+// `bundle_size` like the run cuts them.
+RunWorkload WorkloadFromPlan(const SyncPlan& plan, std::uint64_t bundle_size);
+
+// "SIZE:COUNT,..." with sizes in bytes or with a K, M or G suffix, e.g.
+// "4K:10000,2M:500,1G:2"; appends one upload per file.
+bool ParseSizeHistogram(const std::string& text, std::vector<RunWorkload::Upload>* uploads,
+                        std::string* error);
+
+struct NetworkModel {
+    // From the last byte of a request to the first byte of its answer.
+    double rtt_ms = 30.0;
+    // Round trips to open a connection (TCP plus TLS).
+    double connect_round_trips = 2.0;
+    // Upstream bandwidth of the link and the most one connection gets, in
+    // bytes per second; 0 for no limit.
+    double link_bandwidth = 0.0;
+    double connection_bandwidth = 0.0;
+    // Requests the server works on at once; the rest wait for a slot. 0
+    // for no limit.
+    int server_concurrency = 0;
+    // Share of requests answered with a retryable error.
+    double error_rate = 0.0;
+    double scan_files_per_second = 50000.0;
+};
+
+struct RunPrediction {
+    // Seconds per stage. The warm-up overlaps the scan and only counts for
+    // what it takes longer.
+    double scan = 0.0;
+    double warmup = 0.0;
+    double decide = 0.0;
+    double prepare = 0.0;
+    double execute = 0.0;
+    double total = 0.0;
+
+    int upload_workers = 0;
+    std::uint64_t connections = 0;
+    std::uint64_t propfinds = 0;
+    std::uint64_t mkcols = 0;
+    std::uint64_t puts = 0;
+    // COPYs and MOVEs.
+    std::uint64_t transfers = 0;
+    std::uint64_t retries = 0;
+    // Requests that failed all their attempts.
+    std::uint64_t failures = 0;
+    std::uint64_t upload_bytes = 0;
+
+    // Of the execution stage: share of the time the link (or the rate
+    // limit) was saturated, and mean busy share of the server's slots.
+    double link_busy = 0.0;
+    double server_busy = 0.0;
+    // The single longest upload on its own, as a lower bound of the stage.
+    double longest_item = 0.0;
+    // What limits the run, e.g. "bandwidth" (see SimulateRun).
+    std::string bottleneck;
+};
+
+// Replays the stages of a sync against the network model: the scan, the
+// decision stage's listings on probe_threads workers, the collections on
+// one connection, then the uploads largest first on `threads` workers.
+// Requests of the execution stage share the bandwidth equally, wait for a
+// server slot, and fail at error_rate with the client's three attempts and
+// back-off; the outcome of each attempt is seeded, so a prediction is
+// repeatable.
+RunPrediction SimulateRun(const RunWorkload& workload, const NetworkModel& network,
+                          const AppConfig& config);
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+#include "exclude.h"
+#include "ignore_file.h"
+#include "logger.h"
+#include "path_store.h"
+
+struct ScanStats {
+    std::uint64_t directories = 0;
+    std::uint64_t files = 0;
+    std::uint64_t excluded = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t ignore_files = 0;
+    // The walk ended early because `stop` was set.
+    bool stopped = false;
+};
+
+// Walks `root` depth-first and records every non-excluded directory and
+// regular file in `store`. Relative paths are extended from the parent as the
+// walk descends, entry types come from the directory listing (d_type, or the
+// attributes in the Win32 find data), and size/mtime are captured with a
+// single metadata call per file (statx on Linux, none on Windows where the
+// listing already carries them). Each entry is checked against `excludes`
+// by its own name plus the matcher state of its parent; excluded directories
+// are never opened. When `ignore_file` is set, a file of that name in any
+// scanned directory adds its rules (see IgnoreRuleSet) for the subtree; it is
+// looked up once when the directory is opened and entries it ignores count
+// as excluded. Once `stop` is set the walk ends at the next entry, leaving
+// `store` partial.
+ScanStats ScanSource(const std::filesystem::path& root,
+                     const ExcludeMatcher& excludes,
+                     Logger& logger,
+                     PathStore* store,
+                     const std::string& ignore_file = std::string(),
+                     const std::atomic<bool>* stop = nullptr);
+
+// Size and mtime of one regular file, read the same way the scan reads them so
+// the values compare equal to PathStore columns when the file is unchanged.
+bool StatLocalFile(const std::filesystem::path& path, std::uint64_t* size, std::int64_t* mtime_ns);
+
+// Volume and file index (st_dev/st_ino); hard links of one file share it.
+struct LocalFileId {
+    std::uint64_t device = 0;
+    std::uint64_t index = 0;
+};
+
+bool LocalFileIdentity(const std::filesystem::path& path, LocalFileId* id);
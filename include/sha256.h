@@ -0,0 +1,29 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+using Sha256Digest = std::array<std::uint8_t, 32>;
+
+class Sha256 {
+public:
+    Sha256();
+
+    void Update(const void* data, std::size_t size);
+    Sha256Digest Finish();
+
+private:
+    void Compress(const std::uint8_t* block);
+
+    std::array<std::uint32_t, 8> state_;
+    std::uint8_t buffer_[64];
+    std::size_t buffered_ = 0;
+    std::uint64_t total_ = 0;
+};
+
+std::string Sha256Hex(const Sha256Digest& digest);
+
+// Hashes a whole local file.
+bool Sha256File(const std::filesystem::path& path, Sha256Digest* digest, std::string* error);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "path_store.h"
+
+// One of `count` shards; `index` is 0-based.
+struct ShardSpec {
+    std::uint32_t index = 0;
+    std::uint32_t count = 1;
+    // Directories below this depth belong to the shard of their ancestor at
+    // this depth.
+    std::uint32_t depth = 1;
+};
+
+// Parses "i/N" with 1 <= i <= N, as given to --shard.
+bool ParseShardSpec(const std::string& text, ShardSpec* spec);
+
+// Balance of a split, counted over the whole tree.
+struct ShardStats {
+    // Per shard.
+    std::vector<std::uint64_t> files;
+    std::vector<std::uint64_t> bytes;
+    std::vector<std::uint64_t> prefixes;
+    // The prefix holding the most bytes, which bounds how even the split
+    // can be.
+    std::string largest_prefix;
+    std::uint64_t largest_prefix_bytes = 0;
+};
+
+// Shard of every directory. A directory's prefix is its ancestor at
+// spec.depth, or the directory itself when it is not that deep; the shard
+// is a hash of the prefix's relative path, so every process that scans the
+// same tree agrees on it without coordination.
+std::vector<std::uint32_t> AssignShards(const PathStore& store, const ShardSpec& spec);
+
+// Replaces *store with the part owned by spec.index: the files of owned
+// directories, owned directories even if empty, and the ancestors they
+// need. `shared` gets a flag per directory of the new store that is kept
+// only as such an ancestor; its listing and files belong to another shard.
+ShardStats SelectShard(PathStore* store, const ShardSpec& spec, std::vector<std::uint8_t>* shared);
+
+// Largest value over the mean, 1.0 for a perfect split.
+double MaxOverMean(const std::vector<std::uint64_t>& values);
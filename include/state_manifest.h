@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+
+#include "sha256.h"
+
+// Local record, kept between runs, of files whose remote form cannot be
+// compared with the local file directly (bundled or compressed), or whose
+// upload may be reused after a rename or extended by an append, keyed by a
+// '/'-separated name.
+class StateManifest {
+public:
+    struct Entry {
+        // Local size and mtime when the file was uploaded.
+        std::uint64_t size = 0;
+        std::int64_t mtime_ns = 0;
+        // Bytes stored remotely, e.g. the compressed size.
+        std::uint64_t stored_size = 0;
+        // LocalFileId of the uploaded file, 0 when not recorded.
+        std::uint64_t device = 0;
+        std::uint64_t file_index = 0;
+        // SHA-256 of the uploaded content, all zero when not recorded.
+        Sha256Digest digest{};
+    };
+
+    // A missing file loads as an empty manifest.
+    bool Load(const std::filesystem::path& path, std::string* error);
+    // Written with WriteFileAtomic.
+    bool Save(const std::filesystem::path& path, std::string* error) const;
+
+    const Entry* Find(const std::string& name) const;
+    void Set(const std::string& name, const Entry& entry) { entries_[name] = entry; }
+    void Erase(const std::string& name) { entries_.erase(name); }
+    std::size_t Size() const { return entries_.size(); }
+    const std::unordered_map<std::string, Entry>& Entries() const { return entries_; }
+
+private:
+    std::unordered_map<std::string, Entry> entries_;
+};
+
+// "<state_dir>/<kind>-<hash of key>.manifest".
+std::filesystem::path StateManifestPath(const std::filesystem::path& state_dir,
+                                        const std::string& kind, const std::string& key);
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logger.h"
+
+// What a worker is doing right now.
+enum class WorkerState : std::uint8_t {
+    Idle,
+    // Sending a request body.
+    Sending,
+    // Waiting for the response to a request.
+    Waiting,
+    // Sleeping before the retry of a failed request.
+    RetryWait,
+    // Out of work.
+    Done,
+};
+
+const char* WorkerStateName(WorkerState state);
+
+// Live state of one worker. Only the worker and the client it drives store
+// to it; readers load each field on its own, so a snapshot may mix two
+// consecutive states of a worker but never blocks it.
+struct alignas(64) WorkerStatus {
+    void SetState(WorkerState state);
+
+    std::atomic<std::uint8_t> state{static_cast<std::uint8_t>(WorkerState::Idle)};
+    // Steady clock milliseconds of the last state change.
+    std::atomic<std::int64_t> since_ms{0};
+    // Current work item as (job << 32 | item) + 1; 0 when there is none.
+    std::atomic<std::uint64_t> item{0};
+    std::atomic<std::uint64_t> item_bytes{0};
+    // Body bytes of the current item sent by the current attempt.
+    std::atomic<std::uint64_t> sent{0};
+    std::atomic<std::uint64_t> retries{0};
+};
+
+struct StatusSnapshot {
+    struct Worker {
+        WorkerState state = WorkerState::Idle;
+        double state_seconds = 0.0;
+        std::uint64_t item = 0;
+        std::uint64_t item_bytes = 0;
+        std::uint64_t sent = 0;
+        std::uint64_t retries = 0;
+    };
+
+    double elapsed_seconds = 0.0;
+    std::uint64_t files_total = 0;
+    std::uint64_t files_done = 0;
+    std::uint64_t bytes_total = 0;
+    // Finished items plus what the current attempts have sent so far.
+    std::uint64_t bytes_done = 0;
+    std::uint64_t errors = 0;
+    std::uint64_t retries = 0;
+    std::vector<Worker> workers;
+};
+
+// Progress of the execution stage: totals known from the plan, counters
+// bumped as items finish, and one WorkerStatus per worker, all atomics.
+class StatusBoard {
+public:
+    // `errors` already counted by the stages before execution.
+    explicit StatusBoard(std::uint64_t errors = 0);
+
+    StatusBoard(const StatusBoard&) = delete;
+    StatusBoard& operator=(const StatusBoard&) = delete;
+
+    // Before any worker starts or Read is called.
+    void AddPlanned(std::uint64_t files, std::uint64_t bytes);
+    void SetWorkers(std::size_t count);
+    std::size_t WorkerCount() const { return worker_count_; }
+    WorkerStatus& Worker(std::size_t index) { return workers_[index]; }
+
+    // A worker takes item `key` (see WorkerStatus::item) of `bytes` bytes,
+    // and later finishes it having covered `files` planned files.
+    void Begin(WorkerStatus& worker, std::uint64_t key, std::uint64_t bytes);
+    void Finish(WorkerStatus& worker, std::uint64_t files);
+    void AddErrors(std::uint64_t count) { errors_.fetch_add(count, std::memory_order_relaxed); }
+
+    StatusSnapshot Read() const;
+
+private:
+    std::chrono::steady_clock::time_point start_;
+    std::uint64_t files_total_ = 0;
+    std::uint64_t bytes_total_ = 0;
+    std::atomic<std::uint64_t> files_done_{0};
+    std::atomic<std::uint64_t> bytes_done_{0};
+    std::atomic<std::uint64_t> errors_{0};
+    std::unique_ptr<WorkerStatus[]> workers_;
+    std::size_t worker_count_ = 0;
+};
+
+// "[ 42%] 120/300 files, 1.2/3.0 GB, 11.5 MB/s, ETA 0:02:41, 8 sending,
+// 1 retry-wait, 0 errors"; `rate` in bytes per second, 0 when unknown.
+std::string FormatStatusLine(const StatusSnapshot& status, double rate);
+// The snapshot as a JSON object; `names` has the current item of each
+// worker, empty for none.
+std::string FormatStatusJson(const StatusSnapshot& status, double rate,
+                             const std::vector<std::string>& names, bool finished);
+
+// Throughput over the last few seconds of (elapsed seconds, bytes done)
+// samples. Bytes done drop when a retry sends its body again from the
+// start; the rate is then 0 until the window has moved past the drop.
+class RateWindow {
+public:
+    // Adds a sample and returns the rate in bytes per second, 0 while
+    // unknown.
+    double Add(double seconds, std::uint64_t bytes);
+
+private:
+    std::vector<std::pair<double, std::uint64_t>> samples_;
+};
+
+struct StatusOptions {
+    // Keep a status line at the bottom of the console.
+    bool console = false;
+    // Rewrite this JSON file with the full status; empty for none.
+    std::filesystem::path file;
+    std::chrono::milliseconds interval{1000};
+};
+
+// Reads a StatusBoard every interval on a thread of its own and shows it.
+// Throughput is averaged over the last few seconds.
+class StatusReporter {
+public:
+    // `describe` names the item of a WorkerStatus::item key.
+    StatusReporter(const StatusBoard& board, const StatusOptions& options,
+                   std::function<std::string(std::uint64_t)> describe, Logger& logger);
+    // Stops if Stop was not called.
+    ~StatusReporter();
+
+    StatusReporter(const StatusReporter&) = delete;
+    StatusReporter& operator=(const StatusReporter&) = delete;
+
+    // Writes the final status, marked finished, and clears the status line.
+    void Stop();
+
+private:
+    void Loop();
+    void Report(bool finished);
+
+    const StatusBoard& board_;
+    StatusOptions options_;
+    std::function<std::string(std::uint64_t)> describe_;
+    Logger& logger_;
+    RateWindow rate_;
+    bool file_failed_ = false;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stop_ = false;
+    std::thread thread_;
+};
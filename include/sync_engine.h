@@ -1,10 +1,11 @@
 #pragma once
 
 #include <cstdint>
-#include <string>
+#include <filesystem>
 #include <vector>
 
 #include "app_config.h"
+#include "local_deleter.h"
 #include "logger.h"
 
 struct SyncStats {
@@ -14,7 +15,40 @@ struct SyncStats {
     std::uint64_t files_deleted_old = 0;
     std::uint64_t files_skipped = 0;
     std::uint64_t errors = 0;
-    std::vector<std::string> deleted_files;
+    // Included in files_uploaded.
+    std::uint64_t files_bundled = 0;
+    std::uint64_t bundles_uploaded = 0;
+    // Included in files_uploaded; bytes before and after compression.
+    std::uint64_t files_compressed = 0;
+    std::uint64_t compressed_input_bytes = 0;
+    std::uint64_t compressed_output_bytes = 0;
+    // Included in files_uploaded; made with a server-side COPY.
+    std::uint64_t files_copied = 0;
+    std::uint64_t copied_bytes = 0;
+    // Included in files_uploaded; an earlier upload moved or copied into place.
+    std::uint64_t files_renamed = 0;
+    std::uint64_t renamed_bytes = 0;
+    std::uint64_t dirs_renamed = 0;
+    // Included in files_uploaded; only the bytes added since the last upload
+    // were sent.
+    std::uint64_t files_appended = 0;
+    std::uint64_t appended_bytes = 0;
+    std::uint64_t append_saved_bytes = 0;
+    // Wall time of the execution stage, which all jobs share.
+    double execute_seconds = 0.0;
+    // Local space freed by deletions over the execution stage.
+    std::vector<ReclaimSample> reclaimed;
+    // File listing every deleted local path; empty when nothing was deleted.
+    std::filesystem::path deleted_list;
 };
 
-SyncStats RunSync(const AppConfig& config, Logger& logger);
+// Scans the source, decides every file against one remote listing per
+// directory, then executes the resulting plan largest file first. With
+// config.plan_out the plan is written instead of executed; with
+// config.apply_plan a written plan replaces the scan and decision stages.
+// With config.jobs every job is scanned and decided in turn, then all plans
+// execute on one set of workers, connections and bandwidth, shared between
+// the jobs by weight. Uploads that delete their local file move ahead while
+// a source volume is below config.low_space_percent free space. Returns the
+// stats of each job, or of the single mapping.
+std::vector<SyncStats> RunSync(const AppConfig& config, Logger& logger);
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Byte kernels for path strings. On x86 they process 32 bytes at a time with
+// AVX2 when the CPU has it and 16 with SSE2 otherwise; other targets use the
+// scalar loops. All of them treat bytes >= 0x80 (UTF-8 sequences) as opaque.
+
+// Lower-cases 'A'..'Z' in place.
+void LowerAsciiInPlace(char* data, std::size_t size);
+
+// Length of the leading run that needs no percent-encoding in a URL path:
+// RFC 3986 unreserved characters and '/'.
+std::size_t UrlSafePrefixLength(const char* data, std::size_t size);
+
+// Appends `text` to `out` with every byte outside the URL-safe set written as
+// %XX (upper-case hex); '/' is kept.
+void AppendUrlEncoded(std::string* out, std::string_view text);
+
+// "avx2", "sse2" or "scalar", for benchmark and log output.
+const char* ActiveTextKernel();
@@ -1,10 +1,21 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <functional>
+#include <algorithm>
+#include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "decision.h"
+#include "path_utils.h"
+#include "rate_limiter.h"
+
+struct WorkerStatus;
+enum class WorkerState : std::uint8_t;
 
 struct WebDavResponse {
     long status = 0;
@@ -23,43 +34,216 @@ struct WebDavCredentials {
     std::string password;
 };
 
+struct RemoteDirectoryEntry {
+    // Decoded leaf name as listed by the server.
+    std::string name;
+    RemoteItemInfo info;
+};
+
+// Request body produced while it is sent, so an upload never has to be
+// assembled in memory first.
+class UploadBody {
+public:
+    virtual ~UploadBody() = default;
+    // Exact number of bytes Read will produce.
+    virtual std::uint64_t Size() const = 0;
+    // Starts again from the first byte, for retries.
+    virtual bool Rewind(std::string* error) = 0;
+    // Copies the next bytes into `buffer`; *read is 0 at the end.
+    virtual bool Read(char* buffer, std::size_t capacity, std::size_t* read, std::string* error) = 0;
+};
+
+class MemoryBody : public UploadBody {
+public:
+    explicit MemoryBody(std::string data) : data_(std::move(data)) {}
+
+    std::uint64_t Size() const override { return data_.size(); }
+    bool Rewind(std::string*) override {
+        pos_ = 0;
+        return true;
+    }
+    bool Read(char* buffer, std::size_t capacity, std::size_t* read, std::string*) override {
+        *read = (std::min)(capacity, data_.size() - pos_);
+        data_.copy(buffer, *read, pos_);
+        pos_ += *read;
+        return true;
+    }
+
+private:
+    std::string data_;
+    std::size_t pos_ = 0;
+};
+
+// Microseconds spent in the phases of one request.
+struct HttpTimings {
+    // Until the request headers were sent, a new connection included.
+    std::uint32_t connect_us = 0;
+    // Sending the body and reading the response body.
+    std::uint32_t transfer_us = 0;
+    // From the end of the body to the response headers.
+    std::uint32_t ttfb_us = 0;
+};
+
+struct HttpRequest {
+    const char* method = "";
+    // Encoded, with the base path.
+    std::string path;
+    // Each ending in CRLF, authorization included.
+    std::string headers;
+    // Null for a request without a body.
+    UploadBody* body = nullptr;
+};
+
+// Carries one attempt of a request. WebDavClient keeps the retries and the
+// WebDAV semantics, so a transport can be swapped for a recording or a
+// replay of one (see http_trace.h).
+class WebDavTransport {
+public:
+    virtual ~WebDavTransport() = default;
+
+    virtual bool IsReady() const = 0;
+    // Status 0 with *error set when no response arrived. The body goes out
+    // no faster than `limiter` allows and reports its progress to `status`;
+    // either may be null, as may `timings`.
+    virtual WebDavResponse Send(const HttpRequest& request, RateLimiter* limiter,
+                                WorkerStatus* status, HttpTimings* timings,
+                                std::string* error) = 0;
+};
+
+// One WinHTTP session with its connection to `base_url`.
+std::unique_ptr<WebDavTransport> MakeWinHttpTransport(const BaseUrlParts& base_url);
+
 class WebDavClient {
 public:
+    // Sends over WinHTTP.
     WebDavClient(const BaseUrlParts& base_url, const WebDavCredentials& creds);
-    ~WebDavClient();
+    WebDavClient(const BaseUrlParts& base_url, const WebDavCredentials& creds,
+                 std::unique_ptr<WebDavTransport> transport);
+
+    bool IsReady() const { return transport_->IsReady(); }
+
+    // Request bodies are sent no faster than `limiter` allows; nullptr
+    // removes the limit.
+    void SetRateLimiter(RateLimiter* limiter) { limiter_ = limiter; }
 
-    bool IsReady() const;
+    // Requests report their state, retries and bytes sent to `status`;
+    // nullptr stops the reporting.
+    void SetStatus(WorkerStatus* status) { status_ = status; }
 
+    // Each request has an overload taking a RemotePath whose encoded form is
+    // used as is, so callers that cache encoded prefixes skip re-encoding.
     WebDavResponse PropFind(const std::string& remote_path, std::string* error);
+    WebDavResponse PropFind(const RemotePath& remote_path, std::string* error);
     bool MkCol(const std::string& remote_path, bool* created, std::string* error);
+    bool MkCol(const RemotePath& remote_path, bool* created, std::string* error);
     bool PutFile(const std::string& remote_path,
                  const std::filesystem::path& local_path,
                  std::string* error);
+    bool PutFile(const RemotePath& remote_path,
+                 const std::filesystem::path& local_path,
+                 std::string* error);
+
+    // PUT of a streamed body, e.g. a bundle assembled from many files.
+    bool PutBody(const RemotePath& remote_path, UploadBody* body, std::string* error);
+    // PUT with "Content-Range: bytes offset-(offset+size-1)/total", writing
+    // `body` into an existing object at `offset`. Only some servers support
+    // it; others refuse it or replace the object with the body.
+    bool PutRange(const RemotePath& remote_path, UploadBody* body, std::uint64_t offset,
+                  std::uint64_t total, std::string* error);
+
+    // Server-side COPY or MOVE of a file or a whole collection. With
+    // `overwrite` an existing `to` is replaced, otherwise the request fails.
+    bool Copy(const RemotePath& from, const RemotePath& to, bool overwrite, std::string* error);
+    bool Move(const RemotePath& from, const RemotePath& to, bool overwrite, std::string* error);
 
     RemoteItemInfo GetInfo(const std::string& remote_path, std::string* error);
+    RemoteItemInfo GetInfo(const RemotePath& remote_path, std::string* error);
+
+    // PROPFIND with Depth: 1. `exists` is false when the collection is
+    // missing, which is not an error; the collection itself is not listed.
+    bool ListDirectory(const RemotePath& remote_path,
+                       bool* exists,
+                       std::vector<RemoteDirectoryEntry>* entries,
+                       std::string* error);
 
     static std::optional<BaseUrlParts> ParseBaseUrl(const std::string& url, std::string* error);
 
 private:
-    WebDavResponse SendRequest(const std::wstring& method,
-                               const std::wstring& request_path,
+    WebDavResponse SendPropFind(const RemotePath& remote_path,
+                                const char* depth,
+                                std::string* error);
+    WebDavResponse SendRequest(const char* method,
+                               const std::string& request_path,
                                const std::string& body,
                                const std::string& extra_headers,
                                std::string* error);
 
-    bool SendFile(const std::wstring& method,
-                  const std::wstring& request_path,
-                  const std::filesystem::path& local_path,
+    bool SendBody(const char* method,
+                  const std::string& request_path,
+                  UploadBody* body,
                   const std::string& extra_headers,
                   std::string* error);
 
-    std::wstring BuildRequestPath(const std::string& remote_path) const;
+    bool Transfer(const char* method, const RemotePath& from, const RemotePath& to,
+                  bool overwrite, std::string* error);
+
+    std::string BuildRequestPath(const RemotePath& remote_path) const;
+    // Absolute URL, as the Destination header requires.
+    std::string BuildUrl(const RemotePath& remote_path) const;
     std::string BuildAuthHeader() const;
 
-    void CloseHandles();
+    void SetState(WorkerState state);
+    // Sleeps before retry `attempt`.
+    void BackOff(int attempt);
+
+    BaseUrlParts base_url_;
+    WebDavCredentials creds_;
+    std::unique_ptr<WebDavTransport> transport_;
+    RateLimiter* limiter_ = nullptr;
+    WorkerStatus* status_ = nullptr;
+};
+
+class WebDavClientPool;
+
+struct WebDavClientReturn {
+    WebDavClientPool* pool = nullptr;
+    void operator()(WebDavClient* client) const;
+};
+
+// A client borrowed from a WebDavClientPool; it goes back when released.
+using PooledClient = std::unique_ptr<WebDavClient, WebDavClientReturn>;
+
+// Idle clients kept for reuse, so their sessions (and with them the open
+// connections and TLS sessions WinHTTP keeps per session) carry over from
+// one stage or job to the next instead of being set up again.
+class WebDavClientPool {
+public:
+    // Makes the transport of each new client; empty for WinHTTP.
+    using TransportFactory = std::function<std::unique_ptr<WebDavTransport>()>;
+
+    // Every client sends through `limiter` when it is not null.
+    WebDavClientPool(const BaseUrlParts& base_url, const WebDavCredentials& creds,
+                     RateLimiter* limiter, TransportFactory transports = nullptr);
+
+    WebDavClientPool(const WebDavClientPool&) = delete;
+    WebDavClientPool& operator=(const WebDavClientPool&) = delete;
+
+    // An idle client, or a new one; empty if a new client failed to
+    // initialize.
+    PooledClient Acquire();
+
+    // Number of clients created so far.
+    std::size_t Created();
+
+private:
+    friend struct WebDavClientReturn;
+    void Release(WebDavClient* client);
 
     BaseUrlParts base_url_;
     WebDavCredentials creds_;
-    void* session_ = nullptr;
-    void* connection_ = nullptr;
+    RateLimiter* limiter_;
+    TransportFactory transports_;
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<WebDavClient>> idle_;
+    std::size_t created_ = 0;
 };
@@ -0,0 +1,304 @@
+#include "bundle.h"
+
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+
+#include "scanner.h"
+
+namespace {
+
+constexpr std::size_t kTarBlock = 512;
+constexpr std::size_t kTarNameField = 100;
+// Two zero blocks end the archive.
+constexpr std::uint64_t kTarTrailer = 2 * kTarBlock;
+
+// Octal, zero-padded, NUL-terminated; values that do not fit use the GNU
+// base-256 form (high bit of the first byte set, big-endian value).
+void PutTarNumber(char* field, std::size_t width, std::uint64_t value) {
+    std::uint64_t limit = 1ULL << (3 * (width - 1));
+    if (value < limit) {
+        field[width - 1] = '\0';
+        for (std::size_t i = width - 1; i-- > 0;) {
+            field[i] = static_cast<char>('0' + (value & 7));
+            value >>= 3;
+        }
+        return;
+    }
+    std::memset(field, 0, width);
+    for (std::size_t i = width; i-- > 1;) {
+        field[i] = static_cast<char>(value & 0xFF);
+        value >>= 8;
+    }
+    field[0] = static_cast<char>(0x80);
+}
+
+void PutTarText(char* field, std::size_t width, std::string_view text) {
+    std::memcpy(field, text.data(), std::min(width, text.size()));
+}
+
+std::string TarBlock(std::string_view name, char type, std::uint64_t size,
+                     std::int64_t mtime_ns) {
+    std::string block(kTarBlock, '\0');
+    char* h = &block[0];
+    PutTarText(h, kTarNameField, name);
+    PutTarNumber(h + 100, 8, 0644);
+    PutTarNumber(h + 108, 8, 0);
+    PutTarNumber(h + 116, 8, 0);
+    PutTarNumber(h + 124, 12, size);
+    PutTarNumber(h + 136, 12, mtime_ns > 0 ? static_cast<std::uint64_t>(mtime_ns / 1000000000) : 0);
+    h[156] = type;
+    PutTarText(h + 257, 6, std::string_view("ustar\0", 6));
+    PutTarText(h + 263, 2, "00");
+
+    // The checksum is computed with its own field set to spaces.
+    std::memset(h + 148, ' ', 8);
+    unsigned checksum = 0;
+    for (char c : block) {
+        checksum += static_cast<unsigned char>(c);
+    }
+    PutTarNumber(h + 148, 7, checksum);
+    h[155] = ' ';
+    return block;
+}
+
+// One "<length> path=<name>\n" record, where length counts itself.
+std::string PaxPathRecord(std::string_view name) {
+    std::size_t body = std::strlen(" path=") + name.size() + 1;
+    std::size_t length = body + 1;
+    while (std::to_string(length).size() + body != length) {
+        length = std::to_string(length).size() + body;
+    }
+    std::string record = std::to_string(length);
+    record += " path=";
+    record.append(name.data(), name.size());
+    record.push_back('\n');
+    return record;
+}
+
+bool SameAsScanned(const std::filesystem::path& path, std::uint64_t size, std::int64_t mtime_ns) {
+    std::uint64_t current_size = 0;
+    std::int64_t current_mtime = 0;
+    return StatLocalFile(path, &current_size, &current_mtime) && current_size == size &&
+           current_mtime == mtime_ns;
+}
+
+}  // namespace
+
+std::string NormalizeBundleRoot(const std::string& root) {
+    std::string out;
+    std::size_t pos = 0;
+    std::string normalized = root;
+    std::replace(normalized.begin(), normalized.end(), '\\', '/');
+    while (pos <= normalized.size()) {
+        std::size_t next = normalized.find('/', pos);
+        if (next == std::string::npos) {
+            next = normalized.size();
+        }
+        std::string_view part(normalized.data() + pos, next - pos);
+        if (!part.empty() && part != ".") {
+            if (!out.empty()) {
+                out.push_back('/');
+            }
+            out.append(part.data(), part.size());
+        }
+        pos = next + 1;
+    }
+    return out;
+}
+
+BundleGroups AssignBundleGroups(const PathStore& store, const std::vector<std::string>& roots) {
+    BundleGroups groups;
+    groups.dir_group.assign(store.DirectoryCount(), 0);
+    groups.root_dir.assign(roots.size(), PathStore::kInvalidId);
+    if (roots.empty()) {
+        return groups;
+    }
+    std::unordered_map<std::string, std::uint16_t> by_path;
+    for (std::size_t i = 0; i < roots.size(); ++i) {
+        by_path.emplace(roots[i], static_cast<std::uint16_t>(i + 1));
+    }
+    // Parents precede children, so a directory inherits the group of its
+    // parent; a root nested in another root is part of the outer one.
+    for (DirId dir = 0; dir < store.DirectoryCount(); ++dir) {
+        if (dir != PathStore::kRootDir && groups.dir_group[store.DirectoryParent(dir)] != 0) {
+            groups.dir_group[dir] = groups.dir_group[store.DirectoryParent(dir)];
+            continue;
+        }
+        auto found = by_path.find(store.DirectoryRelativeUtf8(dir));
+        if (found != by_path.end()) {
+            groups.dir_group[dir] = found->second;
+            groups.root_dir[found->second - 1] = dir;
+        }
+    }
+    return groups;
+}
+
+std::string BundleMemberName(const PathStore& store, FileId file, const std::string& root) {
+    std::string relative = store.FileRelativeUtf8(file);
+    if (root.empty()) {
+        return relative;
+    }
+    return relative.substr(root.size() + 1);
+}
+
+std::string TarHeader(std::string_view name, std::uint64_t size, std::int64_t mtime_ns) {
+    std::string out;
+    if (name.size() > kTarNameField) {
+        std::string record = PaxPathRecord(name);
+        out = TarBlock("././@PaxHeader", 'x', record.size(), mtime_ns);
+        out += record;
+        out.resize(out.size() + TarPaddedSize(record.size()) - record.size(), '\0');
+    }
+    out += TarBlock(name.substr(0, kTarNameField), '0', size, mtime_ns);
+    return out;
+}
+
+TarBundleBody::TarBundleBody(const PathStore& store, const std::filesystem::path& source,
+                             const std::vector<FileId>& files, const std::string& root)
+    : store_(store), source_(source) {
+    members_.reserve(files.size());
+    for (FileId file : files) {
+        Member member;
+        member.file = file;
+        member.name = BundleMemberName(store, file, root);
+        member.size = store.FileSize(file);
+        member.mtime_ns = store.FileMtimeNs(file);
+        member.header = TarHeader(member.name, member.size, member.mtime_ns);
+        member.data_offset = size_ + member.header.size();
+        size_ = member.data_offset + TarPaddedSize(member.size);
+        members_.push_back(std::move(member));
+    }
+    size_ += kTarTrailer;
+}
+
+TarBundleBody::~TarBundleBody() {
+    CloseMember(false);
+}
+
+bool TarBundleBody::Rewind(std::string* error) {
+    (void)error;
+    CloseMember(false);
+    for (Member& member : members_) {
+        member.intact = true;
+    }
+    current_ = 0;
+    phase_ = members_.empty() ? Phase::Trailer : Phase::Header;
+    phase_pos_ = 0;
+    return true;
+}
+
+void TarBundleBody::OpenMember() {
+    Member& member = members_[current_];
+    std::filesystem::path path = store_.FileAbsolutePath(source_, member.file);
+    if (!SameAsScanned(path, member.size, member.mtime_ns)) {
+        member.intact = false;
+        return;
+    }
+#ifdef _WIN32
+    file_ = _wfopen(path.c_str(), L"rb");
+#else
+    file_ = std::fopen(path.c_str(), "rb");
+#endif
+    if (!file_) {
+        member.intact = false;
+    }
+}
+
+void TarBundleBody::CloseMember(bool check) {
+    if (!file_) {
+        return;
+    }
+    Member& member = members_[current_];
+    // A file that grew past its scanned size, or was rewritten while it was
+    // read, does not match the bytes just sent.
+    if (check && (std::fgetc(file_) != EOF ||
+                  !SameAsScanned(store_.FileAbsolutePath(source_, member.file), member.size,
+                                 member.mtime_ns))) {
+        member.intact = false;
+    }
+    std::fclose(file_);
+    file_ = nullptr;
+}
+
+bool TarBundleBody::Read(char* buffer, std::size_t capacity, std::size_t* read,
+                         std::string* error) {
+    (void)error;
+    if (members_.empty() && phase_ == Phase::Header) {
+        phase_ = Phase::Trailer;
+    }
+    std::size_t out = 0;
+    while (out < capacity && phase_ != Phase::Done) {
+        std::size_t room = capacity - out;
+        if (phase_ == Phase::Trailer) {
+            std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(room, kTarTrailer - phase_pos_));
+            std::memset(buffer + out, 0, n);
+            out += n;
+            phase_pos_ += n;
+            if (phase_pos_ == kTarTrailer) {
+                phase_ = Phase::Done;
+            }
+            continue;
+        }
+
+        Member& member = members_[current_];
+        if (phase_ == Phase::Header) {
+            std::size_t n = static_cast<std::size_t>(
+                std::min<std::uint64_t>(room, member.header.size() - phase_pos_));
+            std::memcpy(buffer + out, member.header.data() + phase_pos_, n);
+            out += n;
+            phase_pos_ += n;
+            if (phase_pos_ == member.header.size()) {
+                phase_ = Phase::Data;
+                phase_pos_ = 0;
+                OpenMember();
+            }
+        } else if (phase_ == Phase::Data) {
+            std::size_t n =
+                static_cast<std::size_t>(std::min<std::uint64_t>(room, member.size - phase_pos_));
+            std::size_t got = file_ ? std::fread(buffer + out, 1, n, file_) : 0;
+            if (got < n) {
+                std::memset(buffer + out + got, 0, n - got);
+                member.intact = false;
+            }
+            out += n;
+            phase_pos_ += n;
+            if (phase_pos_ == member.size) {
+                CloseMember(member.intact);
+                phase_ = Phase::Padding;
+                phase_pos_ = 0;
+            }
+        } else {
+            std::uint64_t padding = TarPaddedSize(member.size) - member.size;
+            std::size_t n = static_cast<std::size_t>(std::min<std::uint64_t>(room, padding - phase_pos_));
+            std::memset(buffer + out, 0, n);
+            out += n;
+            phase_pos_ += n;
+            if (phase_pos_ == padding) {
+                current_++;
+                phase_ = current_ < members_.size() ? Phase::Header : Phase::Trailer;
+                phase_pos_ = 0;
+            }
+        }
+    }
+    *read = out;
+    return true;
+}
+
+std::string TarBundleBody::BuildIndex() const {
+    std::string index;
+    for (const Member& member : members_) {
+        if (!member.intact) {
+            continue;
+        }
+        index += std::to_string(member.data_offset);
+        index.push_back('\t');
+        index += std::to_string(member.size);
+        index.push_back('\t');
+        index += std::to_string(member.mtime_ns);
+        index.push_back('\t');
+        index += member.name;
+        index.push_back('\n');
+    }
+    return index;
+}
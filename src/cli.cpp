@@ -8,7 +8,10 @@
 #include <vector>
 
 #include "config_defaults.h"
+#include "file_reader.h"
 #include "path_utils.h"
+#include "rules.h"
+#include "shard.h"
 
 namespace {
 
@@ -94,6 +97,14 @@ void StripBom(std::string* value) {
     }
 }
 
+// A [job <name>] section; unset compare modes follow the global one.
+struct JobSection {
+    SyncJob job;
+    bool has_source = false;
+    bool has_remote = false;
+    bool has_compare = false;
+};
+
 struct ConfigFileData {
     std::filesystem::path source;
     bool has_source = false;
@@ -103,15 +114,99 @@ struct ConfigFileData {
     bool has_base_url = false;
     int threads = 1;
     bool has_threads = false;
+    int probe_threads = 8;
+    bool has_probe_threads = false;
     CompareMode compare_mode = CompareMode::SizeMtime;
     bool has_compare = false;
     bool dry_run = false;
     bool has_dry_run = false;
     std::vector<std::string> excludes;
+    std::string ignore_file;
+    bool has_ignore_file = false;
+    bool async_log = false;
+    bool has_async_log = false;
+    LogLevel log_level = LogLevel::Info;
+    bool has_log_level = false;
+    int log_skip_rate = 0;
+    bool has_log_skip_rate = false;
+    std::vector<std::string> bundle_dirs;
+    std::uint64_t bundle_size = 0;
+    bool has_bundle_size = false;
+    std::uint64_t bundle_max_file = 0;
+    bool has_bundle_max_file = false;
+    std::vector<std::string> compress_patterns;
+    std::vector<std::string> append_patterns;
+    bool dedup = false;
+    bool has_dedup = false;
+    bool detect_renames = false;
+    bool has_detect_renames = false;
+    bool move_renames = false;
+    bool has_rename_mode = false;
+    ReadOptions read_options;
+    bool has_read_mode = false;
+    bool has_direct_min = false;
+    std::uint64_t chunked_min = 0;
+    bool has_chunked_min = false;
+    std::uint64_t chunk_size = 0;
+    bool has_chunk_size = false;
+    std::filesystem::path state_dir;
+    bool has_state_dir = false;
+    std::uint64_t rate_limit = 0;
+    bool has_rate_limit = false;
+    bool progress = true;
+    bool has_progress = false;
+    std::filesystem::path status_file;
+    bool has_status_file = false;
+    std::uint32_t status_interval = 1;
+    bool has_status_interval = false;
+    std::uint32_t low_space = 0;
+    bool has_low_space = false;
+    std::uint32_t critical_space = 0;
+    bool has_critical_space = false;
+    ShardSpec shard;
+    bool has_shard = false;
+    bool has_shard_depth = false;
+    std::vector<JobSection> jobs;
+    std::vector<SyncRule> rules;
     std::string email;
     std::string app_password;
 };
 
+bool ParseCompareMode(const std::string& value, CompareMode* out) {
+    std::string mode = ToLowerAscii(value);
+    if (mode == "size-mtime") {
+        *out = CompareMode::SizeMtime;
+    } else if (mode == "size-only") {
+        *out = CompareMode::SizeOnly;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool ParseRenameMode(const std::string& value, bool* move) {
+    std::string lower = ToLowerAscii(value);
+    if (lower == "copy" || lower == "move") {
+        *move = lower == "move";
+        return true;
+    }
+    return false;
+}
+
+bool ParseLogLevel(const std::string& value, LogLevel* out) {
+    std::string lower = ToLowerAscii(Trim(value));
+    if (lower == "info") {
+        *out = LogLevel::Info;
+    } else if (lower == "warn") {
+        *out = LogLevel::Warn;
+    } else if (lower == "error") {
+        *out = LogLevel::Error;
+    } else {
+        return false;
+    }
+    return true;
+}
+
 bool ParseBoolValue(const std::string& value, bool* out) {
     std::string lower = ToLowerAscii(Trim(value));
     if (lower == "1" || lower == "true" || lower == "yes" || lower == "on") {
@@ -129,6 +224,140 @@ bool ParseBoolValue(const std::string& value, bool* out) {
     return false;
 }
 
+// Positive integer times `unit`, e.g. "64" MB.
+bool ParseSizeValue(const std::string& value, std::uint64_t unit, std::uint64_t* out) {
+    std::string trimmed = Trim(value);
+    if (trimmed.empty() || trimmed.size() > 9 ||
+        trimmed.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    std::uint64_t parsed = std::stoull(trimmed);
+    if (parsed == 0) {
+        return false;
+    }
+    *out = parsed * unit;
+    return true;
+}
+
+// As ParseSizeValue, but "0" is accepted for "off".
+bool ParseSizeOrOff(const std::string& value, std::uint64_t unit, std::uint64_t* out) {
+    if (Trim(value) == "0") {
+        *out = 0;
+        return true;
+    }
+    return ParseSizeValue(value, unit, out);
+}
+
+// "10" or "10%", 0 to 100.
+bool ParsePercentValue(const std::string& value, std::uint32_t* out) {
+    std::string trimmed = Trim(value);
+    if (!trimmed.empty() && trimmed.back() == '%') {
+        trimmed.pop_back();
+    }
+    if (trimmed.empty() || trimmed.size() > 3 ||
+        trimmed.find_first_not_of("0123456789") != std::string::npos) {
+        return false;
+    }
+    std::uint32_t parsed = static_cast<std::uint32_t>(std::stoul(trimmed));
+    if (parsed > 100) {
+        return false;
+    }
+    *out = parsed;
+    return true;
+}
+
+// Keys of a [job <name>] section.
+bool ParseJobKey(const std::string& key_lower, const std::string& value, JobSection* section,
+                 std::string* error) {
+    const std::string& name = section->job.name;
+    if (key_lower == "source") {
+        section->job.source = std::filesystem::path(value);
+        section->has_source = true;
+    } else if (key_lower == "remote") {
+        section->job.remote = value;
+        section->has_remote = true;
+    } else if (key_lower == "exclude") {
+        if (!value.empty()) {
+            section->job.excludes.push_back(value);
+        }
+    } else if (key_lower == "compare") {
+        if (!ParseCompareMode(value, &section->job.compare_mode)) {
+            if (error) {
+                *error = "Invalid compare value in job " + name + ": " + value;
+            }
+            return false;
+        }
+        section->has_compare = true;
+    } else if (key_lower == "weight") {
+        std::string trimmed = Trim(value);
+        if (trimmed.empty() || trimmed.size() > 4 ||
+            trimmed.find_first_not_of("0123456789") != std::string::npos ||
+            std::stoul(trimmed) == 0) {
+            if (error) {
+                *error = "Invalid weight value in job " + name + ": " + value;
+            }
+            return false;
+        }
+        section->job.weight = static_cast<std::uint32_t>(std::stoul(trimmed));
+    } else {
+        if (error) {
+            *error = "Unknown key in job " + name + ": " + key_lower;
+        }
+        return false;
+    }
+    return true;
+}
+
+// Keys of a [rule <name>] section.
+bool ParseRuleKey(const std::string& key_lower, const std::string& value, SyncRule* rule,
+                  std::string* error) {
+    std::string lower = ToLowerAscii(value);
+    if (key_lower == "match") {
+        if (!value.empty()) {
+            rule->patterns.push_back(value);
+        }
+    } else if (key_lower == "upload") {
+        if (lower != "always" && lower != "changed") {
+            if (error) {
+                *error = "Invalid upload value in rule " + rule->name + ": " + value;
+            }
+            return false;
+        }
+        rule->always_upload = lower == "always";
+    } else if (key_lower == "delete") {
+        if (!ParseBoolValue(value, &rule->delete_after_upload)) {
+            if (error) {
+                *error = "Invalid delete value in rule " + rule->name + ": " + value;
+            }
+            return false;
+        }
+    } else if (key_lower == "delete_age" || key_lower == "delete-age") {
+        std::string trimmed = Trim(value);
+        if (trimmed.empty() || trimmed.size() > 6 ||
+            trimmed.find_first_not_of("0123456789") != std::string::npos) {
+            if (error) {
+                *error = "Invalid delete_age value in rule " + rule->name + ": " + value;
+            }
+            return false;
+        }
+        rule->delete_age_hours = static_cast<std::uint32_t>(std::stoul(trimmed));
+    } else if (key_lower == "compare") {
+        if (!ParseCompareMode(value, &rule->compare_mode)) {
+            if (error) {
+                *error = "Invalid compare value in rule " + rule->name + ": " + value;
+            }
+            return false;
+        }
+        rule->has_compare = true;
+    } else {
+        if (error) {
+            *error = "Unknown key in rule " + rule->name + ": " + key_lower;
+        }
+        return false;
+    }
+    return true;
+}
+
 bool LoadConfigFile(const std::filesystem::path& path,
                     ConfigFileData* out,
                     std::string* error) {
@@ -146,6 +375,8 @@ bool LoadConfigFile(const std::filesystem::path& path,
         return false;
     }
 
+    // Everything after a [job] or [rule] header belongs to that section.
+    enum class Section { Top, Job, Rule } section = Section::Top;
     std::string line;
     while (std::getline(file, line)) {
         std::string trimmed = Trim(line);
@@ -155,6 +386,55 @@ bool LoadConfigFile(const std::filesystem::path& path,
         if (trimmed[0] == '#' || trimmed[0] == ';') {
             continue;
         }
+        StripBom(&trimmed);
+        if (trimmed.front() == '[' && trimmed.back() == ']') {
+            std::string header = Trim(trimmed.substr(1, trimmed.size() - 2));
+            std::string name;
+            if (ToLowerAscii(header.substr(0, 4)) == "job ") {
+                name = Trim(header.substr(4));
+                section = Section::Job;
+            } else if (ToLowerAscii(header.substr(0, 5)) == "rule ") {
+                name = Trim(header.substr(5));
+                section = Section::Rule;
+            }
+            if (name.empty()) {
+                if (error) {
+                    *error = "Invalid section in config: " + trimmed;
+                }
+                return false;
+            }
+            if (section == Section::Rule) {
+                for (const auto& rule : out->rules) {
+                    if (rule.name == name) {
+                        if (error) {
+                            *error = "Duplicate rule in config: " + name;
+                        }
+                        return false;
+                    }
+                }
+                if (out->rules.size() == kMaxSyncRules) {
+                    if (error) {
+                        *error = "Too many rules in config, at most " +
+                                 std::to_string(kMaxSyncRules);
+                    }
+                    return false;
+                }
+                out->rules.emplace_back();
+                out->rules.back().name = name;
+                continue;
+            }
+            for (const auto& job : out->jobs) {
+                if (job.job.name == name) {
+                    if (error) {
+                        *error = "Duplicate job in config: " + name;
+                    }
+                    return false;
+                }
+            }
+            out->jobs.emplace_back();
+            out->jobs.back().job.name = name;
+            continue;
+        }
         auto pos = trimmed.find('=');
         if (pos == std::string::npos) {
             continue;
@@ -173,6 +453,18 @@ bool LoadConfigFile(const std::filesystem::path& path,
             continue;
         }
         std::string key_lower = ToLowerAscii(key);
+        if (section == Section::Job) {
+            if (!ParseJobKey(key_lower, value, &out->jobs.back(), error)) {
+                return false;
+            }
+            continue;
+        }
+        if (section == Section::Rule) {
+            if (!ParseRuleKey(key_lower, value, &out->rules.back(), error)) {
+                return false;
+            }
+            continue;
+        }
         if (key_lower == "email") {
             out->email = value;
         } else if (key_lower == "app_password" || key_lower == "app-password") {
@@ -196,6 +488,16 @@ bool LoadConfigFile(const std::filesystem::path& path,
                 }
                 return false;
             }
+        } else if (key_lower == "probe_threads" || key_lower == "probe-threads") {
+            try {
+                out->probe_threads = std::stoi(value);
+                out->has_probe_threads = true;
+            } catch (...) {
+                if (error) {
+                    *error = "Invalid probe_threads value in config: " + value;
+                }
+                return false;
+            }
         } else if (key_lower == "compare") {
             std::string mode = ToLowerAscii(value);
             if (mode == "size-mtime") {
@@ -224,6 +526,185 @@ bool LoadConfigFile(const std::filesystem::path& path,
             if (!value.empty()) {
                 out->excludes.push_back(value);
             }
+        } else if (key_lower == "ignore_file" || key_lower == "ignore-file") {
+            out->ignore_file = value;
+            out->has_ignore_file = true;
+        } else if (key_lower == "async_log" || key_lower == "async-log") {
+            if (!ParseBoolValue(value, &out->async_log)) {
+                if (error) {
+                    *error = "Invalid async_log value in config: " + value;
+                }
+                return false;
+            }
+            out->has_async_log = true;
+        } else if (key_lower == "log_level" || key_lower == "log-level") {
+            if (!ParseLogLevel(value, &out->log_level)) {
+                if (error) {
+                    *error = "Invalid log_level value in config: " + value;
+                }
+                return false;
+            }
+            out->has_log_level = true;
+        } else if (key_lower == "log_skip_rate" || key_lower == "log-skip-rate") {
+            try {
+                out->log_skip_rate = std::stoi(value);
+                out->has_log_skip_rate = true;
+            } catch (...) {
+                if (error) {
+                    *error = "Invalid log_skip_rate value in config: " + value;
+                }
+                return false;
+            }
+        } else if (key_lower == "bundle") {
+            if (!value.empty()) {
+                out->bundle_dirs.push_back(value);
+            }
+        } else if (key_lower == "bundle_size" || key_lower == "bundle-size") {
+            if (!ParseSizeValue(value, 1ULL << 20, &out->bundle_size)) {
+                if (error) {
+                    *error = "Invalid bundle_size value in config: " + value;
+                }
+                return false;
+            }
+            out->has_bundle_size = true;
+        } else if (key_lower == "bundle_max_file" || key_lower == "bundle-max-file") {
+            if (!ParseSizeValue(value, 1ULL << 10, &out->bundle_max_file)) {
+                if (error) {
+                    *error = "Invalid bundle_max_file value in config: " + value;
+                }
+                return false;
+            }
+            out->has_bundle_max_file = true;
+        } else if (key_lower == "detect_renames" || key_lower == "detect-renames") {
+            if (!ParseBoolValue(value, &out->detect_renames)) {
+                if (error) {
+                    *error = "Invalid detect_renames value in config: " + value;
+                }
+                return false;
+            }
+            out->has_detect_renames = true;
+        } else if (key_lower == "rename_mode" || key_lower == "rename-mode") {
+            if (!ParseRenameMode(value, &out->move_renames)) {
+                if (error) {
+                    *error = "Invalid rename_mode value in config: " + value;
+                }
+                return false;
+            }
+            out->has_rename_mode = true;
+        } else if (key_lower == "read_mode" || key_lower == "read-mode") {
+            if (!ParseReadCacheMode(value, &out->read_options.mode)) {
+                if (error) {
+                    *error = "Invalid read_mode value in config: " + value;
+                }
+                return false;
+            }
+            out->has_read_mode = true;
+        } else if (key_lower == "direct_min" || key_lower == "direct-min") {
+            if (!ParseSizeValue(value, 1ULL << 20, &out->read_options.direct_min)) {
+                if (error) {
+                    *error = "Invalid direct_min value in config: " + value;
+                }
+                return false;
+            }
+            out->has_direct_min = true;
+        } else if (key_lower == "chunked_min" || key_lower == "chunked-min") {
+            if (!ParseSizeOrOff(value, 1ULL << 20, &out->chunked_min)) {
+                if (error) {
+                    *error = "Invalid chunked_min value in config: " + value;
+                }
+                return false;
+            }
+            out->has_chunked_min = true;
+        } else if (key_lower == "chunk_size" || key_lower == "chunk-size") {
+            if (!ParseSizeValue(value, 1ULL << 20, &out->chunk_size)) {
+                if (error) {
+                    *error = "Invalid chunk_size value in config: " + value;
+                }
+                return false;
+            }
+            out->has_chunk_size = true;
+        } else if (key_lower == "dedup") {
+            if (!ParseBoolValue(value, &out->dedup)) {
+                if (error) {
+                    *error = "Invalid dedup value in config: " + value;
+                }
+                return false;
+            }
+            out->has_dedup = true;
+        } else if (key_lower == "compress") {
+            if (!value.empty()) {
+                out->compress_patterns.push_back(value);
+            }
+        } else if (key_lower == "append") {
+            if (!value.empty()) {
+                out->append_patterns.push_back(value);
+            }
+        } else if (key_lower == "state_dir" || key_lower == "state-dir") {
+            out->state_dir = std::filesystem::path(value);
+            out->has_state_dir = true;
+        } else if (key_lower == "shard") {
+            if (!ParseShardSpec(value, &out->shard)) {
+                if (error) {
+                    *error = "Invalid shard value in config: " + value;
+                }
+                return false;
+            }
+            out->has_shard = true;
+        } else if (key_lower == "shard_depth" || key_lower == "shard-depth") {
+            std::uint64_t depth = 0;
+            if (!ParseSizeValue(value, 1, &depth) || depth == 0 || depth > 0xFFFF) {
+                if (error) {
+                    *error = "Invalid shard_depth value in config: " + value;
+                }
+                return false;
+            }
+            out->shard.depth = static_cast<std::uint32_t>(depth);
+            out->has_shard_depth = true;
+        } else if (key_lower == "low_space" || key_lower == "low-space") {
+            if (!ParsePercentValue(value, &out->low_space)) {
+                if (error) {
+                    *error = "Invalid low_space value in config: " + value;
+                }
+                return false;
+            }
+            out->has_low_space = true;
+        } else if (key_lower == "critical_space" || key_lower == "critical-space") {
+            if (!ParsePercentValue(value, &out->critical_space)) {
+                if (error) {
+                    *error = "Invalid critical_space value in config: " + value;
+                }
+                return false;
+            }
+            out->has_critical_space = true;
+        } else if (key_lower == "rate_limit" || key_lower == "rate-limit") {
+            if (!ParseSizeValue(value, 1ULL << 10, &out->rate_limit)) {
+                if (error) {
+                    *error = "Invalid rate_limit value in config: " + value;
+                }
+                return false;
+            }
+            out->has_rate_limit = true;
+        } else if (key_lower == "progress") {
+            if (!ParseBoolValue(value, &out->progress)) {
+                if (error) {
+                    *error = "Invalid progress value in config: " + value;
+                }
+                return false;
+            }
+            out->has_progress = true;
+        } else if (key_lower == "status_file" || key_lower == "status-file") {
+            out->status_file = std::filesystem::path(value);
+            out->has_status_file = true;
+        } else if (key_lower == "status_interval" || key_lower == "status-interval") {
+            std::uint64_t seconds = 0;
+            if (!ParseSizeValue(value, 1, &seconds) || seconds > 3600) {
+                if (error) {
+                    *error = "Invalid status_interval value in config: " + value;
+                }
+                return false;
+            }
+            out->status_interval = static_cast<std::uint32_t>(seconds);
+            out->has_status_interval = true;
         }
     }
 
@@ -242,7 +723,14 @@ std::string BuildUsage() {
     oss << "Defaults:\n";
     oss << "  --source <exe_dir>\\p\n\n";
     oss << "Config file:\n";
-    oss << "  <exe_dir>\\uploader.conf with email/app_password/source/remote/base_url/threads/compare/dry_run/exclude.\n";
+    oss << "  <exe_dir>\\uploader.conf with email/app_password/source/remote/base_url/threads/probe_threads/compare/dry_run/exclude/ignore_file/\n"
+           "  async_log/log_level/log_skip_rate/bundle/bundle_size/bundle_max_file/compress/append/\n"
+           "  dedup/detect_renames/rename_mode/state_dir/rate_limit/shard/shard_depth/low_space/critical_space/\n"
+           "  read_mode/direct_min/chunked_min/chunk_size/progress/status_file/status_interval,\n"
+           "  [job <name>] sections with\n"
+           "  source/remote/exclude/compare/weight that run as jobs in one process,\n"
+           "  and [rule <name>] sections with match/upload/delete/delete_age/compare\n"
+           "  that decide per file pattern what is uploaded and deleted.\n";
     oss << "Compiled defaults:\n";
     oss << "  set via CMake cache DEFAULT_* variables or DEFAULTS_FROM_CONF_PATH.\n";
     oss << "Environment:\n";
@@ -254,8 +742,44 @@ std::string BuildUsage() {
     oss << "  --base-url <url>            WebDAV base URL (default: https://webdav.cloud.mail.ru).\n";
     oss << "  --dry-run                   Show actions without uploading or deleting.\n";
     oss << "  --threads <n>               Number of worker threads (default: 1).\n";
+    oss << "  --probe-threads <n>         Concurrent directory listings before the uploads (default: 8).\n";
     oss << "  --exclude <pattern>         Exclude glob pattern (repeatable).\n";
     oss << "  --compare <mode>            size-mtime (default) or size-only.\n";
+    oss << "  --ignore-file <name>        Per-directory ignore file (default: .uploaderignore, \"\" disables).\n";
+    oss << "  --async-log                 Write the log from a background thread.\n";
+    oss << "  --log-level <level>         info (default), warn or error.\n";
+    oss << "  --log-skip-rate <n>         Max per-file Skip lines per second (default: 0 = unlimited).\n";
+    oss << "  --plan-out <file>           Decide every file and write the plan without executing it.\n";
+    oss << "  --apply <file>              Execute a plan written by --plan-out; changed files are skipped.\n";
+    oss << "  --trace-record <file>       Record the method, path hash, sizes, status and timings of every\n"
+           "                              WebDAV request to a binary trace.\n";
+    oss << "  --trace-replay <file>       Answer WebDAV requests from a recorded trace instead of the\n"
+           "                              server, with its latencies; local files are kept.\n";
+    oss << "  --bundle <dir>              Upload small files under this source subtree as tar bundles (repeatable).\n";
+    oss << "  --bundle-size <MB>          Max bundle size (default: 64).\n";
+    oss << "  --bundle-max-file <KB>      Larger files are uploaded one by one (default: 1024).\n";
+    oss << "  --compress <pattern>        Upload matching files gzip-compressed as <name>.gz (repeatable).\n";
+    oss << "  --append <pattern>          Treat matching files as append-only: send only what they grew by\n"
+           "                              since the last upload (repeatable).\n";
+    oss << "  --detect-renames            Reuse earlier uploads of renamed files and directories.\n";
+    oss << "  --rename-mode <mode>        copy (default) or move the earlier upload.\n";
+    oss << "  --read-mode <mode>          buffered (default), drop-behind (keep uploaded files out of the page\n"
+           "                              cache) or direct (also bypass it for large files).\n";
+    oss << "  --direct-min <MB>           Smallest file read with direct I/O in direct mode (default: 256).\n";
+    oss << "  --chunked-min <MB>          Upload files at least this large in parallel, resumable chunks when\n"
+           "                              the server accepts Content-Range PUTs (default: 1024, 0 = off).\n";
+    oss << "  --chunk-size <MB>           Size of those chunks (default: 64).\n";
+    oss << "  --dedup                     Upload identical files once and create the other copies with COPY.\n";
+    oss << "  --shard <i/N>               Sync only shard i of N; N processes split the tree by directory.\n";
+    oss << "  --shard-depth <n>           Directory depth whose prefixes are hashed to shards (default: 1).\n";
+    oss << "  --rate-limit <KB/s>         Upload bandwidth shared by all workers and jobs (default: unlimited).\n";
+    oss << "  --low-space <percent>       Below this much free space on the source volume, uploads that delete\n"
+           "                              their local file go first within the job (default: 10, 0 = off).\n";
+    oss << "  --critical-space <percent>  Below this, they go before all other uploads (default: 2, 0 = off).\n";
+    oss << "  --no-progress               Do not keep a status line at the bottom of the console.\n";
+    oss << "  --status-file <file>        Rewrite this JSON file with the live status of the uploads.\n";
+    oss << "  --status-interval <s>       How often the status is refreshed (default: 1).\n";
+    oss << "  --state-dir <path>          Bundle manifests and other state (default: state).\n";
     oss << "  --help                      Show this help.\n";
     return oss.str();
 }
@@ -275,8 +799,31 @@ bool ParseArgs(const std::vector<std::string>& args,
     bool remote_set = false;
     bool base_url_set = false;
     bool threads_set = false;
+    bool probe_threads_set = false;
     bool compare_set = false;
     bool dry_run_set = false;
+    bool ignore_file_set = false;
+    bool async_log_set = false;
+    bool log_level_set = false;
+    bool log_skip_rate_set = false;
+    bool bundle_size_set = false;
+    bool bundle_max_file_set = false;
+    bool state_dir_set = false;
+    bool dedup_set = false;
+    bool detect_renames_set = false;
+    bool rename_mode_set = false;
+    bool read_mode_set = false;
+    bool direct_min_set = false;
+    bool chunked_min_set = false;
+    bool chunk_size_set = false;
+    bool rate_limit_set = false;
+    bool progress_set = false;
+    bool status_file_set = false;
+    bool status_interval_set = false;
+    bool low_space_set = false;
+    bool critical_space_set = false;
+    bool shard_set = false;
+    bool shard_depth_set = false;
     for (size_t i = 0; i < args.size(); ++i) {
         const std::string& arg = args[i];
         if (IsFlag(arg, "--help") || IsFlag(arg, "-h")) {
@@ -349,6 +896,22 @@ bool ParseArgs(const std::vector<std::string>& args,
             }
             continue;
         }
+        if (IsFlag(arg, "--probe-threads")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            try {
+                config->probe_threads = std::stoi(value);
+                probe_threads_set = true;
+            } catch (...) {
+                if (error) {
+                    *error = "Invalid probe threads value: " + value;
+                }
+                return false;
+            }
+            continue;
+        }
         if (IsFlag(arg, "--exclude")) {
             std::string value;
             if (!ReadValue(args, &i, &value, error)) {
@@ -357,6 +920,328 @@ bool ParseArgs(const std::vector<std::string>& args,
             config->excludes.push_back(value);
             continue;
         }
+        if (IsFlag(arg, "--ignore-file")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            config->ignore_file = value;
+            ignore_file_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--async-log")) {
+            config->async_log = true;
+            async_log_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--log-level")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            if (!ParseLogLevel(value, &config->log_level)) {
+                if (error) {
+                    *error = "Unknown log level: " + value;
+                }
+                return false;
+            }
+            log_level_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--log-skip-rate")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            try {
+                config->log_skip_rate = std::stoi(value);
+                log_skip_rate_set = true;
+            } catch (...) {
+                if (error) {
+                    *error = "Invalid log skip rate: " + value;
+                }
+                return false;
+            }
+            continue;
+        }
+        if (IsFlag(arg, "--plan-out")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            config->plan_out = std::filesystem::path(value);
+            continue;
+        }
+        if (IsFlag(arg, "--apply")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            config->apply_plan = std::filesystem::path(value);
+            continue;
+        }
+        if (IsFlag(arg, "--trace-record")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            config->trace_record = std::filesystem::path(value);
+            continue;
+        }
+        if (IsFlag(arg, "--trace-replay")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            config->trace_replay = std::filesystem::path(value);
+            continue;
+        }
+        if (IsFlag(arg, "--bundle")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            config->bundle_dirs.push_back(value);
+            continue;
+        }
+        if (IsFlag(arg, "--shard")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            ShardSpec spec;
+            if (!ParseShardSpec(value, &spec)) {
+                if (error) {
+                    *error = "Invalid shard (expected i/N with 1 <= i <= N): " + value;
+                }
+                return false;
+            }
+            config->shard_index = spec.index;
+            config->shard_count = spec.count;
+            shard_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--shard-depth")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            std::uint64_t depth = 0;
+            if (!ParseSizeValue(value, 1, &depth) || depth == 0 || depth > 0xFFFF) {
+                if (error) {
+                    *error = "Invalid shard depth: " + value;
+                }
+                return false;
+            }
+            config->shard_depth = static_cast<std::uint32_t>(depth);
+            shard_depth_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--low-space")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            if (!ParsePercentValue(value, &config->low_space_percent)) {
+                if (error) {
+                    *error = "Invalid low space percent: " + value;
+                }
+                return false;
+            }
+            low_space_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--critical-space")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            if (!ParsePercentValue(value, &config->critical_space_percent)) {
+                if (error) {
+                    *error = "Invalid critical space percent: " + value;
+                }
+                return false;
+            }
+            critical_space_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--rate-limit")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            if (!ParseSizeValue(value, 1ULL << 10, &config->rate_limit)) {
+                if (error) {
+                    *error = "Invalid rate limit: " + value;
+                }
+                return false;
+            }
+            rate_limit_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--no-progress")) {
+            config->progress = false;
+            progress_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--status-file")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            config->status_file = std::filesystem::path(value);
+            status_file_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--status-interval")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            std::uint64_t seconds = 0;
+            if (!ParseSizeValue(value, 1, &seconds) || seconds > 3600) {
+                if (error) {
+                    *error = "Invalid status interval: " + value;
+                }
+                return false;
+            }
+            config->status_interval = static_cast<std::uint32_t>(seconds);
+            status_interval_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--detect-renames")) {
+            config->detect_renames = true;
+            detect_renames_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--rename-mode")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            if (!ParseRenameMode(value, &config->move_renames)) {
+                if (error) {
+                    *error = "Invalid rename mode: " + value;
+                }
+                return false;
+            }
+            rename_mode_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--read-mode")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            if (!ParseReadCacheMode(value, &config->read_options.mode)) {
+                if (error) {
+                    *error = "Invalid read mode: " + value;
+                }
+                return false;
+            }
+            read_mode_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--direct-min")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            if (!ParseSizeValue(value, 1ULL << 20, &config->read_options.direct_min)) {
+                if (error) {
+                    *error = "Invalid direct-min size: " + value;
+                }
+                return false;
+            }
+            direct_min_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--chunked-min")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            if (!ParseSizeOrOff(value, 1ULL << 20, &config->chunked_min)) {
+                if (error) {
+                    *error = "Invalid chunked-min size: " + value;
+                }
+                return false;
+            }
+            chunked_min_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--chunk-size")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            if (!ParseSizeValue(value, 1ULL << 20, &config->chunk_size)) {
+                if (error) {
+                    *error = "Invalid chunk size: " + value;
+                }
+                return false;
+            }
+            chunk_size_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--dedup")) {
+            config->dedup = true;
+            dedup_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--compress")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            config->compress_patterns.push_back(value);
+            continue;
+        }
+        if (IsFlag(arg, "--append")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            config->append_patterns.push_back(value);
+            continue;
+        }
+        if (IsFlag(arg, "--bundle-size")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            if (!ParseSizeValue(value, 1ULL << 20, &config->bundle_size)) {
+                if (error) {
+                    *error = "Invalid bundle size: " + value;
+                }
+                return false;
+            }
+            bundle_size_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--bundle-max-file")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            if (!ParseSizeValue(value, 1ULL << 10, &config->bundle_max_file)) {
+                if (error) {
+                    *error = "Invalid bundle max file size: " + value;
+                }
+                return false;
+            }
+            bundle_max_file_set = true;
+            continue;
+        }
+        if (IsFlag(arg, "--state-dir")) {
+            std::string value;
+            if (!ReadValue(args, &i, &value, error)) {
+                return false;
+            }
+            config->state_dir = std::filesystem::path(value);
+            state_dir_set = true;
+            continue;
+        }
         if (IsFlag(arg, "--compare")) {
             std::string value;
             if (!ReadValue(args, &i, &value, error)) {
@@ -384,6 +1269,11 @@ bool ParseArgs(const std::vector<std::string>& args,
         return false;
     }
 
+    // Jobs replace the single mapping, so it cannot be given as well.
+    bool mapping_on_command_line = source_set || remote_set;
+    // Per job in config->jobs: whether it sets its own compare mode. Jobs
+    // the caller passed in keep theirs.
+    std::vector<std::uint8_t> job_has_compare(config->jobs.size(), 1);
     std::filesystem::path config_root = default_source_root;
     if (config_root.empty()) {
         config_root = std::filesystem::current_path();
@@ -425,6 +1315,10 @@ bool ParseArgs(const std::vector<std::string>& args,
             config->threads = file_data.threads;
             threads_set = true;
         }
+        if (!probe_threads_set && file_data.has_probe_threads) {
+            config->probe_threads = file_data.probe_threads;
+            probe_threads_set = true;
+        }
         if (!compare_set && file_data.has_compare) {
             config->compare_mode = file_data.compare_mode;
             compare_set = true;
@@ -442,6 +1336,126 @@ bool ParseArgs(const std::vector<std::string>& args,
         for (const auto& pattern : file_data.excludes) {
             config->excludes.push_back(pattern);
         }
+        if (!ignore_file_set && file_data.has_ignore_file) {
+            config->ignore_file = file_data.ignore_file;
+            ignore_file_set = true;
+        }
+        if (!async_log_set && file_data.has_async_log) {
+            config->async_log = file_data.async_log;
+            async_log_set = true;
+        }
+        if (!log_level_set && file_data.has_log_level) {
+            config->log_level = file_data.log_level;
+            log_level_set = true;
+        }
+        if (!log_skip_rate_set && file_data.has_log_skip_rate) {
+            config->log_skip_rate = file_data.log_skip_rate;
+            log_skip_rate_set = true;
+        }
+        for (const auto& dir : file_data.bundle_dirs) {
+            config->bundle_dirs.push_back(dir);
+        }
+        for (const auto& pattern : file_data.compress_patterns) {
+            config->compress_patterns.push_back(pattern);
+        }
+        for (const auto& pattern : file_data.append_patterns) {
+            config->append_patterns.push_back(pattern);
+        }
+        if (!dedup_set && file_data.has_dedup) {
+            config->dedup = file_data.dedup;
+            dedup_set = true;
+        }
+        if (!detect_renames_set && file_data.has_detect_renames) {
+            config->detect_renames = file_data.detect_renames;
+            detect_renames_set = true;
+        }
+        if (!read_mode_set && file_data.has_read_mode) {
+            config->read_options.mode = file_data.read_options.mode;
+            read_mode_set = true;
+        }
+        if (!direct_min_set && file_data.has_direct_min) {
+            config->read_options.direct_min = file_data.read_options.direct_min;
+            direct_min_set = true;
+        }
+        if (!chunked_min_set && file_data.has_chunked_min) {
+            config->chunked_min = file_data.chunked_min;
+            chunked_min_set = true;
+        }
+        if (!chunk_size_set && file_data.has_chunk_size) {
+            config->chunk_size = file_data.chunk_size;
+            chunk_size_set = true;
+        }
+        if (!rename_mode_set && file_data.has_rename_mode) {
+            config->move_renames = file_data.move_renames;
+            rename_mode_set = true;
+        }
+        if (!bundle_size_set && file_data.has_bundle_size) {
+            config->bundle_size = file_data.bundle_size;
+            bundle_size_set = true;
+        }
+        if (!bundle_max_file_set && file_data.has_bundle_max_file) {
+            config->bundle_max_file = file_data.bundle_max_file;
+            bundle_max_file_set = true;
+        }
+        if (!state_dir_set && file_data.has_state_dir) {
+            config->state_dir = file_data.state_dir;
+            state_dir_set = true;
+        }
+        if (!shard_set && file_data.has_shard) {
+            config->shard_index = file_data.shard.index;
+            config->shard_count = file_data.shard.count;
+            shard_set = true;
+        }
+        if (!shard_depth_set && file_data.has_shard_depth) {
+            config->shard_depth = file_data.shard.depth;
+            shard_depth_set = true;
+        }
+        if (!low_space_set && file_data.has_low_space) {
+            config->low_space_percent = file_data.low_space;
+            low_space_set = true;
+        }
+        if (!critical_space_set && file_data.has_critical_space) {
+            config->critical_space_percent = file_data.critical_space;
+            critical_space_set = true;
+        }
+        if (!rate_limit_set && file_data.has_rate_limit) {
+            config->rate_limit = file_data.rate_limit;
+            rate_limit_set = true;
+        }
+        if (!progress_set && file_data.has_progress) {
+            config->progress = file_data.progress;
+            progress_set = true;
+        }
+        if (!status_file_set && file_data.has_status_file) {
+            config->status_file = file_data.status_file;
+            status_file_set = true;
+        }
+        if (!status_interval_set && file_data.has_status_interval) {
+            config->status_interval = file_data.status_interval;
+            status_interval_set = true;
+        }
+        for (const auto& rule : file_data.rules) {
+            if (rule.patterns.empty()) {
+                if (error) {
+                    *error = "Rule " + rule.name + " needs a match pattern";
+                }
+                return false;
+            }
+        }
+        config->rules = file_data.rules;
+        for (auto& section : file_data.jobs) {
+            if (!section.has_source || !section.has_remote) {
+                if (error) {
+                    *error = "Job " + section.job.name + " needs source and remote";
+                }
+                return false;
+            }
+            if (section.job.source.is_relative()) {
+                section.job.source = config_root / section.job.source;
+            }
+            config->jobs.push_back(section.job);
+            job_has_compare.push_back(section.has_compare ? 1 : 0);
+        }
     } else if (config_ec) {
         if (error) {
             *error = "Failed to access config file: " + config_path.string();
@@ -537,7 +1551,13 @@ bool ParseArgs(const std::vector<std::string>& args,
         }
     }
 
-    if (!source_set) {
+    for (std::size_t i = 0; i < config->jobs.size(); ++i) {
+        if (!job_has_compare[i]) {
+            config->jobs[i].compare_mode = config->compare_mode;
+        }
+    }
+
+    if (!source_set && config->jobs.empty()) {
         std::filesystem::path base = default_source_root;
         if (base.empty()) {
             base = std::filesystem::current_path();
@@ -573,12 +1593,68 @@ bool ParseArgs(const std::vector<std::string>& args,
             return false;
         }
     }
+    if (!config->plan_out.empty() && !config->apply_plan.empty()) {
+        if (error) {
+            *error = "--plan-out and --apply cannot be combined";
+        }
+        return false;
+    }
+    if (config->shard_count > 1 && !config->apply_plan.empty()) {
+        if (error) {
+            *error = "--shard selects files while planning and cannot be combined with --apply";
+        }
+        return false;
+    }
+    if (config->low_space_percent > 0 && config->critical_space_percent > config->low_space_percent) {
+        if (error) {
+            *error = "--critical-space must not exceed --low-space";
+        }
+        return false;
+    }
+    if (config->bundle_dirs.size() > 0xFFFF) {
+        if (error) {
+            *error = "Too many --bundle directories";
+        }
+        return false;
+    }
     if (config->threads < 1) {
         if (error) {
             *error = "--threads must be >= 1";
         }
         return false;
     }
+    if (config->probe_threads < 1) {
+        if (error) {
+            *error = "--probe-threads must be >= 1";
+        }
+        return false;
+    }
+    if (!config->jobs.empty()) {
+        if (mapping_on_command_line) {
+            if (error) {
+                *error = "--source and --remote cannot be combined with jobs in uploader.conf";
+            }
+            return false;
+        }
+        if (!config->plan_out.empty() || !config->apply_plan.empty()) {
+            if (error) {
+                *error = "--plan-out and --apply work with a single job only";
+            }
+            return false;
+        }
+        for (auto& job : config->jobs) {
+            if (!std::filesystem::is_directory(job.source)) {
+                if (error) {
+                    *error = "Source path of job " + job.name +
+                             " is not a directory: " + job.source.string();
+                }
+                return false;
+            }
+            job.remote = NormalizeRemoteRoot(job.remote);
+            job.source = std::filesystem::absolute(job.source);
+        }
+        return true;
+    }
     if (!std::filesystem::exists(config->source)) {
         if (error) {
             *error = "Source path does not exist: " + config->source.string();
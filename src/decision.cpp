@@ -2,15 +2,6 @@
 
 #include <chrono>
 
-namespace {
-
-std::chrono::system_clock::time_point NowMinusHours(std::chrono::system_clock::time_point now,
-                                                    int hours) {
-    return now - std::chrono::hours(hours);
-}
-
-}  // namespace
-
 bool IsDifferent(const LocalFileInfo& local,
                  const RemoteItemInfo& remote,
                  CompareMode mode) {
@@ -39,37 +30,64 @@ bool IsDifferent(const LocalFileInfo& local,
 
 FileDecision DecideFileAction(const LocalFileInfo& local,
                               const RemoteItemInfo& remote,
+                              const SyncRule& rule,
                               CompareMode mode,
                               std::chrono::system_clock::time_point run_start) {
     FileDecision decision;
+    bool deletes = rule.delete_after_upload &&
+                   (rule.delete_age_hours == 0 ||
+                    IsOlderThanHours(local, run_start, rule.delete_age_hours));
+    FileActionType upload = deletes ? FileActionType::UploadAndDelete : FileActionType::Upload;
 
-    if (local.is_jpg) {
-        decision.action = FileActionType::UploadAndDelete;
-        decision.reason = remote.exists ? "jpg overwrite" : "jpg upload";
+    if (rule.always_upload) {
+        decision.action = upload;
+        decision.reason =
+            remote.exists ? DecisionReason::AlwaysOverwrite : DecisionReason::AlwaysUpload;
         return decision;
     }
 
-    bool older_than_24 = IsOlderThan24Hours(local, run_start);
-
     if (!remote.exists) {
-        decision.action = older_than_24 ? FileActionType::UploadAndDelete : FileActionType::Upload;
-        decision.reason = older_than_24 ? "upload + delete (old)" : "upload (missing)";
+        decision.action = upload;
+        decision.reason = deletes ? DecisionReason::OldMissing : DecisionReason::Missing;
         return decision;
     }
 
-    if (IsDifferent(local, remote, mode)) {
-        decision.action = older_than_24 ? FileActionType::UploadAndDelete : FileActionType::Upload;
-        decision.reason = older_than_24 ? "upload + delete (old diff)" : "upload (diff)";
+    if (IsDifferent(local, remote, rule.has_compare ? rule.compare_mode : mode)) {
+        decision.action = upload;
+        decision.reason = deletes ? DecisionReason::OldDifferent : DecisionReason::Different;
         return decision;
     }
 
     decision.action = FileActionType::Skip;
-    decision.reason = "skip (same)";
+    decision.reason = DecisionReason::Same;
     return decision;
 }
 
-bool IsOlderThan24Hours(const LocalFileInfo& local,
-                        std::chrono::system_clock::time_point run_start) {
-    auto threshold = NowMinusHours(run_start, 24);
-    return local.last_modified < threshold;
+const char* DecisionReasonText(DecisionReason reason) {
+    switch (reason) {
+    case DecisionReason::Missing:
+        return "upload (missing)";
+    case DecisionReason::Different:
+        return "upload (diff)";
+    case DecisionReason::OldMissing:
+        return "upload + delete (old)";
+    case DecisionReason::OldDifferent:
+        return "upload + delete (old diff)";
+    case DecisionReason::AlwaysUpload:
+        return "upload (always)";
+    case DecisionReason::AlwaysOverwrite:
+        return "overwrite (always)";
+    default:
+        return "skip (same)";
+    }
+}
+
+bool IsAlwaysReason(DecisionReason reason) {
+    return reason == DecisionReason::AlwaysUpload || reason == DecisionReason::AlwaysOverwrite;
+}
+
+bool IsOlderThanHours(const LocalFileInfo& local,
+                      std::chrono::system_clock::time_point run_start,
+                      std::uint32_t hours) {
+    return local.last_modified < run_start - std::chrono::hours(hours);
 }
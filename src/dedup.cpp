@@ -0,0 +1,154 @@
+#include "dedup.h"
+
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "scanner.h"
+#include "sha256.h"
+
+namespace {
+
+bool IsCandidate(const SyncPlan& plan, FileId file) {
+    return plan.reason[file] != kReasonUndecided &&
+           (plan.action[file] == FileActionType::Upload ||
+            plan.action[file] == FileActionType::UploadAndDelete) &&
+           plan.bundle[file] == 0 && plan.encoding[file] == FileEncoding::Plain &&
+           plan.rename_from[file] == PathStore::kInvalidId &&
+           plan.store.FileSize(file) >= kMinDedupSize;
+}
+
+// Files of one size that are one file on disk.
+struct Identity {
+    LocalFileId id;
+    std::vector<FileId> files;
+    Sha256Digest digest{};
+    bool hashed = false;
+};
+
+}  // namespace
+
+DedupStats FindDuplicateUploads(SyncPlan* plan, int threads, Logger& logger) {
+    DedupStats stats;
+    const PathStore& store = plan->store;
+
+    std::vector<FileId> candidates;
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        if (IsCandidate(*plan, file)) {
+            candidates.push_back(file);
+        }
+    }
+    std::stable_sort(candidates.begin(), candidates.end(), [&](FileId a, FileId b) {
+        return store.FileSize(a) < store.FileSize(b);
+    });
+
+    // Only sizes shared by several uploads can hold duplicates; within
+    // them, every distinct file on disk is hashed once.
+    std::vector<std::pair<std::size_t, std::size_t>> size_groups;
+    std::vector<Identity> identities;
+    for (std::size_t begin = 0; begin < candidates.size();) {
+        std::size_t end = begin + 1;
+        while (end < candidates.size() &&
+               store.FileSize(candidates[end]) == store.FileSize(candidates[begin])) {
+            end++;
+        }
+        if (end - begin > 1) {
+            std::size_t first = identities.size();
+            std::map<std::pair<std::uint64_t, std::uint64_t>, std::size_t> seen;
+            for (std::size_t i = begin; i < end; ++i) {
+                FileId file = candidates[i];
+                LocalFileId id;
+                if (!LocalFileIdentity(store.FileAbsolutePath(plan->source, file), &id)) {
+                    continue;
+                }
+                auto inserted = seen.emplace(std::make_pair(id.device, id.index), identities.size());
+                if (!inserted.second) {
+                    identities[inserted.first->second].files.push_back(file);
+                    stats.hard_links++;
+                } else {
+                    identities.push_back({id, {file}});
+                }
+            }
+            size_groups.emplace_back(first, identities.size());
+        }
+        begin = end;
+    }
+
+    std::vector<std::size_t> to_hash;
+    for (const auto& group : size_groups) {
+        if (group.second - group.first > 1) {
+            for (std::size_t i = group.first; i < group.second; ++i) {
+                to_hash.push_back(i);
+            }
+        }
+    }
+    std::atomic<std::size_t> next{0};
+    std::mutex stats_mutex;
+    auto worker = [&]() {
+        while (true) {
+            std::size_t index = next.fetch_add(1);
+            if (index >= to_hash.size()) {
+                break;
+            }
+            Identity& identity = identities[to_hash[index]];
+            FileId file = identity.files.front();
+            std::filesystem::path path = store.FileAbsolutePath(plan->source, file);
+            std::string err;
+            bool ok = Sha256File(path, &identity.digest, &err);
+            std::uint64_t size = 0;
+            std::int64_t mtime_ns = 0;
+            // A file rewritten since the scan may not match what is uploaded.
+            identity.hashed = ok && StatLocalFile(path, &size, &mtime_ns) &&
+                              size == store.FileSize(file) && mtime_ns == store.FileMtimeNs(file);
+            std::lock_guard<std::mutex> lock(stats_mutex);
+            if (!ok) {
+                logger.Error("Failed to hash " + store.FileRelativeUtf8(file) + ": " + err);
+                stats.errors++;
+                continue;
+            }
+            stats.hashed++;
+            stats.hashed_bytes += store.FileSize(file);
+        }
+    };
+    std::size_t thread_count = std::max<std::size_t>(
+        1, std::min<std::size_t>(static_cast<std::size_t>(std::max(1, threads)), to_hash.size()));
+    std::vector<std::thread> workers;
+    for (std::size_t i = 0; i < thread_count && !to_hash.empty(); ++i) {
+        workers.emplace_back(worker);
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+
+    plan->copy_from.assign(store.FileCount(), PathStore::kInvalidId);
+    for (const auto& group : size_groups) {
+        // A lone identity has only hard links and needs no hash.
+        std::map<Sha256Digest, std::vector<FileId>> by_content;
+        bool single = group.second - group.first == 1;
+        for (std::size_t i = group.first; i < group.second; ++i) {
+            Identity& identity = identities[i];
+            if (!single && !identity.hashed) {
+                continue;
+            }
+            std::vector<FileId>& files = by_content[identity.digest];
+            files.insert(files.end(), identity.files.begin(), identity.files.end());
+        }
+        for (auto& entry : by_content) {
+            std::vector<FileId>& files = entry.second;
+            if (files.size() < 2) {
+                continue;
+            }
+            std::sort(files.begin(), files.end());
+            for (std::size_t i = 1; i < files.size(); ++i) {
+                plan->copy_from[files[i]] = files[0];
+                stats.copies++;
+                stats.saved_bytes += store.FileSize(files[i]);
+            }
+        }
+    }
+    return stats;
+}
@@ -1,58 +1,113 @@
 #include "exclude.h"
 
-#include <sstream>
-#include <vector>
+#include <algorithm>
 
 #include "path_utils.h"
 
 namespace {
 
-bool GlobMatch(const std::string& pattern, const std::string& text) {
-    size_t p = 0;
-    size_t t = 0;
-    size_t star = std::string::npos;
-    size_t match = 0;
+bool HasWildcard(std::string_view pattern) {
+    return pattern.find_first_of("*?") != std::string_view::npos;
+}
+
+}  // namespace
 
-    while (t < text.size()) {
-        if (p < pattern.size() && (pattern[p] == '?' || pattern[p] == text[t])) {
-            ++p;
-            ++t;
-            continue;
+ExcludeMatcher::ExcludeMatcher(const ExcludeRules& rules)
+    : segment_globs_(GlobAutomaton::Syntax::Anything),
+      path_globs_(GlobAutomaton::Syntax::Anything) {
+    // Views into names_ must stay valid, so it is never reallocated.
+    names_.reserve(rules.patterns.size());
+    for (const auto& raw_pattern : rules.patterns) {
+        names_.push_back(ToLowerAscii(raw_pattern));
+        std::string_view pattern = names_.back();
+        if (pattern.find('/') != std::string_view::npos) {
+            path_globs_.AddPattern(pattern, 0);
+        } else if (!HasWildcard(pattern)) {
+            literals_.insert(pattern);
+        } else if (pattern[0] == '*' && !HasWildcard(pattern.substr(1))) {
+            std::string_view suffix = pattern.substr(1);
+            suffixes_.insert(suffix);
+            if (std::find(suffix_lengths_.begin(), suffix_lengths_.end(), suffix.size()) ==
+                suffix_lengths_.end()) {
+                suffix_lengths_.push_back(suffix.size());
+            }
+        } else {
+            segment_globs_.AddPattern(pattern, 0);
         }
-        if (p < pattern.size() && pattern[p] == '*') {
-            star = p;
-            match = t;
-            ++p;
-            continue;
+    }
+}
+
+ExcludeMatcher::State ExcludeMatcher::RootState() const {
+    return path_globs_.Empty() ? GlobAutomaton::kDead : path_globs_.Start();
+}
+
+bool ExcludeMatcher::MatchesSegment(std::string_view lower_name) const {
+    if (!literals_.empty() && literals_.count(lower_name) != 0) {
+        return true;
+    }
+    for (std::size_t length : suffix_lengths_) {
+        if (length <= lower_name.size() &&
+            suffixes_.count(lower_name.substr(lower_name.size() - length)) != 0) {
+            return true;
         }
-        if (star != std::string::npos) {
-            p = star + 1;
-            ++match;
-            t = match;
-            continue;
+    }
+    if (!segment_globs_.Empty()) {
+        GlobAutomaton::State state = segment_globs_.Feed(segment_globs_.Start(), lower_name);
+        if (segment_globs_.MatchedRule(state, false) != GlobAutomaton::kNoRule) {
+            return true;
         }
-        return false;
     }
+    return false;
+}
 
-    while (p < pattern.size() && pattern[p] == '*') {
-        ++p;
+bool ExcludeMatcher::ExcludesChild(State parent, std::string_view name, State* child) const {
+    char buffer[256];
+    std::string heap;
+    std::string_view lower;
+    if (name.size() <= sizeof(buffer)) {
+        for (std::size_t i = 0; i < name.size(); ++i) {
+            char c = name[i];
+            buffer[i] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+        }
+        lower = std::string_view(buffer, name.size());
+    } else {
+        heap = ToLowerAscii(std::string(name));
+        lower = heap;
+    }
+
+    if (MatchesSegment(lower)) {
+        return true;
     }
-    return p == pattern.size();
-}
 
-std::vector<std::string> SplitPath(const std::string& value) {
-    std::vector<std::string> parts;
-    std::stringstream ss(value);
-    std::string item;
-    while (std::getline(ss, item, '/')) {
-        if (!item.empty()) {
-            parts.push_back(item);
+    State state = GlobAutomaton::kDead;
+    if (parent != GlobAutomaton::kDead) {
+        state = path_globs_.Feed(parent, lower);
+        if (path_globs_.MatchedRule(state, false) != GlobAutomaton::kNoRule) {
+            return true;
         }
+        state = path_globs_.Step(state, '/');
+    }
+    if (child) {
+        *child = state;
     }
-    return parts;
+    return false;
 }
 
-}  // namespace
+bool ExcludeMatcher::Excludes(std::string_view relative_utf8) const {
+    State state = RootState();
+    std::size_t pos = 0;
+    while (pos <= relative_utf8.size()) {
+        std::size_t slash = relative_utf8.find('/', pos);
+        if (slash == std::string_view::npos) {
+            slash = relative_utf8.size();
+        }
+        if (slash > pos && ExcludesChild(state, relative_utf8.substr(pos, slash - pos), &state)) {
+            return true;
+        }
+        pos = slash + 1;
+    }
+    return false;
+}
 
 ExcludeRules BuildDefaultExcludeRules() {
     ExcludeRules rules;
@@ -72,23 +127,5 @@ ExcludeRules BuildDefaultExcludeRules() {
 }
 
 bool ShouldExclude(const std::filesystem::path& relative, const ExcludeRules& rules) {
-    std::string rel = ToLowerAscii(PathToGenericUtf8(relative));
-    std::vector<std::string> segments = SplitPath(rel);
-
-    for (const auto& raw_pattern : rules.patterns) {
-        std::string pattern = ToLowerAscii(raw_pattern);
-        if (pattern.find('/') != std::string::npos) {
-            if (GlobMatch(pattern, rel)) {
-                return true;
-            }
-        } else {
-            for (const auto& segment : segments) {
-                if (GlobMatch(pattern, segment)) {
-                    return true;
-                }
-            }
-        }
-    }
-
-    return false;
+    return ExcludeMatcher(rules).Excludes(PathToGenericUtf8(relative));
 }
@@ -0,0 +1,68 @@
+#include "fair_scheduler.h"
+
+#include <algorithm>
+#include <utility>
+
+std::size_t FairScheduler::AddFlow(std::uint32_t weight, std::vector<std::uint64_t> costs,
+                                   const std::vector<std::uint8_t>& urgent) {
+    Flow flow;
+    flow.weight = std::max<std::uint32_t>(1, weight);
+    total_ += costs.size();
+    for (std::size_t i = 0; i < costs.size(); ++i) {
+        flow.queue[i < urgent.size() && urgent[i] ? 0 : 1].push_back(i);
+    }
+    flow.costs = std::move(costs);
+    flows_.push_back(std::move(flow));
+    return flows_.size() - 1;
+}
+
+void FairScheduler::SetPromotion(std::size_t flow, Promotion promotion) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    flows_[flow].promotion = promotion;
+}
+
+int FairScheduler::HeadQueue(const Flow& flow) {
+    bool urgent = flow.next[0] < flow.queue[0].size();
+    bool other = flow.next[1] < flow.queue[1].size();
+    if (!urgent || !other) {
+        return urgent ? 0 : other ? 1 : -1;
+    }
+    if (flow.promotion != Promotion::None) {
+        return 0;
+    }
+    return flow.queue[0][flow.next[0]] < flow.queue[1][flow.next[1]] ? 0 : 1;
+}
+
+bool FairScheduler::Next(Pick* pick) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Flow* best = nullptr;
+    int best_queue = -1;
+    bool best_first = false;
+    double best_finish = 0.0;
+    for (Flow& flow : flows_) {
+        int queue = HeadQueue(flow);
+        if (queue < 0) {
+            continue;
+        }
+        std::size_t item = flow.queue[queue][flow.next[queue]];
+        bool first = queue == 0 && flow.promotion == Promotion::Global;
+        double finish = flow.finish +
+                        static_cast<double>(std::max(flow.costs[item], kMinScheduleCost)) /
+                            flow.weight;
+        // Globally promoted items first, then by finish time; ties go to the
+        // earlier flow.
+        if (!best || (first && !best_first) || (first == best_first && finish < best_finish)) {
+            best = &flow;
+            best_queue = queue;
+            best_first = first;
+            best_finish = finish;
+        }
+    }
+    if (!best) {
+        return false;
+    }
+    pick->flow = static_cast<std::size_t>(best - flows_.data());
+    pick->item = best->queue[best_queue][best->next[best_queue]++];
+    best->finish = best_finish;
+    return true;
+}
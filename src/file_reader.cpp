@@ -0,0 +1,291 @@
+#include "file_reader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#endif
+
+namespace {
+
+// Bytes read between two DONTNEED calls.
+constexpr std::uint64_t kDropWindow = 8ULL << 20;
+// Direct reads go through a chunk of this size, aligned for any sector or
+// logical block size in use.
+constexpr std::size_t kDirectChunk = 1 << 20;
+constexpr std::size_t kDirectAlign = 4096;
+
+std::string LastError() {
+#ifdef _WIN32
+    return std::system_category().message(static_cast<int>(GetLastError()));
+#else
+    return std::strerror(errno);
+#endif
+}
+
+}  // namespace
+
+bool ParseReadCacheMode(const std::string& text, ReadCacheMode* mode) {
+    if (text == "buffered") {
+        *mode = ReadCacheMode::Buffered;
+    } else if (text == "drop-behind") {
+        *mode = ReadCacheMode::DropBehind;
+    } else if (text == "direct") {
+        *mode = ReadCacheMode::Direct;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+const char* ReadCacheModeName(ReadCacheMode mode) {
+    switch (mode) {
+        case ReadCacheMode::DropBehind:
+            return "drop-behind";
+        case ReadCacheMode::Direct:
+            return "direct";
+        default:
+            return "buffered";
+    }
+}
+
+FileReader::FileReader(const ReadOptions& options) : options_(options) {}
+
+FileReader::~FileReader() {
+    Close();
+}
+
+#ifdef _WIN32
+
+bool FileReader::Open(const std::filesystem::path& path, std::string* error) {
+    Close();
+    WIN32_FILE_ATTRIBUTE_DATA data{};
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) {
+        *error = "Failed to open file for upload: " + LastError();
+        return false;
+    }
+    std::uint64_t size = (static_cast<std::uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+    DWORD flags = FILE_ATTRIBUTE_NORMAL;
+    if (options_.mode != ReadCacheMode::Buffered) {
+        flags |= FILE_FLAG_SEQUENTIAL_SCAN;
+    }
+    direct_ = options_.mode == ReadCacheMode::Direct && size >= options_.direct_min;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    if (direct_) {
+        file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           flags | FILE_FLAG_NO_BUFFERING, nullptr);
+        direct_ = file != INVALID_HANDLE_VALUE;
+    }
+    if (!direct_) {
+        file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           flags, nullptr);
+    }
+    if (file == INVALID_HANDLE_VALUE) {
+        *error = "Failed to open file for upload: " + LastError();
+        return false;
+    }
+    LARGE_INTEGER size_info{};
+    if (!GetFileSizeEx(file, &size_info)) {
+        *error = "Failed to get file size: " + LastError();
+        CloseHandle(file);
+        direct_ = false;
+        return false;
+    }
+    handle_ = file;
+    size_ = static_cast<std::uint64_t>(size_info.QuadPart);
+    begin_ = 0;
+    end_ = size_;
+    return Rewind(error);
+}
+
+void FileReader::Close() {
+    if (handle_) {
+        CloseHandle(static_cast<HANDLE>(handle_));
+        handle_ = nullptr;
+    }
+    direct_ = false;
+}
+
+bool FileReader::Rewind(std::string* error) {
+    LARGE_INTEGER begin{};
+    begin.QuadPart = static_cast<LONGLONG>(begin_);
+    if (!SetFilePointerEx(static_cast<HANDLE>(handle_), begin, nullptr, FILE_BEGIN)) {
+        *error = LastError();
+        return false;
+    }
+    offset_ = begin_;
+    dropped_ = begin_;
+    chunk_pos_ = 0;
+    chunk_len_ = 0;
+    return true;
+}
+
+bool FileReader::ReadRaw(char* buffer, std::size_t capacity, std::size_t* read,
+                         std::string* error) {
+    DWORD got = 0;
+    if (!ReadFile(static_cast<HANDLE>(handle_), buffer, static_cast<DWORD>(capacity), &got,
+                  nullptr)) {
+        *error = LastError();
+        return false;
+    }
+    *read = got;
+    return true;
+}
+
+// The cache manager unmaps pages behind a FILE_FLAG_SEQUENTIAL_SCAN reader
+// by itself.
+void FileReader::DropBehind(bool all) {
+    (void)all;
+}
+
+#else
+
+bool FileReader::Open(const std::filesystem::path& path, std::string* error) {
+    Close();
+    struct stat st {};
+    if (::stat(path.c_str(), &st) != 0) {
+        *error = "Failed to open file for upload: " + LastError();
+        return false;
+    }
+    direct_ = options_.mode == ReadCacheMode::Direct &&
+              static_cast<std::uint64_t>(st.st_size) >= options_.direct_min;
+#ifdef O_DIRECT
+    if (direct_) {
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECT);
+    }
+#endif
+    // tmpfs and some network file systems refuse O_DIRECT.
+    direct_ = fd_ >= 0;
+    if (!direct_) {
+        fd_ = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (fd_ < 0) {
+        *error = "Failed to open file for upload: " + LastError();
+        return false;
+    }
+    if (::fstat(fd_, &st) != 0) {
+        *error = "Failed to get file size: " + LastError();
+        Close();
+        return false;
+    }
+    size_ = static_cast<std::uint64_t>(st.st_size);
+    begin_ = 0;
+    end_ = size_;
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (options_.mode != ReadCacheMode::Buffered && !direct_) {
+        ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+#endif
+    return Rewind(error);
+}
+
+void FileReader::Close() {
+    if (fd_ >= 0) {
+        DropBehind(true);
+        ::close(fd_);
+        fd_ = -1;
+    }
+    direct_ = false;
+}
+
+bool FileReader::Rewind(std::string* error) {
+    if (::lseek(fd_, static_cast<off_t>(begin_), SEEK_SET) != static_cast<off_t>(begin_)) {
+        *error = LastError();
+        return false;
+    }
+    offset_ = begin_;
+    dropped_ = begin_;
+    chunk_pos_ = 0;
+    chunk_len_ = 0;
+    return true;
+}
+
+bool FileReader::ReadRaw(char* buffer, std::size_t capacity, std::size_t* read,
+                         std::string* error) {
+    while (true) {
+        ssize_t got = ::read(fd_, buffer, capacity);
+        if (got >= 0) {
+            *read = static_cast<std::size_t>(got);
+            return true;
+        }
+        if (errno != EINTR) {
+            *error = LastError();
+            return false;
+        }
+    }
+}
+
+void FileReader::DropBehind(bool all) {
+#ifdef POSIX_FADV_DONTNEED
+    if (options_.mode == ReadCacheMode::Buffered || direct_) {
+        return;
+    }
+    if (all) {
+        ::posix_fadvise(fd_, 0, 0, POSIX_FADV_DONTNEED);
+        dropped_ = offset_;
+    } else if (offset_ - dropped_ >= kDropWindow) {
+        ::posix_fadvise(fd_, static_cast<off_t>(dropped_), static_cast<off_t>(offset_ - dropped_),
+                        POSIX_FADV_DONTNEED);
+        dropped_ = offset_;
+    }
+#else
+    (void)all;
+#endif
+}
+
+#endif
+
+bool FileReader::SetRange(std::uint64_t offset, std::uint64_t length, std::string* error) {
+    if (offset > size_ || length > size_ - offset || (direct_ && offset % kDirectChunk != 0)) {
+        *error = "Invalid range of " + std::to_string(length) + " bytes at " +
+                 std::to_string(offset) + " of a file of " + std::to_string(size_) + " bytes";
+        return false;
+    }
+    begin_ = offset;
+    end_ = offset + length;
+    return Rewind(error);
+}
+
+bool FileReader::Read(char* buffer, std::size_t capacity, std::size_t* read, std::string* error) {
+    if (!direct_) {
+        capacity = static_cast<std::size_t>((std::min)(
+            static_cast<std::uint64_t>(capacity), end_ - offset_));
+        *read = 0;
+        if (capacity > 0 && !ReadRaw(buffer, capacity, read, error)) {
+            return false;
+        }
+        offset_ += *read;
+        DropBehind(false);
+        return true;
+    }
+
+    if (chunk_pos_ == chunk_len_) {
+        if (!chunk_) {
+            chunk_storage_.reset(new char[kDirectChunk + kDirectAlign]);
+            std::uintptr_t raw = reinterpret_cast<std::uintptr_t>(chunk_storage_.get());
+            chunk_ = chunk_storage_.get() + (kDirectAlign - raw % kDirectAlign) % kDirectAlign;
+        }
+        // Whole aligned chunks at aligned offsets; only the last is short.
+        chunk_pos_ = 0;
+        chunk_len_ = 0;
+        if (offset_ < end_ && !ReadRaw(chunk_, kDirectChunk, &chunk_len_, error)) {
+            return false;
+        }
+        // The last chunk of a range may read past its end.
+        chunk_len_ = static_cast<std::size_t>((std::min)(
+            static_cast<std::uint64_t>(chunk_len_), end_ - offset_));
+        offset_ += chunk_len_;
+    }
+    *read = (std::min)(capacity, chunk_len_ - chunk_pos_);
+    std::memcpy(buffer, chunk_ + chunk_pos_, *read);
+    chunk_pos_ += *read;
+    return true;
+}
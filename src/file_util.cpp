@@ -0,0 +1,73 @@
+#include "file_util.h"
+
+#include <cstdio>
+#include <system_error>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace {
+
+bool Fail(std::string* error, const std::string& message) {
+    if (error) {
+        *error = message;
+    }
+    return false;
+}
+
+std::FILE* OpenFile(const std::filesystem::path& path, bool write) {
+#ifdef _WIN32
+    return _wfopen(path.c_str(), write ? L"wb" : L"rb");
+#else
+    return std::fopen(path.c_str(), write ? "wb" : "rb");
+#endif
+}
+
+}  // namespace
+
+bool WriteFileAtomic(const std::filesystem::path& path, std::string_view data, std::string* error) {
+    std::filesystem::path temp = path;
+    temp += ".tmp";
+    std::FILE* file = OpenFile(temp, true);
+    if (!file) {
+        return Fail(error, "cannot create " + temp.string());
+    }
+    bool ok = std::fwrite(data.data(), 1, data.size(), file) == data.size() &&
+              std::fflush(file) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(file)) == 0;
+#else
+    ok = ok && fsync(fileno(file)) == 0;
+#endif
+    ok = std::fclose(file) == 0 && ok;
+    std::error_code ec;
+    if (!ok) {
+        std::filesystem::remove(temp, ec);
+        return Fail(error, "cannot write " + temp.string());
+    }
+    std::filesystem::rename(temp, path, ec);
+    if (ec) {
+        std::filesystem::remove(temp, ec);
+        return Fail(error, "cannot rename into place: " + path.string());
+    }
+    return true;
+}
+
+bool ReadWholeFile(const std::filesystem::path& path, std::string* data, std::string* error) {
+    std::FILE* file = OpenFile(path, false);
+    if (!file) {
+        return Fail(error, "cannot open " + path.string());
+    }
+    data->clear();
+    char buffer[64 * 1024];
+    std::size_t read = 0;
+    while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        data->append(buffer, read);
+    }
+    bool ok = !std::ferror(file);
+    std::fclose(file);
+    return ok || Fail(error, "cannot read " + path.string());
+}
@@ -0,0 +1,244 @@
+#include "glob_automaton.h"
+
+#include <algorithm>
+
+namespace {
+
+unsigned char FoldAscii(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c - 'A' + 'a') : c;
+}
+
+}  // namespace
+
+GlobAutomaton::GlobAutomaton(Syntax syntax) : syntax_(syntax) {
+    NewState();
+    Intern({});
+}
+
+std::uint32_t GlobAutomaton::NewState() {
+    nfa_.emplace_back();
+    return static_cast<std::uint32_t>(nfa_.size() - 1);
+}
+
+int GlobAutomaton::AddSet(const ByteSet& set) {
+    for (std::size_t i = 0; i < sets_.size(); ++i) {
+        if (sets_[i] == set) {
+            return static_cast<int>(i);
+        }
+    }
+    sets_.push_back(set);
+    return static_cast<int>(sets_.size() - 1);
+}
+
+void GlobAutomaton::AddPattern(std::string_view pattern, int rule, bool dir_only) {
+    ByteSet any;
+    any.fill(~0ULL);
+    ByteSet no_slash = any;
+    no_slash['/' / 64] &= ~(1ULL << ('/' % 64));
+    ByteSet slash{};
+    slash['/' / 64] |= 1ULL << ('/' % 64);
+
+    const bool segments = syntax_ == Syntax::PathSegments;
+    const int any_set = AddSet(any);
+    const int wild_set = AddSet(segments ? no_slash : any);
+
+    auto edge = [&](std::uint32_t from, int set) {
+        std::uint32_t to = NewState();
+        nfa_[from].edge_set = set;
+        nfa_[from].edge_target = to;
+        return to;
+    };
+    auto star = [&](std::uint32_t from, int set) {
+        std::uint32_t to = NewState();
+        nfa_[from].loop_set = set;
+        nfa_[from].epsilon.push_back(to);
+        return to;
+    };
+    auto literal = [&](unsigned char c) {
+        ByteSet set{};
+        c = FoldAscii(c);
+        set[c / 64] |= 1ULL << (c % 64);
+        return AddSet(set);
+    };
+
+    std::uint32_t cur = NewState();
+    nfa_[0].epsilon.push_back(cur);
+
+    std::size_t i = 0;
+    while (i < pattern.size()) {
+        char c = pattern[i];
+        if (c == '*') {
+            bool double_star = segments && i + 1 < pattern.size() && pattern[i + 1] == '*';
+            bool at_segment_start = i == 0 || pattern[i - 1] == '/';
+            if (double_star && at_segment_start && i + 2 < pattern.size() && pattern[i + 2] == '/') {
+                // "**/": zero or more whole directories.
+                std::uint32_t loop = NewState();
+                std::uint32_t next = NewState();
+                nfa_[cur].epsilon.push_back(next);
+                nfa_[cur].epsilon.push_back(loop);
+                nfa_[loop].loop_set = any_set;
+                nfa_[loop].edge_set = AddSet(slash);
+                nfa_[loop].edge_target = next;
+                cur = next;
+                i += 3;
+                continue;
+            }
+            if (double_star && at_segment_start && i + 2 == pattern.size()) {
+                // Trailing "**": everything below.
+                cur = star(cur, any_set);
+                i += 2;
+                continue;
+            }
+            cur = star(cur, wild_set);
+            i += double_star ? 2 : 1;
+            continue;
+        }
+        if (c == '?') {
+            cur = edge(cur, wild_set);
+            ++i;
+            continue;
+        }
+        if (segments && c == '\\' && i + 1 < pattern.size()) {
+            cur = edge(cur, literal(static_cast<unsigned char>(pattern[i + 1])));
+            i += 2;
+            continue;
+        }
+        if (segments && c == '[') {
+            std::size_t j = i + 1;
+            bool negate = j < pattern.size() && (pattern[j] == '!' || pattern[j] == '^');
+            if (negate) {
+                ++j;
+            }
+            ByteSet set{};
+            bool first = true;
+            while (j < pattern.size() && (first || pattern[j] != ']')) {
+                unsigned char lo = FoldAscii(static_cast<unsigned char>(pattern[j]));
+                unsigned char hi = lo;
+                if (j + 2 < pattern.size() && pattern[j + 1] == '-' && pattern[j + 2] != ']') {
+                    hi = FoldAscii(static_cast<unsigned char>(pattern[j + 2]));
+                    j += 2;
+                }
+                for (unsigned v = lo; v <= hi; ++v) {
+                    set[v / 64] |= 1ULL << (v % 64);
+                }
+                first = false;
+                ++j;
+            }
+            if (j < pattern.size()) {
+                if (negate) {
+                    for (auto& word : set) {
+                        word = ~word;
+                    }
+                }
+                set['/' / 64] &= ~(1ULL << ('/' % 64));
+                cur = edge(cur, AddSet(set));
+                i = j + 1;
+                continue;
+            }
+            // Unterminated class: treat '[' literally.
+        }
+        cur = edge(cur, literal(static_cast<unsigned char>(c)));
+        ++i;
+    }
+
+    nfa_[cur].rule = rule;
+    nfa_[cur].dir_only = dir_only;
+    pattern_count_++;
+}
+
+void GlobAutomaton::Close(std::vector<std::uint32_t>* nfa_states) const {
+    std::vector<std::uint32_t> pending = *nfa_states;
+    std::vector<bool> seen(nfa_.size(), false);
+    for (std::uint32_t s : *nfa_states) {
+        seen[s] = true;
+    }
+    while (!pending.empty()) {
+        std::uint32_t s = pending.back();
+        pending.pop_back();
+        for (std::uint32_t next : nfa_[s].epsilon) {
+            if (!seen[next]) {
+                seen[next] = true;
+                nfa_states->push_back(next);
+                pending.push_back(next);
+            }
+        }
+    }
+    std::sort(nfa_states->begin(), nfa_states->end());
+}
+
+GlobAutomaton::State GlobAutomaton::Intern(std::vector<std::uint32_t> nfa_states) const {
+    auto it = dfa_ids_.find(nfa_states);
+    if (it != dfa_ids_.end()) {
+        return it->second;
+    }
+    State id = static_cast<State>(dfa_sets_.size());
+    int rule_dir = kNoRule;
+    int rule_file = kNoRule;
+    for (std::uint32_t s : nfa_states) {
+        int rule = nfa_[s].rule;
+        if (rule == kNoRule) {
+            continue;
+        }
+        rule_dir = std::max(rule_dir, rule);
+        if (!nfa_[s].dir_only) {
+            rule_file = std::max(rule_file, rule);
+        }
+    }
+    dfa_rule_dir_.push_back(rule_dir);
+    dfa_rule_file_.push_back(rule_file);
+    dfa_next_.resize(dfa_next_.size() + 256, kUnknown);
+    dfa_ids_.emplace(nfa_states, id);
+    dfa_sets_.push_back(std::move(nfa_states));
+    return id;
+}
+
+GlobAutomaton::State GlobAutomaton::Start() const {
+    if (start_ == kUnknown) {
+        std::vector<std::uint32_t> initial{0};
+        Close(&initial);
+        start_ = Intern(std::move(initial));
+    }
+    return start_;
+}
+
+GlobAutomaton::State GlobAutomaton::Step(State state, unsigned char c) const {
+    if (state == kDead) {
+        return kDead;
+    }
+    c = FoldAscii(c);
+    std::size_t slot = static_cast<std::size_t>(state) * 256 + c;
+    State cached = dfa_next_[slot];
+    if (cached != kUnknown) {
+        return cached;
+    }
+
+    std::vector<std::uint32_t> next;
+    for (std::uint32_t s : dfa_sets_[state]) {
+        const NfaState& nfa = nfa_[s];
+        if (nfa.loop_set >= 0 && (sets_[nfa.loop_set][c / 64] >> (c % 64)) & 1ULL) {
+            next.push_back(s);
+        }
+        if (nfa.edge_set >= 0 && (sets_[nfa.edge_set][c / 64] >> (c % 64)) & 1ULL) {
+            next.push_back(nfa.edge_target);
+        }
+    }
+    Close(&next);
+    next.erase(std::unique(next.begin(), next.end()), next.end());
+    State target = Intern(std::move(next));
+    dfa_next_[slot] = target;
+    return target;
+}
+
+GlobAutomaton::State GlobAutomaton::Feed(State state, std::string_view text) const {
+    for (char c : text) {
+        if (state == kDead) {
+            break;
+        }
+        state = Step(state, static_cast<unsigned char>(c));
+    }
+    return state;
+}
+
+int GlobAutomaton::MatchedRule(State state, bool is_dir) const {
+    return is_dir ? dfa_rule_dir_[state] : dfa_rule_file_[state];
+}
@@ -0,0 +1,432 @@
+#include "gzip_stream.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
+namespace {
+
+constexpr std::size_t kWindowSize = 32768;
+constexpr std::size_t kMinMatch = 3;
+constexpr std::size_t kMaxMatch = 258;
+constexpr int kHashBits = 15;
+constexpr std::size_t kHashSize = std::size_t{1} << kHashBits;
+// Chain steps per position, and a match length that ends the search early;
+// both keep the encoder near I/O speed at a small cost in ratio.
+constexpr int kMaxChain = 8;
+constexpr std::size_t kNiceMatch = 64;
+constexpr std::size_t kMaxInsertMatch = 16;
+constexpr std::size_t kInputChunk = 64 * 1024;
+
+constexpr std::size_t kSampleSize = 16 * 1024;
+constexpr double kMaxCompressibleEntropy = 7.0;
+
+const std::uint16_t kLengthBase[29] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                       31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const std::uint8_t kLengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+                                       2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const std::uint16_t kDistanceBase[30] = {1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+                                         33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+                                         1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+const std::uint8_t kDistanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+                                         6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+const std::array<std::uint32_t, 256>& CrcTable() {
+    static const std::array<std::uint32_t, 256> table = []() {
+        std::array<std::uint32_t, 256> out{};
+        for (std::uint32_t i = 0; i < 256; ++i) {
+            std::uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            }
+            out[i] = c;
+        }
+        return out;
+    }();
+    return table;
+}
+
+// Huffman codes are defined most significant bit first, deflate packs
+// bits from the least significant end.
+std::uint32_t ReverseBits(std::uint32_t code, int length) {
+    std::uint32_t out = 0;
+    for (int i = 0; i < length; ++i) {
+        out = (out << 1) | ((code >> i) & 1);
+    }
+    return out;
+}
+
+struct FixedCode {
+    std::uint16_t bits;
+    std::uint8_t length;
+};
+
+// Fixed literal/length codes (RFC 1951, 3.2.6), already bit-reversed.
+const std::array<FixedCode, 288>& FixedLiteralCodes() {
+    static const std::array<FixedCode, 288> table = []() {
+        std::array<FixedCode, 288> out{};
+        for (int value = 0; value < 288; ++value) {
+            std::uint32_t code = 0;
+            int length = 0;
+            if (value < 144) {
+                code = 0x30 + value;
+                length = 8;
+            } else if (value < 256) {
+                code = 0x190 + value - 144;
+                length = 9;
+            } else if (value < 280) {
+                code = value - 256;
+                length = 7;
+            } else {
+                code = 0xC0 + value - 280;
+                length = 8;
+            }
+            out[value] = {static_cast<std::uint16_t>(ReverseBits(code, length)),
+                          static_cast<std::uint8_t>(length)};
+        }
+        return out;
+    }();
+    return table;
+}
+
+std::uint32_t Hash3(const unsigned char* p) {
+    std::uint32_t value = p[0] | (p[1] << 8) | (p[2] << 16);
+    return (value * 2654435761u) >> (32 - kHashBits);
+}
+
+std::size_t MatchLength(const unsigned char* a, const unsigned char* b, std::size_t limit) {
+    std::size_t length = 0;
+    while (length + 8 <= limit) {
+        std::uint64_t x = 0;
+        std::uint64_t y = 0;
+        std::memcpy(&x, a + length, 8);
+        std::memcpy(&y, b + length, 8);
+        if (x != y) {
+            break;
+        }
+        length += 8;
+    }
+    while (length < limit && a[length] == b[length]) {
+        length++;
+    }
+    return length;
+}
+
+void PutLittleEndian32(std::uint32_t value, std::string* out) {
+    for (int i = 0; i < 4; ++i) {
+        out->push_back(static_cast<char>((value >> (8 * i)) & 0xFF));
+    }
+}
+
+std::FILE* OpenForRead(const std::filesystem::path& path) {
+#ifdef _WIN32
+    return _wfopen(path.c_str(), L"rb");
+#else
+    return std::fopen(path.c_str(), "rb");
+#endif
+}
+
+}  // namespace
+
+std::uint32_t Crc32(std::uint32_t crc, const unsigned char* data, std::size_t size) {
+    const auto& table = CrcTable();
+    crc = ~crc;
+    for (std::size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+GzipEncoder::GzipEncoder() {
+    Reset();
+}
+
+void GzipEncoder::Reset() {
+    window_.clear();
+    base_ = 0;
+    pos_ = 0;
+    head_.assign(kHashSize, -1);
+    prev_.assign(kWindowSize, -1);
+    bit_buffer_ = 0;
+    bit_count_ = 0;
+    crc_ = 0;
+    input_size_ = 0;
+    started_ = false;
+}
+
+void GzipEncoder::PutBits(std::uint32_t bits, int count, std::string* out) {
+    bit_buffer_ |= bits << bit_count_;
+    bit_count_ += count;
+    while (bit_count_ >= 8) {
+        out->push_back(static_cast<char>(bit_buffer_ & 0xFF));
+        bit_buffer_ >>= 8;
+        bit_count_ -= 8;
+    }
+}
+
+void GzipEncoder::PutLiteral(int value, std::string* out) {
+    const FixedCode& code = FixedLiteralCodes()[value];
+    PutBits(code.bits, code.length, out);
+}
+
+void GzipEncoder::PutMatch(std::size_t length, std::uint64_t distance, std::string* out) {
+    int code = static_cast<int>(std::upper_bound(std::begin(kLengthBase), std::end(kLengthBase),
+                                                 length) -
+                                std::begin(kLengthBase)) -
+               1;
+    PutLiteral(257 + code, out);
+    PutBits(static_cast<std::uint32_t>(length - kLengthBase[code]), kLengthExtra[code], out);
+
+    int dcode = static_cast<int>(std::upper_bound(std::begin(kDistanceBase),
+                                                  std::end(kDistanceBase), distance) -
+                                 std::begin(kDistanceBase)) -
+                1;
+    PutBits(ReverseBits(dcode, 5), 5, out);
+    PutBits(static_cast<std::uint32_t>(distance - kDistanceBase[dcode]), kDistanceExtra[dcode],
+            out);
+}
+
+void GzipEncoder::Insert(std::uint64_t position) {
+    std::uint32_t h = Hash3(&window_[position - base_]);
+    prev_[position & (kWindowSize - 1)] = head_[h];
+    head_[h] = static_cast<std::int64_t>(position);
+}
+
+void GzipEncoder::Encode(bool final, std::string* out) {
+    while (true) {
+        std::size_t index = static_cast<std::size_t>(pos_ - base_);
+        std::size_t available = window_.size() - index;
+        // Without the full lookahead a match could come out shorter than
+        // with more input, which would make the output depend on chunking.
+        if (available == 0 || (!final && available < kMaxMatch + kMinMatch)) {
+            break;
+        }
+        std::size_t best_length = 0;
+        std::uint64_t best_distance = 0;
+        if (available >= kMinMatch) {
+            std::size_t max_length = std::min(available, kMaxMatch);
+            const unsigned char* current = &window_[index];
+            std::int64_t candidate = head_[Hash3(current)];
+            for (int chain = kMaxChain;
+                 candidate >= 0 && pos_ - static_cast<std::uint64_t>(candidate) <= kWindowSize &&
+                 chain > 0;
+                 --chain) {
+                const unsigned char* previous = &window_[candidate - base_];
+                if (previous[best_length] == current[best_length]) {
+                    std::size_t length = MatchLength(previous, current, max_length);
+                    if (length > best_length) {
+                        best_length = length;
+                        best_distance = pos_ - static_cast<std::uint64_t>(candidate);
+                        if (length >= std::min(max_length, kNiceMatch)) {
+                            break;
+                        }
+                    }
+                }
+                candidate = prev_[candidate & (kWindowSize - 1)];
+            }
+            Insert(pos_);
+        }
+
+        if (best_length >= kMinMatch) {
+            PutMatch(best_length, best_distance, out);
+            // Positions inside long matches are not indexed (as zlib's fast
+            // levels do); long runs would mostly add useless chain entries.
+            if (best_length <= kMaxInsertMatch) {
+                for (std::size_t k = 1; k < best_length; ++k) {
+                    if (index + k + kMinMatch <= window_.size()) {
+                        Insert(pos_ + k);
+                    }
+                }
+            }
+            pos_ += best_length;
+        } else {
+            PutLiteral(window_[index], out);
+            pos_++;
+        }
+    }
+
+    // Keep one window of history; drop the rest once it has doubled.
+    std::size_t consumed = static_cast<std::size_t>(pos_ - base_);
+    if (consumed > 2 * kWindowSize) {
+        std::size_t drop = consumed - kWindowSize;
+        window_.erase(window_.begin(), window_.begin() + drop);
+        base_ += drop;
+    }
+}
+
+void GzipEncoder::Write(const unsigned char* data, std::size_t size, std::string* out) {
+    if (!started_) {
+        // No name and a zero mtime, so equal input gives equal output.
+        const unsigned char header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+        out->append(reinterpret_cast<const char*>(header), sizeof(header));
+        // One fixed-Huffman block, not final.
+        PutBits(0, 1, out);
+        PutBits(1, 2, out);
+        started_ = true;
+    }
+    crc_ = Crc32(crc_, data, size);
+    input_size_ += size;
+    window_.insert(window_.end(), data, data + size);
+    Encode(false, out);
+}
+
+void GzipEncoder::Finish(std::string* out) {
+    Write(nullptr, 0, out);
+    Encode(true, out);
+    PutLiteral(256, out);
+    // An empty final block ends the stream.
+    PutBits(1, 1, out);
+    PutBits(1, 2, out);
+    PutLiteral(256, out);
+    if (bit_count_ > 0) {
+        PutBits(0, 8 - bit_count_, out);
+    }
+    PutLittleEndian32(crc_, out);
+    PutLittleEndian32(static_cast<std::uint32_t>(input_size_), out);
+}
+
+bool LooksCompressible(const std::filesystem::path& path, std::uint64_t size) {
+    if (size < kMinCompressSize) {
+        return false;
+    }
+    std::FILE* file = OpenForRead(path);
+    if (!file) {
+        return false;
+    }
+    std::vector<std::uint64_t> offsets = {0};
+    if (size > 3 * kSampleSize) {
+        offsets.push_back(size / 2);
+        offsets.push_back(size - kSampleSize);
+    }
+    std::array<std::uint64_t, 256> counts{};
+    std::uint64_t total = 0;
+    std::vector<unsigned char> buffer(kSampleSize);
+    for (std::uint64_t offset : offsets) {
+#ifdef _WIN32
+        bool seeked = _fseeki64(file, static_cast<__int64>(offset), SEEK_SET) == 0;
+#else
+        bool seeked = fseeko(file, static_cast<off_t>(offset), SEEK_SET) == 0;
+#endif
+        if (!seeked) {
+            break;
+        }
+        std::size_t got = std::fread(buffer.data(), 1, buffer.size(), file);
+        for (std::size_t i = 0; i < got; ++i) {
+            counts[buffer[i]]++;
+        }
+        total += got;
+    }
+    std::fclose(file);
+    if (total == 0) {
+        return false;
+    }
+    double entropy = 0.0;
+    for (std::uint64_t count : counts) {
+        if (count > 0) {
+            double p = static_cast<double>(count) / static_cast<double>(total);
+            entropy -= p * std::log2(p);
+        }
+    }
+    return entropy < kMaxCompressibleEntropy;
+}
+
+GzipFileBody::GzipFileBody(const std::filesystem::path& path) : path_(path) {}
+
+GzipFileBody::~GzipFileBody() {
+    if (file_) {
+        std::fclose(file_);
+    }
+}
+
+bool GzipFileBody::Open(std::string* error) {
+    file_ = OpenForRead(path_);
+    if (!file_) {
+        *error = "Failed to open file for upload";
+        return false;
+    }
+    input_.resize(kInputChunk);
+    if (!Rewind(error)) {
+        return false;
+    }
+    size_ = 0;
+    source_size_ = 0;
+    while (!finished_) {
+        std::size_t got = 0;
+        if (!Pump(&got, error)) {
+            return false;
+        }
+        source_size_ += got;
+        size_ += pending_.size();
+        pending_.clear();
+    }
+    return Rewind(error);
+}
+
+bool GzipFileBody::Rewind(std::string* error) {
+    if (std::fseek(file_, 0, SEEK_SET) != 0) {
+        *error = "Failed to rewind file";
+        return false;
+    }
+    encoder_.Reset();
+    pending_.clear();
+    pending_pos_ = 0;
+    finished_ = false;
+    produced_ = 0;
+    return true;
+}
+
+bool GzipFileBody::Pump(std::size_t* got, std::string* error) {
+    *got = std::fread(input_.data(), 1, input_.size(), file_);
+    if (*got > 0) {
+        encoder_.Write(input_.data(), *got, &pending_);
+        return true;
+    }
+    if (std::ferror(file_)) {
+        *error = "Failed to read file";
+        return false;
+    }
+    encoder_.Finish(&pending_);
+    finished_ = true;
+    return true;
+}
+
+bool GzipFileBody::Read(char* buffer, std::size_t capacity, std::size_t* read,
+                        std::string* error) {
+    std::size_t out = 0;
+    while (out < capacity) {
+        if (pending_pos_ < pending_.size()) {
+            std::size_t n = std::min(capacity - out, pending_.size() - pending_pos_);
+            std::memcpy(buffer + out, pending_.data() + pending_pos_, n);
+            out += n;
+            pending_pos_ += n;
+            continue;
+        }
+        if (finished_) {
+            break;
+        }
+        pending_.clear();
+        pending_pos_ = 0;
+        std::size_t got = 0;
+        if (!Pump(&got, error)) {
+            return false;
+        }
+    }
+    produced_ += out;
+    if (produced_ > size_ || (out < capacity && produced_ != size_)) {
+        *error = "File changed while it was compressed";
+        return false;
+    }
+    *read = out;
+    return true;
+}
+
+bool GzipCompressedSize(const std::filesystem::path& path, std::uint64_t* size,
+                        std::string* error) {
+    GzipFileBody body(path);
+    if (!body.Open(error)) {
+        return false;
+    }
+    *size = body.Size();
+    return true;
+}
@@ -0,0 +1,379 @@
+#include "http_trace.h"
+
+#include <algorithm>
+#include <map>
+#include <thread>
+
+#include "binary_io.h"
+#include "file_util.h"
+#include "status_board.h"
+
+namespace {
+
+const char kTraceMagic[8] = {'U', 'P', 'L', 'T', 'R', 'A', 'C', 'E'};
+constexpr std::uint32_t kTraceVersion = 1;
+
+const char* const kMethodNames[kTraceMethods] = {"PROPFIND", "MKCOL", "PUT", "COPY", "MOVE",
+                                                 "OTHER"};
+
+// What a method answers when the trace has no request of it at all.
+const std::uint16_t kDefaultStatus[kTraceMethods] = {207, 201, 201, 201, 201, 200};
+
+// A listing whose only entry is missing: the collection exists, and any
+// file asked for is not there.
+const char kEmptyListing[] =
+    "<?xml version=\"1.0\" encoding=\"utf-8\"?><d:multistatus xmlns:d=\"DAV:\">"
+    "<d:response><d:href>/</d:href><d:status>HTTP/1.1 404 Not Found</d:status></d:response>"
+    "</d:multistatus>";
+
+std::uint64_t QueueKey(TraceMethod method, std::uint64_t path_hash) {
+    return path_hash * kTraceMethods + static_cast<std::uint64_t>(method);
+}
+
+std::uint32_t Median(std::vector<std::uint32_t>* values) {
+    if (values->empty()) {
+        return 0;
+    }
+    auto middle = values->begin() + values->size() / 2;
+    std::nth_element(values->begin(), middle, values->end());
+    return *middle;
+}
+
+bool Fail(std::string* error, const std::string& message) {
+    if (error) {
+        *error = message;
+    }
+    return false;
+}
+
+class RecordingTransport : public WebDavTransport {
+public:
+    RecordingTransport(std::unique_ptr<WebDavTransport> inner, TraceRecorder* recorder,
+                       std::uint32_t client)
+        : inner_(std::move(inner)), recorder_(recorder), client_(client) {}
+
+    bool IsReady() const override { return inner_->IsReady(); }
+
+    WebDavResponse Send(const HttpRequest& request, RateLimiter* limiter, WorkerStatus* status,
+                        HttpTimings* timings, std::string* error) override {
+        TraceRecord record;
+        record.start_us = recorder_->ElapsedUs();
+        WebDavResponse response = inner_->Send(request, limiter, status, &record.timings, error);
+        record.path_hash = TracePathHash(request.path);
+        record.request_bytes = request.body ? request.body->Size() : 0;
+        record.response_bytes = response.body.size();
+        record.client = client_;
+        record.status = static_cast<std::uint16_t>(response.status);
+        record.method = TraceMethodOf(request.method);
+        recorder_->Add(record);
+        if (timings) {
+            *timings = record.timings;
+        }
+        return response;
+    }
+
+private:
+    std::unique_ptr<WebDavTransport> inner_;
+    TraceRecorder* recorder_;
+    std::uint32_t client_;
+};
+
+class ReplayTransport : public WebDavTransport {
+public:
+    explicit ReplayTransport(TraceReplayer* replayer) : replayer_(replayer) {}
+
+    bool IsReady() const override { return true; }
+
+    WebDavResponse Send(const HttpRequest& request, RateLimiter* limiter, WorkerStatus* status,
+                        HttpTimings* timings, std::string* error) override;
+
+private:
+    TraceReplayer* replayer_;
+};
+
+WebDavResponse ReplayTransport::Send(const HttpRequest& request, RateLimiter* limiter,
+                                     WorkerStatus* status, HttpTimings* timings,
+                                     std::string* error) {
+    using Clock = std::chrono::steady_clock;
+    TraceMethod method = TraceMethodOf(request.method);
+    bool matched = false;
+    TraceRecord record = replayer_->Next(method, TracePathHash(request.path),
+                                         request.body ? request.body->Size() : 0, &matched);
+    std::this_thread::sleep_for(std::chrono::microseconds(record.timings.connect_us));
+
+    // The body is read as it would be sent, so the local side of a replayed
+    // run does its real work.
+    auto transfer_start = Clock::now();
+    if (request.body) {
+        if (status) {
+            status->sent.store(0, std::memory_order_relaxed);
+            status->SetState(WorkerState::Sending);
+        }
+        std::vector<char> buffer(64 * 1024);
+        std::size_t read = 0;
+        while (true) {
+            std::string read_error;
+            if (!request.body->Read(buffer.data(), buffer.size(), &read, &read_error)) {
+                *error = "Failed to read upload data: " + read_error;
+                return {};
+            }
+            if (read == 0) {
+                break;
+            }
+            if (limiter) {
+                limiter->Acquire(read);
+            }
+            if (status) {
+                status->sent.fetch_add(read, std::memory_order_relaxed);
+            }
+        }
+        if (status) {
+            status->SetState(WorkerState::Waiting);
+        }
+    }
+    std::this_thread::sleep_until(transfer_start +
+                                  std::chrono::microseconds(record.timings.transfer_us));
+    std::this_thread::sleep_for(std::chrono::microseconds(record.timings.ttfb_us));
+
+    if (timings) {
+        *timings = record.timings;
+    }
+    WebDavResponse response;
+    response.status = record.status;
+    if (record.status == 0) {
+        *error = "No response (replayed)";
+    } else if (method == TraceMethod::Propfind && record.status == 207) {
+        response.body = kEmptyListing;
+    }
+    return response;
+}
+
+}  // namespace
+
+TraceMethod TraceMethodOf(std::string_view method) {
+    for (std::size_t i = 0; i + 1 < kTraceMethods; ++i) {
+        if (method == kMethodNames[i]) {
+            return static_cast<TraceMethod>(i);
+        }
+    }
+    return TraceMethod::Other;
+}
+
+const char* TraceMethodName(TraceMethod method) {
+    return kMethodNames[static_cast<std::size_t>(method)];
+}
+
+std::uint64_t TracePathHash(std::string_view path) {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (char c : path) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool WriteTraceFile(const std::filesystem::path& path, const std::vector<TraceRecord>& records,
+                    std::string* error) {
+    std::vector<std::uint64_t> start;
+    std::vector<std::uint64_t> path_hash;
+    std::vector<std::uint64_t> request_bytes;
+    std::vector<std::uint64_t> response_bytes;
+    std::vector<std::uint32_t> connect;
+    std::vector<std::uint32_t> transfer;
+    std::vector<std::uint32_t> ttfb;
+    std::vector<std::uint32_t> client;
+    std::vector<std::uint16_t> status;
+    std::vector<std::uint8_t> method;
+    for (const TraceRecord& record : records) {
+        start.push_back(record.start_us);
+        path_hash.push_back(record.path_hash);
+        request_bytes.push_back(record.request_bytes);
+        response_bytes.push_back(record.response_bytes);
+        connect.push_back(record.timings.connect_us);
+        transfer.push_back(record.timings.transfer_us);
+        ttfb.push_back(record.timings.ttfb_us);
+        client.push_back(record.client);
+        status.push_back(record.status);
+        method.push_back(static_cast<std::uint8_t>(record.method));
+    }
+
+    std::string out(kTraceMagic, sizeof(kTraceMagic));
+    BinaryWriter writer(&out);
+    writer.Put<std::uint32_t>(kTraceVersion);
+    writer.PutColumn(start);
+    writer.PutColumn(path_hash);
+    writer.PutColumn(request_bytes);
+    writer.PutColumn(response_bytes);
+    writer.PutColumn(connect);
+    writer.PutColumn(transfer);
+    writer.PutColumn(ttfb);
+    writer.PutColumn(client);
+    writer.PutColumn(status);
+    writer.PutColumn(method);
+    return WriteFileAtomic(path, out, error);
+}
+
+bool ReadTraceFile(const std::filesystem::path& path, std::vector<TraceRecord>* records,
+                   std::string* error) {
+    std::string data;
+    if (!ReadWholeFile(path, &data, error)) {
+        return false;
+    }
+    if (data.size() < sizeof(kTraceMagic) ||
+        std::string_view(data).substr(0, sizeof(kTraceMagic)) !=
+            std::string_view(kTraceMagic, sizeof(kTraceMagic))) {
+        return Fail(error, "not a trace file");
+    }
+    BinaryReader reader(std::string_view(data).substr(sizeof(kTraceMagic)));
+    std::uint32_t version = reader.Get<std::uint32_t>();
+    std::vector<std::uint64_t> start;
+    std::vector<std::uint64_t> path_hash;
+    std::vector<std::uint64_t> request_bytes;
+    std::vector<std::uint64_t> response_bytes;
+    std::vector<std::uint32_t> connect;
+    std::vector<std::uint32_t> transfer;
+    std::vector<std::uint32_t> ttfb;
+    std::vector<std::uint32_t> client;
+    std::vector<std::uint16_t> status;
+    std::vector<std::uint8_t> method;
+    reader.GetColumn(&start);
+    reader.GetColumn(&path_hash);
+    reader.GetColumn(&request_bytes);
+    reader.GetColumn(&response_bytes);
+    reader.GetColumn(&connect);
+    reader.GetColumn(&transfer);
+    reader.GetColumn(&ttfb);
+    reader.GetColumn(&client);
+    reader.GetColumn(&status);
+    reader.GetColumn(&method);
+    std::size_t count = start.size();
+    if (version != kTraceVersion || !reader.Ok() || !reader.AtEnd() ||
+        path_hash.size() != count || request_bytes.size() != count ||
+        response_bytes.size() != count || connect.size() != count ||
+        transfer.size() != count || ttfb.size() != count || client.size() != count ||
+        status.size() != count || method.size() != count) {
+        return Fail(error, "invalid trace file");
+    }
+
+    records->clear();
+    records->reserve(count);
+    for (std::size_t i = 0; i < count; ++i) {
+        if (method[i] >= kTraceMethods) {
+            return Fail(error, "invalid trace file");
+        }
+        TraceRecord record;
+        record.start_us = start[i];
+        record.path_hash = path_hash[i];
+        record.request_bytes = request_bytes[i];
+        record.response_bytes = response_bytes[i];
+        record.timings = {connect[i], transfer[i], ttfb[i]};
+        record.client = client[i];
+        record.status = status[i];
+        record.method = static_cast<TraceMethod>(method[i]);
+        records->push_back(record);
+    }
+    return true;
+}
+
+std::unique_ptr<WebDavTransport> TraceRecorder::Wrap(std::unique_ptr<WebDavTransport> inner) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return std::make_unique<RecordingTransport>(std::move(inner), this, next_client_++);
+}
+
+void TraceRecorder::Add(const TraceRecord& record) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    records_.push_back(record);
+}
+
+std::uint64_t TraceRecorder::ElapsedUs() const {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                                          std::chrono::steady_clock::now() - start_)
+                                          .count());
+}
+
+std::size_t TraceRecorder::Size() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return records_.size();
+}
+
+bool TraceRecorder::Save(const std::filesystem::path& path, std::string* error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Requests are added as they finish; the file lists them as they began.
+    std::stable_sort(records_.begin(), records_.end(),
+                     [](const TraceRecord& a, const TraceRecord& b) {
+                         return a.start_us < b.start_us;
+                     });
+    return WriteTraceFile(path, records_, error);
+}
+
+TraceReplayer::TraceReplayer(std::vector<TraceRecord> records) : records_(std::move(records)) {
+    std::array<std::vector<std::uint32_t>, kTraceMethods> connect;
+    std::array<std::vector<std::uint32_t>, kTraceMethods> ttfb;
+    std::array<std::map<std::uint16_t, std::size_t>, kTraceMethods> statuses;
+    std::array<std::uint64_t, kTraceMethods> bytes{};
+    std::array<std::uint64_t, kTraceMethods> transfer_us{};
+    for (std::size_t i = 0; i < records_.size(); ++i) {
+        const TraceRecord& record = records_[i];
+        std::size_t method = static_cast<std::size_t>(record.method);
+        queues_[QueueKey(record.method, record.path_hash)].records.push_back(i);
+        if (record.status == 0) {
+            continue;
+        }
+        connect[method].push_back(record.timings.connect_us);
+        ttfb[method].push_back(record.timings.ttfb_us);
+        statuses[method][record.status]++;
+        if (record.request_bytes > 0 && record.timings.transfer_us > 0) {
+            bytes[method] += record.request_bytes;
+            transfer_us[method] += record.timings.transfer_us;
+        }
+    }
+    for (std::size_t method = 0; method < kTraceMethods; ++method) {
+        MethodModel& model = models_[method];
+        model.status = kDefaultStatus[method];
+        std::size_t most = 0;
+        for (const auto& status : statuses[method]) {
+            if (status.second > most) {
+                most = status.second;
+                model.status = status.first;
+            }
+        }
+        model.connect_us = Median(&connect[method]);
+        model.ttfb_us = Median(&ttfb[method]);
+        if (transfer_us[method] > 0) {
+            model.bytes_per_us =
+                static_cast<double>(bytes[method]) / static_cast<double>(transfer_us[method]);
+        }
+    }
+}
+
+std::unique_ptr<WebDavTransport> TraceReplayer::MakeTransport() {
+    return std::make_unique<ReplayTransport>(this);
+}
+
+TraceRecord TraceReplayer::Next(TraceMethod method, std::uint64_t path_hash,
+                                std::uint64_t request_bytes, bool* matched) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = queues_.find(QueueKey(method, path_hash));
+        if (found != queues_.end() && found->second.next < found->second.records.size()) {
+            *matched = true;
+            matched_++;
+            return records_[found->second.records[found->second.next++]];
+        }
+    }
+    const MethodModel& model = models_[static_cast<std::size_t>(method)];
+    TraceRecord record;
+    record.path_hash = path_hash;
+    record.request_bytes = request_bytes;
+    record.status = model.status;
+    record.method = method;
+    record.timings.connect_us = model.connect_us;
+    record.timings.ttfb_us = model.ttfb_us;
+    if (model.bytes_per_us > 0.0) {
+        record.timings.transfer_us = static_cast<std::uint32_t>((std::min)(
+            static_cast<double>(request_bytes) / model.bytes_per_us, 4294967295.0));
+    }
+    *matched = false;
+    modelled_++;
+    return record;
+}
@@ -0,0 +1,105 @@
+#include "ignore_file.h"
+
+#include "path_utils.h"
+
+IgnoreRuleSet::IgnoreRuleSet(std::string_view text)
+    : automaton_(GlobAutomaton::Syntax::PathSegments) {
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        std::size_t end = text.find('\n', pos);
+        if (end == std::string_view::npos) {
+            end = text.size();
+        }
+        std::string line(text.substr(pos, end - pos));
+        pos = end + 1;
+
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (negated_.empty() && line.compare(0, 3, "\xEF\xBB\xBF") == 0) {
+            line.erase(0, 3);
+        }
+        // Trailing spaces are dropped unless escaped with a backslash.
+        while (!line.empty() && line.back() == ' ' &&
+               !(line.size() >= 2 && line[line.size() - 2] == '\\')) {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        bool negated = false;
+        if (line[0] == '!') {
+            negated = true;
+            line.erase(0, 1);
+        }
+        bool dir_only = false;
+        if (!line.empty() && line.back() == '/') {
+            dir_only = true;
+            line.pop_back();
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        if (line.find('/') == std::string::npos) {
+            line = "**/" + line;
+        } else if (line[0] == '/') {
+            line.erase(0, 1);
+        }
+        automaton_.AddPattern(ToLowerAscii(line), static_cast<int>(negated_.size()), dir_only);
+        negated_.push_back(negated);
+    }
+}
+
+bool IsIgnored(const IgnoreChain& parent, std::string_view name, bool is_dir, IgnoreChain* child) {
+    if (parent.empty()) {
+        if (child) {
+            child->clear();
+        }
+        return false;
+    }
+
+    bool keep_chain = child && is_dir;
+    IgnoreChain next;
+    if (keep_chain) {
+        next.reserve(parent.size());
+    }
+    bool decided = false;
+    for (std::size_t i = parent.size(); i-- > 0;) {
+        const IgnoreLevel& level = parent[i];
+        IgnoreRuleSet::State state = level.rules->Feed(level.state, name);
+        if (!decided) {
+            int rule = level.rules->MatchedRule(state, is_dir);
+            if (rule != GlobAutomaton::kNoRule) {
+                if (!level.rules->Negated(rule)) {
+                    return true;
+                }
+                decided = true;
+            }
+        }
+        if (keep_chain) {
+            state = level.rules->EnterDirectory(state);
+            if (state != GlobAutomaton::kDead) {
+                next.push_back({level.rules, state});
+            }
+        } else if (decided) {
+            break;
+        }
+    }
+
+    if (child) {
+        child->assign(next.rbegin(), next.rend());
+    }
+    return false;
+}
+
+const IgnoreRuleSet* IgnoreFileCache::Compile(const std::string& text) {
+    files_loaded_++;
+    auto it = by_content_.find(text);
+    if (it == by_content_.end()) {
+        auto rules = std::make_unique<IgnoreRuleSet>(text);
+        it = by_content_.emplace(text, std::move(rules)).first;
+    }
+    return it->second->RuleCount() == 0 ? nullptr : it->second.get();
+}
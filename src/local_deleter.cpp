@@ -0,0 +1,204 @@
+#include "local_deleter.h"
+
+#include <algorithm>
+#include <string>
+#include <system_error>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace {
+
+#ifndef _WIN32
+// Open directory fds kept between batches; past this the cache is dropped.
+constexpr std::size_t kMaxCachedDirs = 128;
+#endif
+
+}  // namespace
+
+LocalDeleter::LocalDeleter(const PathStore& store, const std::filesystem::path& root,
+                           const std::filesystem::path& journal_path, Logger& logger,
+                           bool keep_files)
+    : store_(store),
+      root_(root),
+      journal_path_(journal_path),
+      logger_(logger),
+      keep_files_(keep_files),
+      start_(std::chrono::steady_clock::now()) {
+    thread_ = std::thread([this]() { Run(); });
+}
+
+LocalDeleter::~LocalDeleter() {
+    Finish();
+}
+
+void LocalDeleter::Enqueue(FileId file, bool jpg) {
+    bool was_empty = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        was_empty = queue_.empty();
+        queue_.push_back({file, jpg});
+    }
+    if (was_empty) {
+        wake_.notify_one();
+    }
+}
+
+DeletionStats LocalDeleter::Finish() {
+    if (thread_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+    }
+    return stats_;
+}
+
+void LocalDeleter::Run() {
+    std::vector<Request> batch;
+    while (true) {
+        bool stopping = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&]() { return stop_ || !queue_.empty(); });
+            batch.swap(queue_);
+            stopping = stop_;
+        }
+        DeleteBatch(&batch);
+        batch.clear();
+        if (stopping) {
+            // Enqueue is not called once Finish has started, so the queue
+            // taken above was the last one.
+            break;
+        }
+    }
+#ifndef _WIN32
+    CloseDirectoryFds();
+#endif
+    if (journal_) {
+        std::fclose(journal_);
+        journal_ = nullptr;
+    }
+}
+
+void LocalDeleter::DeleteBatch(std::vector<Request>* batch) {
+    if (batch->empty()) {
+        return;
+    }
+    // Files of one directory end up next to each other and reuse its fd.
+    std::sort(batch->begin(), batch->end(), [&](const Request& a, const Request& b) {
+        return store_.FileDirectory(a.file) < store_.FileDirectory(b.file);
+    });
+
+    std::string journal;
+    std::uint64_t freed = 0;
+    for (const Request& request : *batch) {
+        std::filesystem::path abs_path = store_.FileAbsolutePath(root_, request.file);
+        std::string error;
+        if (keep_files_) {
+            logger_.Info("Would delete local file " + abs_path.string());
+        } else if (!RemoveFile(request.file, &error)) {
+            logger_.Error("Failed to delete local file: " + abs_path.string() + " (" + error +
+                          ")");
+            stats_.errors++;
+            continue;
+        } else {
+            logger_.Info("Deleted local file " + abs_path.string());
+        }
+        if (request.jpg) {
+            stats_.deleted_jpg++;
+        } else {
+            stats_.deleted_old++;
+        }
+        freed += store_.FileSize(request.file);
+        if (!keep_files_) {
+            journal += abs_path.u8string();
+            journal.push_back('\n');
+        }
+    }
+    if (freed > 0) {
+        stats_.reclaimed.push_back(
+            {std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count(),
+             freed});
+    }
+
+    if (journal.empty()) {
+        return;
+    }
+    if (!journal_) {
+#ifdef _WIN32
+        journal_ = _wfopen(journal_path_.c_str(), L"ab");
+#else
+        journal_ = std::fopen(journal_path_.c_str(), "ab");
+#endif
+        if (!journal_) {
+            logger_.Error("Failed to open deletion list: " + journal_path_.string());
+            stats_.errors++;
+            return;
+        }
+    }
+    std::fwrite(journal.data(), 1, journal.size(), journal_);
+    std::fflush(journal_);
+}
+
+#ifdef _WIN32
+
+bool LocalDeleter::RemoveFile(FileId file, std::string* error) {
+    std::filesystem::path abs_path = store_.FileAbsolutePath(root_, file);
+    if (DeleteFileW(abs_path.c_str())) {
+        return true;
+    }
+    *error = std::system_category().message(static_cast<int>(GetLastError()));
+    return false;
+}
+
+#else
+
+int LocalDeleter::DirectoryFd(DirId dir, std::string* error) {
+    auto found = dir_fds_.find(dir);
+    if (found != dir_fds_.end()) {
+        return found->second;
+    }
+    if (dir_fds_.size() >= kMaxCachedDirs) {
+        CloseDirectoryFds();
+    }
+    std::filesystem::path dir_path = root_ / store_.DirectoryRelativePath(dir);
+    int fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = std::strerror(errno);
+        return -1;
+    }
+    dir_fds_.emplace(dir, fd);
+    return fd;
+}
+
+void LocalDeleter::CloseDirectoryFds() {
+    for (const auto& entry : dir_fds_) {
+        close(entry.second);
+    }
+    dir_fds_.clear();
+}
+
+bool LocalDeleter::RemoveFile(FileId file, std::string* error) {
+    int dir_fd = DirectoryFd(store_.FileDirectory(file), error);
+    if (dir_fd < 0) {
+        return false;
+    }
+    std::string name(store_.FileName(file));
+    if (unlinkat(dir_fd, name.c_str(), 0) != 0) {
+        *error = std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+#endif
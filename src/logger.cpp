@@ -1,71 +1,412 @@
 #include "logger.h"
 
-#include <chrono>
+#include <algorithm>
+#include <array>
 #include <ctime>
-#include <iomanip>
 #include <iostream>
-#include <sstream>
 
-Logger::Logger(const std::filesystem::path& log_dir) {
+#ifdef _WIN32
+#include <io.h>
+#include <share.h>
+#include <windows.h>
+#else
+#include <sys/ioctl.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+std::atomic<std::uint64_t> g_next_logger_id{1};
+
+const char* LevelName(LogLevel level) {
+    switch (level) {
+    case LogLevel::Warn:
+        return "WARN";
+    case LogLevel::Error:
+        return "ERROR";
+    default:
+        return "INFO";
+    }
+}
+
+std::tm LocalTime(std::time_t value) {
+    std::tm local_tm{};
+#ifdef _WIN32
+    localtime_s(&local_tm, &value);
+#else
+    localtime_r(&value, &local_tm);
+#endif
+    return local_tm;
+}
+
+// Columns of the terminal on stdout; 80 when unknown.
+std::size_t TerminalWidth() {
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) {
+        return static_cast<std::size_t>(info.srWindow.Right - info.srWindow.Left + 1);
+    }
+#else
+    winsize size{};
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0) {
+        return size.ws_col;
+    }
+#endif
+    return 80;
+}
+
+}  // namespace
+
+// Single-producer single-consumer ring: the owning thread pushes, the writer
+// thread drains. Strings are swapped in and out, never copied.
+class Logger::Ring {
+public:
+    static constexpr std::size_t kCapacity = 4096;
+
+    bool TryPush(Record* record) {
+        std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == kCapacity) {
+            return false;
+        }
+        Record& slot = slots_[tail % kCapacity];
+        slot.time_ns = record->time_ns;
+        slot.level = record->level;
+        slot.skip = record->skip;
+        slot.text.swap(record->text);
+        slot.detail.swap(record->detail);
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    void DrainInto(std::vector<Record>* batch) {
+        std::size_t head = head_.load(std::memory_order_relaxed);
+        std::size_t tail = tail_.load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            Record& slot = slots_[head % kCapacity];
+            batch->emplace_back();
+            Record& out = batch->back();
+            out.time_ns = slot.time_ns;
+            out.level = slot.level;
+            out.skip = slot.skip;
+            out.text.swap(slot.text);
+            out.detail.swap(slot.detail);
+        }
+        head_.store(head, std::memory_order_release);
+    }
+
+    std::size_t Size() const {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+private:
+    std::array<Record, kCapacity> slots_;
+    alignas(64) std::atomic<std::size_t> head_{0};
+    alignas(64) std::atomic<std::size_t> tail_{0};
+};
+
+Logger::Logger(const std::filesystem::path& log_dir, const LoggerOptions& options)
+    : options_(options), id_(g_next_logger_id.fetch_add(1)) {
     std::filesystem::create_directories(log_dir);
     log_path_ = BuildLogPath(log_dir);
-    file_.open(log_path_, std::ios::out | std::ios::app);
+#ifdef _WIN32
+    file_ = _wfsopen(log_path_.c_str(), L"a", _SH_DENYNO);
+#else
+    file_ = std::fopen(log_path_.c_str(), "a");
+#endif
+#ifdef _WIN32
+    terminal_ = options_.console && _isatty(_fileno(stdout));
+#else
+    terminal_ = options_.console && isatty(fileno(stdout));
+#endif
+    if (terminal_) {
+        // Read once; a line that wraps after a resize is erased badly until
+        // it is redrawn shorter.
+        status_width_ = TerminalWidth() - 1;
+    }
+    if (options_.async) {
+        writer_ = std::thread([this]() { WriterLoop(); });
+    }
 }
 
-void Logger::Info(const std::string& message) {
-    Write("INFO", message);
+Logger::~Logger() {
+    std::uint64_t dropped = skip_dropped_.exchange(0);
+    if (dropped > 0) {
+        Info("Rate limit: " + std::to_string(dropped) + " Skip lines suppressed");
+    }
+    if (writer_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            stop_ = true;
+        }
+        wake_.notify_one();
+        writer_.join();
+    }
+    if (file_) {
+        SyncFile();
+        std::fclose(file_);
+    }
 }
 
-void Logger::Warn(const std::string& message) {
-    Write("WARN", message);
+void Logger::Info(std::string message) {
+    if (Enabled(LogLevel::Info)) {
+        Submit({NowNs(), LogLevel::Info, false, std::move(message), {}});
+    }
 }
 
-void Logger::Error(const std::string& message) {
-    Write("ERROR", message);
+void Logger::Warn(std::string message) {
+    if (Enabled(LogLevel::Warn)) {
+        Submit({NowNs(), LogLevel::Warn, false, std::move(message), {}});
+    }
 }
 
-std::filesystem::path Logger::LogPath() const {
-    return log_path_;
+void Logger::Error(std::string message) {
+    if (Enabled(LogLevel::Error)) {
+        Submit({NowNs(), LogLevel::Error, false, std::move(message), {}});
+    }
+}
+
+void Logger::Skip(std::string name, std::string reason) {
+    if (!Enabled(LogLevel::Info)) {
+        return;
+    }
+    std::int64_t now = NowNs();
+    if (AdmitSkip(now)) {
+        Submit({now, LogLevel::Info, true, std::move(name), std::move(reason)});
+    }
 }
 
-void Logger::Write(const std::string& level, const std::string& message) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    std::string line = Timestamp() + " [" + level + "] " + message + "\n";
-    if (file_.is_open()) {
-        file_ << line;
-        file_.flush();
+bool Logger::AdmitSkip(std::int64_t now_ns) {
+    if (options_.skip_lines_per_second <= 0) {
+        return true;
     }
-    if (level == "ERROR") {
-        std::cerr << line;
+    std::int64_t second = now_ns / 1000000000LL;
+    std::int64_t window = skip_window_.load(std::memory_order_relaxed);
+    if (second != window &&
+        skip_window_.compare_exchange_strong(window, second, std::memory_order_relaxed)) {
+        skip_in_window_.store(0, std::memory_order_relaxed);
+        std::uint64_t dropped = skip_dropped_.exchange(0, std::memory_order_relaxed);
+        if (dropped > 0) {
+            Submit({now_ns, LogLevel::Info, false,
+                    "Rate limit: " + std::to_string(dropped) + " Skip lines suppressed", {}});
+        }
+    }
+    if (skip_in_window_.fetch_add(1, std::memory_order_relaxed) < options_.skip_lines_per_second) {
+        return true;
+    }
+    skip_dropped_.fetch_add(1, std::memory_order_relaxed);
+    skip_suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+void Logger::Submit(Record record) {
+    if (!options_.async) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        WriteBatch(&record, 1);
+        return;
+    }
+
+    Ring* ring = LocalRing();
+    bool urgent = record.level == LogLevel::Error;
+    while (!ring->TryPush(&record)) {
+        // Full ring: wake the writer and wait for room rather than drop.
+        wake_.notify_one();
+        std::this_thread::yield();
+    }
+    // Wake the writer once when the ring reaches half full, not on every push.
+    if (urgent || ring->Size() == Ring::kCapacity / 2) {
+        wake_.notify_one();
+    }
+}
+
+Logger::Ring* Logger::LocalRing() {
+    // Logger ids are never reused, so entries of destroyed loggers are inert.
+    thread_local std::vector<std::pair<std::uint64_t, Ring*>> rings;
+    for (const auto& entry : rings) {
+        if (entry.first == id_) {
+            return entry.second;
+        }
+    }
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    rings_.push_back(std::make_unique<Ring>());
+    rings.emplace_back(id_, rings_.back().get());
+    return rings_.back().get();
+}
+
+void Logger::Flush() {
+    if (!options_.async) {
+        std::lock_guard<std::mutex> lock(write_mutex_);
+        if (file_) {
+            std::fflush(file_);
+        }
+        return;
+    }
+    std::uint64_t ticket = flush_requested_.fetch_add(1) + 1;
+    wake_.notify_one();
+    std::unique_lock<std::mutex> lock(wake_mutex_);
+    flushed_.wait(lock, [&]() { return flush_done_ >= ticket || stop_; });
+}
+
+void Logger::WriterLoop() {
+    std::vector<Record> batch;
+    std::vector<Ring*> rings;
+    auto last_sync = std::chrono::steady_clock::now();
+    bool busy = false;
+    while (true) {
+        bool stopping = false;
+        {
+            // After a non-empty batch, go straight back for more.
+            std::unique_lock<std::mutex> lock(wake_mutex_);
+            if (!busy) {
+                wake_.wait_for(lock, options_.flush_interval, [&]() {
+                    return stop_ || flush_requested_.load() > flush_done_;
+                });
+            }
+            stopping = stop_;
+        }
+        std::uint64_t flush_target = flush_requested_.load();
+
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            rings.clear();
+            for (const auto& ring : rings_) {
+                rings.push_back(ring.get());
+            }
+        }
+        batch.clear();
+        for (Ring* ring : rings) {
+            ring->DrainInto(&batch);
+        }
+        busy = !batch.empty();
+        if (!batch.empty()) {
+            // Each ring is in order; merge threads by timestamp.
+            std::stable_sort(batch.begin(), batch.end(), [](const Record& a, const Record& b) {
+                return a.time_ns < b.time_ns;
+            });
+            std::lock_guard<std::mutex> lock(write_mutex_);
+            WriteBatch(batch.data(), batch.size());
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (file_ && now - last_sync >= options_.sync_interval) {
+            SyncFile();
+            last_sync = now;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(wake_mutex_);
+            flush_done_ = flush_target;
+        }
+        flushed_.notify_all();
+        if (stopping) {
+            // Producers are gone once the destructor runs, so this drain
+            // was the last one.
+            break;
+        }
+    }
+}
+
+void Logger::WriteBatch(const Record* records, std::size_t count) {
+    std::string lines;
+    std::vector<std::size_t> ends;
+    bool has_error = false;
+    for (std::size_t i = 0; i < count; ++i) {
+        AppendLine(records[i], &lines);
+        ends.push_back(lines.size());
+        has_error = has_error || records[i].level == LogLevel::Error;
+    }
+    if (file_) {
+        std::fwrite(lines.data(), 1, lines.size(), file_);
+        std::fflush(file_);
+    }
+    if (!options_.console) {
+        return;
+    }
+    EraseStatusLine();
+    if (!has_error) {
+        std::cout << lines;
     } else {
-        std::cout << line;
+        // Errors go to stderr, everything else to stdout, as with single lines.
+        std::size_t start = 0;
+        for (std::size_t i = 0; i < count; ++i) {
+            std::ostream& stream = records[i].level == LogLevel::Error ? std::cerr : std::cout;
+            stream.write(lines.data() + start, static_cast<std::streamsize>(ends[i] - start));
+            start = ends[i];
+        }
+    }
+    if (!status_line_.empty()) {
+        std::cout << status_line_ << std::flush;
     }
 }
 
-std::string Logger::Timestamp() {
-    auto now = std::chrono::system_clock::now();
-    std::time_t now_c = std::chrono::system_clock::to_time_t(now);
-    std::tm local_tm{};
+void Logger::SetStatusLine(std::string line) {
+    if (!terminal_) {
+        return;
+    }
+    // Longer lines would wrap, and a wrapped line cannot be erased with \r.
+    if (line.size() > status_width_) {
+        line.resize(status_width_);
+    }
+    std::lock_guard<std::mutex> lock(write_mutex_);
+    EraseStatusLine();
+    status_line_ = std::move(line);
+    if (!status_line_.empty()) {
+        std::cout << status_line_ << std::flush;
+    }
+}
+
+void Logger::EraseStatusLine() {
+    if (!status_line_.empty()) {
+        std::cout << '\r' << std::string(status_line_.size(), ' ') << '\r' << std::flush;
+    }
+}
+
+void Logger::AppendLine(const Record& record, std::string* out) {
+    std::int64_t second = record.time_ns / 1000000000LL;
+    if (second != cached_second_) {
+        std::tm tm = LocalTime(static_cast<std::time_t>(second));
+        std::snprintf(cached_stamp_, sizeof(cached_stamp_), "%04d-%02d-%02d %02d:%02d:%02d",
+                      tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min,
+                      tm.tm_sec);
+        cached_second_ = second;
+    }
+    out->append(cached_stamp_);
+    out->append(" [");
+    out->append(LevelName(record.level));
+    out->append("] ");
+    if (record.skip) {
+        out->append("Skip ");
+        out->append(record.text);
+        out->append(" (");
+        out->append(record.detail);
+        out->append(")");
+    } else {
+        out->append(record.text);
+    }
+    out->push_back('\n');
+}
+
+void Logger::SyncFile() {
+    std::fflush(file_);
 #ifdef _WIN32
-    localtime_s(&local_tm, &now_c);
+    _commit(_fileno(file_));
 #else
-    localtime_r(&now_c, &local_tm);
+    fsync(fileno(file_));
 #endif
-    std::ostringstream oss;
-    oss << std::put_time(&local_tm, "%Y-%m-%d %H:%M:%S");
-    return oss.str();
+}
+
+std::filesystem::path Logger::LogPath() const {
+    return log_path_;
+}
+
+std::int64_t Logger::NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::system_clock::now().time_since_epoch()).count();
 }
 
 std::filesystem::path Logger::BuildLogPath(const std::filesystem::path& log_dir) {
-    auto now = std::chrono::system_clock::now();
-    std::time_t now_c = std::chrono::system_clock::to_time_t(now);
-    std::tm local_tm{};
-#ifdef _WIN32
-    localtime_s(&local_tm, &now_c);
-#else
-    localtime_r(&now_c, &local_tm);
-#endif
-    std::ostringstream oss;
-    oss << std::put_time(&local_tm, "%Y-%m-%d") << ".log";
-    return log_dir / oss.str();
+    std::tm local_tm = LocalTime(std::chrono::system_clock::to_time_t(std::chrono::system_clock::now()));
+    char name[32];
+    std::snprintf(name, sizeof(name), "%04d-%02d-%02d.log", local_tm.tm_year + 1900,
+                  local_tm.tm_mon + 1, local_tm.tm_mday);
+    return log_dir / name;
 }
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <cstdio>
 #include <filesystem>
 #include <iostream>
 #include <sstream>
@@ -6,7 +8,9 @@
 #include <windows.h>
 
 #include "cli.h"
+#include "file_reader.h"
 #include "logger.h"
+#include "rules.h"
 #include "sync_engine.h"
 
 namespace {
@@ -35,6 +39,105 @@ std::string JoinList(const std::vector<std::string>& items, const std::string& s
     return oss.str();
 }
 
+// Bytes freed and when: a run under disk pressure should free most of them
+// early.
+std::string ReclaimTimeline(std::vector<ReclaimSample> samples) {
+    std::sort(samples.begin(), samples.end(),
+              [](const ReclaimSample& a, const ReclaimSample& b) { return a.seconds < b.seconds; });
+    std::uint64_t total = 0;
+    for (const ReclaimSample& sample : samples) {
+        total += sample.bytes;
+    }
+    std::string out = std::to_string(total) + " bytes";
+    const int percents[] = {50, 90, 100};
+    std::uint64_t sum = 0;
+    std::size_t next = 0;
+    for (const ReclaimSample& sample : samples) {
+        sum += sample.bytes;
+        while (next < 3 && sum * 100 >= total * percents[next]) {
+            char line[64];
+            std::snprintf(line, sizeof(line), ", %d%% after %.1f s", percents[next], sample.seconds);
+            out += line;
+            next++;
+        }
+    }
+    return out;
+}
+
+void LogSummary(Logger& logger, const std::string& title, const SyncStats& stats) {
+    logger.Info(title + ":");
+    logger.Info("  Dirs created: " + std::to_string(stats.dirs_created));
+    logger.Info("  Files uploaded: " + std::to_string(stats.files_uploaded));
+    logger.Info("  Files deleted (always): " + std::to_string(stats.files_deleted_jpg));
+    logger.Info("  Files deleted (by age): " + std::to_string(stats.files_deleted_old));
+    logger.Info("  Files skipped: " + std::to_string(stats.files_skipped));
+    if (!stats.reclaimed.empty()) {
+        logger.Info("  Space reclaimed: " + ReclaimTimeline(stats.reclaimed));
+    }
+    if (stats.bundles_uploaded > 0) {
+        char ratio[32];
+        std::snprintf(ratio, sizeof(ratio), "%.1f",
+                      static_cast<double>(stats.files_bundled) / stats.bundles_uploaded);
+        logger.Info("  Bundles uploaded: " + std::to_string(stats.bundles_uploaded) + " (" +
+                    std::to_string(stats.files_bundled) + " files, " + ratio + " files per bundle)");
+    }
+    if (stats.files_compressed > 0) {
+        char ratio[32];
+        std::snprintf(ratio, sizeof(ratio), "%.1f",
+                      100.0 * stats.compressed_output_bytes / stats.compressed_input_bytes);
+        logger.Info("  Files compressed: " + std::to_string(stats.files_compressed) + " (" +
+                    std::to_string(stats.compressed_input_bytes) + " -> " +
+                    std::to_string(stats.compressed_output_bytes) + " bytes, " + ratio + "%)");
+    }
+    if (stats.files_renamed > 0) {
+        logger.Info("  Files renamed on the server: " + std::to_string(stats.files_renamed) + " (" +
+                    std::to_string(stats.dirs_renamed) + " whole directories, " +
+                    std::to_string(stats.renamed_bytes) + " bytes not uploaded)");
+    }
+    if (stats.files_appended > 0) {
+        logger.Info("  Files appended: " + std::to_string(stats.files_appended) + " (" +
+                    std::to_string(stats.appended_bytes) + " new bytes sent, " +
+                    std::to_string(stats.append_saved_bytes) + " bytes not uploaded again)");
+    }
+    if (stats.files_copied > 0) {
+        logger.Info("  Files copied on the server: " + std::to_string(stats.files_copied) + " (" +
+                    std::to_string(stats.copied_bytes) + " bytes not uploaded)");
+    }
+    if (stats.files_uploaded > 0 && stats.execute_seconds > 0) {
+        char rate[32];
+        std::snprintf(rate, sizeof(rate), "%.1f", stats.files_uploaded / stats.execute_seconds);
+        logger.Info(std::string("  Effective rate: ") + rate + " files/s");
+    }
+    logger.Info("  Errors: " + std::to_string(stats.errors));
+    if (!stats.deleted_list.empty()) {
+        logger.Info("Deleted local files are listed in " + stats.deleted_list.string());
+    }
+}
+
+void AddStats(SyncStats* total, const SyncStats& stats) {
+    total->dirs_created += stats.dirs_created;
+    total->files_uploaded += stats.files_uploaded;
+    total->files_deleted_jpg += stats.files_deleted_jpg;
+    total->files_deleted_old += stats.files_deleted_old;
+    total->files_skipped += stats.files_skipped;
+    total->errors += stats.errors;
+    total->files_bundled += stats.files_bundled;
+    total->bundles_uploaded += stats.bundles_uploaded;
+    total->files_compressed += stats.files_compressed;
+    total->compressed_input_bytes += stats.compressed_input_bytes;
+    total->compressed_output_bytes += stats.compressed_output_bytes;
+    total->files_copied += stats.files_copied;
+    total->copied_bytes += stats.copied_bytes;
+    total->files_renamed += stats.files_renamed;
+    total->renamed_bytes += stats.renamed_bytes;
+    total->dirs_renamed += stats.dirs_renamed;
+    total->files_appended += stats.files_appended;
+    total->appended_bytes += stats.appended_bytes;
+    total->append_saved_bytes += stats.append_saved_bytes;
+    total->execute_seconds = stats.execute_seconds;
+    total->reclaimed.insert(total->reclaimed.end(), stats.reclaimed.begin(), stats.reclaimed.end());
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -54,21 +157,110 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    Logger logger("logs");
+    LoggerOptions log_options;
+    log_options.async = config.async_log;
+    log_options.min_level = config.log_level;
+    log_options.skip_lines_per_second = config.log_skip_rate;
+    Logger logger("logs", log_options);
     logger.Info("Start");
     logger.Info("Log file: " + logger.LogPath().string());
     logger.Info("Mode: " + std::string(config.dry_run ? "dry-run" : "sync"));
     logger.Info("Dry-run: " + std::string(config.dry_run ? "true" : "false"));
-    logger.Info("Source: " + config.source.string());
-    logger.Info("Remote root: " + config.remote);
-    logger.Info("Target URL: " + config.base_url + config.remote);
+    if (config.jobs.empty()) {
+        logger.Info("Source: " + config.source.string());
+        logger.Info("Remote root: " + config.remote);
+        logger.Info("Target URL: " + config.base_url + config.remote);
+    }
+    for (const SyncJob& job : config.jobs) {
+        logger.Info("Job " + job.name + ": " + job.source.string() + " -> " + job.remote +
+                    " (weight " + std::to_string(job.weight) + ", compare " +
+                    (job.compare_mode == CompareMode::SizeOnly ? "size-only" : "size-mtime") +
+                    (job.excludes.empty() ? std::string() : ", excludes " + JoinList(job.excludes, ";")) +
+                    ")");
+    }
     logger.Info("Email: " + config.email);
     logger.Info("Base URL: " + config.base_url);
     logger.Info("Threads: " + std::to_string(config.threads));
+    logger.Info("Probe threads: " + std::to_string(config.probe_threads));
     logger.Info("Compare: " + std::string(config.compare_mode == CompareMode::SizeOnly
                                               ? "size-only"
                                               : "size-mtime"));
     logger.Info("Excludes: " + (config.excludes.empty() ? "(none)" : JoinList(config.excludes, ";")));
+    logger.Info("Ignore file: " + (config.ignore_file.empty() ? std::string("(disabled)") : config.ignore_file));
+    std::vector<SyncRule> rules = config.rules.empty() ? DefaultSyncRules() : config.rules;
+    rules.push_back(FallbackSyncRule());
+    for (const auto& rule : rules) {
+        std::string line = "Rule " + rule.name + ": " +
+                           (rule.patterns.empty() ? std::string("(other files)")
+                                                  : JoinList(rule.patterns, ";")) +
+                           " -> upload " + (rule.always_upload ? "always" : "changed") + ", ";
+        line += rule.delete_after_upload
+                    ? "delete after " + std::to_string(rule.delete_age_hours) + "h"
+                    : std::string("keep");
+        if (rule.has_compare) {
+            line += rule.compare_mode == CompareMode::SizeOnly ? ", size-only" : ", size-mtime";
+        }
+        logger.Info(line);
+    }
+    if (!config.bundle_dirs.empty()) {
+        logger.Info("Bundles: " + JoinList(config.bundle_dirs, ";") + " (max " +
+                    std::to_string(config.bundle_size >> 20) + " MB, files up to " +
+                    std::to_string(config.bundle_max_file >> 10) + " KB, state " +
+                    config.state_dir.string() + ")");
+    }
+    if (config.rate_limit > 0) {
+        logger.Info("Rate limit: " + std::to_string(config.rate_limit >> 10) + " KB/s");
+    }
+    if (config.shard_count > 1) {
+        logger.Info("Shard: " + std::to_string(config.shard_index + 1) + "/" +
+                    std::to_string(config.shard_count) + " (depth " +
+                    std::to_string(config.shard_depth) + ")");
+    }
+    if (config.low_space_percent > 0 || config.critical_space_percent > 0) {
+        logger.Info("Free space watermarks: low " + std::to_string(config.low_space_percent) +
+                    "%, critical " + std::to_string(config.critical_space_percent) + "%");
+    }
+    if (config.read_options.mode != ReadCacheMode::Buffered) {
+        std::string line = std::string("Read mode: ") + ReadCacheModeName(config.read_options.mode);
+        if (config.read_options.mode == ReadCacheMode::Direct) {
+            line += " (files from " + std::to_string(config.read_options.direct_min >> 20) + " MB)";
+        }
+        logger.Info(line);
+    }
+    if (config.chunked_min > 0) {
+        logger.Info("Chunked uploads: files from " + std::to_string(config.chunked_min >> 20) +
+                    " MB in chunks of " + std::to_string(config.chunk_size >> 20) + " MB");
+    }
+    if (!config.status_file.empty()) {
+        logger.Info("Status file: " + config.status_file.string() + " (every " +
+                    std::to_string(config.status_interval) + " s)");
+    }
+    if (config.detect_renames) {
+        logger.Info(std::string("Renames: detected, earlier uploads are ") +
+                    (config.move_renames ? "moved" : "copied"));
+    }
+    if (config.dedup) {
+        logger.Info("Dedup: on");
+    }
+    if (!config.compress_patterns.empty()) {
+        logger.Info("Compress: " + JoinList(config.compress_patterns, ";"));
+    }
+    if (!config.append_patterns.empty()) {
+        logger.Info("Append-only: " + JoinList(config.append_patterns, ";"));
+    }
+    if (!config.plan_out.empty()) {
+        logger.Info("Plan output: " + config.plan_out.string());
+    }
+    if (!config.apply_plan.empty()) {
+        logger.Info("Apply plan: " + config.apply_plan.string());
+    }
+    if (!config.trace_record.empty()) {
+        logger.Info("Trace record: " + config.trace_record.string());
+    }
+    if (!config.trace_replay.empty()) {
+        logger.Info("Trace replay: " + config.trace_replay.string() +
+                    " (no network, local files are kept)");
+    }
 
     std::filesystem::path config_path = exe_dir / "uploader.conf";
     std::error_code ec;
@@ -76,22 +268,18 @@ int main(int argc, char** argv) {
     logger.Info("Config file: " + config_path.string() + " (" +
                 (config_exists ? "found" : "absent") + ")");
 
-    SyncStats stats = RunSync(config, logger);
-
-    logger.Info("Summary:");
-    logger.Info("  Dirs created: " + std::to_string(stats.dirs_created));
-    logger.Info("  Files uploaded: " + std::to_string(stats.files_uploaded));
-    logger.Info("  Files deleted (jpg): " + std::to_string(stats.files_deleted_jpg));
-    logger.Info("  Files deleted (>24h): " + std::to_string(stats.files_deleted_old));
-    logger.Info("  Files skipped: " + std::to_string(stats.files_skipped));
-    logger.Info("  Errors: " + std::to_string(stats.errors));
+    std::vector<SyncStats> job_stats = RunSync(config, logger);
 
-    if (!stats.deleted_files.empty()) {
-        logger.Info("Deleted local files:");
-        for (const auto& file : stats.deleted_files) {
-            logger.Info("  " + file);
+    SyncStats stats = job_stats.front();
+    if (!config.jobs.empty()) {
+        // Deletion journals are listed per job.
+        stats = SyncStats();
+        for (std::size_t i = 0; i < job_stats.size(); ++i) {
+            LogSummary(logger, "Summary of job " + config.jobs[i].name, job_stats[i]);
+            AddStats(&stats, job_stats[i]);
         }
     }
+    LogSummary(logger, config.jobs.empty() ? "Summary" : "Summary of all jobs", stats);
 
     logger.Info("Finish");
 
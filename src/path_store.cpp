@@ -0,0 +1,201 @@
+#include "path_store.h"
+
+#include <limits>
+
+#include "path_utils.h"
+#include "text_kernels.h"
+
+namespace {
+
+constexpr std::size_t kMaxNameLength = std::numeric_limits<std::uint16_t>::max();
+constexpr std::size_t kMaxArenaSize = std::numeric_limits<std::uint32_t>::max();
+
+template <typename T>
+std::uint64_t VectorBytes(const std::vector<T>& values) {
+    return static_cast<std::uint64_t>(values.capacity()) * sizeof(T);
+}
+
+}  // namespace
+
+PathStore::PathStore() {
+    dir_parent_.push_back(kRootDir);
+    dir_name_offset_.push_back(0);
+    dir_name_length_.push_back(0);
+    dir_depth_.push_back(0);
+}
+
+bool PathStore::AppendName(std::string_view name, std::uint32_t* offset) {
+    if (name.size() > kMaxNameLength || arena_.size() + name.size() > kMaxArenaSize) {
+        return false;
+    }
+    *offset = static_cast<std::uint32_t>(arena_.size());
+    arena_.append(name.data(), name.size());
+    return true;
+}
+
+DirId PathStore::AddDirectory(DirId parent, std::string_view name_utf8) {
+    if (dir_parent_.size() >= kInvalidId) {
+        return kInvalidId;
+    }
+    std::uint32_t offset = 0;
+    if (!AppendName(name_utf8, &offset)) {
+        return kInvalidId;
+    }
+    DirId id = static_cast<DirId>(dir_parent_.size());
+    dir_parent_.push_back(parent);
+    dir_name_offset_.push_back(offset);
+    dir_name_length_.push_back(static_cast<std::uint16_t>(name_utf8.size()));
+    dir_depth_.push_back(static_cast<std::uint16_t>(dir_depth_[parent] + 1));
+    return id;
+}
+
+FileId PathStore::AddFile(DirId parent, std::string_view name_utf8,
+                          std::uint64_t size, std::int64_t mtime_ns) {
+    if (file_dir_.size() >= kInvalidId) {
+        return kInvalidId;
+    }
+    std::uint32_t offset = 0;
+    if (!AppendName(name_utf8, &offset)) {
+        return kInvalidId;
+    }
+    FileId id = static_cast<FileId>(file_dir_.size());
+    file_dir_.push_back(parent);
+    file_name_offset_.push_back(offset);
+    file_name_length_.push_back(static_cast<std::uint16_t>(name_utf8.size()));
+    file_size_.push_back(size);
+    file_mtime_.push_back(mtime_ns);
+    return id;
+}
+
+void PathStore::ReserveFiles(std::size_t count, std::size_t name_bytes) {
+    file_dir_.reserve(count);
+    file_name_offset_.reserve(count);
+    file_name_length_.reserve(count);
+    file_size_.reserve(count);
+    file_mtime_.reserve(count);
+    arena_.reserve(arena_.size() + name_bytes);
+}
+
+std::string_view PathStore::DirectoryName(DirId dir) const {
+    return std::string_view(arena_).substr(dir_name_offset_[dir], dir_name_length_[dir]);
+}
+
+std::string_view PathStore::FileName(FileId file) const {
+    return std::string_view(arena_).substr(file_name_offset_[file], file_name_length_[file]);
+}
+
+std::chrono::system_clock::time_point PathStore::FileModified(FileId file) const {
+    auto since_epoch = std::chrono::nanoseconds(file_mtime_[file]);
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(since_epoch));
+}
+
+void PathStore::AppendDirectoryPath(DirId dir, std::string* out) const {
+    if (dir == kRootDir) {
+        return;
+    }
+    // Walk up once to size the result, then fill it back to front.
+    std::size_t total = 0;
+    for (DirId cur = dir; cur != kRootDir; cur = dir_parent_[cur]) {
+        total += dir_name_length_[cur] + 1;
+    }
+    std::size_t start = out->size();
+    out->resize(start + total - 1);
+    std::size_t pos = out->size();
+    for (DirId cur = dir; cur != kRootDir; cur = dir_parent_[cur]) {
+        std::string_view name = DirectoryName(cur);
+        pos -= name.size();
+        out->replace(pos, name.size(), name.data(), name.size());
+        if (pos > start) {
+            (*out)[--pos] = '/';
+        }
+    }
+}
+
+std::string PathStore::DirectoryRelativeUtf8(DirId dir) const {
+    std::string out;
+    AppendDirectoryPath(dir, &out);
+    return out;
+}
+
+std::string PathStore::FileRelativeUtf8(FileId file) const {
+    std::string out;
+    AppendDirectoryPath(file_dir_[file], &out);
+    if (!out.empty()) {
+        out.push_back('/');
+    }
+    out.append(FileName(file));
+    return out;
+}
+
+std::filesystem::path PathStore::DirectoryRelativePath(DirId dir) const {
+    return std::filesystem::u8path(DirectoryRelativeUtf8(dir));
+}
+
+std::filesystem::path PathStore::FileRelativePath(FileId file) const {
+    return std::filesystem::u8path(FileRelativeUtf8(file));
+}
+
+std::filesystem::path PathStore::FileAbsolutePath(const std::filesystem::path& root,
+                                                  FileId file) const {
+    return root / FileRelativePath(file);
+}
+
+std::string PathStore::DirectoryRemotePath(const std::string& remote_root, DirId dir) const {
+    std::string out = NormalizeRemoteRoot(remote_root);
+    if (dir == kRootDir) {
+        return out;
+    }
+    if (out.back() != '/') {
+        out.push_back('/');
+    }
+    AppendDirectoryPath(dir, &out);
+    return out;
+}
+
+std::string PathStore::FileRemotePath(const std::string& remote_root, FileId file) const {
+    std::string out = DirectoryRemotePath(remote_root, file_dir_[file]);
+    if (out.back() != '/') {
+        out.push_back('/');
+    }
+    out.append(FileName(file));
+    return out;
+}
+
+std::uint64_t PathStore::MemoryUsage() const {
+    return sizeof(*this) + arena_.capacity() +
+           VectorBytes(dir_parent_) + VectorBytes(dir_name_offset_) +
+           VectorBytes(dir_name_length_) + VectorBytes(dir_depth_) +
+           VectorBytes(file_dir_) + VectorBytes(file_name_offset_) +
+           VectorBytes(file_name_length_) + VectorBytes(file_size_) +
+           VectorBytes(file_mtime_);
+}
+
+RemotePathTable::RemotePathTable(const PathStore& store, const std::string& remote_root)
+    : store_(store) {
+    dirs_.resize(store.DirectoryCount());
+    std::string root = NormalizeRemoteRoot(remote_root);
+    dirs_[PathStore::kRootDir] = {root, UrlEncodePath(root)};
+    for (DirId dir = 1; dir < dirs_.size(); ++dir) {
+        dirs_[dir] = AppendRemotePath(dirs_[store.DirectoryParent(dir)], store.DirectoryName(dir));
+    }
+}
+
+RemotePath RemotePathTable::File(FileId file) const {
+    return AppendRemotePath(dirs_[store_.FileDirectory(file)], store_.FileName(file));
+}
+
+RemotePath AppendRemotePath(const RemotePath& parent, std::string_view name) {
+    RemotePath path;
+    path.plain.reserve(parent.plain.size() + 1 + name.size());
+    path.encoded.reserve(parent.encoded.size() + 1 + name.size() + name.size() / 4);
+    path.plain = parent.plain;
+    path.encoded = parent.encoded;
+    if (path.plain.back() != '/') {
+        path.plain.push_back('/');
+        path.encoded.push_back('/');
+    }
+    path.plain.append(name);
+    AppendUrlEncoded(&path.encoded, name);
+    return path;
+}
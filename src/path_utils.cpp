@@ -1,19 +1,19 @@
 #include "path_utils.h"
 
 #include <algorithm>
-#include <iomanip>
-#include <sstream>
 #include <string>
 #include <vector>
 
+#include "text_kernels.h"
+
 #ifdef _WIN32
 #include <windows.h>
 #endif
 
 namespace {
 
-std::string WideToUtf8(const std::wstring& wide) {
 #ifdef _WIN32
+std::string WideToUtf8(const std::wstring& wide) {
     if (wide.empty()) {
         return {};
     }
@@ -28,17 +28,8 @@ std::string WideToUtf8(const std::wstring& wide) {
                         static_cast<int>(wide.size()),
                         result.data(), size, nullptr, nullptr);
     return result;
-#else
-    return std::string(wide.begin(), wide.end());
-#endif
-}
-
-bool IsUnreserved(unsigned char c) {
-    return (c >= 'A' && c <= 'Z') ||
-           (c >= 'a' && c <= 'z') ||
-           (c >= '0' && c <= '9') ||
-           c == '-' || c == '_' || c == '.' || c == '~';
 }
+#endif
 
 }  // namespace
 
@@ -75,34 +66,25 @@ std::string JoinRemotePath(const std::string& remote_root,
 }
 
 std::string UrlEncodePath(const std::string& path) {
-    std::ostringstream oss;
-    oss << std::hex << std::uppercase;
-    for (unsigned char c : path) {
-        if (c == '/') {
-            oss << '/';
-        } else if (IsUnreserved(c)) {
-            oss << c;
-        } else {
-            oss << '%' << std::setw(2) << std::setfill('0') << static_cast<int>(c);
-        }
-    }
-    return oss.str();
+    std::string out;
+    out.reserve(path.size() + path.size() / 4);
+    AppendUrlEncoded(&out, path);
+    return out;
 }
 
 std::string ToLowerAscii(const std::string& value) {
     std::string out = value;
-    std::transform(out.begin(), out.end(), out.begin(), [](unsigned char c) {
-        if (c >= 'A' && c <= 'Z') {
-            return static_cast<unsigned char>(c - 'A' + 'a');
-        }
-        return c;
-    });
+    LowerAsciiInPlace(out.data(), out.size());
     return out;
 }
 
 std::string PathToGenericUtf8(const std::filesystem::path& path) {
-    std::wstring wide = path.wstring();
-    std::string utf8 = WideToUtf8(wide);
+#ifdef _WIN32
+    // native() is already the wide string; no intermediate copy.
+    std::string utf8 = WideToUtf8(path.native());
+#else
+    std::string utf8 = path.native();
+#endif
     std::replace(utf8.begin(), utf8.end(), '\\', '/');
     return utf8;
 }
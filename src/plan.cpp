@@ -0,0 +1,294 @@
+#include "plan.h"
+
+#include <algorithm>
+
+#include "binary_io.h"
+#include "file_util.h"
+#include "path_utils.h"
+
+namespace {
+
+const char kPlanMagic[8] = {'U', 'P', 'L', 'P', 'L', 'A', 'N', '\0'};
+// Version 2 added the bundle columns, version 3 the encoding column,
+// version 4 the copy column and version 5 the rename columns; older files
+// load without them.
+constexpr std::uint32_t kPlanVersion = 5;
+
+bool NeedsUpload(FileActionType action) {
+    return action == FileActionType::Upload || action == FileActionType::UploadAndDelete;
+}
+
+bool Fail(std::string* error, const std::string& message) {
+    if (error) {
+        *error = message;
+    }
+    return false;
+}
+
+}  // namespace
+
+PlanSummary SummarizePlan(const SyncPlan& plan) {
+    PlanSummary summary;
+    for (FileId file = 0; file < plan.action.size(); ++file) {
+        if (plan.reason[file] == kReasonUndecided) {
+            summary.undecided++;
+        } else if (NeedsUpload(plan.action[file])) {
+            summary.uploads++;
+            if (plan.copy_from[file] != PathStore::kInvalidId) {
+                summary.copies++;
+            } else if (plan.rename_from[file] != PathStore::kInvalidId) {
+                summary.renames++;
+            } else {
+                summary.upload_bytes += plan.store.FileSize(file);
+            }
+            if (plan.bundle[file] != 0) {
+                summary.bundled++;
+            }
+            if (plan.encoding[file] == FileEncoding::Gzip) {
+                summary.compressed++;
+            }
+            if (plan.action[file] == FileActionType::UploadAndDelete) {
+                summary.deletes++;
+            }
+        } else {
+            summary.skips++;
+        }
+    }
+    for (std::uint8_t missing : plan.dir_missing) {
+        summary.missing_dirs += missing == 1;
+    }
+    for (std::uint32_t source : plan.dir_rename_from) {
+        summary.dir_renames += source != PathStore::kInvalidId;
+    }
+    return summary;
+}
+
+std::vector<FileId> PlanExecutionOrder(const SyncPlan& plan) {
+    std::vector<FileId> order;
+    for (FileId file = 0; file < plan.action.size(); ++file) {
+        if (plan.reason[file] != kReasonUndecided && NeedsUpload(plan.action[file]) &&
+            plan.bundle[file] == 0 && plan.copy_from[file] == PathStore::kInvalidId) {
+            order.push_back(file);
+        }
+    }
+    // Stable, so equal sizes keep scan order.
+    std::stable_sort(order.begin(), order.end(), [&](FileId a, FileId b) {
+        return plan.store.FileSize(a) > plan.store.FileSize(b);
+    });
+    return order;
+}
+
+std::string SerializePlan(const SyncPlan& plan) {
+    const PathStore& store = plan.store;
+    std::string out;
+    BinaryWriter writer(&out);
+    out.append(kPlanMagic, sizeof(kPlanMagic));
+    writer.Put<std::uint32_t>(kPlanVersion);
+    writer.Put<std::uint8_t>(plan.compare_mode == CompareMode::SizeOnly ? 1 : 0);
+    writer.Put<std::int64_t>(plan.created_ns);
+    writer.PutString(PathToGenericUtf8(plan.source));
+    writer.PutString(plan.remote_root);
+    writer.Put<std::uint8_t>(plan.root_exists ? 1 : 0);
+
+    // The root is implicit; directories 1..n-1 follow in id order.
+    std::vector<DirId> dir_parent;
+    std::vector<std::uint16_t> dir_name_length;
+    std::string dir_names;
+    for (DirId dir = 1; dir < store.DirectoryCount(); ++dir) {
+        std::string_view name = store.DirectoryName(dir);
+        dir_parent.push_back(store.DirectoryParent(dir));
+        dir_name_length.push_back(static_cast<std::uint16_t>(name.size()));
+        dir_names.append(name.data(), name.size());
+    }
+    writer.PutColumn(dir_parent);
+    writer.PutColumn(dir_name_length);
+    writer.PutString(dir_names);
+    writer.PutColumn(plan.dir_missing);
+
+    std::vector<DirId> file_dir;
+    std::vector<std::uint16_t> file_name_length;
+    std::vector<std::uint64_t> file_size;
+    std::vector<std::int64_t> file_mtime;
+    std::string file_names;
+    file_dir.reserve(store.FileCount());
+    file_name_length.reserve(store.FileCount());
+    file_size.reserve(store.FileCount());
+    file_mtime.reserve(store.FileCount());
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        std::string_view name = store.FileName(file);
+        file_dir.push_back(store.FileDirectory(file));
+        file_name_length.push_back(static_cast<std::uint16_t>(name.size()));
+        file_size.push_back(store.FileSize(file));
+        file_mtime.push_back(store.FileMtimeNs(file));
+        file_names.append(name.data(), name.size());
+    }
+    writer.PutColumn(file_dir);
+    writer.PutColumn(file_name_length);
+    writer.PutString(file_names);
+    writer.PutColumn(file_size);
+    writer.PutColumn(file_mtime);
+    writer.PutColumn(plan.action);
+    writer.PutColumn(plan.reason);
+    writer.Put<std::uint32_t>(static_cast<std::uint32_t>(plan.bundle_roots.size()));
+    for (const std::string& root : plan.bundle_roots) {
+        writer.PutString(root);
+    }
+    writer.PutColumn(plan.bundle);
+    writer.PutColumn(plan.encoding);
+    writer.PutColumn(plan.copy_from);
+    writer.Put<std::uint32_t>(static_cast<std::uint32_t>(plan.rename_sources.size()));
+    for (const std::string& source : plan.rename_sources) {
+        writer.PutString(source);
+    }
+    writer.PutColumn(plan.rename_from);
+    writer.PutColumn(plan.dir_rename_from);
+    return out;
+}
+
+bool DeserializePlan(std::string_view data, SyncPlan* plan, std::string* error) {
+    if (data.size() < sizeof(kPlanMagic) ||
+        data.substr(0, sizeof(kPlanMagic)) != std::string_view(kPlanMagic, sizeof(kPlanMagic))) {
+        return Fail(error, "not a plan file");
+    }
+    BinaryReader reader(data.substr(sizeof(kPlanMagic)));
+    std::uint32_t version = reader.Get<std::uint32_t>();
+    if (version < 1 || version > kPlanVersion) {
+        return Fail(error, "unsupported plan version " + std::to_string(version));
+    }
+
+    SyncPlan out;
+    out.compare_mode = reader.Get<std::uint8_t>() == 1 ? CompareMode::SizeOnly
+                                                        : CompareMode::SizeMtime;
+    out.created_ns = reader.Get<std::int64_t>();
+    out.source = std::filesystem::u8path(reader.GetString());
+    out.remote_root = reader.GetString();
+    out.root_exists = reader.Get<std::uint8_t>() != 0;
+
+    std::vector<DirId> dir_parent;
+    std::vector<std::uint16_t> dir_name_length;
+    reader.GetColumn(&dir_parent);
+    reader.GetColumn(&dir_name_length);
+    std::string dir_names = reader.GetString();
+    reader.GetColumn(&out.dir_missing);
+
+    std::vector<DirId> file_dir;
+    std::vector<std::uint16_t> file_name_length;
+    std::vector<std::uint64_t> file_size;
+    std::vector<std::int64_t> file_mtime;
+    reader.GetColumn(&file_dir);
+    reader.GetColumn(&file_name_length);
+    std::string file_names = reader.GetString();
+    reader.GetColumn(&file_size);
+    reader.GetColumn(&file_mtime);
+    reader.GetColumn(&out.action);
+    reader.GetColumn(&out.reason);
+    if (version >= 2) {
+        std::uint32_t root_count = reader.Get<std::uint32_t>();
+        for (std::uint32_t i = 0; i < root_count && reader.Ok(); ++i) {
+            out.bundle_roots.push_back(reader.GetString());
+        }
+        reader.GetColumn(&out.bundle);
+    } else {
+        out.bundle.assign(file_dir.size(), 0);
+    }
+    if (version >= 3) {
+        reader.GetColumn(&out.encoding);
+    } else {
+        out.encoding.assign(file_dir.size(), FileEncoding::Plain);
+    }
+    if (version >= 4) {
+        reader.GetColumn(&out.copy_from);
+    } else {
+        out.copy_from.assign(file_dir.size(), PathStore::kInvalidId);
+    }
+    if (version >= 5) {
+        std::uint32_t source_count = reader.Get<std::uint32_t>();
+        for (std::uint32_t i = 0; i < source_count && reader.Ok(); ++i) {
+            out.rename_sources.push_back(reader.GetString());
+        }
+        reader.GetColumn(&out.rename_from);
+        reader.GetColumn(&out.dir_rename_from);
+    } else {
+        out.rename_from.assign(file_dir.size(), PathStore::kInvalidId);
+        out.dir_rename_from.assign(dir_parent.size() + 1, PathStore::kInvalidId);
+    }
+    if (!reader.Ok() || !reader.AtEnd()) {
+        return Fail(error, "truncated or oversized plan file");
+    }
+
+    std::size_t dir_count = dir_parent.size() + 1;
+    std::size_t file_count = file_dir.size();
+    if (dir_name_length.size() + 1 != dir_count || out.dir_missing.size() != dir_count ||
+        file_name_length.size() != file_count || file_size.size() != file_count ||
+        file_mtime.size() != file_count || out.action.size() != file_count ||
+        out.reason.size() != file_count || out.bundle.size() != file_count ||
+        out.encoding.size() != file_count || out.copy_from.size() != file_count ||
+        out.rename_from.size() != file_count || out.dir_rename_from.size() != dir_count) {
+        return Fail(error, "plan columns have different lengths");
+    }
+
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < dir_parent.size(); ++i) {
+        // Parents always precede their children.
+        if (dir_parent[i] > i || offset + dir_name_length[i] > dir_names.size() ||
+            out.store.AddDirectory(dir_parent[i], std::string_view(dir_names).substr(
+                                                      offset, dir_name_length[i])) ==
+                PathStore::kInvalidId) {
+            return Fail(error, "invalid directory entry in plan");
+        }
+        offset += dir_name_length[i];
+    }
+    if (offset != dir_names.size()) {
+        return Fail(error, "invalid directory names in plan");
+    }
+
+    offset = 0;
+    out.store.ReserveFiles(file_count, file_names.size());
+    for (std::size_t i = 0; i < file_count; ++i) {
+        if (file_dir[i] >= dir_count || offset + file_name_length[i] > file_names.size() ||
+            static_cast<std::uint8_t>(out.action[i]) >
+                static_cast<std::uint8_t>(FileActionType::UploadAndDelete) ||
+            out.bundle[i] > out.bundle_roots.size() ||
+            static_cast<std::uint8_t>(out.encoding[i]) >
+                static_cast<std::uint8_t>(FileEncoding::Gzip) ||
+            out.store.AddFile(file_dir[i],
+                              std::string_view(file_names).substr(offset, file_name_length[i]),
+                              file_size[i], file_mtime[i]) == PathStore::kInvalidId) {
+            return Fail(error, "invalid file entry in plan");
+        }
+        offset += file_name_length[i];
+    }
+    if (offset != file_names.size()) {
+        return Fail(error, "invalid file names in plan");
+    }
+    // A copy's source is an upload that is not a copy itself.
+    for (std::size_t i = 0; i < file_count; ++i) {
+        FileId source = out.copy_from[i];
+        if (source != PathStore::kInvalidId &&
+            (source >= file_count || out.copy_from[source] != PathStore::kInvalidId ||
+             !NeedsUpload(out.action[source]) || !NeedsUpload(out.action[i]))) {
+            return Fail(error, "invalid copy entry in plan");
+        }
+        if (out.rename_from[i] != PathStore::kInvalidId &&
+            out.rename_from[i] >= out.rename_sources.size()) {
+            return Fail(error, "invalid rename entry in plan");
+        }
+    }
+    for (std::uint32_t source : out.dir_rename_from) {
+        if (source != PathStore::kInvalidId && source >= out.rename_sources.size()) {
+            return Fail(error, "invalid rename entry in plan");
+        }
+    }
+
+    *plan = std::move(out);
+    return true;
+}
+
+bool WritePlanFile(const std::filesystem::path& path, const SyncPlan& plan, std::string* error) {
+    return WriteFileAtomic(path, SerializePlan(plan), error);
+}
+
+bool ReadPlanFile(const std::filesystem::path& path, SyncPlan* plan, std::string* error) {
+    std::string data;
+    return ReadWholeFile(path, &data, error) && DeserializePlan(data, plan, error);
+}
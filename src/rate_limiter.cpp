@@ -0,0 +1,28 @@
+#include "rate_limiter.h"
+
+#include <thread>
+
+RateLimiter::RateLimiter(std::uint64_t bytes_per_second)
+    : bytes_per_second_(bytes_per_second),
+      burst_(std::chrono::milliseconds(250)),
+      paid_until_(Clock::now()) {}
+
+void RateLimiter::Acquire(std::uint64_t bytes) {
+    if (bytes == 0) {
+        return;
+    }
+    auto cost = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(static_cast<double>(bytes) / bytes_per_second_));
+    Clock::time_point wait_until;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Clock::time_point now = Clock::now();
+        // Idle time earns no credit; sending may run one burst ahead.
+        if (paid_until_ < now) {
+            paid_until_ = now;
+        }
+        paid_until_ += cost;
+        wait_until = paid_until_ - burst_;
+    }
+    std::this_thread::sleep_until(wait_until);
+}
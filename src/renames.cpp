@@ -0,0 +1,182 @@
+#include "renames.h"
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "scanner.h"
+
+namespace {
+
+bool IsCandidate(const SyncPlan& plan, FileId file) {
+    return plan.reason[file] != kReasonUndecided &&
+           (plan.action[file] == FileActionType::Upload ||
+            plan.action[file] == FileActionType::UploadAndDelete) &&
+           plan.bundle[file] == 0 && plan.encoding[file] == FileEncoding::Plain;
+}
+
+// "a/b/c" -> ("a/b", "c"); a top-level name has an empty parent.
+std::pair<std::string, std::string> SplitLast(const std::string& path) {
+    std::size_t slash = path.rfind('/');
+    if (slash == std::string::npos) {
+        return {std::string(), path};
+    }
+    return {path.substr(0, slash), path.substr(slash + 1)};
+}
+
+// The old directory a new one would be a rename of, built up from its
+// files and subdirectories.
+struct DirRename {
+    bool ok = true;
+    bool known = false;
+    std::string from;
+    std::uint64_t files = 0;
+
+    void Require(const std::string& parent) {
+        // The remote root itself is never moved.
+        if (parent.empty()) {
+            ok = false;
+        } else if (!known) {
+            from = parent;
+            known = true;
+        } else if (from != parent) {
+            ok = false;
+        }
+    }
+};
+
+std::uint32_t AddSource(SyncPlan* plan, const std::string& path) {
+    plan->rename_sources.push_back(path);
+    return static_cast<std::uint32_t>(plan->rename_sources.size() - 1);
+}
+
+}  // namespace
+
+RenameStats FindRenamedUploads(SyncPlan* plan, StateManifest* uploads) {
+    RenameStats stats;
+    const PathStore& store = plan->store;
+    plan->rename_sources.clear();
+    plan->rename_from.assign(store.FileCount(), PathStore::kInvalidId);
+    plan->dir_rename_from.assign(store.DirectoryCount(), PathStore::kInvalidId);
+    if (uploads->Size() == 0) {
+        return stats;
+    }
+
+    std::map<std::pair<std::uint64_t, std::uint64_t>, const std::string*> by_identity;
+    std::vector<std::string> recorded;
+    recorded.reserve(uploads->Size());
+    for (const auto& entry : uploads->Entries()) {
+        if (entry.second.device != 0 || entry.second.file_index != 0) {
+            by_identity[{entry.second.device, entry.second.file_index}] = &entry.first;
+        }
+        recorded.push_back(entry.first);
+    }
+    std::sort(recorded.begin(), recorded.end());
+    std::unordered_set<std::string> local_files;
+    std::unordered_set<std::string> local_dirs;
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        local_files.insert(store.FileRelativeUtf8(file));
+    }
+    for (DirId dir = 0; dir < store.DirectoryCount(); ++dir) {
+        local_dirs.insert(store.DirectoryRelativeUtf8(dir));
+    }
+
+    // Each recorded upload is reused once, so two hard links at new paths
+    // do not both move the same remote file.
+    std::set<const std::string*> used;
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        if (!IsCandidate(*plan, file)) {
+            continue;
+        }
+        LocalFileId id;
+        if (!LocalFileIdentity(store.FileAbsolutePath(plan->source, file), &id)) {
+            continue;
+        }
+        auto found = by_identity.find({id.device, id.index});
+        if (found == by_identity.end() || local_files.count(*found->second) != 0 ||
+            used.count(found->second) != 0) {
+            continue;
+        }
+        const StateManifest::Entry* entry = uploads->Find(*found->second);
+        if (entry->size != store.FileSize(file) || entry->mtime_ns != store.FileMtimeNs(file)) {
+            continue;
+        }
+        used.insert(found->second);
+        plan->rename_from[file] = AddSource(plan, *found->second);
+        stats.files++;
+    }
+
+    // Uploads of files that are gone and were not renamed cannot be reused.
+    std::vector<std::string> stale;
+    for (const auto& entry : uploads->Entries()) {
+        if (local_files.count(entry.first) == 0 && used.count(&entry.first) == 0) {
+            stale.push_back(entry.first);
+        }
+    }
+    for (const std::string& name : stale) {
+        uploads->Erase(name);
+    }
+    if (stats.files == 0) {
+        return stats;
+    }
+
+    // Children have larger ids than their parents, so a reverse pass sees
+    // every subdirectory before its parent.
+    std::vector<DirRename> dirs(store.DirectoryCount());
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        DirRename& dir = dirs[store.FileDirectory(file)];
+        dir.files++;
+        if (plan->rename_from[file] == PathStore::kInvalidId) {
+            dir.ok = false;
+            continue;
+        }
+        auto parts = SplitLast(plan->rename_sources[plan->rename_from[file]]);
+        if (parts.second != store.FileName(file)) {
+            dir.ok = false;
+            continue;
+        }
+        dir.Require(parts.first);
+    }
+    for (DirId dir = static_cast<DirId>(store.DirectoryCount()); dir-- > 1;) {
+        DirRename& current = dirs[dir];
+        DirRename& parent = dirs[store.DirectoryParent(dir)];
+        parent.files += current.files;
+        auto parts = SplitLast(current.from);
+        if (!current.ok || !current.known || parts.second != store.DirectoryName(dir)) {
+            parent.ok = false;
+            continue;
+        }
+        parent.Require(parts.first);
+    }
+
+    std::vector<std::uint8_t> covered(store.DirectoryCount(), 0);
+    for (DirId dir = 1; dir < store.DirectoryCount(); ++dir) {
+        if (covered[store.DirectoryParent(dir)]) {
+            covered[dir] = 1;
+            continue;
+        }
+        const DirRename& current = dirs[dir];
+        if (!current.ok || !current.known || plan->dir_missing[dir] != 1 ||
+            local_dirs.count(current.from) != 0) {
+            continue;
+        }
+        // The old directory must hold exactly the files that moved out of it.
+        std::string prefix = current.from + "/";
+        auto first = std::lower_bound(recorded.begin(), recorded.end(), prefix);
+        auto last = first;
+        while (last != recorded.end() && last->compare(0, prefix.size(), prefix) == 0) {
+            ++last;
+        }
+        if (static_cast<std::uint64_t>(last - first) != current.files) {
+            continue;
+        }
+        plan->dir_rename_from[dir] = AddSource(plan, current.from);
+        covered[dir] = 1;
+        stats.dirs++;
+    }
+    return stats;
+}
@@ -0,0 +1,158 @@
+#include "rules.h"
+
+#include <algorithm>
+
+#include "path_utils.h"
+
+namespace {
+
+// Seeds tried per table size before the table is doubled.
+constexpr std::uint32_t kSeedsPerSize = 64;
+
+char FoldAscii(char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<char>(c - 'A' + 'a') : c;
+}
+
+// FNV-1a over the lower-cased bytes, varied by `seed`.
+std::uint32_t HashExtension(std::string_view extension, std::uint32_t seed) {
+    std::uint32_t hash = 2166136261u ^ (seed * 0x9E3779B9u);
+    for (char c : extension) {
+        hash ^= static_cast<unsigned char>(FoldAscii(c));
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// "*.ext" with a plain extension, returned lower-cased without "*.".
+bool ExtensionPattern(const std::string& pattern, std::string* extension) {
+    if (pattern.size() < 3 || pattern.compare(0, 2, "*.") != 0 ||
+        pattern.find_first_of("*?[\\/.", 2) != std::string::npos) {
+        return false;
+    }
+    *extension = ToLowerAscii(pattern.substr(2));
+    return true;
+}
+
+}  // namespace
+
+std::vector<SyncRule> DefaultSyncRules() {
+    SyncRule jpg;
+    jpg.name = "jpg";
+    jpg.patterns = {"*.jpg"};
+    jpg.always_upload = true;
+    jpg.delete_age_hours = 0;
+    return {jpg};
+}
+
+SyncRule FallbackSyncRule() {
+    SyncRule rule;
+    rule.name = "default";
+    return rule;
+}
+
+RuleTable::RuleTable(const std::vector<SyncRule>& rules)
+    : rules_(rules.empty() ? DefaultSyncRules() : rules),
+      name_globs_(GlobAutomaton::Syntax::Anything),
+      path_globs_(GlobAutomaton::Syntax::Anything) {
+    if (rules_.size() > kMaxSyncRules) {
+        rules_.resize(kMaxSyncRules);
+    }
+    std::vector<Extension> found;
+    for (std::size_t index = 0; index < rules_.size(); ++index) {
+        // The automata report the highest rule, so earlier rules get higher ones.
+        int priority = static_cast<int>(kMaxSyncRules - index);
+        for (const std::string& raw_pattern : rules_[index].patterns) {
+            std::string extension;
+            if (ExtensionPattern(raw_pattern, &extension)) {
+                auto same = [&](const Extension& e) { return e.lower == extension; };
+                if (std::find_if(found.begin(), found.end(), same) == found.end()) {
+                    found.push_back({extension, static_cast<std::uint8_t>(index)});
+                    longest_extension_ = std::max(longest_extension_, extension.size());
+                }
+                continue;
+            }
+            std::string pattern = ToLowerAscii(raw_pattern);
+            if (pattern.find('/') != std::string::npos) {
+                path_globs_.AddPattern(pattern.front() == '/' ? pattern.substr(1) : pattern,
+                                       priority);
+            } else {
+                name_globs_.AddPattern(pattern, priority);
+            }
+        }
+    }
+    rules_.push_back(FallbackSyncRule());
+    if (found.empty()) {
+        return;
+    }
+
+    // Looks for a seed that sends every extension to its own slot, in a
+    // table at least twice as large as the extensions, which usually takes a
+    // handful of tries.
+    std::size_t size = 1;
+    while (size < 2 * found.size()) {
+        size <<= 1;
+    }
+    while (true) {
+        for (seed_ = 1; seed_ <= kSeedsPerSize; ++seed_) {
+            extensions_.assign(size, Extension());
+            bool placed = true;
+            for (const Extension& extension : found) {
+                Extension& slot = extensions_[Slot(extension.lower)];
+                if (!slot.lower.empty()) {
+                    placed = false;
+                    break;
+                }
+                slot = extension;
+            }
+            if (placed) {
+                return;
+            }
+        }
+        size <<= 1;
+    }
+}
+
+std::size_t RuleTable::Slot(std::string_view extension) const {
+    return HashExtension(extension, seed_) & (extensions_.size() - 1);
+}
+
+std::uint8_t RuleTable::MatchExtension(std::string_view name) const {
+    std::uint8_t none = static_cast<std::uint8_t>(rules_.size() - 1);
+    // Same rule as path::extension(): a leading dot does not start one.
+    std::size_t dot = name.rfind('.');
+    if (extensions_.empty() || dot == std::string_view::npos || dot == 0) {
+        return none;
+    }
+    std::string_view extension = name.substr(dot + 1);
+    if (extension.empty() || extension.size() > longest_extension_) {
+        return none;
+    }
+    const Extension& slot = extensions_[Slot(extension)];
+    if (slot.lower.size() != extension.size()) {
+        return none;
+    }
+    for (std::size_t i = 0; i < extension.size(); ++i) {
+        if (FoldAscii(extension[i]) != slot.lower[i]) {
+            return none;
+        }
+    }
+    return slot.rule;
+}
+
+std::uint8_t RuleTable::Match(const PathStore& store, FileId file) const {
+    std::string_view name = store.FileName(file);
+    std::uint8_t best = MatchExtension(name);
+    auto consider = [&](const GlobAutomaton& globs, std::string_view text) {
+        int rule = globs.MatchedRule(globs.Feed(globs.Start(), text), false);
+        if (rule != GlobAutomaton::kNoRule) {
+            best = std::min(best, static_cast<std::uint8_t>(kMaxSyncRules - rule));
+        }
+    };
+    if (best != 0 && !name_globs_.Empty()) {
+        consider(name_globs_, name);
+    }
+    if (best != 0 && !path_globs_.Empty()) {
+        consider(path_globs_, store.FileRelativeUtf8(file));
+    }
+    return best;
+}
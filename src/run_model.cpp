@@ -0,0 +1,515 @@
+#include "run_model.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <deque>
+#include <limits>
+
+#include "bundle.h"
+
+namespace {
+
+// As WebDavClient: three attempts, 300 ms times the attempt in between.
+constexpr int kAttempts = 3;
+constexpr double kBackOffSeconds = 0.3;
+// Seconds of bytes RateLimiter lets through ahead of the limit.
+constexpr double kRateLimitBurst = 0.25;
+// As SyncRunner, which rounds the chunk size up to whole MiB.
+constexpr std::uint64_t kChunkAlign = 1ULL << 20;
+// The chunked-upload probe: two PUTs and a PROPFIND.
+constexpr std::uint64_t kProbeRequests = 3;
+
+const double kUnlimited = std::numeric_limits<double>::infinity();
+
+// One unit of a stage's work queue: a request with `bytes` of body, then
+// `followups` body-less requests on the same connection.
+struct ModelItem {
+    std::uint64_t bytes = 0;
+    std::uint32_t followups = 0;
+    // 1-based chunked file; the worker that ends its last chunk checks the
+    // temporary object's size and sends the MOVE into place.
+    std::uint32_t chunked = 0;
+};
+
+struct StageResult {
+    double seconds = 0.0;
+    std::uint64_t retries = 0;
+    std::uint64_t failures = 0;
+    double link_busy = 0.0;
+    double server_busy = 0.0;
+};
+
+// Which attempts fail, from a fixed seed (SplitMix64), so the same inputs
+// always predict the same run.
+class Outcomes {
+public:
+    explicit Outcomes(double error_rate) : rate_(error_rate) {}
+
+    bool Fails() {
+        if (rate_ <= 0.0) {
+            return false;
+        }
+        std::uint64_t z = (state_ += 0x9E3779B97F4A7C15ULL);
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        z ^= z >> 31;
+        return static_cast<double>(z >> 11) * 0x1.0p-53 < rate_;
+    }
+
+private:
+    double rate_;
+    std::uint64_t state_ = 0x5EED;
+};
+
+struct Link {
+    double rtt = 0.0;
+    // Bytes per second; kUnlimited without a cap.
+    double total = kUnlimited;
+    double connection = kUnlimited;
+    // Bytes the rate limiter lets through ahead of the limit (its burst),
+    // earned back while the link is not saturated.
+    double burst = 0.0;
+    int slots = 0;
+};
+
+// Runs `items` in order on `workers` connections and returns when the last
+// one is answered. Every request holds a server slot from its first byte
+// to its answer; connections sending at once split the link equally.
+StageResult RunStage(const std::vector<ModelItem>& items, std::size_t workers, const Link& link,
+                     Outcomes* outcomes) {
+    enum class Phase { Idle, Queued, Sending, Waiting, BackOff };
+    struct Worker {
+        Phase phase = Phase::Idle;
+        std::size_t item = 0;
+        int attempt = 0;
+        std::uint64_t request_bytes = 0;
+        double remaining = 0.0;
+        double until = 0.0;
+        // Whether the current request is one of the item's follow-ups, and
+        // how many are still to send after it.
+        bool followup = false;
+        std::uint32_t pending = 0;
+    };
+
+    StageResult result;
+    workers = (std::min)(workers, items.size());
+    if (workers == 0) {
+        return result;
+    }
+    std::vector<Worker> pool(workers);
+    std::vector<Phase> phases(workers);
+    std::vector<std::uint32_t> chunks_left;
+    for (const ModelItem& item : items) {
+        if (item.chunked > chunks_left.size()) {
+            chunks_left.resize(item.chunked, 0);
+        }
+        if (item.chunked != 0) {
+            ++chunks_left[item.chunked - 1];
+        }
+    }
+    std::deque<std::size_t> queued;
+    int busy_slots = 0;
+    std::size_t next = 0;
+    double now = 0.0;
+    double link_time = 0.0;
+    double slot_time = 0.0;
+    double credit = link.burst;
+
+    auto enter = [&](Worker& w) {
+        ++busy_slots;
+        if (w.request_bytes > 0) {
+            w.phase = Phase::Sending;
+            w.remaining = static_cast<double>(w.request_bytes);
+        } else {
+            w.phase = Phase::Waiting;
+            w.until = now + link.rtt;
+        }
+    };
+    auto start = [&](std::size_t index, std::uint64_t bytes) {
+        Worker& w = pool[index];
+        w.request_bytes = bytes;
+        if (link.slots > 0 && busy_slots >= link.slots) {
+            w.phase = Phase::Queued;
+            queued.push_back(index);
+            return;
+        }
+        enter(w);
+    };
+    auto take = [&](std::size_t index) {
+        Worker& w = pool[index];
+        if (next >= items.size()) {
+            w.phase = Phase::Idle;
+            return;
+        }
+        w.item = next++;
+        w.attempt = 0;
+        w.pending = 0;
+        w.followup = false;
+        start(index, items[w.item].bytes);
+    };
+    // The current request of pool[index] was answered.
+    auto answered = [&](std::size_t index) {
+        Worker& w = pool[index];
+        --busy_slots;
+        if (!queued.empty()) {
+            std::size_t waiting = queued.front();
+            queued.pop_front();
+            enter(pool[waiting]);
+        }
+        if (outcomes->Fails()) {
+            if (w.attempt + 1 < kAttempts) {
+                ++w.attempt;
+                ++result.retries;
+                w.phase = Phase::BackOff;
+                w.until = now + kBackOffSeconds * w.attempt;
+                return;
+            }
+            ++result.failures;
+            if (!w.followup) {
+                // Nothing follows an upload that failed.
+                take(index);
+                return;
+            }
+        }
+        if (!w.followup) {
+            const ModelItem& item = items[w.item];
+            w.pending = item.followups;
+            if (item.chunked != 0 && --chunks_left[item.chunked - 1] == 0) {
+                w.pending += 2;
+            }
+        }
+        if (w.pending > 0) {
+            --w.pending;
+            w.followup = true;
+            w.attempt = 0;
+            start(index, 0);
+            return;
+        }
+        take(index);
+    };
+
+    for (std::size_t i = 0; i < workers; ++i) {
+        take(i);
+    }
+    while (true) {
+        std::size_t sending = 0;
+        bool active = false;
+        for (const Worker& w : pool) {
+            sending += w.phase == Phase::Sending ? 1 : 0;
+            active = active || w.phase != Phase::Idle;
+        }
+        if (!active) {
+            break;
+        }
+        double rate = 0.0;
+        if (sending > 0) {
+            double share = credit > 0.0 ? kUnlimited : link.total / static_cast<double>(sending);
+            rate = (std::min)(link.connection, share);
+        }
+        if (rate == kUnlimited && link.total != kUnlimited) {
+            // Nothing else holds the bytes back: the credit goes at once.
+            for (Worker& w : pool) {
+                if (w.phase == Phase::Sending && credit > 0.0) {
+                    double take = (std::min)(w.remaining, credit);
+                    w.remaining -= take;
+                    credit -= take;
+                    if (w.remaining <= 1e-6 * static_cast<double>(w.request_bytes)) {
+                        w.phase = Phase::Waiting;
+                        w.until = now + link.rtt;
+                    }
+                }
+            }
+            credit = credit < 1e-6 * link.burst ? 0.0 : credit;
+            continue;
+        }
+        double at = kUnlimited;
+        double drain = credit > 0.0 ? rate * static_cast<double>(sending) - link.total : 0.0;
+        if (drain > 0.0) {
+            at = now + credit / drain;
+        }
+        for (const Worker& w : pool) {
+            if (w.phase == Phase::Sending) {
+                at = (std::min)(at, rate == kUnlimited ? now : now + w.remaining / rate);
+            } else if (w.phase == Phase::Waiting || w.phase == Phase::BackOff) {
+                at = (std::min)(at, w.until);
+            }
+        }
+        double elapsed = at - now;
+        if (link.total != kUnlimited && sending > 0) {
+            link_time += elapsed * (std::min)(1.0, rate * sending / link.total);
+        }
+        slot_time += elapsed * busy_slots;
+        if (link.total != kUnlimited) {
+            credit += (link.total - rate * static_cast<double>(sending)) * elapsed;
+            credit = (std::min)(link.burst, credit < 1e-6 * link.burst ? 0.0 : credit);
+        }
+        now = at;
+        // Requests started below wait for the next step.
+        for (std::size_t i = 0; i < pool.size(); ++i) {
+            phases[i] = pool[i].phase;
+        }
+        for (std::size_t i = 0; i < pool.size(); ++i) {
+            Worker& w = pool[i];
+            if (phases[i] == Phase::Sending) {
+                w.remaining -= rate == kUnlimited ? w.remaining : rate * elapsed;
+                if (w.remaining <= 1e-6 * static_cast<double>(w.request_bytes)) {
+                    w.phase = Phase::Waiting;
+                    w.until = now + link.rtt;
+                }
+            } else if (phases[i] == Phase::Waiting && w.until <= now) {
+                answered(i);
+            } else if (phases[i] == Phase::BackOff && w.until <= now) {
+                start(i, w.request_bytes);
+            }
+        }
+    }
+    result.seconds = now;
+    if (now > 0.0) {
+        result.link_busy = link_time / now;
+        result.server_busy = link.slots > 0 ? slot_time / now / link.slots : 0.0;
+    }
+    return result;
+}
+
+std::vector<ModelItem> EmptyRequests(std::uint64_t count) {
+    return std::vector<ModelItem>(static_cast<std::size_t>(count));
+}
+
+std::size_t Workers(int threads, std::uint64_t items) {
+    return static_cast<std::size_t>(
+        (std::min)(static_cast<std::uint64_t>((std::max)(threads, 1)), items));
+}
+
+}  // namespace
+
+RunWorkload WorkloadFromPlan(const SyncPlan& plan, std::uint64_t bundle_size) {
+    const PathStore& store = plan.store;
+    RunWorkload workload;
+    workload.files = store.FileCount();
+    workload.directories = store.DirectoryCount();
+    // A plan with fewer columns than directories, such as a truncated or
+    // older one, counts the rest as missing.
+    auto dir_missing = [&](DirId dir) -> std::uint8_t {
+        return dir < plan.dir_missing.size() ? plan.dir_missing[dir] : 1;
+    };
+    for (DirId dir = 0; dir < store.DirectoryCount(); ++dir) {
+        std::uint8_t missing = dir_missing(dir);
+        bool parent_missing =
+            dir != PathStore::kRootDir && dir_missing(store.DirectoryParent(dir)) == 1;
+        if (missing != kDirUnlisted && !parent_missing) {
+            ++workload.listings;
+        }
+        if (dir != PathStore::kRootDir && missing != 0) {
+            ++workload.collections;
+        }
+    }
+    if (!plan.root_exists) {
+        ++workload.collections;
+    }
+    for (DirId dir = 0; dir < plan.dir_rename_from.size(); ++dir) {
+        workload.collections += plan.dir_rename_from[dir] != PathStore::kInvalidId ? 1 : 0;
+    }
+
+    std::vector<std::uint32_t> copies(store.FileCount(), 0);
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        if (plan.copy_from[file] != PathStore::kInvalidId && plan.reason[file] != kReasonUndecided) {
+            ++copies[plan.copy_from[file]];
+        }
+    }
+    for (FileId file : PlanExecutionOrder(plan)) {
+        if (plan.rename_from[file] != PathStore::kInvalidId) {
+            ++workload.renames;
+        } else {
+            workload.uploads.push_back({store.FileSize(file), copies[file]});
+        }
+    }
+    // Bundles as PlanBundles cuts them: per bundle root in scan order.
+    std::vector<std::uint64_t> open(plan.bundle_roots.size(), 0);
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        std::uint16_t group = file < plan.bundle.size() ? plan.bundle[file] : 0;
+        if (group == 0 || plan.reason[file] == kReasonUndecided ||
+            plan.action[file] == FileActionType::Skip) {
+            continue;
+        }
+        std::uint64_t bytes = 512 + TarPaddedSize(store.FileSize(file));
+        if (open[group - 1] != 0 && open[group - 1] + bytes > bundle_size) {
+            workload.uploads.push_back({open[group - 1], 0});
+            open[group - 1] = 0;
+        }
+        open[group - 1] += bytes;
+    }
+    for (std::uint64_t bytes : open) {
+        if (bytes != 0) {
+            workload.uploads.push_back({bytes, 0});
+        }
+    }
+    return workload;
+}
+
+bool ParseSizeHistogram(const std::string& text, std::vector<RunWorkload::Upload>* uploads,
+                        std::string* error) {
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+        std::size_t end = text.find(',', pos);
+        if (end == std::string::npos) {
+            end = text.size();
+        }
+        std::string entry = text.substr(pos, end - pos);
+        pos = end + 1;
+        std::size_t colon = entry.find(':');
+        const char* digits = "0123456789";
+        std::string size = colon == std::string::npos ? std::string() : entry.substr(0, colon);
+        std::string count = colon == std::string::npos ? std::string() : entry.substr(colon + 1);
+        std::uint64_t unit = 1;
+        if (!size.empty()) {
+            switch (std::toupper(static_cast<unsigned char>(size.back()))) {
+            case 'K':
+                unit = 1ULL << 10;
+                break;
+            case 'M':
+                unit = 1ULL << 20;
+                break;
+            case 'G':
+                unit = 1ULL << 30;
+                break;
+            default:
+                break;
+            }
+            if (unit != 1) {
+                size.pop_back();
+            }
+        }
+        if (size.empty() || count.empty() || size.size() > 12 || count.size() > 9 ||
+            size.find_first_not_of(digits) != std::string::npos ||
+            count.find_first_not_of(digits) != std::string::npos) {
+            if (error) {
+                *error = "Invalid size histogram entry: " + entry;
+            }
+            return false;
+        }
+        std::uint64_t bytes = std::strtoull(size.c_str(), nullptr, 10) * unit;
+        uploads->insert(uploads->end(), std::strtoull(count.c_str(), nullptr, 10),
+                        RunWorkload::Upload{bytes, 0});
+    }
+    return true;
+}
+
+RunPrediction SimulateRun(const RunWorkload& workload, const NetworkModel& network,
+                          const AppConfig& config) {
+    RunPrediction prediction;
+    Link link;
+    link.rtt = network.rtt_ms / 1000.0;
+    link.slots = (std::max)(network.server_concurrency, 0);
+    if (network.link_bandwidth > 0.0) {
+        link.total = network.link_bandwidth;
+    }
+    if (config.rate_limit > 0 && static_cast<double>(config.rate_limit) <= link.total) {
+        link.total = static_cast<double>(config.rate_limit);
+        link.burst = link.total * kRateLimitBurst;
+    }
+    if (network.connection_bandwidth > 0.0) {
+        link.connection = network.connection_bandwidth;
+    }
+    Outcomes outcomes(network.error_rate);
+
+    if (network.scan_files_per_second > 0.0) {
+        prediction.scan =
+            static_cast<double>(workload.files + workload.directories) / network.scan_files_per_second;
+    }
+
+    // Every pooled connection opens and checks the remote root while the
+    // scan runs.
+    prediction.connections = static_cast<std::uint64_t>(
+        (std::max)({config.threads, config.probe_threads, 1}));
+    StageResult warmup = RunStage(EmptyRequests(prediction.connections),
+                                  static_cast<std::size_t>(prediction.connections), link, &outcomes);
+    double warmup_seconds = network.connect_round_trips * link.rtt + warmup.seconds;
+    prediction.warmup = (std::max)(0.0, warmup_seconds - prediction.scan);
+    prediction.propfinds += prediction.connections;
+
+    StageResult decide = RunStage(EmptyRequests(workload.listings),
+                                  Workers(config.probe_threads, workload.listings), link, &outcomes);
+    prediction.decide = decide.seconds;
+    prediction.propfinds += workload.listings;
+
+    std::uint64_t chunk_size = (config.chunk_size + kChunkAlign - 1) / kChunkAlign * kChunkAlign;
+    std::vector<ModelItem> items;
+    std::uint32_t chunked_files = 0;
+    for (const RunWorkload::Upload& upload : workload.uploads) {
+        prediction.upload_bytes += upload.bytes;
+        prediction.transfers += upload.copies;
+        if (config.chunked_min > 0 && upload.bytes >= config.chunked_min &&
+            upload.bytes > config.chunk_size && chunk_size > 0) {
+            ++chunked_files;
+            ++prediction.transfers;
+            for (std::uint64_t offset = 0; offset < upload.bytes; offset += chunk_size) {
+                items.push_back({(std::min)(chunk_size, upload.bytes - offset), 0, chunked_files});
+            }
+            // The follow-up COPYs go with the last chunk.
+            items.back().followups = upload.copies;
+        } else {
+            items.push_back({upload.bytes, upload.copies, 0});
+        }
+    }
+    prediction.puts = items.size();
+    std::stable_sort(items.begin(), items.end(),
+                     [](const ModelItem& a, const ModelItem& b) { return a.bytes > b.bytes; });
+    items.insert(items.end(), static_cast<std::size_t>(workload.renames), ModelItem{});
+    prediction.transfers += workload.renames;
+
+    // Then each chunked file's temporary object is created empty.
+    std::uint64_t serial =
+        workload.collections + (chunked_files > 0 ? kProbeRequests : 0) + chunked_files;
+    StageResult prepare = RunStage(EmptyRequests(serial), 1, link, &outcomes);
+    prediction.prepare = prepare.seconds;
+    prediction.mkcols = workload.collections;
+    if (chunked_files > 0) {
+        prediction.puts += 2 + chunked_files;
+        prediction.propfinds += 1 + chunked_files;
+    }
+
+    prediction.upload_workers = static_cast<int>(Workers(config.threads, items.size()));
+    StageResult execute = RunStage(items, static_cast<std::size_t>(prediction.upload_workers),
+                                   link, &outcomes);
+    prediction.execute = execute.seconds;
+    prediction.link_busy = execute.link_busy;
+    prediction.server_busy = execute.server_busy;
+    for (const ModelItem& item : items) {
+        double send = static_cast<double>(item.bytes) / (std::min)(link.connection, link.total);
+        prediction.longest_item = (std::max)(prediction.longest_item, send + link.rtt);
+    }
+
+    for (const StageResult* stage : {&warmup, &decide, &prepare, &execute}) {
+        prediction.retries += stage->retries;
+        prediction.failures += stage->failures;
+    }
+    prediction.total = prediction.scan + prediction.warmup + prediction.decide +
+                       prediction.prepare + prediction.execute;
+
+    // The stage that takes longest, and within the uploads the resource
+    // that kept them from going faster.
+    double local = prediction.scan + prediction.warmup;
+    double longest = (std::max)({local, prediction.decide, prediction.prepare, prediction.execute});
+    if (longest <= 0.0) {
+        prediction.bottleneck = "none";
+    } else if (longest == prediction.decide) {
+        prediction.bottleneck = "directory listings";
+    } else if (longest == prediction.prepare) {
+        prediction.bottleneck = "collections";
+    } else if (longest == local) {
+        prediction.bottleneck = "local scan";
+    } else if (prediction.link_busy >= 0.8) {
+        prediction.bottleneck = "bandwidth";
+    } else if (link.slots > 0 && prediction.server_busy >= 0.8) {
+        prediction.bottleneck = "server concurrency";
+    } else if (prediction.longest_item >= 0.8 * prediction.execute) {
+        prediction.bottleneck = "largest file";
+    } else {
+        double workers = static_cast<double>(prediction.upload_workers);
+        double sending = static_cast<double>(prediction.upload_bytes) / link.connection / workers;
+        double waiting = static_cast<double>(items.size()) * link.rtt / workers;
+        prediction.bottleneck = sending > waiting ? "connection bandwidth" : "round trips";
+    }
+    return prediction;
+}
@@ -0,0 +1,538 @@
+#include "scanner.h"
+
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace {
+
+struct EntryMeta {
+    std::uint64_t size = 0;
+    std::int64_t mtime_ns = 0;
+};
+
+// Appends `name` to the relative path of its parent; returns the parent length
+// so the caller can truncate back after handling the entry.
+std::size_t PushRelative(std::string* rel, const std::string& name) {
+    std::size_t parent_len = rel->size();
+    if (!rel->empty()) {
+        rel->push_back('/');
+    }
+    rel->append(name);
+    return parent_len;
+}
+
+#ifdef _WIN32
+
+std::string WideToUtf8(const wchar_t* wide) {
+    int length = static_cast<int>(wcslen(wide));
+    if (length == 0) {
+        return {};
+    }
+    int size = WideCharToMultiByte(CP_UTF8, 0, wide, length, nullptr, 0, nullptr, nullptr);
+    if (size <= 0) {
+        return {};
+    }
+    std::string result(static_cast<size_t>(size), '\0');
+    WideCharToMultiByte(CP_UTF8, 0, wide, length, result.data(), size, nullptr, nullptr);
+    return result;
+}
+
+std::int64_t FileTimeToUnixNs(const FILETIME& ft) {
+    // FILETIME counts 100ns ticks since 1601-01-01.
+    const std::int64_t kEpochDelta = 116444736000000000LL;
+    ULARGE_INTEGER ticks;
+    ticks.LowPart = ft.dwLowDateTime;
+    ticks.HighPart = ft.dwHighDateTime;
+    return (static_cast<std::int64_t>(ticks.QuadPart) - kEpochDelta) * 100;
+}
+
+bool IsDotEntry(const wchar_t* name) {
+    return name[0] == L'.' && (name[1] == L'\0' || (name[1] == L'.' && name[2] == L'\0'));
+}
+
+// Reparse-point files (symlinks) report the link itself in the find data;
+// read the target through a handle, which follows the link as
+// std::filesystem::is_regular_file would. Its FILETIME goes through the
+// same conversion as the find data's, so a linked file always gets the
+// same mtime.
+bool ResolveLinkedFile(const std::filesystem::path& path, EntryMeta* meta) {
+    HANDLE file = CreateFileW(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    BY_HANDLE_FILE_INFORMATION info{};
+    BOOL ok = GetFileInformationByHandle(file, &info);
+    CloseHandle(file);
+    if (!ok || (info.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
+        return false;
+    }
+    meta->size = (static_cast<std::uint64_t>(info.nFileSizeHigh) << 32) | info.nFileSizeLow;
+    meta->mtime_ns = FileTimeToUnixNs(info.ftLastWriteTime);
+    return true;
+}
+
+// Reads a per-directory ignore file; false when there is none.
+bool ReadIgnoreFile(const std::wstring& path, std::string* text, DWORD* error) {
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        *error = GetLastError();
+        return false;
+    }
+    char buffer[4096];
+    DWORD read = 0;
+    while (ReadFile(file, buffer, sizeof(buffer), &read, nullptr) && read > 0) {
+        text->append(buffer, read);
+    }
+    CloseHandle(file);
+    return true;
+}
+
+struct Frame {
+    HANDLE find = INVALID_HANDLE_VALUE;
+    WIN32_FIND_DATAW data{};
+    bool has_pending = false;
+    DirId id = PathStore::kRootDir;
+    ExcludeMatcher::State exclude_state = GlobAutomaton::kDead;
+    IgnoreChain ignore;
+    std::size_t rel_len = 0;
+    std::size_t wide_len = 0;
+};
+
+bool OpenFrame(const std::wstring& dir, DirId id, ExcludeMatcher::State exclude_state,
+               std::size_t rel_len, Frame* frame, DWORD* error) {
+    std::wstring pattern = dir + L"\\*";
+    frame->find = FindFirstFileExW(pattern.c_str(), FindExInfoBasic, &frame->data,
+                                   FindExSearchNameMatch, nullptr,
+                                   FIND_FIRST_EX_LARGE_FETCH);
+    if (frame->find == INVALID_HANDLE_VALUE) {
+        *error = GetLastError();
+        return false;
+    }
+    frame->has_pending = true;
+    frame->id = id;
+    frame->exclude_state = exclude_state;
+    frame->rel_len = rel_len;
+    frame->wide_len = dir.size();
+    return true;
+}
+
+#else
+
+bool IsDotEntry(const char* name) {
+    return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+bool StatEntry(int dir_fd, const char* name, bool follow, mode_t* mode, EntryMeta* meta) {
+#ifdef STATX_SIZE
+    struct statx stx;
+    int flags = AT_STATX_SYNC_AS_STAT | (follow ? 0 : AT_SYMLINK_NOFOLLOW);
+    if (statx(dir_fd, name, flags, STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME, &stx) != 0) {
+        return false;
+    }
+    *mode = stx.stx_mode;
+    meta->size = stx.stx_size;
+    meta->mtime_ns = static_cast<std::int64_t>(stx.stx_mtime.tv_sec) * 1000000000LL +
+                     stx.stx_mtime.tv_nsec;
+#else
+    struct stat st;
+    if (fstatat(dir_fd, name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) != 0) {
+        return false;
+    }
+    *mode = st.st_mode;
+    meta->size = static_cast<std::uint64_t>(st.st_size);
+    meta->mtime_ns = static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1000000000LL +
+                     st.st_mtim.tv_nsec;
+#endif
+    return true;
+}
+
+// Reads a per-directory ignore file; false when there is none.
+bool ReadIgnoreFile(int dir_fd, const char* name, std::string* text, int* error) {
+    int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *error = errno;
+        return false;
+    }
+    char buffer[4096];
+    ssize_t read_bytes = 0;
+    while ((read_bytes = read(fd, buffer, sizeof(buffer))) > 0) {
+        text->append(buffer, static_cast<std::size_t>(read_bytes));
+    }
+    close(fd);
+    return true;
+}
+
+struct Frame {
+    DIR* dir = nullptr;
+    DirId id = PathStore::kRootDir;
+    ExcludeMatcher::State exclude_state = GlobAutomaton::kDead;
+    std::size_t rel_len = 0;
+    IgnoreChain ignore;
+};
+
+#endif
+
+}  // namespace
+
+ScanStats ScanSource(const std::filesystem::path& root,
+                     const ExcludeMatcher& excludes,
+                     Logger& logger,
+                     PathStore* store,
+                     const std::string& ignore_file,
+                     const std::atomic<bool>* stop) {
+    ScanStats stats;
+    std::string rel;
+    std::vector<Frame> stack;
+    IgnoreFileCache ignore_cache;
+
+    auto add_ignore_rules = [&](const std::string& text, IgnoreChain* chain) {
+        if (const IgnoreRuleSet* rules = ignore_cache.Compile(text)) {
+            chain->push_back({rules, rules->Start()});
+        }
+    };
+
+    auto add_directory = [&](DirId parent, const std::string& name) {
+        DirId id = store->AddDirectory(parent, name);
+        if (id == PathStore::kInvalidId) {
+            logger.Error("Path store capacity exceeded at " + rel);
+            stats.errors++;
+        } else {
+            stats.directories++;
+        }
+        return id;
+    };
+
+    auto add_file = [&](DirId parent, const std::string& name, const EntryMeta& meta) {
+        if (store->AddFile(parent, name, meta.size, meta.mtime_ns) == PathStore::kInvalidId) {
+            logger.Error("Path store capacity exceeded at " + rel);
+            stats.errors++;
+        } else {
+            stats.files++;
+        }
+    };
+
+#ifdef _WIN32
+    std::wstring wide = root.native();
+    while (!wide.empty() && (wide.back() == L'\\' || wide.back() == L'/')) {
+        wide.pop_back();
+    }
+
+    const std::wstring ignore_name =
+        ignore_file.empty() ? std::wstring() : std::filesystem::u8path(ignore_file).native();
+    auto load_ignore_file = [&](Frame* frame) {
+        if (ignore_name.empty()) {
+            return;
+        }
+        std::string text;
+        DWORD error = 0;
+        if (ReadIgnoreFile(wide + L"\\" + ignore_name, &text, &error)) {
+            add_ignore_rules(text, &frame->ignore);
+        } else if (error != ERROR_FILE_NOT_FOUND) {
+            logger.Warn("Failed to read ignore file in: " + (rel.empty() ? "." : rel) + " (" +
+                        std::to_string(error) + ")");
+        }
+    };
+
+    DWORD open_error = 0;
+    stack.emplace_back();
+    if (!OpenFrame(wide, PathStore::kRootDir, excludes.RootState(), 0, &stack.back(),
+                   &open_error)) {
+        logger.Error("Failed to open source directory: " + root.string());
+        stats.errors++;
+        return stats;
+    }
+    load_ignore_file(&stack.back());
+
+    while (!stack.empty()) {
+        if (stop && stop->load(std::memory_order_relaxed)) {
+            for (Frame& open : stack) {
+                FindClose(open.find);
+            }
+            stack.clear();
+            stats.stopped = true;
+            break;
+        }
+        Frame& frame = stack.back();
+        if (frame.has_pending) {
+            frame.has_pending = false;
+        } else if (!FindNextFileW(frame.find, &frame.data)) {
+            DWORD error = GetLastError();
+            if (error != ERROR_NO_MORE_FILES) {
+                logger.Error("Directory iteration error: " + rel + " (" + std::to_string(error) + ")");
+                stats.errors++;
+            }
+            FindClose(frame.find);
+            stack.pop_back();
+            if (!stack.empty()) {
+                rel.resize(stack.back().rel_len);
+                wide.resize(stack.back().wide_len);
+            }
+            continue;
+        }
+
+        const WIN32_FIND_DATAW& data = frame.data;
+        if (IsDotEntry(data.cFileName)) {
+            continue;
+        }
+
+        DirId parent = frame.id;
+        ExcludeMatcher::State parent_state = frame.exclude_state;
+        std::size_t parent_rel = frame.rel_len;
+        std::size_t parent_wide = frame.wide_len;
+        std::string name = WideToUtf8(data.cFileName);
+        PushRelative(&rel, name);
+
+        bool is_dir = (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+        bool is_link = (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) != 0;
+
+        ExcludeMatcher::State child_state = GlobAutomaton::kDead;
+        IgnoreChain child_ignore;
+        if (excludes.ExcludesChild(parent_state, name, &child_state) ||
+            IsIgnored(frame.ignore, name, is_dir, &child_ignore)) {
+            stats.excluded++;
+            rel.resize(parent_rel);
+            continue;
+        }
+
+        if (is_dir) {
+            DirId id = add_directory(parent, name);
+            // Directory links are recorded but not followed, matching the
+            // default std::filesystem iteration options.
+            if (id != PathStore::kInvalidId && !is_link) {
+                wide.push_back(L'\\');
+                wide.append(data.cFileName);
+                Frame child;
+                DWORD error = 0;
+                if (OpenFrame(wide, id, child_state, rel.size(), &child, &error)) {
+                    child.ignore = std::move(child_ignore);
+                    load_ignore_file(&child);
+                    stack.push_back(std::move(child));
+                    continue;
+                }
+                if (error != ERROR_ACCESS_DENIED) {
+                    logger.Error("Failed to open directory: " + rel + " (" + std::to_string(error) + ")");
+                    stats.errors++;
+                }
+                wide.resize(parent_wide);
+            }
+        } else if (is_link) {
+            EntryMeta meta;
+            std::filesystem::path full = root / std::filesystem::u8path(rel);
+            if (ResolveLinkedFile(full, &meta)) {
+                add_file(parent, name, meta);
+            }
+        } else {
+            EntryMeta meta;
+            meta.size = (static_cast<std::uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+            meta.mtime_ns = FileTimeToUnixNs(data.ftLastWriteTime);
+            add_file(parent, name, meta);
+        }
+        rel.resize(parent_rel);
+    }
+#else
+    int root_fd = open(root.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR* root_dir = root_fd >= 0 ? fdopendir(root_fd) : nullptr;
+    if (!root_dir) {
+        if (root_fd >= 0) {
+            close(root_fd);
+        }
+        logger.Error("Failed to open source directory: " + root.string() + " (" +
+                     std::strerror(errno) + ")");
+        stats.errors++;
+        return stats;
+    }
+    auto load_ignore_file = [&](Frame* frame) {
+        if (ignore_file.empty()) {
+            return;
+        }
+        std::string text;
+        int error = 0;
+        if (ReadIgnoreFile(dirfd(frame->dir), ignore_file.c_str(), &text, &error)) {
+            add_ignore_rules(text, &frame->ignore);
+        } else if (error != ENOENT) {
+            logger.Warn("Failed to read ignore file in: " + (rel.empty() ? "." : rel) + " (" +
+                        std::strerror(error) + ")");
+        }
+    };
+
+    stack.push_back({root_dir, PathStore::kRootDir, excludes.RootState(), 0, {}});
+    load_ignore_file(&stack.back());
+
+    while (!stack.empty()) {
+        if (stop && stop->load(std::memory_order_relaxed)) {
+            for (Frame& open : stack) {
+                closedir(open.dir);
+            }
+            stack.clear();
+            stats.stopped = true;
+            break;
+        }
+        Frame& frame = stack.back();
+        errno = 0;
+        dirent* ent = readdir(frame.dir);
+        if (!ent) {
+            if (errno != 0) {
+                logger.Error("Directory iteration error: " + rel + " (" + std::strerror(errno) + ")");
+                stats.errors++;
+            }
+            closedir(frame.dir);
+            stack.pop_back();
+            if (!stack.empty()) {
+                rel.resize(stack.back().rel_len);
+            }
+            continue;
+        }
+        if (IsDotEntry(ent->d_name)) {
+            continue;
+        }
+
+        int dir_fd = dirfd(frame.dir);
+        DirId parent = frame.id;
+        ExcludeMatcher::State parent_state = frame.exclude_state;
+        std::size_t parent_rel = frame.rel_len;
+        std::string name = ent->d_name;
+        PushRelative(&rel, name);
+
+        ExcludeMatcher::State child_state = GlobAutomaton::kDead;
+        if (excludes.ExcludesChild(parent_state, name, &child_state)) {
+            stats.excluded++;
+            rel.resize(parent_rel);
+            continue;
+        }
+
+        unsigned char type = ent->d_type;
+        EntryMeta meta;
+        bool have_meta = false;
+        bool descend = true;
+        if (type == DT_UNKNOWN || type == DT_LNK) {
+            // Links are classified by their target but never descended into,
+            // as with the default std::filesystem iteration options.
+            mode_t mode = 0;
+            if (type == DT_UNKNOWN && StatEntry(dir_fd, ent->d_name, false, &mode, &meta)) {
+                type = S_ISDIR(mode) ? DT_DIR : S_ISREG(mode) ? DT_REG : S_ISLNK(mode) ? DT_LNK : 0;
+                have_meta = true;
+            }
+            if (type == DT_LNK) {
+                descend = false;
+                if (StatEntry(dir_fd, ent->d_name, true, &mode, &meta)) {
+                    type = S_ISDIR(mode) ? DT_DIR : S_ISREG(mode) ? DT_REG : 0;
+                    have_meta = true;
+                } else {
+                    type = 0;
+                }
+            }
+        }
+
+        IgnoreChain child_ignore;
+        if (IsIgnored(frame.ignore, name, type == DT_DIR, &child_ignore)) {
+            stats.excluded++;
+            rel.resize(parent_rel);
+            continue;
+        }
+
+        if (type == DT_DIR) {
+            DirId id = add_directory(parent, name);
+            if (id != PathStore::kInvalidId && descend) {
+                int child_fd = openat(dir_fd, ent->d_name,
+                                      O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+                DIR* child = child_fd >= 0 ? fdopendir(child_fd) : nullptr;
+                if (child) {
+                    stack.push_back({child, id, child_state, rel.size(), std::move(child_ignore)});
+                    load_ignore_file(&stack.back());
+                    continue;
+                }
+                int error = errno;
+                if (child_fd >= 0) {
+                    close(child_fd);
+                }
+                if (error != EACCES && error != EPERM) {
+                    logger.Error("Failed to open directory: " + rel + " (" + std::strerror(error) + ")");
+                    stats.errors++;
+                }
+            }
+        } else if (type == DT_REG) {
+            mode_t mode = 0;
+            if (have_meta || StatEntry(dir_fd, ent->d_name, false, &mode, &meta)) {
+                add_file(parent, name, meta);
+            } else {
+                logger.Error("Failed to stat file: " + rel + " (" + std::strerror(errno) + ")");
+                stats.errors++;
+            }
+        }
+        rel.resize(parent_rel);
+    }
+#endif
+
+    stats.ignore_files = ignore_cache.FilesLoaded();
+    return stats;
+}
+
+bool StatLocalFile(const std::filesystem::path& path, std::uint64_t* size, std::int64_t* mtime_ns) {
+    EntryMeta meta;
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data{};
+    if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data)) {
+        return false;
+    }
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+        return false;
+    }
+    if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+        if (!ResolveLinkedFile(path, &meta)) {
+            return false;
+        }
+    } else {
+        meta.size = (static_cast<std::uint64_t>(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+        meta.mtime_ns = FileTimeToUnixNs(data.ftLastWriteTime);
+    }
+#else
+    mode_t mode = 0;
+    if (!StatEntry(AT_FDCWD, path.c_str(), true, &mode, &meta) || !S_ISREG(mode)) {
+        return false;
+    }
+#endif
+    *size = meta.size;
+    *mtime_ns = meta.mtime_ns;
+    return true;
+}
+
+bool LocalFileIdentity(const std::filesystem::path& path, LocalFileId* id) {
+#ifdef _WIN32
+    // No access rights are needed to read the volume serial and file index.
+    HANDLE file = CreateFileW(path.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                              nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    BY_HANDLE_FILE_INFORMATION info{};
+    BOOL ok = GetFileInformationByHandle(file, &info);
+    CloseHandle(file);
+    if (!ok) {
+        return false;
+    }
+    id->device = info.dwVolumeSerialNumber;
+    id->index = (static_cast<std::uint64_t>(info.nFileIndexHigh) << 32) | info.nFileIndexLow;
+#else
+    struct stat st {};
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        return false;
+    }
+    id->device = static_cast<std::uint64_t>(st.st_dev);
+    id->index = static_cast<std::uint64_t>(st.st_ino);
+#endif
+    return true;
+}
@@ -0,0 +1,147 @@
+#include "shard.h"
+
+#include <algorithm>
+#include <string_view>
+#include <utility>
+
+namespace {
+
+// FNV-1a with a final mix, so that short, similar prefixes still spread
+// evenly modulo small shard counts. Must never change: processes on
+// different machines and versions have to agree.
+std::uint64_t PrefixHash(std::string_view text) {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+bool ParseCount(std::string_view text, std::uint32_t* out) {
+    if (text.empty() || text.size() > 6 ||
+        text.find_first_not_of("0123456789") != std::string_view::npos) {
+        return false;
+    }
+    *out = static_cast<std::uint32_t>(std::stoul(std::string(text)));
+    return true;
+}
+
+// Ancestor of every directory at `depth`, or the directory itself.
+std::vector<DirId> PrefixDirectories(const PathStore& store, std::uint32_t depth) {
+    std::vector<DirId> prefix(store.DirectoryCount());
+    for (DirId dir = 0; dir < store.DirectoryCount(); ++dir) {
+        prefix[dir] = static_cast<std::uint32_t>(store.DirectoryDepth(dir)) <= depth
+                          ? dir
+                          : prefix[store.DirectoryParent(dir)];
+    }
+    return prefix;
+}
+
+}  // namespace
+
+bool ParseShardSpec(const std::string& text, ShardSpec* spec) {
+    std::size_t slash = text.find('/');
+    std::uint32_t index = 0;
+    std::uint32_t count = 0;
+    if (slash == std::string::npos ||
+        !ParseCount(std::string_view(text).substr(0, slash), &index) ||
+        !ParseCount(std::string_view(text).substr(slash + 1), &count) || index == 0 ||
+        index > count) {
+        return false;
+    }
+    spec->index = index - 1;
+    spec->count = count;
+    return true;
+}
+
+std::vector<std::uint32_t> AssignShards(const PathStore& store, const ShardSpec& spec) {
+    std::vector<DirId> prefix = PrefixDirectories(store, spec.depth);
+    std::vector<std::uint32_t> shard(store.DirectoryCount(), 0);
+    for (DirId dir = 0; dir < store.DirectoryCount(); ++dir) {
+        shard[dir] = prefix[dir] == dir
+                         ? static_cast<std::uint32_t>(
+                               PrefixHash(store.DirectoryRelativeUtf8(dir)) % spec.count)
+                         : shard[prefix[dir]];
+    }
+    return shard;
+}
+
+ShardStats SelectShard(PathStore* store, const ShardSpec& spec, std::vector<std::uint8_t>* shared) {
+    const PathStore& full = *store;
+    std::size_t dir_count = full.DirectoryCount();
+    std::vector<std::uint32_t> shard = AssignShards(full, spec);
+    std::vector<DirId> prefix = PrefixDirectories(full, spec.depth);
+
+    ShardStats stats;
+    stats.files.assign(spec.count, 0);
+    stats.bytes.assign(spec.count, 0);
+    stats.prefixes.assign(spec.count, 0);
+    std::vector<std::uint64_t> prefix_bytes(dir_count, 0);
+    for (DirId dir = 0; dir < dir_count; ++dir) {
+        stats.prefixes[shard[dir]] += prefix[dir] == dir;
+    }
+    for (FileId file = 0; file < full.FileCount(); ++file) {
+        DirId dir = full.FileDirectory(file);
+        stats.files[shard[dir]]++;
+        stats.bytes[shard[dir]] += full.FileSize(file);
+        prefix_bytes[prefix[dir]] += full.FileSize(file);
+    }
+    auto largest = std::max_element(prefix_bytes.begin(), prefix_bytes.end());
+    if (largest != prefix_bytes.end() && *largest > 0) {
+        stats.largest_prefix =
+            full.DirectoryRelativeUtf8(static_cast<DirId>(largest - prefix_bytes.begin()));
+        stats.largest_prefix_bytes = *largest;
+    }
+
+    // Children have larger ids than their parents, so a reverse pass marks
+    // every ancestor of an owned directory.
+    std::vector<std::uint8_t> needed(dir_count, 0);
+    for (DirId dir = 0; dir < dir_count; ++dir) {
+        needed[dir] = shard[dir] == spec.index;
+    }
+    for (DirId dir = static_cast<DirId>(dir_count); dir-- > 1;) {
+        if (needed[dir]) {
+            needed[full.DirectoryParent(dir)] = 1;
+        }
+    }
+    needed[PathStore::kRootDir] = 1;
+
+    PathStore out;
+    std::vector<DirId> new_id(dir_count, PathStore::kInvalidId);
+    new_id[PathStore::kRootDir] = PathStore::kRootDir;
+    shared->assign(1, shard[PathStore::kRootDir] != spec.index);
+    for (DirId dir = 1; dir < dir_count; ++dir) {
+        if (needed[dir]) {
+            new_id[dir] =
+                out.AddDirectory(new_id[full.DirectoryParent(dir)], full.DirectoryName(dir));
+            shared->push_back(shard[dir] != spec.index);
+        }
+    }
+    out.ReserveFiles(stats.files[spec.index], 0);
+    for (FileId file = 0; file < full.FileCount(); ++file) {
+        DirId dir = full.FileDirectory(file);
+        if (shard[dir] == spec.index) {
+            out.AddFile(new_id[dir], full.FileName(file), full.FileSize(file),
+                        full.FileMtimeNs(file));
+        }
+    }
+    *store = std::move(out);
+    return stats;
+}
+
+double MaxOverMean(const std::vector<std::uint64_t>& values) {
+    std::uint64_t total = 0;
+    std::uint64_t max = 0;
+    for (std::uint64_t value : values) {
+        total += value;
+        max = std::max(max, value);
+    }
+    if (total == 0) {
+        return 1.0;
+    }
+    return static_cast<double>(max) * values.size() / total;
+}
@@ -0,0 +1,161 @@
+#include "state_manifest.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "binary_io.h"
+#include "file_util.h"
+
+namespace {
+
+// The magic predates compressed uploads, when only bundles kept manifests.
+const char kManifestMagic[8] = {'U', 'P', 'L', 'B', 'M', 'A', 'N', '\0'};
+// Version 2 added the stored size column, version 3 the file identity,
+// version 4 the content digest.
+constexpr std::uint32_t kManifestVersion = 4;
+
+std::uint64_t Fnv1a64(std::string_view text) {
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (char c : text) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+bool Fail(std::string* error, const std::string& message) {
+    if (error) {
+        *error = message;
+    }
+    return false;
+}
+
+}  // namespace
+
+bool StateManifest::Load(const std::filesystem::path& path, std::string* error) {
+    entries_.clear();
+    std::error_code ec;
+    if (!std::filesystem::exists(path, ec)) {
+        return true;
+    }
+    std::string data;
+    if (!ReadWholeFile(path, &data, error)) {
+        return false;
+    }
+    if (data.size() < sizeof(kManifestMagic) ||
+        std::string_view(data).substr(0, sizeof(kManifestMagic)) !=
+            std::string_view(kManifestMagic, sizeof(kManifestMagic))) {
+        return Fail(error, "not a state manifest");
+    }
+    BinaryReader reader(std::string_view(data).substr(sizeof(kManifestMagic)));
+    std::uint32_t version = reader.Get<std::uint32_t>();
+    std::vector<std::uint16_t> name_length;
+    std::vector<std::uint64_t> size;
+    std::vector<std::int64_t> mtime;
+    std::vector<std::uint64_t> stored;
+    std::vector<std::uint64_t> device;
+    std::vector<std::uint64_t> file_index;
+    std::string digests;
+    reader.GetColumn(&name_length);
+    std::string names = reader.GetString();
+    reader.GetColumn(&size);
+    reader.GetColumn(&mtime);
+    if (version >= 2) {
+        reader.GetColumn(&stored);
+    } else {
+        stored = size;
+    }
+    if (version >= 3) {
+        reader.GetColumn(&device);
+        reader.GetColumn(&file_index);
+    } else {
+        device.assign(name_length.size(), 0);
+        file_index.assign(name_length.size(), 0);
+    }
+    if (version >= 4) {
+        digests = reader.GetString();
+    } else {
+        digests.assign(name_length.size() * sizeof(Sha256Digest), '\0');
+    }
+    if (version < 1 || version > kManifestVersion || !reader.Ok() || !reader.AtEnd() ||
+        size.size() != name_length.size() || mtime.size() != name_length.size() ||
+        stored.size() != name_length.size() || device.size() != name_length.size() ||
+        file_index.size() != name_length.size() ||
+        digests.size() != name_length.size() * sizeof(Sha256Digest)) {
+        return Fail(error, "invalid state manifest");
+    }
+    std::size_t offset = 0;
+    for (std::size_t i = 0; i < name_length.size(); ++i) {
+        if (offset + name_length[i] > names.size()) {
+            entries_.clear();
+            return Fail(error, "invalid state manifest");
+        }
+        Entry& entry = entries_[names.substr(offset, name_length[i])];
+        entry = {size[i], mtime[i], stored[i], device[i], file_index[i]};
+        std::memcpy(entry.digest.data(), digests.data() + i * sizeof(Sha256Digest),
+                    sizeof(Sha256Digest));
+        offset += name_length[i];
+    }
+    return true;
+}
+
+bool StateManifest::Save(const std::filesystem::path& path, std::string* error) const {
+    // Sorted, so the file does not depend on hash order.
+    std::vector<const std::pair<const std::string, Entry>*> sorted;
+    sorted.reserve(entries_.size());
+    for (const auto& entry : entries_) {
+        sorted.push_back(&entry);
+    }
+    std::sort(sorted.begin(), sorted.end(),
+              [](const auto* a, const auto* b) { return a->first < b->first; });
+
+    std::vector<std::uint16_t> name_length;
+    std::vector<std::uint64_t> size;
+    std::vector<std::int64_t> mtime;
+    std::vector<std::uint64_t> stored;
+    std::vector<std::uint64_t> device;
+    std::vector<std::uint64_t> file_index;
+    std::string names;
+    std::string digests;
+    for (const auto* entry : sorted) {
+        name_length.push_back(static_cast<std::uint16_t>(entry->first.size()));
+        names += entry->first;
+        size.push_back(entry->second.size);
+        mtime.push_back(entry->second.mtime_ns);
+        stored.push_back(entry->second.stored_size);
+        device.push_back(entry->second.device);
+        file_index.push_back(entry->second.file_index);
+        digests.append(reinterpret_cast<const char*>(entry->second.digest.data()),
+                       sizeof(Sha256Digest));
+    }
+
+    std::string out(kManifestMagic, sizeof(kManifestMagic));
+    BinaryWriter writer(&out);
+    writer.Put<std::uint32_t>(kManifestVersion);
+    writer.PutColumn(name_length);
+    writer.PutString(names);
+    writer.PutColumn(size);
+    writer.PutColumn(mtime);
+    writer.PutColumn(stored);
+    writer.PutColumn(device);
+    writer.PutColumn(file_index);
+    writer.PutString(digests);
+    return WriteFileAtomic(path, out, error);
+}
+
+const StateManifest::Entry* StateManifest::Find(const std::string& name) const {
+    auto found = entries_.find(name);
+    return found == entries_.end() ? nullptr : &found->second;
+}
+
+std::filesystem::path StateManifestPath(const std::filesystem::path& state_dir,
+                                        const std::string& kind, const std::string& key) {
+    char hash[20];
+    std::snprintf(hash, sizeof(hash), "%016llx",
+                  static_cast<unsigned long long>(Fnv1a64(key)));
+    return state_dir / (kind + "-" + hash + ".manifest");
+}
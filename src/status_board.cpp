@@ -0,0 +1,306 @@
+#include "status_board.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "file_util.h"
+
+namespace {
+
+// Throughput is measured over this many seconds of reports.
+constexpr double kRateWindowSeconds = 10.0;
+
+std::int64_t SteadyMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+std::string FormatBytes(std::uint64_t bytes) {
+    const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+    double value = static_cast<double>(bytes);
+    int unit = 0;
+    while (value >= 1024.0 && unit < 4) {
+        value /= 1024.0;
+        unit++;
+    }
+    char out[32];
+    std::snprintf(out, sizeof(out), unit == 0 ? "%.0f %s" : "%.1f %s", value, units[unit]);
+    return out;
+}
+
+std::string FormatDuration(double seconds) {
+    std::uint64_t total = static_cast<std::uint64_t>(seconds + 0.5);
+    char out[32];
+    std::snprintf(out, sizeof(out), "%llu:%02u:%02u",
+                  static_cast<unsigned long long>(total / 3600),
+                  static_cast<unsigned>(total / 60 % 60), static_cast<unsigned>(total % 60));
+    return out;
+}
+
+// Seconds left at `rate`, or a negative value when unknown.
+double Eta(const StatusSnapshot& status, double rate) {
+    if (status.bytes_done >= status.bytes_total) {
+        return 0.0;
+    }
+    return rate > 0.0 ? (status.bytes_total - status.bytes_done) / rate : -1.0;
+}
+
+std::string JsonString(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        switch (c) {
+            case '"':
+                out += "\\\"";
+                break;
+            case '\\':
+                out += "\\\\";
+                break;
+            case '\n':
+                out += "\\n";
+                break;
+            case '\r':
+                out += "\\r";
+                break;
+            case '\t':
+                out += "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                    out += escaped;
+                } else {
+                    out += c;
+                }
+        }
+    }
+    return out + "\"";
+}
+
+std::string JsonNumber(double value) {
+    char out[32];
+    std::snprintf(out, sizeof(out), "%.1f", value);
+    return out;
+}
+
+}  // namespace
+
+const char* WorkerStateName(WorkerState state) {
+    switch (state) {
+        case WorkerState::Sending:
+            return "sending";
+        case WorkerState::Waiting:
+            return "waiting";
+        case WorkerState::RetryWait:
+            return "retry-wait";
+        case WorkerState::Done:
+            return "done";
+        default:
+            return "idle";
+    }
+}
+
+void WorkerStatus::SetState(WorkerState value) {
+    since_ms.store(SteadyMs(), std::memory_order_relaxed);
+    state.store(static_cast<std::uint8_t>(value), std::memory_order_relaxed);
+}
+
+StatusBoard::StatusBoard(std::uint64_t errors)
+    : start_(std::chrono::steady_clock::now()), errors_(errors) {}
+
+void StatusBoard::AddPlanned(std::uint64_t files, std::uint64_t bytes) {
+    files_total_ += files;
+    bytes_total_ += bytes;
+}
+
+void StatusBoard::SetWorkers(std::size_t count) {
+    workers_.reset(new WorkerStatus[count]);
+    worker_count_ = count;
+    for (std::size_t i = 0; i < count; ++i) {
+        workers_[i].SetState(WorkerState::Idle);
+    }
+}
+
+void StatusBoard::Begin(WorkerStatus& worker, std::uint64_t key, std::uint64_t bytes) {
+    worker.sent.store(0, std::memory_order_relaxed);
+    worker.item_bytes.store(bytes, std::memory_order_relaxed);
+    worker.item.store(key, std::memory_order_relaxed);
+}
+
+void StatusBoard::Finish(WorkerStatus& worker, std::uint64_t files) {
+    // Dropped from the worker before it is added to the total, so a reader
+    // may briefly miss the item but never counts it twice.
+    std::uint64_t bytes = worker.item_bytes.load(std::memory_order_relaxed);
+    worker.item.store(0, std::memory_order_relaxed);
+    worker.sent.store(0, std::memory_order_relaxed);
+    worker.SetState(WorkerState::Idle);
+    bytes_done_.fetch_add(bytes, std::memory_order_relaxed);
+    files_done_.fetch_add(files, std::memory_order_relaxed);
+}
+
+StatusSnapshot StatusBoard::Read() const {
+    StatusSnapshot status;
+    status.elapsed_seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+    status.files_total = files_total_;
+    status.bytes_total = bytes_total_;
+    status.files_done = files_done_.load(std::memory_order_relaxed);
+    status.bytes_done = bytes_done_.load(std::memory_order_relaxed);
+    status.errors = errors_.load(std::memory_order_relaxed);
+    std::int64_t now = SteadyMs();
+    status.workers.resize(worker_count_);
+    for (std::size_t i = 0; i < worker_count_; ++i) {
+        const WorkerStatus& source = workers_[i];
+        StatusSnapshot::Worker& worker = status.workers[i];
+        worker.state = static_cast<WorkerState>(source.state.load(std::memory_order_relaxed));
+        worker.state_seconds = (now - source.since_ms.load(std::memory_order_relaxed)) / 1000.0;
+        worker.item = source.item.load(std::memory_order_relaxed);
+        worker.retries = source.retries.load(std::memory_order_relaxed);
+        if (worker.item != 0) {
+            // A compressed or bundled body may differ from the planned size.
+            worker.item_bytes = source.item_bytes.load(std::memory_order_relaxed);
+            worker.sent = std::min(source.sent.load(std::memory_order_relaxed), worker.item_bytes);
+            status.bytes_done += worker.sent;
+        }
+        status.retries += worker.retries;
+    }
+    return status;
+}
+
+std::string FormatStatusLine(const StatusSnapshot& status, double rate) {
+    double done = status.bytes_total > 0
+                      ? 100.0 * status.bytes_done / status.bytes_total
+                      : (status.files_total > 0 ? 100.0 * status.files_done / status.files_total
+                                                : 100.0);
+    char percent[16];
+    std::snprintf(percent, sizeof(percent), "%3.0f%%", done);
+    std::string line = std::string(percent) + " | " + std::to_string(status.files_done) + "/" +
+                       std::to_string(status.files_total) + " files | " +
+                       FormatBytes(status.bytes_done) + "/" + FormatBytes(status.bytes_total) +
+                       " | " + FormatBytes(static_cast<std::uint64_t>(rate)) + "/s";
+    double eta = Eta(status, rate);
+    line += " | ETA " + (eta < 0.0 ? std::string("?") : FormatDuration(eta));
+    line += " | " + std::to_string(status.errors) + " errors";
+    std::size_t counts[5] = {};
+    for (const StatusSnapshot::Worker& worker : status.workers) {
+        counts[static_cast<std::size_t>(worker.state)]++;
+    }
+    std::string states;
+    for (WorkerState state : {WorkerState::Sending, WorkerState::Waiting, WorkerState::RetryWait}) {
+        std::size_t count = counts[static_cast<std::size_t>(state)];
+        if (count > 0) {
+            states += (states.empty() ? "" : ", ") + std::to_string(count) + " " +
+                      WorkerStateName(state);
+        }
+    }
+    if (!states.empty()) {
+        line += " | " + states;
+    }
+    return line;
+}
+
+std::string FormatStatusJson(const StatusSnapshot& status, double rate,
+                             const std::vector<std::string>& names, bool finished) {
+    double eta = Eta(status, rate);
+    std::string out = "{\n";
+    out += "  \"finished\": " + std::string(finished ? "true" : "false") + ",\n";
+    out += "  \"elapsed_seconds\": " + JsonNumber(status.elapsed_seconds) + ",\n";
+    out += "  \"files\": {\"done\": " + std::to_string(status.files_done) +
+           ", \"total\": " + std::to_string(status.files_total) + "},\n";
+    out += "  \"bytes\": {\"done\": " + std::to_string(status.bytes_done) +
+           ", \"total\": " + std::to_string(status.bytes_total) + "},\n";
+    out += "  \"bytes_per_second\": " + JsonNumber(rate) + ",\n";
+    out += "  \"eta_seconds\": " + (eta < 0.0 ? std::string("null") : JsonNumber(eta)) + ",\n";
+    out += "  \"errors\": " + std::to_string(status.errors) + ",\n";
+    out += "  \"retries\": " + std::to_string(status.retries) + ",\n";
+    out += "  \"workers\": [";
+    for (std::size_t i = 0; i < status.workers.size(); ++i) {
+        const StatusSnapshot::Worker& worker = status.workers[i];
+        out += i == 0 ? "\n" : ",\n";
+        out += "    {\"state\": " + JsonString(WorkerStateName(worker.state)) +
+               ", \"state_seconds\": " + JsonNumber(worker.state_seconds) + ", \"item\": " +
+               (worker.item == 0 || i >= names.size() ? std::string("null")
+                                                      : JsonString(names[i])) +
+               ", \"item_bytes\": " + std::to_string(worker.item_bytes) +
+               ", \"sent\": " + std::to_string(worker.sent) +
+               ", \"retries\": " + std::to_string(worker.retries) + "}";
+    }
+    out += status.workers.empty() ? "]\n" : "\n  ]\n";
+    out += "}\n";
+    return out;
+}
+
+double RateWindow::Add(double seconds, std::uint64_t bytes) {
+    samples_.emplace_back(seconds, bytes);
+    while (samples_.size() > 2 && samples_.back().first - samples_[1].first >= kRateWindowSeconds) {
+        samples_.erase(samples_.begin());
+    }
+    double span = samples_.back().first - samples_.front().first;
+    double delta = static_cast<double>(samples_.back().second) -
+                   static_cast<double>(samples_.front().second);
+    return span > 0.0 ? (std::max)(0.0, delta) / span : 0.0;
+}
+
+StatusReporter::StatusReporter(const StatusBoard& board, const StatusOptions& options,
+                               std::function<std::string(std::uint64_t)> describe,
+                               Logger& logger)
+    : board_(board), options_(options), describe_(std::move(describe)), logger_(logger) {
+    Report(false);
+    thread_ = std::thread([this]() { Loop(); });
+}
+
+StatusReporter::~StatusReporter() {
+    Stop();
+}
+
+void StatusReporter::Stop() {
+    if (!thread_.joinable()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    thread_.join();
+    Report(true);
+}
+
+void StatusReporter::Loop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!wake_.wait_for(lock, options_.interval, [this]() { return stop_; })) {
+        lock.unlock();
+        Report(false);
+        lock.lock();
+    }
+}
+
+void StatusReporter::Report(bool finished) {
+    StatusSnapshot status = board_.Read();
+    double rate = 0.0;
+    if (finished) {
+        rate = status.elapsed_seconds > 0.0 ? status.bytes_done / status.elapsed_seconds : 0.0;
+    } else {
+        rate = rate_.Add(status.elapsed_seconds, status.bytes_done);
+    }
+
+    if (options_.console) {
+        logger_.SetStatusLine(finished ? std::string() : FormatStatusLine(status, rate));
+    }
+    if (options_.file.empty()) {
+        return;
+    }
+    std::vector<std::string> names(status.workers.size());
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        if (status.workers[i].item != 0) {
+            names[i] = describe_(status.workers[i].item);
+        }
+    }
+    std::string error;
+    if (!WriteFileAtomic(options_.file, FormatStatusJson(status, rate, names, finished), &error) &&
+        !file_failed_) {
+        file_failed_ = true;
+        logger_.Warn("Failed to write status file " + options_.file.string() + ": " + error);
+    }
+}
@@ -2,41 +2,48 @@
 
 #include <algorithm>
 #include <atomic>
+#include <cctype>
 #include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
 #include <memory>
 #include <mutex>
+#include <string_view>
 #include <thread>
+#include <unordered_map>
 #include <unordered_set>
 
+#include "bundle.h"
 #include "decision.h"
+#include "dedup.h"
 #include "exclude.h"
+#include "fair_scheduler.h"
+#include "file_reader.h"
+#include "gzip_stream.h"
+#include "http_trace.h"
+#include "local_deleter.h"
+#include "path_store.h"
 #include "path_utils.h"
+#include "plan.h"
+#include "rate_limiter.h"
+#include "renames.h"
+#include "rules.h"
+#include "scanner.h"
+#include "sha256.h"
+#include "shard.h"
+#include "state_manifest.h"
+#include "status_board.h"
 #include "webdav_client.h"
 
 namespace {
 
-struct FileEntry {
-    std::filesystem::path abs_path;
-    std::filesystem::path rel_path;
+enum DirState : std::uint8_t {
+    kDirUnknown = 0,
+    kDirExists = 1,
+    kDirMissing = 2
 };
 
-std::chrono::system_clock::time_point FileTimeToSystemClock(
-    const std::filesystem::file_time_type& ft) {
-    auto now_sys = std::chrono::system_clock::now();
-    auto now_file = std::filesystem::file_time_type::clock::now();
-    return std::chrono::time_point_cast<std::chrono::system_clock::duration>(
-        ft - now_file + now_sys);
-}
-
-bool IsJpgFile(const std::filesystem::path& path) {
-    std::string ext = ToLowerAscii(path.extension().string());
-    return ext == ".jpg";
-}
-
-int PathDepth(const std::filesystem::path& path) {
-    return static_cast<int>(std::distance(path.begin(), path.end()));
-}
-
 std::vector<std::string> SplitRemotePath(const std::string& remote_path) {
     std::vector<std::string> parts;
     std::string current;
@@ -56,299 +63,2420 @@ std::vector<std::string> SplitRemotePath(const std::string& remote_path) {
     return parts;
 }
 
-}  // namespace
+std::chrono::system_clock::time_point FromUnixNs(std::int64_t ns) {
+    return std::chrono::system_clock::time_point(
+        std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::nanoseconds(ns)));
+}
 
-SyncStats RunSync(const AppConfig& config, Logger& logger) {
-    SyncStats stats;
-    auto run_start = std::chrono::system_clock::now();
+int WorkerCount(int threads, std::size_t items) {
+    std::size_t count = static_cast<std::size_t>(std::max(1, threads));
+    return static_cast<int>(std::max<std::size_t>(1, std::min(count, items)));
+}
+
+// Files of directory d are files[begin[d] .. begin[d + 1]).
+struct FilesByDirectory {
+    std::vector<std::uint32_t> begin;
+    std::vector<FileId> files;
+};
 
-    ExcludeRules rules = BuildDefaultExcludeRules();
-    for (const auto& pattern : config.excludes) {
-        rules.patterns.push_back(pattern);
+FilesByDirectory GroupFilesByDirectory(const PathStore& store) {
+    FilesByDirectory groups;
+    groups.begin.assign(store.DirectoryCount() + 1, 0);
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        groups.begin[store.FileDirectory(file) + 1]++;
+    }
+    for (std::size_t dir = 1; dir < groups.begin.size(); ++dir) {
+        groups.begin[dir] += groups.begin[dir - 1];
     }
+    std::vector<std::uint32_t> next(groups.begin.begin(), groups.begin.end() - 1);
+    groups.files.resize(store.FileCount());
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        groups.files[next[store.FileDirectory(file)]++] = file;
+    }
+    return groups;
+}
 
-    bool remote_checks = !config.app_password.empty();
-    if (config.dry_run && !remote_checks) {
-        logger.Warn("Dry-run without app password: remote checks are disabled.");
+// Files of one bundle root, in scan order, cut at `max_bytes` of archive.
+struct PlannedBundle {
+    std::uint16_t group = 0;
+    std::vector<FileId> files;
+    std::uint64_t bytes = 0;
+};
+
+std::vector<PlannedBundle> PlanBundles(const SyncPlan& plan, std::uint64_t max_bytes) {
+    std::vector<PlannedBundle> bundles;
+    std::vector<std::size_t> open(plan.bundle_roots.size(), static_cast<std::size_t>(-1));
+    for (FileId file = 0; file < plan.store.FileCount(); ++file) {
+        std::uint16_t group = plan.bundle[file];
+        if (group == 0 || plan.reason[file] == kReasonUndecided ||
+            plan.action[file] == FileActionType::Skip) {
+            continue;
+        }
+        // Header plus padded data; long names add a PAX block or two.
+        std::uint64_t bytes = 512 + TarPaddedSize(plan.store.FileSize(file));
+        std::size_t& current = open[group - 1];
+        if (current == static_cast<std::size_t>(-1) ||
+            bundles[current].bytes + bytes > max_bytes) {
+            current = bundles.size();
+            bundles.push_back({group, {}, 0});
+        }
+        bundles[current].files.push_back(file);
+        bundles[current].bytes += bytes;
     }
+    return bundles;
+}
 
-    std::string url_error;
-    auto base_url = WebDavClient::ParseBaseUrl(config.base_url, &url_error);
-    if (!base_url) {
-        logger.Error("Invalid base URL: " + url_error);
-        stats.errors++;
-        return stats;
+// UTC "YYYYMMDD-HHMMSS-mmm", shared by the bundles of one run.
+std::string BundleStamp() {
+    auto now = std::chrono::system_clock::now();
+    std::time_t seconds = std::chrono::system_clock::to_time_t(now);
+    auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      now.time_since_epoch())
+                      .count() %
+                  1000;
+    std::tm utc_tm{};
+#ifdef _WIN32
+    gmtime_s(&utc_tm, &seconds);
+#else
+    gmtime_r(&seconds, &utc_tm);
+#endif
+    char buffer[32];
+    std::size_t length = std::strftime(buffer, sizeof(buffer), "%Y%m%d-%H%M%S", &utc_tm);
+    std::snprintf(buffer + length, sizeof(buffer) - length, "-%03d", static_cast<int>(millis));
+    return buffer;
+}
+
+// Remote name of a file: its own, plus ".gz" when it is uploaded compressed.
+std::string StoredName(const SyncPlan& plan, FileId file) {
+    std::string name(plan.store.FileName(file));
+    if (plan.encoding[file] == FileEncoding::Gzip) {
+        name += ".gz";
+    }
+    return name;
+}
+
+RemotePath StoredPath(const SyncPlan& plan, const RemotePathTable& remote_paths, FileId file) {
+    RemotePath path = remote_paths.File(file);
+    if (plan.encoding[file] == FileEncoding::Gzip) {
+        path.plain += ".gz";
+        path.encoded += ".gz";
     }
+    return path;
+}
 
-    WebDavCredentials creds{config.email, config.app_password};
+// Chunks start at multiples of this, as direct reads need (see
+// FileReader::SetRange).
+constexpr std::uint64_t kChunkAlign = 1ULL << 20;
 
-    std::vector<std::filesystem::path> directories;
-    std::vector<FileEntry> files;
+// Name in the chunks manifest of the chunk at `offset` of a file.
+std::string ChunkKey(const std::string& rel_name, std::uint64_t offset) {
+    return rel_name + "\n" + std::to_string(offset);
+}
 
-    std::error_code ec;
-    std::filesystem::recursive_directory_iterator iter(
-        config.source, std::filesystem::directory_options::skip_permission_denied, ec);
-    std::filesystem::recursive_directory_iterator end;
-    for (; iter != end; iter.increment(ec)) {
-        if (ec) {
-            logger.Error("Directory iteration error: " + ec.message());
-            stats.errors++;
-            ec.clear();
-            continue;
+// How an upload treats a file matching --append: not at all, record its
+// size and digest once it is uploaded whole, or first try to send only
+// what it grew by since the recorded upload.
+enum AppendMode : std::uint8_t {
+    kAppendNone = 0,
+    kAppendRecord = 1,
+    kAppendTail = 2
+};
+
+// Whether the server writes a Content-Range PUT into an existing object.
+enum RangedPuts : std::uint8_t {
+    kRangesUnknown = 0,
+    kRangesSupported = 1,
+    kRangesUnsupported = 2
+};
+
+// Hashes what a body produces on its way to the server. A rewind for a
+// retry starts again from `seed`, the hash of the bytes before the body.
+class HashingBody : public UploadBody {
+public:
+    HashingBody(UploadBody* inner, const Sha256& seed) : inner_(inner), seed_(seed), hash_(seed) {}
+
+    std::uint64_t Size() const override { return inner_->Size(); }
+    bool Rewind(std::string* error) override {
+        hash_ = seed_;
+        return inner_->Rewind(error);
+    }
+    bool Read(char* buffer, std::size_t capacity, std::size_t* read, std::string* error) override {
+        if (!inner_->Read(buffer, capacity, read, error)) {
+            return false;
         }
+        hash_.Update(buffer, *read);
+        return true;
+    }
 
-        const auto& entry = *iter;
-        std::filesystem::path rel = std::filesystem::relative(entry.path(), config.source, ec);
-        if (ec) {
-            logger.Error("Failed to build relative path: " + ec.message());
-            stats.errors++;
-            ec.clear();
-            continue;
+    Sha256Digest Finish() { return hash_.Finish(); }
+
+private:
+    UploadBody* inner_;
+    Sha256 seed_;
+    Sha256 hash_;
+};
+
+// Feeds all of `body` into `hash`.
+bool HashBody(UploadBody* body, Sha256* hash, std::string* error) {
+    std::vector<char> buffer(1 << 20);
+    std::size_t read = 0;
+    do {
+        if (!body->Read(buffer.data(), buffer.size(), &read, error)) {
+            return false;
         }
+        hash->Update(buffer.data(), read);
+    } while (read > 0);
+    return true;
+}
+
+class SyncRunner {
+public:
+    // `pool` is null when remote checks are disabled. `job` names the
+    // deletion journal of one of several jobs; empty for a single one.
+    SyncRunner(const AppConfig& config, WebDavClientPool* pool, Logger& logger, SyncStats* stats,
+               const std::string& job)
+        : config_(config),
+          pool_(pool),
+          job_(job),
+          remote_checks_(!config.app_password.empty()),
+          logger_(logger),
+          stats_(stats),
+          rules_(config.rules) {}
+
+    // A client from the shared pool, or empty (an error is counted) when
+    // none could be created; always empty without remote checks.
+    PooledClient MakeClient(const char* purpose);
+
+    // Lists every remote directory once (PROPFIND Depth: 1) and decides all
+    // files of that directory against the listing, directories spread over
+    // --probe-threads threads. Nothing is modified, locally or remotely.
+    void Decide(SyncPlan* plan);
+    // Points uploads of files renamed since an earlier run at their old
+    // remote path (see FindRenamedUploads).
+    void DetectRenames(SyncPlan* plan);
+    // Directories a shard keeps only as ancestors of its own (see
+    // SelectShard); Decide leaves their listing to the owning shard.
+    void SetSharedDirectories(std::vector<std::uint8_t> shared) { shared_dirs_ = std::move(shared); }
+    // Runs the actions of a plan in three steps, so that several jobs can
+    // share one set of workers. BeginExecute creates the directories, moves
+    // renamed ones and queues the uploads largest first, returning the bytes
+    // of each queued item and flagging in `deletes` those that delete local
+    // files once done; RunItem runs one of them on a worker's client;
+    // FinishExecute saves state and waits for the deletion stage. With
+    // `verify_local` every file is stat'ed again first and skipped if it
+    // changed since the plan was made. `plan` must outlive FinishExecute.
+    std::vector<std::uint64_t> BeginExecute(const SyncPlan& plan, bool verify_local,
+                                            std::vector<std::uint8_t>* deletes);
+    void RunItem(WebDavClient* client, std::size_t item);
+    void FinishExecute();
+    // Planned bytes and files an item covers, and what the status shows
+    // it as.
+    std::uint64_t ItemBytes(std::size_t item) const { return order_[item].bytes; }
+    std::uint64_t ItemFiles(std::size_t item) const;
+    std::string ItemName(std::size_t item) const;
+    // Errors are counted on `board` as well from now on.
+    void SetStatusBoard(StatusBoard* board) { board_ = board; }
+
+private:
+    // Single files, bundles and chunks share one largest-first queue;
+    // `bundle` is the 1-based bundle index, 0 for a single file, and
+    // `chunked` the 1-based index of a chunked upload with `chunk` the
+    // 0-based chunk of it.
+    struct WorkItem {
+        std::uint64_t bytes;
+        std::uint32_t bundle;
+        FileId file;
+        // Local files deleted once the item is done.
+        bool deletes;
+        std::uint32_t chunked = 0;
+        std::uint32_t chunk = 0;
+    };
+
+    // A large file uploaded in chunks into a temporary object next to its
+    // remote name, which the last chunk to finish moves into place. When
+    // the server ignores Content-Range (`ranged` false) the one chunk is the
+    // whole file.
+    struct ChunkedUpload {
+        FileId file = 0;
+        RemotePath part;
+        std::uint64_t chunk_size = 0;
+        std::uint32_t chunks = 0;
+        bool ranged = true;
+        // The queued chunk counted as the file on the status board.
+        std::uint32_t last_queued = 0;
+        std::atomic<std::uint32_t> remaining{0};
+        std::atomic<bool> failed{false};
+        std::atomic<bool> changed{false};
+    };
+
+    void DecideFile(SyncPlan* plan, FileId file, const RemoteItemInfo& remote,
+                    const RemotePathTable& remote_paths, std::uint64_t local_size);
+    void ChooseEncodings(SyncPlan* plan, const FilesByDirectory& groups, DirId dir);
+    void DecideStoredFile(SyncPlan* plan, FileId file, const RemoteItemInfo& remote,
+                          const RemotePathTable& remote_paths);
+    void EnsureRootDirectory(WebDavClient* client, const RemotePath& current);
+    void CreateDirectory(WebDavClient* client, const RemotePath& path);
+    bool ExecuteFile(WebDavClient* client, const SyncPlan& plan, FileId file,
+                     const RemotePathTable& remote_paths, bool verify_local,
+                     bool confirm_unchanged);
+    void ExecuteCopy(WebDavClient* client, const SyncPlan& plan, FileId file, bool source_intact,
+                     const RemotePathTable& remote_paths, bool verify_local);
+    void ExecuteRename(WebDavClient* client, const SyncPlan& plan, FileId file,
+                       const RemotePathTable& remote_paths, bool verify_local,
+                       bool moved_with_directory);
+    bool RenameDirectory(WebDavClient* client, const SyncPlan& plan, DirId dir,
+                         const RemotePathTable& remote_paths);
+    // Remembers an upload for rename detection; `old_name` is the entry it
+    // replaces after a rename.
+    void RecordUpload(const SyncPlan& plan, FileId file, const std::string* old_name);
+    std::filesystem::path BundleManifestFile(const SyncPlan& plan, std::uint16_t group) const;
+    std::filesystem::path GzipManifestFile(const SyncPlan& plan) const;
+    std::filesystem::path UploadsManifestFile(const SyncPlan& plan) const;
+    bool LoadState(const std::filesystem::path& path, StateManifest* manifest);
+    bool EnsureStateDir();
+    void ExecuteBundle(WebDavClient* client, const SyncPlan& plan, const PlannedBundle& bundle,
+                       const RemotePath& target);
+    std::filesystem::path ChunksManifestFile(const SyncPlan& plan) const;
+    bool UploadsInChunks(const SyncPlan& plan, FileId file) const;
+    bool ProbeRangedPut(WebDavClient* client, const RemotePath& part);
+    // Queues the chunks of `files` that earlier runs did not upload yet, or
+    // plain uploads when the server turns out not to support them.
+    void QueueChunkedUploads(WebDavClient* client, const SyncPlan& plan,
+                             const std::vector<FileId>& files);
+    void ExecuteChunk(WebDavClient* client, const WorkItem& item);
+    void FinishChunkedUpload(WebDavClient* client, ChunkedUpload& upload);
+    std::filesystem::path AppendsManifestFile(const SyncPlan& plan) const;
+    // Sends only the bytes `file` grew by since its recorded upload, with a
+    // Content-Range PUT, when that upload is still intact locally and on the
+    // server. False when the file has to be uploaded whole.
+    bool AppendTail(WebDavClient* client, const SyncPlan& plan, FileId file,
+                    const RemotePath& remote_path);
+    // Remembers the first `size` bytes of `file` as its upload for the next
+    // append; hashes them from disk when `digest` is null.
+    void RecordAppendBase(const SyncPlan& plan, FileId file, std::uint64_t size,
+                          const Sha256Digest* digest);
+    // Drops the chunks of `upload` from the manifest; chunks_mutex_ held.
+    bool SettlePart(WebDavClient* client, const ChunkedUpload& upload, bool* whole);
+    void ForgetChunks(const ChunkedUpload& upload);
+    void SaveChunks();
+
+    void AddError() {
+        if (board_) {
+            board_->AddErrors(1);
+        }
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_->errors++;
+    }
+
+    const AppConfig& config_;
+    WebDavClientPool* pool_;
+    std::string job_;
+    bool remote_checks_;
+    Logger& logger_;
+    SyncStats* stats_;
+    std::mutex stats_mutex_;
+    StatusBoard* board_ = nullptr;
+    // Set by BeginExecute for RunItem and FinishExecute.
+    const SyncPlan* plan_ = nullptr;
+    bool verify_local_ = false;
+    std::unique_ptr<RemotePathTable> remote_paths_;
+    std::vector<PlannedBundle> bundles_;
+    std::vector<RemotePath> bundle_targets_;
+    std::vector<WorkItem> order_;
+    // Copies run on the worker that uploaded their source, right after it.
+    std::unordered_map<FileId, std::vector<FileId>> copies_;
+    // Uploaded files are handed to the deletion stage, which runs until
+    // every worker is done.
+    std::unique_ptr<LocalDeleter> deleter_;
+    // Per bundle root, updated as bundles land.
+    std::vector<StateManifest> manifests_;
+    std::mutex manifest_mutex_;
+    // Directories of other shards, kept as ancestors of this one's.
+    std::vector<std::uint8_t> shared_dirs_;
+    // Files matching --compress, set before the decision workers start.
+    std::vector<std::uint8_t> compress_candidate_;
+    // Per file, its index in rules_; set before the decision workers start,
+    // as the table is not thread-safe.
+    RuleTable rules_;
+    std::vector<std::uint8_t> file_rule_;
+    // Compressed sizes of earlier uploads; read-only while deciding, updated
+    // under gzip_mutex_ while executing.
+    StateManifest gzip_manifest_;
+    bool gzip_loaded_ = false;
+    bool gzip_dirty_ = false;
+    std::mutex gzip_mutex_;
+    // Uploads with their file identity, for --detect-renames.
+    StateManifest uploads_manifest_;
+    bool uploads_loaded_ = false;
+    bool uploads_dirty_ = false;
+    std::mutex uploads_mutex_;
+    // Chunks already on the server, saved after every chunk so that an
+    // interrupted upload resumes; atomics keep ChunkedUpload off a vector.
+    std::vector<std::unique_ptr<ChunkedUpload>> chunked_;
+    StateManifest chunks_manifest_;
+    std::mutex chunks_mutex_;
+    // Per file, its AppendMode; empty without --append.
+    std::vector<std::uint8_t> append_mode_;
+    // Size and digest of the last upload of each --append file.
+    StateManifest appends_manifest_;
+    bool appends_dirty_ = false;
+    std::mutex appends_mutex_;
+    // Learned from the chunked upload probe or the first append.
+    std::atomic<std::uint8_t> ranged_puts_{kRangesUnknown};
+};
+
+PooledClient SyncRunner::MakeClient(const char* purpose) {
+    if (!remote_checks_) {
+        return PooledClient(nullptr, WebDavClientReturn{pool_});
+    }
+    PooledClient client = pool_->Acquire();
+    if (!client) {
+        logger_.Error(std::string("Failed to initialize WebDAV client for ") + purpose + ".");
+        AddError();
+    }
+    return client;
+}
+
+void SyncRunner::DecideFile(SyncPlan* plan, FileId file, const RemoteItemInfo& remote,
+                            const RemotePathTable& remote_paths, std::uint64_t local_size) {
+    if (remote.exists && remote.is_dir) {
+        logger_.Error("Remote path is a directory, expected file: " +
+                      remote_paths.File(file).plain);
+        AddError();
+        plan->reason[file] = kReasonUndecided;
+        return;
+    }
+    // Size and mtime were captured by the scan; no second stat here.
+    LocalFileInfo local;
+    local.size = local_size;
+    local.last_modified = plan->store.FileModified(file);
+    FileDecision decision = DecideFileAction(local, remote, rules_.Rule(file_rule_[file]),
+                                             plan->compare_mode, FromUnixNs(plan->created_ns));
+    plan->action[file] = decision.action;
+    plan->reason[file] = static_cast<std::uint8_t>(decision.reason);
+}
 
-        if (ShouldExclude(rel, rules)) {
-            if (entry.is_directory()) {
-                iter.disable_recursion_pending();
+// Compresses the candidates of `dir` that look compressible and have no
+// "<name>.gz" sibling. A file recorded in the gzip manifest with its current
+// size and mtime was compressible before and is not sampled again.
+void SyncRunner::ChooseEncodings(SyncPlan* plan, const FilesByDirectory& groups, DirId dir) {
+    const PathStore& store = plan->store;
+    std::uint32_t begin = groups.begin[dir];
+    std::uint32_t end = groups.begin[dir + 1];
+    std::unordered_set<std::string_view> names;
+    for (std::uint32_t i = begin; i < end; ++i) {
+        FileId file = groups.files[i];
+        if (!compress_candidate_[file]) {
+            continue;
+        }
+        if (names.empty()) {
+            for (std::uint32_t j = begin; j < end; ++j) {
+                names.insert(store.FileName(groups.files[j]));
             }
+        }
+        if (names.count(std::string(store.FileName(file)) + ".gz") != 0) {
             continue;
         }
+        const StateManifest::Entry* entry = gzip_manifest_.Find(store.FileRelativeUtf8(file));
+        bool known = entry && entry->size == store.FileSize(file) &&
+                     entry->mtime_ns == store.FileMtimeNs(file);
+        if (known || LooksCompressible(store.FileAbsolutePath(plan->source, file),
+                                       store.FileSize(file))) {
+            plan->encoding[file] = FileEncoding::Gzip;
+        }
+    }
+}
 
-        if (entry.is_directory()) {
-            directories.push_back(rel);
-        } else if (entry.is_regular_file()) {
-            files.push_back({entry.path(), rel});
+// Decides `file` against `remote`, the object at its StoredName. A gzip
+// upload is compared by its compressed size, taken from the gzip manifest or
+// computed by compressing the file when the manifest does not know it.
+void SyncRunner::DecideStoredFile(SyncPlan* plan, FileId file, const RemoteItemInfo& remote,
+                                  const RemotePathTable& remote_paths) {
+    const PathStore& store = plan->store;
+    std::uint64_t local_size = store.FileSize(file);
+    if (plan->encoding[file] == FileEncoding::Gzip && remote.exists) {
+        const StateManifest::Entry* entry = gzip_manifest_.Find(store.FileRelativeUtf8(file));
+        if (entry && entry->size == local_size && entry->mtime_ns == store.FileMtimeNs(file)) {
+            local_size = entry->stored_size;
+        } else {
+            std::string err;
+            if (!GzipCompressedSize(store.FileAbsolutePath(plan->source, file), &local_size,
+                                    &err)) {
+                logger_.Error("Failed to compress " + store.FileRelativeUtf8(file) + ": " + err);
+                AddError();
+                plan->reason[file] = kReasonUndecided;
+                return;
+            }
         }
     }
+    DecideFile(plan, file, remote, remote_paths, local_size);
+}
 
-    std::sort(directories.begin(), directories.end(),
-              [](const std::filesystem::path& a, const std::filesystem::path& b) {
-                  return PathDepth(a) < PathDepth(b);
-              });
+void SyncRunner::Decide(SyncPlan* plan) {
+    const PathStore& store = plan->store;
+    std::size_t dir_count = store.DirectoryCount();
+    plan->dir_missing.assign(dir_count, remote_checks_ ? 0 : 1);
+    plan->action.assign(store.FileCount(), FileActionType::Skip);
+    plan->reason.assign(store.FileCount(), kReasonUndecided);
+    plan->encoding.assign(store.FileCount(), FileEncoding::Plain);
+    plan->copy_from.assign(store.FileCount(), PathStore::kInvalidId);
+    plan->rename_from.assign(store.FileCount(), PathStore::kInvalidId);
+    plan->dir_rename_from.assign(store.DirectoryCount(), PathStore::kInvalidId);
 
-    std::unordered_set<std::string> known_dirs;
-    auto ensure_dir = [&](WebDavClient* client, const std::string& remote_path) {
-        std::string normalized = NormalizeRemoteRoot(remote_path);
-        std::vector<std::string> parts = SplitRemotePath(normalized);
-        std::string current;
-        for (const auto& part : parts) {
-            current += "/" + part;
-            if (known_dirs.find(current) != known_dirs.end()) {
+    RemotePathTable remote_paths(store, plan->remote_root);
+    FilesByDirectory groups = GroupFilesByDirectory(store);
+    const RemoteItemInfo missing;
+
+    file_rule_.resize(store.FileCount());
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        file_rule_[file] = rules_.Match(store, file);
+    }
+
+    // Small files below a bundle root are decided against its manifest
+    // rather than a listing, and directories holding nothing else are not
+    // listed at all.
+    BundleGroups bundle_groups = AssignBundleGroups(store, plan->bundle_roots);
+    plan->bundle.assign(store.FileCount(), 0);
+    std::vector<std::uint8_t> listed(dir_count, 1);
+    if (!plan->bundle_roots.empty()) {
+        for (FileId file = 0; file < store.FileCount(); ++file) {
+            std::uint16_t group = bundle_groups.dir_group[store.FileDirectory(file)];
+            if (group != 0 && store.FileSize(file) <= config_.bundle_max_file) {
+                plan->bundle[file] = group;
+            }
+        }
+        for (DirId dir = 0; dir < dir_count; ++dir) {
+            std::uint16_t group = bundle_groups.dir_group[dir];
+            if (group == 0 || bundle_groups.root_dir[group - 1] == dir) {
                 continue;
             }
-
-            if (config.dry_run) {
-                bool exists = false;
-                if (client && remote_checks) {
-                    std::string err;
-                    RemoteItemInfo info = client->GetInfo(current, &err);
-                    if (!err.empty()) {
-                        logger.Error("PROPFIND failed for " + current + ": " + err);
-                        stats.errors++;
-                    }
-                    exists = info.exists;
+            bool only_bundled = true;
+            for (std::uint32_t i = groups.begin[dir]; i < groups.begin[dir + 1]; ++i) {
+                only_bundled = only_bundled && plan->bundle[groups.files[i]] != 0;
+            }
+            listed[dir] = only_bundled ? 0 : 1;
+        }
+        for (std::uint16_t group = 1; group <= plan->bundle_roots.size(); ++group) {
+            StateManifest manifest;
+            LoadState(BundleManifestFile(*plan, group), &manifest);
+            const std::string& root = plan->bundle_roots[group - 1];
+            for (FileId file = 0; file < store.FileCount(); ++file) {
+                if (plan->bundle[file] != group) {
+                    continue;
                 }
-                if (!exists) {
-                    logger.Info("Dry-run: would create directory " + current);
-                    stats.dirs_created++;
+                RemoteItemInfo remote;
+                if (const StateManifest::Entry* entry =
+                        manifest.Find(BundleMemberName(store, file, root))) {
+                    remote.exists = true;
+                    remote.has_size = true;
+                    remote.size = entry->size;
+                    remote.has_last_modified = true;
+                    remote.last_modified = FromUnixNs(entry->mtime_ns);
                 }
-                known_dirs.insert(current);
+                DecideFile(plan, file, remote, remote_paths, store.FileSize(file));
+            }
+        }
+    }
+
+    // A shard passes through the directories of other shards; a missing
+    // child still gets them created (see the end of this function).
+    for (DirId dir = 0; dir < shared_dirs_.size(); ++dir) {
+        if (shared_dirs_[dir]) {
+            listed[dir] = 0;
+        }
+    }
+
+    // Files whose rule ignores the remote state are decided without it. A
+    // directory holding only such files is not listed but marked
+    // kDirUnlisted, so its collection is created unless it exists.
+    std::vector<std::uint8_t> remote_free(dir_count, 0);
+    for (DirId dir = 1; dir < dir_count; ++dir) {
+        std::uint32_t begin = groups.begin[dir];
+        std::uint32_t end = groups.begin[dir + 1];
+        bool independent = listed[dir] && begin != end;
+        for (std::uint32_t i = begin; independent && i < end; ++i) {
+            FileId file = groups.files[i];
+            independent = plan->bundle[file] != 0 || !rules_.NeedsRemote(file_rule_[file]);
+        }
+        remote_free[dir] = independent ? 1 : 0;
+    }
+
+    // Files matching --compress; the matcher is not thread-safe, so this
+    // runs before the workers, which then only sample the candidates.
+    compress_candidate_.assign(store.FileCount(), 0);
+    if (!config_.compress_patterns.empty()) {
+        ExcludeMatcher matcher(ExcludeRules{config_.compress_patterns});
+        for (FileId file = 0; file < store.FileCount(); ++file) {
+            compress_candidate_[file] = plan->bundle[file] == 0 &&
+                                        store.FileSize(file) >= kMinCompressSize &&
+                                        matcher.Excludes(store.FileRelativeUtf8(file));
+        }
+        LoadState(GzipManifestFile(*plan), &gzip_manifest_);
+        gzip_loaded_ = true;
+    }
+
+    if (!remote_checks_) {
+        plan->root_exists = false;
+        for (DirId dir = 0; dir < dir_count; ++dir) {
+            ChooseEncodings(plan, groups, dir);
+        }
+        for (FileId file = 0; file < store.FileCount(); ++file) {
+            if (plan->bundle[file] == 0) {
+                DecideStoredFile(plan, file, missing, remote_paths);
+            }
+        }
+        return;
+    }
+
+    // Directories are interned parent-first, so a worker usually finds the
+    // parent's state already known and skips listing below a missing one.
+    std::unique_ptr<std::atomic<std::uint8_t>[]> states(new std::atomic<std::uint8_t>[dir_count]);
+    for (std::size_t dir = 0; dir < dir_count; ++dir) {
+        states[dir].store(kDirUnknown, std::memory_order_relaxed);
+    }
+    std::atomic<std::size_t> next_dir{0};
+    std::atomic<std::size_t> unlisted{0};
+
+    auto worker = [&]() {
+        PooledClient client = MakeClient("the decision stage");
+        if (!client) {
+            return;
+        }
+        std::vector<RemoteDirectoryEntry> entries;
+        std::unordered_map<std::string_view, const RemoteItemInfo*> by_name;
+        while (true) {
+            std::size_t index = next_dir.fetch_add(1);
+            if (index >= dir_count) {
+                break;
+            }
+            DirId dir = static_cast<DirId>(index);
+            const RemotePath& dir_path = remote_paths.Directory(dir);
+            std::uint32_t begin = groups.begin[dir];
+            std::uint32_t end = groups.begin[dir + 1];
+            if (!listed[dir]) {
                 continue;
             }
+            ChooseEncodings(plan, groups, dir);
 
-            if (!client) {
-                logger.Error("WebDAV client not available for directory " + current);
-                stats.errors++;
+            if (dir != PathStore::kRootDir &&
+                states[store.DirectoryParent(dir)].load(std::memory_order_acquire) ==
+                    kDirMissing) {
+                states[dir].store(kDirMissing, std::memory_order_release);
+                plan->dir_missing[dir] = 1;
+                for (std::uint32_t i = begin; i < end; ++i) {
+                    if (plan->bundle[groups.files[i]] == 0) {
+                        DecideStoredFile(plan, groups.files[i], missing, remote_paths);
+                    }
+                }
+                continue;
+            }
+            if (remote_free[dir]) {
+                unlisted.fetch_add(1, std::memory_order_relaxed);
+                plan->dir_missing[dir] = kDirUnlisted;
+                for (std::uint32_t i = begin; i < end; ++i) {
+                    if (plan->bundle[groups.files[i]] == 0) {
+                        DecideStoredFile(plan, groups.files[i], missing, remote_paths);
+                    }
+                }
                 continue;
             }
 
-            bool created = false;
+            bool exists = false;
             std::string err;
-            if (!client->MkCol(current, &created, &err)) {
-                logger.Error("MKCOL failed for " + current + ": " + err);
-                stats.errors++;
+            if (!client->ListDirectory(dir_path, &exists, &entries, &err)) {
+                // Fall back to one PROPFIND per file, e.g. for servers that
+                // refuse Depth: 1.
+                logger_.Warn("Listing failed for " + dir_path.plain + ": " + err);
+                states[dir].store(kDirExists, std::memory_order_release);
+                for (std::uint32_t i = begin; i < end; ++i) {
+                    FileId file = groups.files[i];
+                    if (plan->bundle[file] != 0) {
+                        continue;
+                    }
+                    if (!rules_.NeedsRemote(file_rule_[file])) {
+                        DecideStoredFile(plan, file, missing, remote_paths);
+                        continue;
+                    }
+                    RemotePath file_path = StoredPath(*plan, remote_paths, file);
+                    std::string file_err;
+                    RemoteItemInfo remote = client->GetInfo(file_path, &file_err);
+                    if (!file_err.empty()) {
+                        logger_.Error("PROPFIND failed for " + file_path.plain + ": " + file_err);
+                        AddError();
+                        continue;
+                    }
+                    DecideStoredFile(plan, file, remote, remote_paths);
+                }
                 continue;
             }
-            if (created) {
-                stats.dirs_created++;
-                logger.Info("Created directory " + current);
+
+            states[dir].store(exists ? kDirExists : kDirMissing, std::memory_order_release);
+            plan->dir_missing[dir] = exists ? 0 : 1;
+            by_name.clear();
+            for (const auto& entry : entries) {
+                by_name.emplace(entry.name, &entry.info);
+            }
+            for (std::uint32_t i = begin; i < end; ++i) {
+                FileId file = groups.files[i];
+                if (plan->bundle[file] != 0) {
+                    continue;
+                }
+                std::string name = StoredName(*plan, file);
+                auto found = by_name.find(name);
+                DecideStoredFile(plan, file, found == by_name.end() ? missing : *found->second,
+                                 remote_paths);
             }
-            known_dirs.insert(current);
         }
     };
 
-    std::unique_ptr<WebDavClient> dir_client;
-    if (remote_checks) {
-        dir_client = std::make_unique<WebDavClient>(*base_url, creds);
-        if (!dir_client->IsReady()) {
-            logger.Error("Failed to initialize WebDAV client for directories.");
-            stats.errors++;
-            return stats;
+    int thread_count = WorkerCount(config_.probe_threads, dir_count);
+    std::vector<std::thread> workers;
+    workers.reserve(thread_count);
+    for (int i = 0; i < thread_count; ++i) {
+        workers.emplace_back(worker);
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    if (unlisted.load() > 0) {
+        logger_.Info("Skipped listing " + std::to_string(unlisted.load()) +
+                     " directories whose files do not depend on the remote state.");
+    }
+    plan->root_exists = states[PathStore::kRootDir].load() == kDirExists;
+    plan->dir_missing[PathStore::kRootDir] = plan->root_exists ? 0 : 1;
+    // A directory that was not listed must exist once a child is missing.
+    for (DirId dir = static_cast<DirId>(dir_count); dir-- > 1;) {
+        DirId parent = store.DirectoryParent(dir);
+        if (plan->dir_missing[dir] && !listed[parent]) {
+            plan->dir_missing[parent] = 1;
         }
     }
+}
+
+std::filesystem::path SyncRunner::BundleManifestFile(const SyncPlan& plan,
+                                                     std::uint16_t group) const {
+    return StateManifestPath(config_.state_dir, "bundle",
+                             plan.remote_root + "\n" + plan.bundle_roots[group - 1]);
+}
+
+std::filesystem::path SyncRunner::GzipManifestFile(const SyncPlan& plan) const {
+    return StateManifestPath(config_.state_dir, "gzip", plan.remote_root);
+}
+
+std::filesystem::path SyncRunner::UploadsManifestFile(const SyncPlan& plan) const {
+    return StateManifestPath(config_.state_dir, "uploads", plan.remote_root);
+}
+
+void SyncRunner::DetectRenames(SyncPlan* plan) {
+    LoadState(UploadsManifestFile(*plan), &uploads_manifest_);
+    uploads_loaded_ = true;
+    std::size_t recorded = uploads_manifest_.Size();
+    RenameStats renames = FindRenamedUploads(plan, &uploads_manifest_);
+    uploads_dirty_ = uploads_manifest_.Size() != recorded;
+    logger_.Info("Renames: " + std::to_string(renames.files) + " files match earlier uploads, " +
+                 std::to_string(renames.dirs) + " directories are renamed whole");
+}
+
+void SyncRunner::RecordUpload(const SyncPlan& plan, FileId file, const std::string* old_name) {
+    if (!config_.detect_renames || config_.dry_run) {
+        return;
+    }
+    const PathStore& store = plan.store;
+    LocalFileId id;
+    if (!LocalFileIdentity(store.FileAbsolutePath(plan.source, file), &id)) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(uploads_mutex_);
+    if (old_name) {
+        uploads_manifest_.Erase(*old_name);
+    }
+    uploads_manifest_.Set(store.FileRelativeUtf8(file),
+                          {store.FileSize(file), store.FileMtimeNs(file), store.FileSize(file),
+                           id.device, id.index});
+    uploads_dirty_ = true;
+}
+
+bool SyncRunner::LoadState(const std::filesystem::path& path, StateManifest* manifest) {
+    std::string err;
+    if (!manifest->Load(path, &err)) {
+        // Starting from an empty manifest only re-uploads, which is safe.
+        logger_.Error("Failed to read state manifest " + path.string() + ": " + err);
+        AddError();
+        return false;
+    }
+    return true;
+}
 
-    ensure_dir(dir_client.get(), config.remote);
-    for (const auto& dir : directories) {
-        std::string remote_path = JoinRemotePath(config.remote, dir);
-        ensure_dir(dir_client.get(), remote_path);
+bool SyncRunner::EnsureStateDir() {
+    std::error_code ec;
+    if (!std::filesystem::create_directories(config_.state_dir, ec) && ec) {
+        logger_.Error("Failed to create state directory " + config_.state_dir.string() + ": " +
+                      ec.message());
+        AddError();
+        return false;
     }
+    return true;
+}
 
-    std::mutex stats_mutex;
-    auto add_deleted = [&](const std::string& path, bool is_jpg, bool old_file) {
-        std::lock_guard<std::mutex> lock(stats_mutex);
-        stats.deleted_files.push_back(path);
-        if (is_jpg) {
-            stats.files_deleted_jpg++;
-        } else if (old_file) {
-            stats.files_deleted_old++;
+// Creates one component of the remote root; parents must already exist.
+void SyncRunner::EnsureRootDirectory(WebDavClient* client, const RemotePath& current) {
+    if (config_.dry_run) {
+        bool exists = false;
+        if (client) {
+            std::string err;
+            RemoteItemInfo info = client->GetInfo(current, &err);
+            if (!err.empty()) {
+                logger_.Error("PROPFIND failed for " + current.plain + ": " + err);
+                AddError();
+            }
+            exists = info.exists;
         }
-    };
+        if (!exists) {
+            logger_.Info("Dry-run: would create directory " + current.plain);
+            stats_->dirs_created++;
+        }
+        return;
+    }
+    CreateDirectory(client, current);
+}
 
-    auto add_uploaded = [&]() {
-        std::lock_guard<std::mutex> lock(stats_mutex);
-        stats.files_uploaded++;
-    };
+void SyncRunner::CreateDirectory(WebDavClient* client, const RemotePath& path) {
+    if (config_.dry_run) {
+        logger_.Info("Dry-run: would create directory " + path.plain);
+        stats_->dirs_created++;
+        return;
+    }
+    if (!client) {
+        logger_.Error("WebDAV client not available for directory " + path.plain);
+        AddError();
+        return;
+    }
+    bool created = false;
+    std::string err;
+    if (!client->MkCol(path, &created, &err)) {
+        logger_.Error("MKCOL failed for " + path.plain + ": " + err);
+        AddError();
+        return;
+    }
+    if (created) {
+        stats_->dirs_created++;
+        logger_.Info("Created directory " + path.plain);
+    }
+}
+
+// True when the file was uploaded (or would be, in a dry run). With
+// `confirm_unchanged` it must also still match the scan after the PUT, so
+// the remote object holds the content its copies were matched against.
+bool SyncRunner::ExecuteFile(WebDavClient* client, const SyncPlan& plan, FileId file,
+                             const RemotePathTable& remote_paths, bool verify_local,
+                             bool confirm_unchanged) {
+    const PathStore& store = plan.store;
+    std::filesystem::path abs_path = store.FileAbsolutePath(plan.source, file);
+    std::string rel_name = store.FileRelativeUtf8(file);
+    DecisionReason reason = static_cast<DecisionReason>(plan.reason[file]);
+    bool should_delete = plan.action[file] == FileActionType::UploadAndDelete;
 
     auto add_skipped = [&]() {
-        std::lock_guard<std::mutex> lock(stats_mutex);
-        stats.files_skipped++;
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_->files_skipped++;
     };
-
-    auto add_error = [&]() {
-        std::lock_guard<std::mutex> lock(stats_mutex);
-        stats.errors++;
+    auto add_dry_run_deleted = [&]() {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        if (IsAlwaysReason(reason)) {
+            stats_->files_deleted_jpg++;
+        } else {
+            stats_->files_deleted_old++;
+        }
+    };
+    auto add_uploaded = [&]() {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_->files_uploaded++;
     };
 
-    std::atomic<size_t> next_index{0};
-    int thread_count = std::max(1, config.threads);
-    if (thread_count > static_cast<int>(files.size())) {
-        thread_count = static_cast<int>(files.size());
-        if (thread_count == 0) {
-            thread_count = 1;
+    if (verify_local) {
+        // A plan may be applied long after it was made; a file that changed
+        // in between is neither uploaded nor, above all, deleted.
+        std::uint64_t size = 0;
+        std::int64_t mtime_ns = 0;
+        if (!StatLocalFile(abs_path, &size, &mtime_ns)) {
+            logger_.Warn("Planned file is gone, skipped: " + rel_name);
+            add_skipped();
+            return false;
+        }
+        if (size != store.FileSize(file) || mtime_ns != store.FileMtimeNs(file)) {
+            logger_.Warn("Planned file changed since the plan was made, skipped: " + rel_name);
+            add_skipped();
+            return false;
         }
     }
 
-    auto worker = [&](int worker_id) {
-        (void)worker_id;
-        std::unique_ptr<WebDavClient> client;
-        if (remote_checks) {
-            client = std::make_unique<WebDavClient>(*base_url, creds);
-            if (!client->IsReady()) {
-                logger.Error("Failed to initialize WebDAV client for worker.");
-                add_error();
-                return;
-            }
+    bool gzip = plan.encoding[file] == FileEncoding::Gzip;
+    if (config_.dry_run) {
+        logger_.Info("Dry-run: would upload " + rel_name + (gzip ? " as gzip" : "") + " (" +
+                     DecisionReasonText(reason) + ")");
+        add_uploaded();
+        if (should_delete) {
+            logger_.Info("Dry-run: would delete local " + rel_name);
+            add_dry_run_deleted();
         }
+        return true;
+    }
 
-        while (true) {
-            size_t index = next_index.fetch_add(1);
-            if (index >= files.size()) {
-                break;
-            }
+    RemotePath remote_path = StoredPath(plan, remote_paths, file);
+    if (!client) {
+        logger_.Error("WebDAV client not available for upload: " + remote_path.plain);
+        AddError();
+        return false;
+    }
 
-            const FileEntry& entry = files[index];
-            std::error_code ec_size;
-            auto file_size = std::filesystem::file_size(entry.abs_path, ec_size);
-            if (ec_size) {
-                logger.Error("Failed to get file size: " + entry.abs_path.string());
-                add_error();
-                continue;
+    std::string err;
+    bool appended = false;
+    if (gzip) {
+        GzipFileBody body(abs_path);
+        if (!body.Open(&err)) {
+            logger_.Error("Failed to compress " + rel_name + ": " + err);
+            AddError();
+            return false;
+        }
+        if (body.SourceSize() != store.FileSize(file)) {
+            logger_.Warn("File changed since it was scanned, skipped: " + rel_name);
+            add_skipped();
+            return false;
+        }
+        if (!client->PutBody(remote_path, &body, &err)) {
+            logger_.Error("PUT failed for " + remote_path.plain + ": " + err);
+            AddError();
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(gzip_mutex_);
+            gzip_manifest_.Set(rel_name, {store.FileSize(file), store.FileMtimeNs(file), body.Size()});
+            gzip_dirty_ = true;
+        }
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_->files_compressed++;
+        stats_->compressed_input_bytes += store.FileSize(file);
+        stats_->compressed_output_bytes += body.Size();
+    } else {
+        std::uint8_t append = append_mode_.empty() ? std::uint8_t{kAppendNone} : append_mode_[file];
+        appended = append == kAppendTail && AppendTail(client, plan, file, remote_path);
+        if (!appended) {
+            FileReader reader(config_.read_options);
+            if (!reader.Open(abs_path, &err)) {
+                logger_.Error(err + ": " + rel_name);
+                AddError();
+                return false;
             }
-
-            std::error_code ec_time;
-            auto last_write = std::filesystem::last_write_time(entry.abs_path, ec_time);
-            if (ec_time) {
-                logger.Error("Failed to get file time: " + entry.abs_path.string());
-                add_error();
-                continue;
+            HashingBody hashing(&reader, Sha256());
+            UploadBody* body = append == kAppendNone ? static_cast<UploadBody*>(&reader) : &hashing;
+            if (!client->PutBody(remote_path, body, &err)) {
+                logger_.Error("PUT failed for " + remote_path.plain + ": " + err);
+                AddError();
+                return false;
+            }
+            if (append != kAppendNone) {
+                Sha256Digest digest = hashing.Finish();
+                RecordAppendBase(plan, file, reader.Size(), &digest);
             }
+        }
+        if (plan.bundle[file] == 0) {
+            RecordUpload(plan, file, nullptr);
+        }
+    }
 
-            LocalFileInfo local;
-            local.path = entry.abs_path;
-            local.size = file_size;
-            local.last_modified = FileTimeToSystemClock(last_write);
-            local.is_jpg = IsJpgFile(entry.abs_path);
-
-            std::string remote_path = JoinRemotePath(config.remote, entry.rel_path);
-            RemoteItemInfo remote;
-            if (remote_checks) {
-                std::string err;
-                remote = client->GetInfo(remote_path, &err);
-                if (!err.empty()) {
-                    logger.Error("PROPFIND failed for " + remote_path + ": " + err);
-                    add_error();
-                    continue;
-                }
-                if (remote.exists && remote.is_dir) {
-                    logger.Error("Remote path is a directory, expected file: " + remote_path);
-                    add_error();
-                    continue;
-                }
+    if (!appended) {
+        logger_.Info("Uploaded " + rel_name);
+    }
+    add_uploaded();
+
+    bool unchanged = true;
+    if (confirm_unchanged) {
+        std::uint64_t size = 0;
+        std::int64_t mtime_ns = 0;
+        unchanged = StatLocalFile(abs_path, &size, &mtime_ns) && size == store.FileSize(file) &&
+                    mtime_ns == store.FileMtimeNs(file);
+    }
+    if (should_delete) {
+        deleter_->Enqueue(file, IsAlwaysReason(reason));
+    }
+    return unchanged;
+}
+
+// Creates `file` as a server-side COPY of its already uploaded source. The
+// file is uploaded itself when the source did not make it or either side
+// changed since the scan, and when the server refuses the COPY.
+void SyncRunner::ExecuteCopy(WebDavClient* client, const SyncPlan& plan, FileId file,
+                             bool source_intact, const RemotePathTable& remote_paths,
+                             bool verify_local) {
+    const PathStore& store = plan.store;
+    FileId source = plan.copy_from[file];
+    std::string rel_name = store.FileRelativeUtf8(file);
+    std::string source_name = store.FileRelativeUtf8(source);
+    DecisionReason reason = static_cast<DecisionReason>(plan.reason[file]);
+    bool should_delete = plan.action[file] == FileActionType::UploadAndDelete;
+
+    std::uint64_t size = 0;
+    std::int64_t mtime_ns = 0;
+    if (!source_intact || !StatLocalFile(store.FileAbsolutePath(plan.source, file), &size, &mtime_ns) ||
+        size != store.FileSize(file) || mtime_ns != store.FileMtimeNs(file)) {
+        ExecuteFile(client, plan, file, remote_paths, verify_local, false);
+        return;
+    }
+
+    if (config_.dry_run) {
+        logger_.Info("Dry-run: would copy " + rel_name + " from " + source_name + " (" +
+                     DecisionReasonText(reason) + ")");
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_->files_uploaded++;
+        stats_->files_copied++;
+        stats_->copied_bytes += size;
+        if (should_delete) {
+            logger_.Info("Dry-run: would delete local " + rel_name);
+            if (IsAlwaysReason(reason)) {
+                stats_->files_deleted_jpg++;
             } else {
-                remote.exists = false;
+                stats_->files_deleted_old++;
             }
+        }
+        return;
+    }
 
-            FileDecision decision = DecideFileAction(local, remote, config.compare_mode, run_start);
-            bool needs_upload = decision.action == FileActionType::Upload ||
-                                decision.action == FileActionType::UploadAndDelete;
-            bool should_delete = decision.action == FileActionType::UploadAndDelete;
+    RemotePath remote_path = remote_paths.File(file);
+    if (!client) {
+        logger_.Error("WebDAV client not available for copy: " + remote_path.plain);
+        AddError();
+        return;
+    }
+    std::string err;
+    if (!client->Copy(remote_paths.File(source), remote_path, true, &err)) {
+        logger_.Warn("COPY failed for " + remote_path.plain + " (" + err + "), uploading instead");
+        ExecuteFile(client, plan, file, remote_paths, verify_local, false);
+        return;
+    }
+    logger_.Info("Copied " + rel_name + " from " + source_name);
+    RecordUpload(plan, file, nullptr);
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_->files_uploaded++;
+        stats_->files_copied++;
+        stats_->copied_bytes += size;
+    }
+    if (should_delete) {
+        deleter_->Enqueue(file, IsAlwaysReason(reason));
+    }
+}
 
-            if (!needs_upload) {
-                logger.Info("Skip " + entry.rel_path.string() + " (" + decision.reason + ")");
-                add_skipped();
-                continue;
-            }
+// Reuses the earlier upload of a renamed file with a server-side MOVE or
+// COPY. A file that changed since the scan, or whose request fails, is
+// uploaded instead. `moved_with_directory` means a collection request of
+// RenameDirectory already put it in place.
+void SyncRunner::ExecuteRename(WebDavClient* client, const SyncPlan& plan, FileId file,
+                               const RemotePathTable& remote_paths, bool verify_local,
+                               bool moved_with_directory) {
+    const PathStore& store = plan.store;
+    std::string rel_name = store.FileRelativeUtf8(file);
+    const std::string& source_name = plan.rename_sources[plan.rename_from[file]];
+    DecisionReason reason = static_cast<DecisionReason>(plan.reason[file]);
+    bool should_delete = plan.action[file] == FileActionType::UploadAndDelete;
+    const char* verb = config_.move_renames ? "move" : "copy";
 
-            if (config.dry_run) {
-                logger.Info("Dry-run: would upload " + entry.rel_path.string() + " (" +
-                            decision.reason + ")");
-                add_uploaded();
-                if (should_delete) {
-                    logger.Info("Dry-run: would delete local " + entry.rel_path.string());
-                    add_deleted(entry.abs_path.string(), local.is_jpg,
-                                IsOlderThan24Hours(local, run_start));
-                }
-                continue;
+    if (!moved_with_directory) {
+        std::uint64_t size = 0;
+        std::int64_t mtime_ns = 0;
+        if (!StatLocalFile(store.FileAbsolutePath(plan.source, file), &size, &mtime_ns) ||
+            size != store.FileSize(file) || mtime_ns != store.FileMtimeNs(file)) {
+            ExecuteFile(client, plan, file, remote_paths, verify_local, false);
+            return;
+        }
+        RemotePath from =
+            AppendRemotePath(remote_paths.Directory(PathStore::kRootDir), source_name);
+        RemotePath to = remote_paths.File(file);
+        if (config_.dry_run) {
+            logger_.Info(std::string("Dry-run: would ") + verb + " " + rel_name + " from " +
+                         source_name + " (" + DecisionReasonText(reason) + ")");
+        } else if (!client) {
+            logger_.Error("WebDAV client not available for rename: " + to.plain);
+            AddError();
+            return;
+        } else {
+            std::string err;
+            bool ok = config_.move_renames ? client->Move(from, to, true, &err)
+                                           : client->Copy(from, to, true, &err);
+            if (!ok) {
+                logger_.Warn(std::string("Failed to ") + verb + " " + from.plain + " to " +
+                             to.plain + " (" + err + "), uploading instead");
+                ExecuteFile(client, plan, file, remote_paths, verify_local, false);
+                return;
             }
+            logger_.Info((config_.move_renames ? "Moved " : "Copied ") + rel_name + " from " +
+                         source_name);
+        }
+    }
 
-            if (!client) {
-                logger.Error("WebDAV client not available for upload: " + remote_path);
-                add_error();
-                continue;
+    RecordUpload(plan, file, &source_name);
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_->files_uploaded++;
+        stats_->files_renamed++;
+        stats_->renamed_bytes += store.FileSize(file);
+        if (config_.dry_run && should_delete) {
+            if (IsAlwaysReason(reason)) {
+                stats_->files_deleted_jpg++;
+            } else {
+                stats_->files_deleted_old++;
             }
+        }
+    }
+    if (should_delete) {
+        if (config_.dry_run) {
+            logger_.Info("Dry-run: would delete local " + rel_name);
+        } else {
+            deleter_->Enqueue(file, IsAlwaysReason(reason));
+        }
+    }
+}
 
-            std::string err;
-            if (!client->PutFile(remote_path, entry.abs_path, &err)) {
-                logger.Error("PUT failed for " + remote_path + ": " + err);
-                add_error();
-                continue;
-            }
+// One MOVE or COPY (Depth: infinity) recreates a renamed directory with all
+// its files; on failure they are handled one by one.
+bool SyncRunner::RenameDirectory(WebDavClient* client, const SyncPlan& plan, DirId dir,
+                                 const RemotePathTable& remote_paths) {
+    const std::string& source_name = plan.rename_sources[plan.dir_rename_from[dir]];
+    RemotePath from =
+        AppendRemotePath(remote_paths.Directory(PathStore::kRootDir), source_name);
+    const RemotePath& to = remote_paths.Directory(dir);
+    const char* verb = config_.move_renames ? "move" : "copy";
+    if (config_.dry_run) {
+        logger_.Info(std::string("Dry-run: would ") + verb + " directory " + to.plain + " from " +
+                     from.plain);
+    } else {
+        if (!client) {
+            logger_.Error("WebDAV client not available for directory " + to.plain);
+            AddError();
+            return false;
+        }
+        std::string err;
+        bool ok = config_.move_renames ? client->Move(from, to, false, &err)
+                                       : client->Copy(from, to, false, &err);
+        if (!ok) {
+            logger_.Warn(std::string("Failed to ") + verb + " directory " + from.plain + " to " +
+                         to.plain + " (" + err + "), its files are handled one by one");
+            return false;
+        }
+        logger_.Info((config_.move_renames ? "Moved directory " : "Copied directory ") + to.plain +
+                     " from " + from.plain);
+    }
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_->dirs_renamed++;
+    return true;
+}
 
-            logger.Info("Uploaded " + entry.rel_path.string());
-            add_uploaded();
+void SyncRunner::ExecuteBundle(WebDavClient* client, const SyncPlan& plan,
+                               const PlannedBundle& bundle, const RemotePath& target) {
+    const PathStore& store = plan.store;
+    std::size_t count = bundle.files.size();
 
-            if (should_delete) {
-                std::error_code ec_delete;
-                if (std::filesystem::remove(entry.abs_path, ec_delete)) {
-                    logger.Info("Deleted local file " + entry.abs_path.string());
-                    add_deleted(entry.abs_path.string(), local.is_jpg,
-                                IsOlderThan24Hours(local, run_start));
-                } else {
-                    logger.Error("Failed to delete local file: " +
-                                 entry.abs_path.string() + " (" + ec_delete.message() + ")");
-                    add_error();
-                }
+    if (config_.dry_run) {
+        logger_.Info("Dry-run: would upload bundle " + target.plain + " (" +
+                     std::to_string(count) + " files)");
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_->bundles_uploaded++;
+        stats_->files_bundled += count;
+        stats_->files_uploaded += count;
+        for (FileId file : bundle.files) {
+            if (plan.action[file] != FileActionType::UploadAndDelete) {
+                continue;
+            }
+            logger_.Info("Dry-run: would delete local " + store.FileRelativeUtf8(file));
+            if (IsAlwaysReason(static_cast<DecisionReason>(plan.reason[file]))) {
+                stats_->files_deleted_jpg++;
+            } else {
+                stats_->files_deleted_old++;
             }
         }
-    };
+        return;
+    }
+    if (!client) {
+        logger_.Error("WebDAV client not available for bundle: " + target.plain);
+        AddError();
+        return;
+    }
 
-    std::vector<std::thread> workers;
-    workers.reserve(thread_count);
-    for (int i = 0; i < thread_count; ++i) {
-        workers.emplace_back(worker, i);
+    TarBundleBody body(store, plan.source, bundle.files, plan.bundle_roots[bundle.group - 1]);
+    std::string err;
+    if (!client->PutBody(target, &body, &err)) {
+        logger_.Error("PUT failed for " + target.plain + ": " + err);
+        AddError();
+        return;
     }
-    for (auto& t : workers) {
-        t.join();
+    // Without its index a bundle is not recorded, so its files are bundled
+    // again next run.
+    RemotePath index_path{target.plain + ".idx", target.encoded + ".idx"};
+    MemoryBody index(body.BuildIndex());
+    if (!client->PutBody(index_path, &index, &err)) {
+        logger_.Error("PUT failed for " + index_path.plain + ": " + err);
+        AddError();
+        return;
     }
 
+    std::size_t intact = 0;
+    std::vector<std::size_t> changed;
+    {
+        std::lock_guard<std::mutex> lock(manifest_mutex_);
+        StateManifest& manifest = manifests_[bundle.group - 1];
+        for (std::size_t i = 0; i < count; ++i) {
+            if (!body.MemberIntact(i)) {
+                changed.push_back(i);
+                continue;
+            }
+            FileId file = body.MemberFile(i);
+            manifest.Set(body.MemberName(i),
+                         {store.FileSize(file), store.FileMtimeNs(file), store.FileSize(file)});
+            intact++;
+        }
+        std::filesystem::path path = BundleManifestFile(plan, bundle.group);
+        if (!manifest.Save(path, &err)) {
+            logger_.Error("Failed to write bundle manifest " + path.string() + ": " + err);
+            AddError();
+        }
+    }
+    for (std::size_t i : changed) {
+        logger_.Warn("File changed while it was bundled, left for the next run: " +
+                     store.FileRelativeUtf8(body.MemberFile(i)));
+    }
+    logger_.Info("Uploaded bundle " + target.plain + " (" + std::to_string(intact) + " files)");
+    {
+        std::lock_guard<std::mutex> lock(stats_mutex_);
+        stats_->bundles_uploaded++;
+        stats_->files_bundled += intact;
+        stats_->files_uploaded += intact;
+        stats_->files_skipped += changed.size();
+    }
+
+    for (std::size_t i = 0; i < count; ++i) {
+        FileId file = body.MemberFile(i);
+        if (body.MemberIntact(i) && plan.action[file] == FileActionType::UploadAndDelete) {
+            deleter_->Enqueue(file, IsAlwaysReason(static_cast<DecisionReason>(plan.reason[file])));
+        }
+    }
+}
+
+std::filesystem::path SyncRunner::ChunksManifestFile(const SyncPlan& plan) const {
+    return StateManifestPath(config_.state_dir, "chunks", plan.remote_root);
+}
+
+// Compressed files are streamed and renamed ones moved, so only plain
+// uploads of more than one chunk qualify.
+bool SyncRunner::UploadsInChunks(const SyncPlan& plan, FileId file) const {
+    std::uint64_t size = plan.store.FileSize(file);
+    return config_.chunked_min > 0 && remote_checks_ && !config_.dry_run &&
+           size >= config_.chunked_min && size > config_.chunk_size &&
+           plan.encoding[file] != FileEncoding::Gzip &&
+           plan.rename_from[file] == PathStore::kInvalidId;
+}
+
+// Whether the server writes a Content-Range PUT into an existing object:
+// `part` gets one byte, then a second one at offset 1. Servers that refuse
+// the header fail the second PUT, those that ignore it replace the object.
+bool SyncRunner::ProbeRangedPut(WebDavClient* client, const RemotePath& part) {
+    std::string err;
+    MemoryBody first("a");
+    if (!client->PutBody(part, &first, &err)) {
+        logger_.Error("PUT failed for " + part.plain + ": " + err);
+        AddError();
+        return false;
+    }
+    MemoryBody second("b");
+    if (!client->PutRange(part, &second, 1, 2, &err)) {
+        return false;
+    }
+    RemoteItemInfo info = client->GetInfo(part, &err);
+    if (!err.empty()) {
+        logger_.Error("PROPFIND failed for " + part.plain + ": " + err);
+        AddError();
+    }
+    return info.exists && info.size == 2;
+}
+
+void SyncRunner::QueueChunkedUploads(WebDavClient* client, const SyncPlan& plan,
+                                     const std::vector<FileId>& files) {
+    const PathStore& store = plan.store;
+    const RemotePathTable& remote_paths = *remote_paths_;
+    std::uint64_t chunk_size = (config_.chunk_size + kChunkAlign - 1) / kChunkAlign * kChunkAlign;
+    EnsureStateDir();
+    LoadState(ChunksManifestFile(plan), &chunks_manifest_);
+
+    // Chunks of earlier runs count when the file is still the same and
+    // cut the same way; any other entry is dropped.
+    std::unordered_map<std::string, FileId> by_name;
+    for (FileId file : files) {
+        by_name.emplace(store.FileRelativeUtf8(file), file);
+    }
+    std::unordered_map<FileId, std::vector<std::uint64_t>> landed;
+    std::vector<std::string> stale;
+    for (const auto& pair : chunks_manifest_.Entries()) {
+        const StateManifest::Entry& entry = pair.second;
+        std::size_t split = pair.first.rfind('\n');
+        auto found = split == std::string::npos ? by_name.end()
+                                                : by_name.find(pair.first.substr(0, split));
+        std::uint64_t offset =
+            split == std::string::npos ? 0 : std::strtoull(pair.first.c_str() + split + 1, nullptr, 10);
+        if (found != by_name.end() && entry.size == store.FileSize(found->second) &&
+            entry.mtime_ns == store.FileMtimeNs(found->second) && offset % chunk_size == 0 &&
+            offset < entry.size && entry.stored_size == std::min(chunk_size, entry.size - offset)) {
+            landed[found->second].push_back(offset);
+        } else {
+            stale.push_back(pair.first);
+        }
+    }
+
+    bool probed = false;
+    bool ranged = true;
+    for (FileId file : files) {
+        std::string rel_name = store.FileRelativeUtf8(file);
+        std::uint64_t size = store.FileSize(file);
+        bool deletes = plan.action[file] == FileActionType::UploadAndDelete;
+        auto upload = std::make_unique<ChunkedUpload>();
+        upload->file = file;
+        upload->part = AppendRemotePath(remote_paths.Directory(store.FileDirectory(file)),
+                                        "." + StoredName(plan, file) + ".part");
+        upload->chunk_size = chunk_size;
+        upload->chunks = static_cast<std::uint32_t>((size + chunk_size - 1) / chunk_size);
+
+        std::vector<std::uint64_t>& offsets = landed[file];
+        if (!offsets.empty() && client) {
+            // The chunks are only worth something while the object holding
+            // them is still there.
+            std::string err;
+            if (!client->GetInfo(upload->part, &err).exists) {
+                for (std::uint64_t offset : offsets) {
+                    stale.push_back(ChunkKey(rel_name, offset));
+                }
+                offsets.clear();
+            }
+        }
+        if (offsets.empty() && !probed) {
+            probed = true;
+            ranged = client && ProbeRangedPut(client, upload->part);
+            ranged_puts_ = ranged ? kRangesSupported : kRangesUnsupported;
+            logger_.Info(ranged ? "Chunked uploads: the server accepts Content-Range PUTs"
+                                : "Chunked uploads: the server does not accept Content-Range "
+                                  "PUTs, large files are uploaded whole");
+            if (!ranged) {
+                // The probe object becomes this file's temporary object,
+                // so it does not stay behind.
+                upload->ranged = false;
+                upload->chunks = 1;
+                upload->remaining = 1;
+                order_.push_back({size, 0, file, deletes,
+                                  static_cast<std::uint32_t>(chunked_.size() + 1), 0});
+                chunked_.push_back(std::move(upload));
+                continue;
+            }
+        } else if (offsets.empty() && !ranged) {
+            order_.push_back({size, 0, file, deletes});
+            continue;
+        }
+        if (offsets.empty()) {
+            // Content-Range PUTs only write into an existing object: start
+            // the file's one empty, which also cuts back one left by the
+            // probe or an earlier version.
+            std::string err;
+            MemoryBody empty("");
+            if (!client->PutBody(upload->part, &empty, &err)) {
+                logger_.Warn("PUT failed for " + upload->part.plain + " (" + err +
+                             "), uploading " + rel_name + " whole");
+                order_.push_back({size, 0, file, deletes});
+                continue;
+            }
+        }
+
+        std::vector<std::uint8_t> done(upload->chunks, 0);
+        for (std::uint64_t offset : offsets) {
+            done[offset / chunk_size] = 1;
+        }
+        if (!offsets.empty()) {
+            logger_.Info("Resuming chunked upload of " + rel_name + ": " +
+                         std::to_string(offsets.size()) + " of " +
+                         std::to_string(upload->chunks) + " chunks already uploaded");
+        }
+        // A file whose chunks all landed still needs its move; its last
+        // chunk is sent again to get there.
+        if (offsets.size() == upload->chunks) {
+            done.back() = 0;
+        }
+        std::uint32_t queued = 0;
+        for (std::uint32_t chunk = 0; chunk < upload->chunks; ++chunk) {
+            if (done[chunk]) {
+                continue;
+            }
+            std::uint64_t offset = chunk * chunk_size;
+            order_.push_back({std::min(chunk_size, size - offset), 0, file, deletes,
+                              static_cast<std::uint32_t>(chunked_.size() + 1), chunk});
+            upload->last_queued = chunk;
+            ++queued;
+        }
+        upload->remaining = queued;
+        chunked_.push_back(std::move(upload));
+    }
+
+    if (!stale.empty()) {
+        std::lock_guard<std::mutex> lock(chunks_mutex_);
+        for (const std::string& key : stale) {
+            chunks_manifest_.Erase(key);
+        }
+        SaveChunks();
+    }
+}
+
+void SyncRunner::ExecuteChunk(WebDavClient* client, const WorkItem& item) {
+    const PathStore& store = plan_->store;
+    ChunkedUpload& upload = *chunked_[item.chunked - 1];
+    FileId file = upload.file;
+    std::string rel_name = store.FileRelativeUtf8(file);
+    std::uint64_t offset = item.chunk * upload.chunk_size;
+
+    bool ok = false;
+    std::string err;
+    if (!client) {
+        logger_.Error("WebDAV client not available for upload: " + upload.part.plain);
+    } else {
+        FileReader body(config_.read_options);
+        if (!body.Open(store.FileAbsolutePath(plan_->source, file), &err)) {
+            logger_.Error(err + ": " + rel_name);
+        } else if (body.FileSize() != store.FileSize(file)) {
+            upload.changed = true;
+        } else if (upload.ranged && !body.SetRange(offset, item.bytes, &err)) {
+            logger_.Error(err + ": " + rel_name);
+        } else {
+            ok = upload.ranged
+                     ? client->PutRange(upload.part, &body, offset, store.FileSize(file), &err)
+                     : client->PutBody(upload.part, &body, &err);
+            if (!ok) {
+                logger_.Error("PUT failed for " + upload.part.plain + " at " +
+                              std::to_string(offset) + ": " + err);
+            }
+        }
+    }
+    if (ok && upload.ranged) {
+        std::lock_guard<std::mutex> lock(chunks_mutex_);
+        chunks_manifest_.Set(ChunkKey(rel_name, offset),
+                             {store.FileSize(file), store.FileMtimeNs(file), item.bytes});
+        SaveChunks();
+    } else if (!ok && !upload.changed) {
+        upload.failed = true;
+        AddError();
+    }
+    if (upload.remaining.fetch_sub(1) == 1) {
+        FinishChunkedUpload(client, upload);
+    }
+}
+
+// Whether `upload.part` holds exactly the file, so it can be moved into
+// place. A part of another size, such as one an earlier, larger version
+// left with its tail, is replaced by the whole file; *whole tells. The
+// uploader never sends DELETE, and a plain PUT replaces the part as well.
+bool SyncRunner::SettlePart(WebDavClient* client, const ChunkedUpload& upload, bool* whole) {
+    const PathStore& store = plan_->store;
+    FileId file = upload.file;
+    std::string rel_name = store.FileRelativeUtf8(file);
+    std::string err;
+    RemoteItemInfo info = client->GetInfo(upload.part, &err);
+    if (!err.empty()) {
+        logger_.Error("PROPFIND failed for " + upload.part.plain + ": " + err);
+        return false;
+    }
+    if (info.exists && info.size == store.FileSize(file)) {
+        return true;
+    }
+
+    logger_.Warn(upload.part.plain + " holds " + std::to_string(info.size) + " bytes, not " +
+                 std::to_string(store.FileSize(file)) + ", uploading " + rel_name + " whole");
+    {
+        std::lock_guard<std::mutex> lock(chunks_mutex_);
+        ForgetChunks(upload);
+        SaveChunks();
+    }
+    FileReader body(config_.read_options);
+    if (!body.Open(store.FileAbsolutePath(plan_->source, file), &err)) {
+        logger_.Error(err + ": " + rel_name);
+        return false;
+    }
+    if (!client->PutBody(upload.part, &body, &err)) {
+        logger_.Error("PUT failed for " + upload.part.plain + ": " + err);
+        return false;
+    }
+    *whole = true;
+    return true;
+}
+
+// Runs on the worker of the last chunk to finish: moves a complete upload
+// into place, or keeps what landed for the next run.
+void SyncRunner::FinishChunkedUpload(WebDavClient* client, ChunkedUpload& upload) {
+    const SyncPlan& plan = *plan_;
+    const PathStore& store = plan.store;
+    FileId file = upload.file;
+    std::string rel_name = store.FileRelativeUtf8(file);
+    DecisionReason reason = static_cast<DecisionReason>(plan.reason[file]);
+
+    bool done = false;
+    if (!upload.failed && !upload.changed) {
+        std::uint64_t size = 0;
+        std::int64_t mtime_ns = 0;
+        upload.changed = !StatLocalFile(store.FileAbsolutePath(plan.source, file), &size, &mtime_ns) ||
+                         size != store.FileSize(file) || mtime_ns != store.FileMtimeNs(file);
+    }
+    if (upload.changed) {
+        logger_.Warn("File changed since it was scanned, skipped: " + rel_name);
+        std::lock_guard<std::mutex> lock(chunks_mutex_);
+        ForgetChunks(upload);
+        SaveChunks();
+        std::lock_guard<std::mutex> stats_lock(stats_mutex_);
+        stats_->files_skipped++;
+    } else if (upload.failed) {
+        logger_.Error("Chunked upload of " + rel_name +
+                      " is incomplete; the next run uploads the missing chunks");
+    } else {
+        std::string err;
+        RemotePath target = StoredPath(plan, *remote_paths_, file);
+        bool whole = false;
+        if (!SettlePart(client, upload, &whole)) {
+            AddError();
+        } else if (!client->Move(upload.part, target, true, &err)) {
+            logger_.Error("MOVE failed for " + upload.part.plain + " -> " + target.plain + ": " + err);
+            AddError();
+        } else {
+            done = true;
+            {
+                std::lock_guard<std::mutex> lock(chunks_mutex_);
+                ForgetChunks(upload);
+                SaveChunks();
+            }
+            RecordUpload(plan, file, nullptr);
+            if (!append_mode_.empty() && append_mode_[file] != kAppendNone) {
+                RecordAppendBase(plan, file, store.FileSize(file), nullptr);
+            }
+            logger_.Info("Uploaded " + rel_name +
+                         (upload.ranged && !whole ? " (" + std::to_string(upload.chunks) + " chunks)"
+                                                  : ""));
+            {
+                std::lock_guard<std::mutex> lock(stats_mutex_);
+                stats_->files_uploaded++;
+            }
+            if (plan.action[file] == FileActionType::UploadAndDelete) {
+                deleter_->Enqueue(file, IsAlwaysReason(reason));
+            }
+        }
+    }
+
+    auto found = copies_.find(file);
+    if (found != copies_.end()) {
+        for (FileId copy : found->second) {
+            ExecuteCopy(client, plan, copy, done, *remote_paths_, verify_local_);
+        }
+    }
+}
+
+void SyncRunner::ForgetChunks(const ChunkedUpload& upload) {
+    std::string rel_name = plan_->store.FileRelativeUtf8(upload.file);
+    for (std::uint32_t chunk = 0; chunk < upload.chunks; ++chunk) {
+        chunks_manifest_.Erase(ChunkKey(rel_name, chunk * upload.chunk_size));
+    }
+}
+
+void SyncRunner::SaveChunks() {
+    std::string err;
+    std::filesystem::path path = ChunksManifestFile(*plan_);
+    if (!chunks_manifest_.Save(path, &err)) {
+        logger_.Error("Failed to write chunks manifest " + path.string() + ": " + err);
+        AddError();
+    }
+}
+
+std::filesystem::path SyncRunner::AppendsManifestFile(const SyncPlan& plan) const {
+    return StateManifestPath(config_.state_dir, "appends", plan.remote_root);
+}
+
+// The tail goes out as "Content-Range: bytes <old size>-<new size - 1>/<new
+// size>". Whether the server honours that is learned from the chunked
+// upload probe or from the first append: a server that refuses it leaves
+// the object as it was, one that ignores it replaces the object with the
+// tail, which the size check after the PUT catches. Either way this file
+// and all later ones are then uploaded whole.
+bool SyncRunner::AppendTail(WebDavClient* client, const SyncPlan& plan, FileId file,
+                            const RemotePath& remote_path) {
+    if (ranged_puts_ == kRangesUnsupported) {
+        return false;
+    }
+    const PathStore& store = plan.store;
+    std::filesystem::path abs_path = store.FileAbsolutePath(plan.source, file);
+    std::string rel_name = store.FileRelativeUtf8(file);
+    StateManifest::Entry base;
+    {
+        std::lock_guard<std::mutex> lock(appends_mutex_);
+        const StateManifest::Entry* entry = appends_manifest_.Find(rel_name);
+        if (!entry) {
+            return false;
+        }
+        base = *entry;
+    }
+
+    std::string err;
+    RemoteItemInfo remote = client->GetInfo(remote_path, &err);
+    if (!err.empty() || !remote.exists || remote.is_dir || remote.size != base.size) {
+        logger_.Info("Append: the server copy of " + rel_name +
+                     " is not its last upload, uploading whole");
+        return false;
+    }
+
+    // The recorded upload must still be the start of the file.
+    FileReader prefix(config_.read_options);
+    Sha256 hash;
+    if (!prefix.Open(abs_path, &err) || !prefix.SetRange(0, base.size, &err) ||
+        !HashBody(&prefix, &hash, &err)) {
+        logger_.Warn("Append: failed to read " + rel_name + " (" + err + "), uploading whole");
+        return false;
+    }
+    std::uint64_t total = prefix.FileSize();
+    prefix.Close();
+    if (total <= base.size || Sha256(hash).Finish() != base.digest) {
+        logger_.Info("Append: " + rel_name + " changed within its last upload, uploading whole");
+        return false;
+    }
+
+    // The tail seldom starts on a direct I/O boundary and is short anyway.
+    ReadOptions tail_options = config_.read_options;
+    tail_options.mode = ReadCacheMode::Buffered;
+    FileReader reader(tail_options);
+    if (!reader.Open(abs_path, &err) || !reader.SetRange(base.size, total - base.size, &err)) {
+        logger_.Warn("Append: failed to read " + rel_name + " (" + err + "), uploading whole");
+        return false;
+    }
+    HashingBody body(&reader, hash);
+    if (!client->PutRange(remote_path, &body, base.size, total, &err)) {
+        std::uint8_t unknown = kRangesUnknown;
+        ranged_puts_.compare_exchange_strong(unknown, kRangesUnsupported);
+        logger_.Warn("Append to " + remote_path.plain + " failed (" + err + "), uploading whole");
+        return false;
+    }
+    RemoteItemInfo after = client->GetInfo(remote_path, &err);
+    if (!err.empty() || after.size != total) {
+        ranged_puts_ = kRangesUnsupported;
+        logger_.Warn("Append: the server did not extend " + remote_path.plain +
+                     " in place, uploading whole");
+        return false;
+    }
+    ranged_puts_ = kRangesSupported;
+    Sha256Digest digest = body.Finish();
+    RecordAppendBase(plan, file, total, &digest);
+    logger_.Info("Appended " + std::to_string(total - base.size) + " bytes to " + rel_name +
+                 " (" + std::to_string(base.size) + " already uploaded)");
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+    stats_->files_appended++;
+    stats_->appended_bytes += total - base.size;
+    stats_->append_saved_bytes += base.size;
+    return true;
+}
+
+void SyncRunner::RecordAppendBase(const SyncPlan& plan, FileId file, std::uint64_t size,
+                                  const Sha256Digest* digest) {
+    const PathStore& store = plan.store;
+    std::string rel_name = store.FileRelativeUtf8(file);
+    StateManifest::Entry entry{size, store.FileMtimeNs(file), size};
+    if (digest) {
+        entry.digest = *digest;
+    } else {
+        FileReader reader(config_.read_options);
+        Sha256 hash;
+        std::string err;
+        if (!reader.Open(store.FileAbsolutePath(plan.source, file), &err) ||
+            !reader.SetRange(0, size, &err) || !HashBody(&reader, &hash, &err)) {
+            logger_.Warn("Append: failed to hash " + rel_name + " (" + err +
+                         "), its next upload is whole");
+            std::lock_guard<std::mutex> lock(appends_mutex_);
+            appends_manifest_.Erase(rel_name);
+            appends_dirty_ = true;
+            return;
+        }
+        entry.digest = hash.Finish();
+    }
+    std::lock_guard<std::mutex> lock(appends_mutex_);
+    appends_manifest_.Set(rel_name, entry);
+    appends_dirty_ = true;
+}
+
+std::vector<std::uint64_t> SyncRunner::BeginExecute(const SyncPlan& plan, bool verify_local,
+                                                    std::vector<std::uint8_t>* deletes) {
+    const PathStore& store = plan.store;
+    plan_ = &plan;
+    verify_local_ = verify_local;
+    // Remote paths are encoded once per directory; files only encode their
+    // own name.
+    remote_paths_ = std::make_unique<RemotePathTable>(store, plan.remote_root);
+    const RemotePathTable& remote_paths = *remote_paths_;
+
+    PooledClient dir_client = MakeClient("directories");
+    if (remote_checks_ && !dir_client) {
+        return {};
+    }
+    if (!plan.root_exists) {
+        std::string current;
+        for (const auto& part :
+             SplitRemotePath(remote_paths.Directory(PathStore::kRootDir).plain)) {
+            current += "/" + part;
+            EnsureRootDirectory(dir_client.get(), RemotePath{current, UrlEncodePath(current)});
+        }
+    }
+    // Id order creates every parent collection before its children. A
+    // renamed directory arrives whole, with its subdirectories and files.
+    std::vector<std::uint8_t> moved(store.DirectoryCount(), 0);
+    for (DirId dir = 1; dir < store.DirectoryCount(); ++dir) {
+        if (moved[store.DirectoryParent(dir)]) {
+            moved[dir] = 1;
+            continue;
+        }
+        if (plan.dir_rename_from[dir] != PathStore::kInvalidId &&
+            RenameDirectory(dir_client.get(), plan, dir, remote_paths)) {
+            moved[dir] = 1;
+            continue;
+        }
+        // A dry run does not know whether an unlisted collection exists.
+        if (plan.dir_missing[dir] == 1 ||
+            (plan.dir_missing[dir] == kDirUnlisted && !config_.dry_run)) {
+            CreateDirectory(dir_client.get(), remote_paths.Directory(dir));
+        }
+    }
+
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        if (plan.reason[file] != kReasonUndecided && plan.action[file] == FileActionType::Skip) {
+            logger_.Skip(store.FileRelativeUtf8(file),
+                         DecisionReasonText(static_cast<DecisionReason>(plan.reason[file])));
+            stats_->files_skipped++;
+        }
+    }
+
+    // Bundles go to their own collection below each bundle root.
+    bundles_ = PlanBundles(plan, config_.bundle_size);
+    if (!bundles_.empty()) {
+        BundleGroups bundle_groups = AssignBundleGroups(store, plan.bundle_roots);
+        std::vector<RemotePath> bundle_dirs(plan.bundle_roots.size());
+        manifests_.assign(plan.bundle_roots.size(), StateManifest());
+        std::vector<std::uint32_t> sequence(plan.bundle_roots.size(), 0);
+        std::string stamp = BundleStamp();
+        if (!config_.dry_run) {
+            EnsureStateDir();
+        }
+        for (const PlannedBundle& bundle : bundles_) {
+            std::size_t index = bundle.group - 1;
+            if (bundle_dirs[index].plain.empty()) {
+                bundle_dirs[index] = AppendRemotePath(
+                    remote_paths.Directory(bundle_groups.root_dir[index]), kBundleDirName);
+                CreateDirectory(dir_client.get(), bundle_dirs[index]);
+                LoadState(BundleManifestFile(plan, bundle.group), &manifests_[index]);
+            }
+            bundle_targets_.push_back(AppendRemotePath(
+                bundle_dirs[index], stamp + "-" + std::to_string(++sequence[index]) + ".tar"));
+        }
+    }
+
+    // Files matching --append are hashed as they upload; those that grew
+    // since a recorded upload are queued at the size of what they grew by.
+    std::vector<FileId> upload_order = PlanExecutionOrder(plan);
+    if (!config_.append_patterns.empty() && remote_checks_ && !config_.dry_run) {
+        EnsureStateDir();
+        LoadState(AppendsManifestFile(plan), &appends_manifest_);
+        ExcludeMatcher matcher(ExcludeRules{config_.append_patterns});
+        append_mode_.assign(store.FileCount(), kAppendNone);
+        for (FileId file : upload_order) {
+            std::string rel_name = store.FileRelativeUtf8(file);
+            if (plan.encoding[file] == FileEncoding::Gzip ||
+                plan.rename_from[file] != PathStore::kInvalidId || !matcher.Excludes(rel_name)) {
+                continue;
+            }
+            const StateManifest::Entry* entry = appends_manifest_.Find(rel_name);
+            append_mode_[file] = entry && entry->size > 0 && entry->size < store.FileSize(file)
+                                     ? kAppendTail
+                                     : kAppendRecord;
+        }
+    }
+
+    std::vector<FileId> moved_files;
+    std::vector<FileId> chunked_files;
+    for (FileId file : upload_order) {
+        if (moved[store.FileDirectory(file)]) {
+            moved_files.push_back(file);
+        } else if (!append_mode_.empty() && append_mode_[file] == kAppendTail) {
+            order_.push_back({store.FileSize(file) -
+                                  appends_manifest_.Find(store.FileRelativeUtf8(file))->size,
+                              0, file, plan.action[file] == FileActionType::UploadAndDelete});
+        } else if (UploadsInChunks(plan, file)) {
+            chunked_files.push_back(file);
+        } else {
+            order_.push_back({store.FileSize(file), 0, file,
+                              plan.action[file] == FileActionType::UploadAndDelete});
+        }
+    }
+    if (!chunked_files.empty()) {
+        QueueChunkedUploads(dir_client.get(), plan, chunked_files);
+    }
+    for (std::size_t i = 0; i < bundles_.size(); ++i) {
+        bool bundle_deletes = false;
+        for (FileId file : bundles_[i].files) {
+            bundle_deletes = bundle_deletes || plan.action[file] == FileActionType::UploadAndDelete;
+        }
+        order_.push_back({bundles_[i].bytes, static_cast<std::uint32_t>(i + 1), 0, bundle_deletes});
+    }
+    std::stable_sort(order_.begin(), order_.end(),
+                     [](const WorkItem& a, const WorkItem& b) { return a.bytes > b.bytes; });
+    if (order_.empty() && moved_files.empty()) {
+        return {};
+    }
+    for (FileId file = 0; file < store.FileCount(); ++file) {
+        if (plan.copy_from[file] != PathStore::kInvalidId && plan.reason[file] != kReasonUndecided) {
+            copies_[plan.copy_from[file]].push_back(file);
+        }
+    }
+    // An applied plan was decided by another run; its compressed sizes are
+    // added to the manifest on disk.
+    if (!gzip_loaded_ &&
+        std::find(plan.encoding.begin(), plan.encoding.end(), FileEncoding::Gzip) !=
+            plan.encoding.end()) {
+        LoadState(GzipManifestFile(plan), &gzip_manifest_);
+        gzip_loaded_ = true;
+    }
+    if (config_.detect_renames && !uploads_loaded_) {
+        LoadState(UploadsManifestFile(plan), &uploads_manifest_);
+        uploads_loaded_ = true;
+    }
+    if (!config_.dry_run) {
+        std::filesystem::path journal = logger_.LogPath();
+        journal.replace_extension(job_.empty() ? ".deleted.txt" : "." + job_ + ".deleted.txt");
+        deleter_ = std::make_unique<LocalDeleter>(store, plan.source, journal, logger_,
+                                                  !config_.trace_replay.empty());
+    }
+    for (FileId file : moved_files) {
+        ExecuteRename(nullptr, plan, file, remote_paths, verify_local, true);
+    }
+
+    std::vector<std::uint64_t> costs;
+    costs.reserve(order_.size());
+    deletes->clear();
+    deletes->reserve(order_.size());
+    for (const WorkItem& item : order_) {
+        costs.push_back(item.bytes);
+        deletes->push_back(item.deletes ? 1 : 0);
+    }
+    return costs;
+}
+
+void SyncRunner::RunItem(WebDavClient* client, std::size_t index) {
+    const SyncPlan& plan = *plan_;
+    const RemotePathTable& remote_paths = *remote_paths_;
+    const WorkItem& item = order_[index];
+    if (item.chunked != 0) {
+        ExecuteChunk(client, item);
+    } else if (item.bundle == 0 && plan.rename_from[item.file] != PathStore::kInvalidId) {
+        ExecuteRename(client, plan, item.file, remote_paths, verify_local_, false);
+    } else if (item.bundle != 0) {
+        ExecuteBundle(client, plan, bundles_[item.bundle - 1], bundle_targets_[item.bundle - 1]);
+    } else {
+        auto found = copies_.find(item.file);
+        bool intact = ExecuteFile(client, plan, item.file, remote_paths, verify_local_,
+                                  found != copies_.end());
+        if (found != copies_.end()) {
+            for (FileId copy : found->second) {
+                ExecuteCopy(client, plan, copy, intact, remote_paths, verify_local_);
+            }
+        }
+    }
+}
+
+std::uint64_t SyncRunner::ItemFiles(std::size_t index) const {
+    const WorkItem& item = order_[index];
+    if (item.bundle != 0) {
+        return bundles_[item.bundle - 1].files.size();
+    }
+    if (item.chunked != 0 && item.chunk != chunked_[item.chunked - 1]->last_queued) {
+        return 0;
+    }
+    auto found = copies_.find(item.file);
+    return 1 + (found == copies_.end() ? 0 : found->second.size());
+}
+
+std::string SyncRunner::ItemName(std::size_t index) const {
+    const WorkItem& item = order_[index];
+    if (item.bundle != 0) {
+        return bundle_targets_[item.bundle - 1].plain;
+    }
+    std::string name = plan_->store.FileRelativeUtf8(item.file);
+    if (item.chunked != 0 && chunked_[item.chunked - 1]->ranged) {
+        name += " [chunk " + std::to_string(item.chunk + 1) + "/" +
+                std::to_string(chunked_[item.chunked - 1]->chunks) + "]";
+    }
+    return name;
+}
+
+void SyncRunner::FinishExecute() {
+    if (!plan_) {
+        return;
+    }
+    const SyncPlan& plan = *plan_;
+    if (gzip_dirty_ && EnsureStateDir()) {
+        std::string err;
+        std::filesystem::path path = GzipManifestFile(plan);
+        if (!gzip_manifest_.Save(path, &err)) {
+            logger_.Error("Failed to write gzip manifest " + path.string() + ": " + err);
+            AddError();
+        }
+    }
+    if (appends_dirty_ && EnsureStateDir()) {
+        std::string err;
+        std::filesystem::path path = AppendsManifestFile(plan);
+        if (!appends_manifest_.Save(path, &err)) {
+            logger_.Error("Failed to write appends manifest " + path.string() + ": " + err);
+            AddError();
+        }
+    }
+    if (uploads_dirty_ && !config_.dry_run && EnsureStateDir()) {
+        std::string err;
+        std::filesystem::path path = UploadsManifestFile(plan);
+        if (!uploads_manifest_.Save(path, &err)) {
+            logger_.Error("Failed to write uploads manifest " + path.string() + ": " + err);
+            AddError();
+        }
+    }
+
+    if (deleter_) {
+        DeletionStats deleted = deleter_->Finish();
+        stats_->files_deleted_jpg += deleted.deleted_jpg;
+        stats_->files_deleted_old += deleted.deleted_old;
+        stats_->reclaimed = std::move(deleted.reclaimed);
+        stats_->errors += deleted.errors;
+        if (board_) {
+            board_->AddErrors(deleted.errors);
+        }
+        if (deleted.deleted_jpg + deleted.deleted_old > 0) {
+            stats_->deleted_list = deleter_->JournalPath();
+        }
+        deleter_.reset();
+    }
+    plan_ = nullptr;
+}
+
+// The settings one job runs with: the shared ones plus its own mapping.
+AppConfig JobConfig(const AppConfig& config, const SyncJob& job) {
+    AppConfig out = config;
+    out.jobs.clear();
+    out.source = job.source;
+    out.remote = job.remote;
+    out.compare_mode = job.compare_mode;
+    out.excludes.insert(out.excludes.end(), job.excludes.begin(), job.excludes.end());
+    return out;
+}
+
+// Job names become part of a file name.
+std::string JournalName(const std::string& job) {
+    std::string out = job;
+    for (char& c : out) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') {
+            c = '_';
+        }
+    }
+    return out;
+}
+
+void LogShard(Logger& logger, const ShardSpec& spec, const ShardStats& shard) {
+    std::uint64_t files = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t prefixes = 0;
+    for (std::uint32_t i = 0; i < spec.count; ++i) {
+        files += shard.files[i];
+        bytes += shard.bytes[i];
+        prefixes += shard.prefixes[i];
+    }
+    logger.Info("Shard " + std::to_string(spec.index + 1) + "/" + std::to_string(spec.count) +
+                " at depth " + std::to_string(spec.depth) + ": " +
+                std::to_string(shard.files[spec.index]) + " of " + std::to_string(files) +
+                " files, " + std::to_string(shard.bytes[spec.index]) + " of " +
+                std::to_string(bytes) + " bytes, " + std::to_string(shard.prefixes[spec.index]) +
+                " of " + std::to_string(prefixes) + " directory prefixes");
+    auto minmax = std::minmax_element(shard.bytes.begin(), shard.bytes.end());
+    char skew[96];
+    std::snprintf(skew, sizeof(skew), "max/mean %.2f by bytes, %.2f by files",
+                  MaxOverMean(shard.bytes), MaxOverMean(shard.files));
+    std::string line = "Shard skew: " + std::string(skew) + "; bytes per shard " +
+                       std::to_string(*minmax.first) + ".." + std::to_string(*minmax.second);
+    if (shard.largest_prefix_bytes > 0) {
+        char share[32];
+        std::snprintf(share, sizeof(share), "%.1f%%", 100.0 * shard.largest_prefix_bytes / bytes);
+        line += "; largest prefix \"" + shard.largest_prefix + "\" holds " + share;
+    }
+    logger.Info(line);
+}
+
+// Opens the pool's first connections while the source is scanned, so the
+// decision stage and the first uploads find DNS, TCP and TLS already done.
+// Each of `clients` threads borrows a client and sends a PROPFIND (Depth: 0)
+// of the remote root, which also checks the credentials one round trip in;
+// the clients then wait idle in the pool.
+class ConnectionWarmup {
+public:
+    ConnectionWarmup(WebDavClientPool* pool, const std::string& remote_root, int clients,
+                     Logger& logger)
+        : logger_(logger), start_(std::chrono::steady_clock::now()) {
+        threads_.reserve(clients);
+        for (int i = 0; i < clients; ++i) {
+            threads_.emplace_back([this, pool, remote_root]() { Warm(pool, remote_root); });
+        }
+    }
+
+    ConnectionWarmup(const ConnectionWarmup&) = delete;
+    ConnectionWarmup& operator=(const ConnectionWarmup&) = delete;
+
+    ~ConnectionWarmup() { Finish(); }
+
+    // Set as soon as the server refuses the credentials.
+    const std::atomic<bool>* Refused() const { return &refused_; }
+
+    // Waits for the connections; false when the credentials were refused.
+    bool Finish() {
+        if (!threads_.empty()) {
+            for (auto& t : threads_) {
+                t.join();
+            }
+            if (!refused_.load()) {
+                logger_.Info("Warm-up: " + std::to_string(ready_.load()) + " of " +
+                             std::to_string(threads_.size()) + " connections ready after " +
+                             std::to_string(last_ms_.load()) + " ms");
+            }
+            threads_.clear();
+        }
+        return !refused_.load();
+    }
+
+private:
+    void Warm(WebDavClientPool* pool, const std::string& remote_root) {
+        PooledClient client = pool->Acquire();
+        if (!client) {
+            return;
+        }
+        std::string err;
+        WebDavResponse response = client->PropFind(remote_root, &err);
+        if (response.status == 401 || response.status == 403) {
+            if (!refused_.exchange(true)) {
+                logger_.Error("The server refused the credentials (status " +
+                              std::to_string(response.status) + " for " + remote_root + ").");
+            }
+            return;
+        }
+        if (response.status == 0) {
+            // The real requests retry and report it.
+            return;
+        }
+        ready_.fetch_add(1);
+        std::int64_t ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::steady_clock::now() - start_)
+                              .count();
+        std::int64_t last = last_ms_.load();
+        while (ms > last && !last_ms_.compare_exchange_weak(last, ms)) {
+        }
+    }
+
+    Logger& logger_;
+    std::chrono::steady_clock::time_point start_;
+    std::vector<std::thread> threads_;
+    std::atomic<bool> refused_{false};
+    std::atomic<std::size_t> ready_{0};
+    std::atomic<std::int64_t> last_ms_{0};
+};
+
+// Reads the plan to apply, or scans and decides a new one. False when
+// there is nothing to execute. With a `warmup` the scan stops once the
+// credentials are refused, and the decision stage waits for its
+// connections.
+bool BuildPlan(const AppConfig& config, SyncRunner* runner, Logger& logger, SyncPlan* plan,
+               SyncStats* stats, ConnectionWarmup* warmup) {
+    if (!config.apply_plan.empty()) {
+        std::string err;
+        if (!ReadPlanFile(config.apply_plan, plan, &err)) {
+            logger.Error("Failed to read plan " + config.apply_plan.string() + ": " + err);
+            stats->errors++;
+            return false;
+        }
+        logger.Info("Applying plan " + config.apply_plan.string() + " (source " +
+                    plan->source.string() + ", remote root " + plan->remote_root + ")");
+    } else {
+        ExcludeRules rules = BuildDefaultExcludeRules();
+        for (const auto& pattern : config.excludes) {
+            rules.patterns.push_back(pattern);
+        }
+
+        plan->source = config.source;
+        plan->remote_root = config.remote;
+        plan->compare_mode = config.compare_mode;
+        for (const auto& dir : config.bundle_dirs) {
+            std::string root = NormalizeBundleRoot(dir);
+            if (std::find(plan->bundle_roots.begin(), plan->bundle_roots.end(), root) ==
+                plan->bundle_roots.end()) {
+                plan->bundle_roots.push_back(root);
+            }
+        }
+        plan->created_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               std::chrono::system_clock::now().time_since_epoch())
+                               .count();
+
+        ScanStats scan = ScanSource(config.source, ExcludeMatcher(rules), logger, &plan->store,
+                                    config.ignore_file, warmup ? warmup->Refused() : nullptr);
+        stats->errors += scan.errors;
+        if (scan.stopped) {
+            logger.Warn("Scan stopped after " + std::to_string(scan.files) + " files.");
+            return false;
+        }
+        logger.Info("Scanned " + std::to_string(scan.files) + " files in " +
+                    std::to_string(scan.directories) + " directories (" +
+                    std::to_string(scan.excluded) + " excluded)");
+        if (scan.ignore_files > 0) {
+            logger.Info("Ignore files applied: " + std::to_string(scan.ignore_files));
+        }
+        if (config.shard_count > 1) {
+            ShardSpec spec{config.shard_index, config.shard_count, config.shard_depth};
+            std::vector<std::uint8_t> shared;
+            ShardStats shard = SelectShard(&plan->store, spec, &shared);
+            runner->SetSharedDirectories(std::move(shared));
+            LogShard(logger, spec, shard);
+        }
+        if (warmup && !warmup->Finish()) {
+            return false;
+        }
+        runner->Decide(plan);
+        if (config.detect_renames) {
+            runner->DetectRenames(plan);
+        }
+        if (config.dedup) {
+            DedupStats dedup = FindDuplicateUploads(plan, config.threads, logger);
+            stats->errors += dedup.errors;
+            logger.Info("Dedup: hashed " + std::to_string(dedup.hashed) + " files (" +
+                        std::to_string(dedup.hashed_bytes) + " bytes), " +
+                        std::to_string(dedup.hard_links) + " hard links, " +
+                        std::to_string(dedup.copies) + " copies save " +
+                        std::to_string(dedup.saved_bytes) + " bytes");
+        }
+    }
+
+    PlanSummary summary = SummarizePlan(*plan);
+    logger.Info("Plan: " + std::to_string(summary.uploads) + " uploads (" +
+                std::to_string(summary.upload_bytes) + " bytes), " +
+                std::to_string(summary.deletes) + " local deletes, " +
+                std::to_string(summary.skips) + " skips, " +
+                std::to_string(summary.missing_dirs) + " missing directories");
+    if (summary.bundled > 0) {
+        logger.Info("Plan: " + std::to_string(summary.bundled) + " of the uploads go into bundles");
+    }
+    if (summary.compressed > 0) {
+        logger.Info("Plan: " + std::to_string(summary.compressed) + " of the uploads are compressed");
+    }
+    if (summary.renames > 0) {
+        logger.Info("Plan: " + std::to_string(summary.renames) + " of the uploads reuse an earlier upload (" +
+                    std::to_string(summary.dir_renames) + " whole directories)");
+    }
+    if (summary.copies > 0) {
+        logger.Info("Plan: " + std::to_string(summary.copies) + " of the uploads are server-side copies");
+    }
+    return true;
+}
+
+// Promotes the uploads that delete local files of each job as the free
+// space of its source volume falls below the watermarks. Workers poll it
+// between items; the volumes are read at most once per interval.
+class SpaceWatch {
+public:
+    SpaceWatch(const AppConfig& config, const std::vector<AppConfig>& jobs,
+               FairScheduler* scheduler, Logger& logger)
+        : low_(config.low_space_percent),
+          critical_(config.critical_space_percent),
+          scheduler_(scheduler),
+          logger_(logger),
+          levels_(jobs.size(), FairScheduler::Promotion::None) {
+        for (const AppConfig& job : jobs) {
+            sources_.push_back(job.source);
+        }
+    }
+
+    void Poll() {
+        if (low_ == 0 && critical_ == 0) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex_, std::try_to_lock);
+        auto now = std::chrono::steady_clock::now();
+        if (!lock.owns_lock() || (polled_ && now - last_poll_ < kPollInterval)) {
+            return;
+        }
+        polled_ = true;
+        last_poll_ = now;
+        for (std::size_t i = 0; i < sources_.size(); ++i) {
+            std::error_code ec;
+            std::filesystem::space_info space = std::filesystem::space(sources_[i], ec);
+            if (ec || space.capacity == 0 || space.available == static_cast<std::uintmax_t>(-1)) {
+                continue;
+            }
+            double percent = 100.0 * static_cast<double>(space.available) / space.capacity;
+            FairScheduler::Promotion level = FairScheduler::Promotion::None;
+            if (percent < critical_) {
+                level = FairScheduler::Promotion::Global;
+            } else if (percent < low_) {
+                level = FairScheduler::Promotion::WithinFlow;
+            }
+            if (level == levels_[i]) {
+                continue;
+            }
+            levels_[i] = level;
+            scheduler_->SetPromotion(i, level);
+            char share[32];
+            std::snprintf(share, sizeof(share), "%.1f%%", percent);
+            std::string message = "Free space on " + sources_[i].string() + ": " +
+                                  std::to_string(space.available) + " bytes (" + share + "); ";
+            if (level == FairScheduler::Promotion::Global) {
+                message += "uploads that delete local files now go before all others";
+            } else if (level == FairScheduler::Promotion::WithinFlow) {
+                message += "uploads that delete local files now go first";
+            } else {
+                message += "uploads go largest first again";
+            }
+            logger_.Info(message);
+        }
+    }
+
+private:
+    static constexpr std::chrono::seconds kPollInterval{1};
+
+    std::uint32_t low_;
+    std::uint32_t critical_;
+    FairScheduler* scheduler_;
+    Logger& logger_;
+    std::vector<std::filesystem::path> sources_;
+    std::vector<FairScheduler::Promotion> levels_;
+    std::mutex mutex_;
+    bool polled_ = false;
+    std::chrono::steady_clock::time_point last_poll_;
+};
+
+}  // namespace
+
+std::vector<SyncStats> RunSync(const AppConfig& config, Logger& logger) {
+    std::vector<AppConfig> configs;
+    std::vector<std::uint32_t> weights;
+    for (const SyncJob& job : config.jobs) {
+        configs.push_back(JobConfig(config, job));
+        weights.push_back(job.weight);
+    }
+    if (configs.empty()) {
+        configs.push_back(config);
+        weights.push_back(1);
+    }
+    std::vector<SyncStats> stats(configs.size());
+    bool applying = !config.apply_plan.empty();
+
+    bool remote_checks = !config.app_password.empty();
+    if (config.dry_run && !remote_checks) {
+        logger.Warn("Dry-run without app password: remote checks are disabled.");
+    }
+
+    std::string url_error;
+    auto base_url = WebDavClient::ParseBaseUrl(config.base_url, &url_error);
+    if (!base_url) {
+        logger.Error("Invalid base URL: " + url_error);
+        stats[0].errors++;
+        return stats;
+    }
+
+    // Every job draws its connections from one pool and its bandwidth from
+    // one limiter.
+    std::unique_ptr<RateLimiter> limiter;
+    if (config.rate_limit > 0) {
+        limiter = std::make_unique<RateLimiter>(config.rate_limit);
+    }
+    // A replay stands in for the server; a recording wraps whichever
+    // transport is in use.
+    std::unique_ptr<TraceReplayer> replayer;
+    std::unique_ptr<TraceRecorder> recorder;
+    WebDavClientPool::TransportFactory transports;
+    if (remote_checks && !config.trace_replay.empty()) {
+        std::vector<TraceRecord> records;
+        std::string err;
+        if (!ReadTraceFile(config.trace_replay, &records, &err)) {
+            logger.Error("Failed to read trace " + config.trace_replay.string() + ": " + err);
+            stats[0].errors++;
+            return stats;
+        }
+        logger.Info("Replaying " + std::to_string(records.size()) + " recorded requests");
+        replayer = std::make_unique<TraceReplayer>(std::move(records));
+    }
+    if (remote_checks && !config.trace_record.empty()) {
+        recorder = std::make_unique<TraceRecorder>();
+    }
+    if (replayer || recorder) {
+        transports = [&]() {
+            std::unique_ptr<WebDavTransport> transport =
+                replayer ? replayer->MakeTransport() : MakeWinHttpTransport(*base_url);
+            return recorder ? recorder->Wrap(std::move(transport)) : std::move(transport);
+        };
+    }
+    auto finish_trace = [&]() {
+        if (replayer) {
+            logger.Info("Replay: " + std::to_string(replayer->Matched()) +
+                        " requests answered from the trace, " +
+                        std::to_string(replayer->Modelled()) + " from its typical timings");
+        }
+        if (!recorder) {
+            return;
+        }
+        std::string err;
+        if (!recorder->Save(config.trace_record, &err)) {
+            logger.Error("Failed to write trace " + config.trace_record.string() + ": " + err);
+            stats[0].errors++;
+        } else {
+            logger.Info("Trace: " + std::to_string(recorder->Size()) + " requests written to " +
+                        config.trace_record.string());
+        }
+    };
+    std::unique_ptr<WebDavClientPool> pool;
+    if (remote_checks) {
+        pool = std::make_unique<WebDavClientPool>(
+            *base_url, WebDavCredentials{config.email, config.app_password}, limiter.get(),
+            transports);
+    }
+    // Connections are set up in the background while the first job scans,
+    // as many as the larger of the two stages uses; the upload workers take
+    // over those the listings leave idle.
+    std::unique_ptr<ConnectionWarmup> warmup;
+    if (pool) {
+        warmup = std::make_unique<ConnectionWarmup>(
+            pool.get(), configs.front().remote, (std::max)({config.threads, config.probe_threads, 1}),
+            logger);
+    }
+
+    std::vector<std::unique_ptr<SyncRunner>> runners;
+    std::vector<SyncPlan> plans(configs.size());
+    std::vector<std::uint8_t> ready(configs.size(), 0);
+    for (std::size_t i = 0; i < configs.size(); ++i) {
+        std::string name = config.jobs.empty() ? std::string() : config.jobs[i].name;
+        if (!name.empty()) {
+            logger.Info("Job " + name + ": " + configs[i].source.string() + " -> " +
+                        configs[i].remote);
+        }
+        runners.push_back(std::make_unique<SyncRunner>(configs[i], pool.get(), logger, &stats[i],
+                                                       JournalName(name)));
+        ready[i] = BuildPlan(configs[i], runners[i].get(), logger, &plans[i], &stats[i],
+                             warmup.get());
+        if (warmup && warmup->Refused()->load()) {
+            break;
+        }
+    }
+    if (warmup && !warmup->Finish()) {
+        stats[0].errors++;
+        finish_trace();
+        return stats;
+    }
+
+    if (!config.plan_out.empty()) {
+        if (ready[0]) {
+            std::string err;
+            if (!WritePlanFile(config.plan_out, plans[0], &err)) {
+                logger.Error("Failed to write plan: " + err);
+                stats[0].errors++;
+            } else {
+                logger.Info("Plan written to " + config.plan_out.string());
+            }
+        }
+        finish_trace();
+        return stats;
+    }
+
+    // One set of workers serves all jobs; each job keeps its largest-first
+    // order and gets a share of the workers in proportion to its weight,
+    // unless its source volume runs out of space.
+    auto execute_start = std::chrono::steady_clock::now();
+    std::uint64_t plan_errors = 0;
+    for (const SyncStats& job_stats : stats) {
+        plan_errors += job_stats.errors;
+    }
+    StatusBoard board(plan_errors);
+    FairScheduler scheduler;
+    for (std::size_t i = 0; i < runners.size(); ++i) {
+        std::vector<std::uint8_t> deletes;
+        std::vector<std::uint64_t> costs;
+        runners[i]->SetStatusBoard(&board);
+        if (ready[i]) {
+            costs = runners[i]->BeginExecute(plans[i], applying, &deletes);
+        }
+        for (std::size_t item = 0; item < costs.size(); ++item) {
+            board.AddPlanned(runners[i]->ItemFiles(item), costs[item]);
+        }
+        scheduler.AddFlow(weights[i], std::move(costs), deletes);
+    }
+    SpaceWatch space_watch(config, configs, &scheduler, logger);
+    space_watch.Poll();
+    auto worker = [&](WorkerStatus* status) {
+        // A client that cannot be created counts against the first job.
+        PooledClient client = runners.front()->MakeClient("worker");
+        if (remote_checks && !client) {
+            status->SetState(WorkerState::Done);
+            return;
+        }
+        if (client) {
+            client->SetStatus(status);
+        }
+        FairScheduler::Pick pick;
+        while (true) {
+            space_watch.Poll();
+            if (!scheduler.Next(&pick)) {
+                break;
+            }
+            board.Begin(*status, (static_cast<std::uint64_t>(pick.flow) << 32 | pick.item) + 1,
+                        runners[pick.flow]->ItemBytes(pick.item));
+            runners[pick.flow]->RunItem(client.get(), pick.item);
+            board.Finish(*status, runners[pick.flow]->ItemFiles(pick.item));
+        }
+        status->SetState(WorkerState::Done);
+    };
+    int thread_count = scheduler.Items() == 0 ? 0 : WorkerCount(config.threads, scheduler.Items());
+    board.SetWorkers(thread_count);
+    std::unique_ptr<StatusReporter> reporter;
+    if (thread_count > 0 && (config.progress || !config.status_file.empty())) {
+        StatusOptions status_options;
+        status_options.console = config.progress;
+        status_options.file = config.status_file;
+        status_options.interval = std::chrono::seconds(config.status_interval);
+        auto describe = [&](std::uint64_t key) {
+            std::size_t flow = static_cast<std::size_t>((key - 1) >> 32);
+            std::string name = runners[flow]->ItemName(static_cast<std::uint32_t>(key - 1));
+            return config.jobs.empty() ? name : config.jobs[flow].name + ": " + name;
+        };
+        reporter = std::make_unique<StatusReporter>(board, status_options, describe, logger);
+    }
+    std::vector<std::thread> workers;
+    workers.reserve(thread_count);
+    for (int i = 0; i < thread_count; ++i) {
+        workers.emplace_back(worker, &board.Worker(i));
+    }
+    for (auto& t : workers) {
+        t.join();
+    }
+    for (auto& runner : runners) {
+        runner->FinishExecute();
+    }
+    if (reporter) {
+        reporter->Stop();
+    }
+    double execute_seconds =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - execute_start).count();
+    for (SyncStats& job_stats : stats) {
+        job_stats.execute_seconds = execute_seconds;
+    }
+    if (pool) {
+        logger.Info("Connections: " + std::to_string(pool->Created()) + " WebDAV clients for " +
+                    std::to_string(configs.size()) + " job(s)");
+    }
+    finish_trace();
     return stats;
 }
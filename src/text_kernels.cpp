@@ -0,0 +1,234 @@
+#include "text_kernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define UPLOADER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(UPLOADER_X86) && (defined(__SSE2__) || defined(_M_X64) || \
+                              (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define UPLOADER_SSE2 1
+#endif
+
+#if defined(UPLOADER_SSE2) && (defined(__GNUC__) || defined(__clang__) || defined(_MSC_VER))
+#define UPLOADER_AVX2 1
+#if defined(__GNUC__) || defined(__clang__)
+#define UPLOADER_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define UPLOADER_TARGET_AVX2
+#endif
+#endif
+
+namespace {
+
+bool IsUrlSafe(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ||
+           (c >= 'a' && c <= 'z') ||
+           (c >= '0' && c <= '9') ||
+           c == '-' || c == '_' || c == '.' || c == '~' || c == '/';
+}
+
+unsigned CountTrailingZeros(unsigned value) {
+#ifdef _MSC_VER
+    unsigned long index = 0;
+    _BitScanForward(&index, value);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(value));
+#endif
+}
+
+#ifdef UPLOADER_AVX2
+
+bool DetectAvx2() {
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7) {
+        return false;
+    }
+    __cpuid(regs, 1);
+    bool os_saves_ymm = (regs[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+    __cpuidex(regs, 7, 0);
+    return os_saves_ymm && (regs[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+bool HasAvx2() {
+    static const bool has_avx2 = DetectAvx2();
+    return has_avx2;
+}
+
+UPLOADER_TARGET_AVX2 std::size_t LowerAvx2(char* data, std::size_t size) {
+    const __m256i before_a = _mm256_set1_epi8('A' - 1);
+    const __m256i after_z = _mm256_set1_epi8('Z' + 1);
+    const __m256i flip = _mm256_set1_epi8(0x20);
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, before_a),
+                                         _mm256_cmpgt_epi8(after_z, v));
+        v = _mm256_or_si256(v, _mm256_and_si256(upper, flip));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i), v);
+    }
+    return i;
+}
+
+UPLOADER_TARGET_AVX2 std::size_t SafePrefixAvx2(const char* data, std::size_t size) {
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i before_a = _mm256_set1_epi8('a' - 1);
+    const __m256i after_z = _mm256_set1_epi8('z' + 1);
+    const __m256i before_0 = _mm256_set1_epi8('0' - 1);
+    const __m256i after_9 = _mm256_set1_epi8('9' + 1);
+    const __m256i dash = _mm256_set1_epi8('-');
+    const __m256i underscore = _mm256_set1_epi8('_');
+    const __m256i dot = _mm256_set1_epi8('.');
+    const __m256i tilde = _mm256_set1_epi8('~');
+    const __m256i slash = _mm256_set1_epi8('/');
+    std::size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        __m256i folded = _mm256_or_si256(v, case_bit);
+        __m256i safe = _mm256_and_si256(_mm256_cmpgt_epi8(folded, before_a),
+                                        _mm256_cmpgt_epi8(after_z, folded));
+        safe = _mm256_or_si256(safe, _mm256_and_si256(_mm256_cmpgt_epi8(v, before_0),
+                                                      _mm256_cmpgt_epi8(after_9, v)));
+        safe = _mm256_or_si256(safe, _mm256_cmpeq_epi8(v, dash));
+        safe = _mm256_or_si256(safe, _mm256_cmpeq_epi8(v, underscore));
+        safe = _mm256_or_si256(safe, _mm256_cmpeq_epi8(v, dot));
+        safe = _mm256_or_si256(safe, _mm256_cmpeq_epi8(v, tilde));
+        safe = _mm256_or_si256(safe, _mm256_cmpeq_epi8(v, slash));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(safe));
+        if (mask != 0xFFFFFFFFu) {
+            return i + CountTrailingZeros(~mask);
+        }
+    }
+    return i;
+}
+
+#endif
+
+#ifdef UPLOADER_SSE2
+
+std::size_t LowerSse2(char* data, std::size_t size) {
+    const __m128i before_a = _mm_set1_epi8('A' - 1);
+    const __m128i after_z = _mm_set1_epi8('Z' + 1);
+    const __m128i flip = _mm_set1_epi8(0x20);
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, before_a), _mm_cmplt_epi8(v, after_z));
+        v = _mm_or_si128(v, _mm_and_si128(upper, flip));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data + i), v);
+    }
+    return i;
+}
+
+std::size_t SafePrefixSse2(const char* data, std::size_t size) {
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i before_a = _mm_set1_epi8('a' - 1);
+    const __m128i after_z = _mm_set1_epi8('z' + 1);
+    const __m128i before_0 = _mm_set1_epi8('0' - 1);
+    const __m128i after_9 = _mm_set1_epi8('9' + 1);
+    std::size_t i = 0;
+    for (; i + 16 <= size; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i folded = _mm_or_si128(v, case_bit);
+        __m128i safe = _mm_and_si128(_mm_cmpgt_epi8(folded, before_a),
+                                     _mm_cmplt_epi8(folded, after_z));
+        safe = _mm_or_si128(safe, _mm_and_si128(_mm_cmpgt_epi8(v, before_0),
+                                                _mm_cmplt_epi8(v, after_9)));
+        safe = _mm_or_si128(safe, _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+        safe = _mm_or_si128(safe, _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+        safe = _mm_or_si128(safe, _mm_cmpeq_epi8(v, _mm_set1_epi8('.')));
+        safe = _mm_or_si128(safe, _mm_cmpeq_epi8(v, _mm_set1_epi8('~')));
+        safe = _mm_or_si128(safe, _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(safe));
+        if (mask != 0xFFFFu) {
+            return i + CountTrailingZeros(~mask & 0xFFFFu);
+        }
+    }
+    return i;
+}
+
+#endif
+
+}  // namespace
+
+void LowerAsciiInPlace(char* data, std::size_t size) {
+    std::size_t i = 0;
+#if defined(UPLOADER_AVX2)
+    if (HasAvx2()) {
+        i = LowerAvx2(data, size);
+    }
+#endif
+#if defined(UPLOADER_SSE2)
+    i += LowerSse2(data + i, size - i);
+#endif
+    for (; i < size; ++i) {
+        char c = data[i];
+        if (c >= 'A' && c <= 'Z') {
+            data[i] = static_cast<char>(c - 'A' + 'a');
+        }
+    }
+}
+
+std::size_t UrlSafePrefixLength(const char* data, std::size_t size) {
+    std::size_t i = 0;
+#if defined(UPLOADER_AVX2)
+    if (HasAvx2()) {
+        i = SafePrefixAvx2(data, size);
+        if (i + 32 <= size) {
+            return i;
+        }
+    }
+#endif
+#if defined(UPLOADER_SSE2)
+    std::size_t sse = SafePrefixSse2(data + i, size - i);
+    i += sse;
+    if (i + 16 <= size) {
+        return i;
+    }
+#endif
+    while (i < size && IsUrlSafe(static_cast<unsigned char>(data[i]))) {
+        ++i;
+    }
+    return i;
+}
+
+void AppendUrlEncoded(std::string* out, std::string_view text) {
+    static const char kHex[] = "0123456789ABCDEF";
+    const char* data = text.data();
+    std::size_t size = text.size();
+    std::size_t pos = 0;
+    while (pos < size) {
+        std::size_t run = UrlSafePrefixLength(data + pos, size - pos);
+        out->append(data + pos, run);
+        pos += run;
+        // Encode the whole unsafe run so multi-byte UTF-8 names don't go back
+        // through the kernel once per byte.
+        while (pos < size && !IsUrlSafe(static_cast<unsigned char>(data[pos]))) {
+            unsigned char c = static_cast<unsigned char>(data[pos++]);
+            char encoded[3] = {'%', kHex[c >> 4], kHex[c & 0xF]};
+            out->append(encoded, 3);
+        }
+    }
+}
+
+const char* ActiveTextKernel() {
+#if defined(UPLOADER_AVX2)
+    if (HasAvx2()) {
+        return "avx2";
+    }
+#endif
+#if defined(UPLOADER_SSE2)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
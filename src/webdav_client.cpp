@@ -1,18 +1,22 @@
 #include "webdav_client.h"
 
 #include <algorithm>
+#include <cctype>
 #include <chrono>
 #include <iomanip>
 #include <optional>
 #include <regex>
 #include <sstream>
+#include <string_view>
 #include <thread>
 #include <vector>
 
 #include <windows.h>
 #include <winhttp.h>
 
+#include "file_reader.h"
 #include "path_utils.h"
+#include "status_board.h"
 
 namespace {
 
@@ -130,58 +134,316 @@ std::optional<std::chrono::system_clock::time_point> ParseHttpDate(const std::st
     return std::chrono::system_clock::from_time_t(t);
 }
 
-bool IsRetryableStatus(long status) {
-    return status == 408 || status == 429 || (status >= 500 && status <= 599);
+// Fills `info` from the properties of one <response> element; false when the
+// element reports 404 for the resource.
+bool ParseItemInfo(const std::string& xml, RemoteItemInfo* info) {
+    if (ContainsNotFoundStatus(xml)) {
+        return false;
+    }
+    if (!info) {
+        return true;
+    }
+    info->exists = true;
+    info->is_dir = ContainsCollection(xml);
+
+    if (auto size_value = ExtractXmlTagValue(xml, "getcontentlength")) {
+        try {
+            info->size = std::stoull(*size_value);
+            info->has_size = true;
+        } catch (...) {
+            info->has_size = false;
+        }
+    }
+
+    if (auto last_modified = ExtractXmlTagValue(xml, "getlastmodified")) {
+        auto parsed = ParseHttpDate(*last_modified);
+        if (parsed.has_value()) {
+            info->last_modified = *parsed;
+            info->has_last_modified = true;
+        }
+    }
+
+    if (auto etag = ExtractXmlTagValue(xml, "getetag")) {
+        info->etag = *etag;
+    }
+    return true;
 }
 
-}  // namespace
+// Splits a multistatus body into its <response> elements, whatever the
+// namespace prefix.
+std::vector<std::string> SplitMultiStatus(const std::string& xml) {
+    std::vector<std::string> blocks;
+    std::size_t start = std::string::npos;
+    std::size_t pos = 0;
+    while ((pos = xml.find('<', pos)) != std::string::npos) {
+        std::size_t end = xml.find('>', pos);
+        if (end == std::string::npos) {
+            break;
+        }
+        std::string_view tag(xml.data() + pos + 1, end - pos - 1);
+        bool closing = !tag.empty() && tag.front() == '/';
+        if (closing) {
+            tag.remove_prefix(1);
+        }
+        tag = tag.substr(0, tag.find_first_of(" \t\r\n/"));
+        std::size_t colon = tag.find(':');
+        if (colon != std::string_view::npos) {
+            tag.remove_prefix(colon + 1);
+        }
+        if (tag.size() == 8 && ToLowerAscii(std::string(tag)) == "response") {
+            if (!closing) {
+                start = end + 1;
+            } else if (start != std::string::npos) {
+                blocks.push_back(xml.substr(start, pos - start));
+                start = std::string::npos;
+            }
+        }
+        pos = end + 1;
+    }
+    return blocks;
+}
 
-WebDavClient::WebDavClient(const BaseUrlParts& base_url, const WebDavCredentials& creds)
-    : base_url_(base_url), creds_(creds) {
-    session_ = WinHttpOpen(L"MailRuUploader/1.0",
-                           WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
-                           WINHTTP_NO_PROXY_NAME,
-                           WINHTTP_NO_PROXY_BYPASS, 0);
-    if (session_) {
-        WinHttpSetTimeouts(session_, 10000, 10000, 30000, 30000);
-        connection_ = WinHttpConnect(session_, base_url_.host.c_str(), base_url_.port, 0);
+int HexValue(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
     }
+    c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+    return (c >= 'a' && c <= 'f') ? c - 'a' + 10 : -1;
 }
 
-WebDavClient::~WebDavClient() {
-    CloseHandles();
+std::string UrlDecode(const std::string& value) {
+    std::string out;
+    out.reserve(value.size());
+    for (std::size_t i = 0; i < value.size(); ++i) {
+        int high = -1;
+        int low = -1;
+        if (value[i] == '%' && i + 2 < value.size() &&
+            (high = HexValue(value[i + 1])) >= 0 && (low = HexValue(value[i + 2])) >= 0) {
+            out.push_back(static_cast<char>(high * 16 + low));
+            i += 2;
+        } else {
+            out.push_back(value[i]);
+        }
+    }
+    return out;
+}
+
+// "https://host/a/b" -> "/a/b"; plain paths are returned as is.
+std::string StripUrlOrigin(const std::string& href) {
+    std::size_t scheme = href.find("://");
+    if (scheme == std::string::npos) {
+        return href;
+    }
+    std::size_t path = href.find('/', scheme + 3);
+    return path == std::string::npos ? std::string("/") : href.substr(path);
+}
+
+std::string TrimTrailingSlashes(std::string path) {
+    while (path.size() > 1 && path.back() == '/') {
+        path.pop_back();
+    }
+    return path;
 }
 
-bool WebDavClient::IsReady() const {
-    return session_ && connection_;
+bool IsRetryableStatus(long status) {
+    return status == 408 || status == 429 || (status >= 500 && status <= 599);
+}
+
+
+std::uint32_t Microseconds(std::chrono::steady_clock::duration elapsed) {
+    auto us = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    return static_cast<std::uint32_t>((std::min)(us, static_cast<decltype(us)>(0xFFFFFFFF)));
 }
 
-void WebDavClient::CloseHandles() {
-    if (connection_) {
-        WinHttpCloseHandle(connection_);
-        connection_ = nullptr;
+class WinHttpTransport : public WebDavTransport {
+public:
+    explicit WinHttpTransport(const BaseUrlParts& base_url) : https_(base_url.https) {
+        session_ = WinHttpOpen(L"MailRuUploader/1.0",
+                               WINHTTP_ACCESS_TYPE_DEFAULT_PROXY,
+                               WINHTTP_NO_PROXY_NAME,
+                               WINHTTP_NO_PROXY_BYPASS, 0);
+        if (session_) {
+            WinHttpSetTimeouts(session_, 10000, 10000, 30000, 30000);
+            connection_ = WinHttpConnect(session_, base_url.host.c_str(), base_url.port, 0);
+        }
+    }
+
+    ~WinHttpTransport() override {
+        if (connection_) {
+            WinHttpCloseHandle(connection_);
+        }
+        if (session_) {
+            WinHttpCloseHandle(session_);
+        }
+    }
+
+    bool IsReady() const override { return session_ && connection_; }
+
+    WebDavResponse Send(const HttpRequest& request, RateLimiter* limiter, WorkerStatus* status,
+                        HttpTimings* timings, std::string* error) override;
+
+private:
+    bool https_;
+    HINTERNET session_ = nullptr;
+    HINTERNET connection_ = nullptr;
+};
+
+WebDavResponse WinHttpTransport::Send(const HttpRequest& request, RateLimiter* limiter,
+                                      WorkerStatus* status, HttpTimings* timings,
+                                      std::string* error) {
+    using Clock = std::chrono::steady_clock;
+    WebDavResponse response;
+    std::wstring method = Utf8ToWide(request.method);
+    std::wstring path = Utf8ToWide(request.path);
+    DWORD flags = https_ ? WINHTTP_FLAG_SECURE : 0;
+    HINTERNET handle = WinHttpOpenRequest(connection_, method.c_str(), path.c_str(), nullptr,
+                                          WINHTTP_NO_REFERER, WINHTTP_DEFAULT_ACCEPT_TYPES, flags);
+    if (!handle) {
+        *error = "WinHttpOpenRequest failed: " + FormatWinError(GetLastError());
+        return response;
+    }
+
+    // The total length is a DWORD; a larger body states its length in a
+    // header of its own.
+    std::uint64_t body_size = request.body ? request.body->Size() : 0;
+    std::string headers = request.headers;
+    DWORD total_length = static_cast<DWORD>(body_size);
+    if (body_size > 0xFFFFFFFFull) {
+        headers += "Content-Length: " + std::to_string(body_size) + "\r\n";
+        total_length = WINHTTP_IGNORE_REQUEST_TOTAL_LENGTH;
+    }
+    if (!headers.empty()) {
+        std::wstring headers_w = Utf8ToWide(headers);
+        WinHttpAddRequestHeaders(handle, headers_w.c_str(), -1,
+                                 WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE);
+    }
+
+    auto start = Clock::now();
+    if (!WinHttpSendRequest(handle, WINHTTP_NO_ADDITIONAL_HEADERS, 0, WINHTTP_NO_REQUEST_DATA, 0,
+                            total_length, 0)) {
+        *error = "WinHttpSendRequest failed: " + FormatWinError(GetLastError());
+        WinHttpCloseHandle(handle);
+        return response;
+    }
+    auto connected = Clock::now();
+
+    if (request.body) {
+        if (status) {
+            status->sent.store(0, std::memory_order_relaxed);
+            status->SetState(WorkerState::Sending);
+        }
+        const std::size_t kBufferSize = 64 * 1024;
+        std::vector<char> buffer(kBufferSize);
+        std::size_t read = 0;
+        while (true) {
+            std::string read_error;
+            if (!request.body->Read(buffer.data(), kBufferSize, &read, &read_error)) {
+                *error = "Failed to read upload data: " + read_error;
+                WinHttpCloseHandle(handle);
+                return response;
+            }
+            if (read == 0) {
+                break;
+            }
+            if (limiter) {
+                limiter->Acquire(read);
+            }
+            DWORD written = 0;
+            if (!WinHttpWriteData(handle, buffer.data(), static_cast<DWORD>(read), &written)) {
+                *error = "WinHttpWriteData failed: " + FormatWinError(GetLastError());
+                WinHttpCloseHandle(handle);
+                return response;
+            }
+            if (status) {
+                status->sent.fetch_add(written, std::memory_order_relaxed);
+            }
+        }
+        if (status) {
+            status->SetState(WorkerState::Waiting);
+        }
+    }
+    auto sent = Clock::now();
+
+    if (!WinHttpReceiveResponse(handle, nullptr)) {
+        *error = "WinHttpReceiveResponse failed: " + FormatWinError(GetLastError());
+        WinHttpCloseHandle(handle);
+        return response;
     }
-    if (session_) {
-        WinHttpCloseHandle(session_);
-        session_ = nullptr;
+    auto answered = Clock::now();
+
+    DWORD status_code = 0;
+    DWORD status_size = sizeof(status_code);
+    WinHttpQueryHeaders(handle, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+                        WINHTTP_HEADER_NAME_BY_INDEX, &status_code, &status_size,
+                        WINHTTP_NO_HEADER_INDEX);
+    response.status = static_cast<long>(status_code);
+
+    DWORD data_size = 0;
+    do {
+        data_size = 0;
+        if (!WinHttpQueryDataAvailable(handle, &data_size) || data_size == 0) {
+            break;
+        }
+        std::vector<char> buffer(data_size);
+        DWORD read = 0;
+        if (!WinHttpReadData(handle, buffer.data(), data_size, &read)) {
+            break;
+        }
+        response.body.append(buffer.data(), buffer.data() + read);
+    } while (data_size > 0);
+    WinHttpCloseHandle(handle);
+
+    if (timings) {
+        timings->connect_us = Microseconds(connected - start);
+        timings->transfer_us = Microseconds((sent - connected) + (Clock::now() - answered));
+        timings->ttfb_us = Microseconds(answered - sent);
     }
+    return response;
+}
+
+}  // namespace
+
+std::unique_ptr<WebDavTransport> MakeWinHttpTransport(const BaseUrlParts& base_url) {
+    return std::make_unique<WinHttpTransport>(base_url);
 }
 
+WebDavClient::WebDavClient(const BaseUrlParts& base_url, const WebDavCredentials& creds)
+    : WebDavClient(base_url, creds, MakeWinHttpTransport(base_url)) {}
+
+WebDavClient::WebDavClient(const BaseUrlParts& base_url, const WebDavCredentials& creds,
+                           std::unique_ptr<WebDavTransport> transport)
+    : base_url_(base_url), creds_(creds), transport_(std::move(transport)) {}
+
 WebDavResponse WebDavClient::PropFind(const std::string& remote_path, std::string* error) {
+    return PropFind(RemotePath{remote_path, UrlEncodePath(remote_path)}, error);
+}
+
+WebDavResponse WebDavClient::PropFind(const RemotePath& remote_path, std::string* error) {
+    return SendPropFind(remote_path, "0", error);
+}
+
+WebDavResponse WebDavClient::SendPropFind(const RemotePath& remote_path,
+                                          const char* depth,
+                                          std::string* error) {
     const std::string body =
         "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
         "<d:propfind xmlns:d=\"DAV:\">"
         "<d:prop><d:getlastmodified/><d:getcontentlength/><d:getetag/><d:resourcetype/></d:prop>"
         "</d:propfind>";
 
-    const std::string headers = "Depth: 0\r\nContent-Type: text/xml\r\n";
-    std::wstring path = BuildRequestPath(remote_path);
-    return SendRequest(L"PROPFIND", path, body, headers, error);
+    const std::string headers =
+        std::string("Depth: ") + depth + "\r\nContent-Type: text/xml\r\n";
+    std::string path = BuildRequestPath(remote_path);
+    return SendRequest("PROPFIND", path, body, headers, error);
 }
 
 bool WebDavClient::MkCol(const std::string& remote_path, bool* created, std::string* error) {
-    std::wstring path = BuildRequestPath(remote_path);
-    WebDavResponse resp = SendRequest(L"MKCOL", path, "", "", error);
+    return MkCol(RemotePath{remote_path, UrlEncodePath(remote_path)}, created, error);
+}
+
+bool WebDavClient::MkCol(const RemotePath& remote_path, bool* created, std::string* error) {
+    std::string path = BuildRequestPath(remote_path);
+    WebDavResponse resp = SendRequest("MKCOL", path, "", "", error);
     if (created) {
         *created = (resp.status == 201);
     }
@@ -197,11 +459,70 @@ bool WebDavClient::MkCol(const std::string& remote_path, bool* created, std::str
 bool WebDavClient::PutFile(const std::string& remote_path,
                            const std::filesystem::path& local_path,
                            std::string* error) {
-    std::wstring path = BuildRequestPath(remote_path);
-    return SendFile(L"PUT", path, local_path, "", error);
+    return PutFile(RemotePath{remote_path, UrlEncodePath(remote_path)}, local_path, error);
+}
+
+bool WebDavClient::PutFile(const RemotePath& remote_path,
+                           const std::filesystem::path& local_path,
+                           std::string* error) {
+    // Open once and size the upload from the handle, so retries neither
+    // re-resolve the path nor stat it again.
+    FileReader body{ReadOptions{}};
+    std::string open_error;
+    if (!body.Open(local_path, &open_error)) {
+        if (error) {
+            *error = open_error;
+        }
+        return false;
+    }
+    std::string path = BuildRequestPath(remote_path);
+    return SendBody("PUT", path, &body, "", error);
+}
+
+bool WebDavClient::PutBody(const RemotePath& remote_path, UploadBody* body, std::string* error) {
+    std::string path = BuildRequestPath(remote_path);
+    return SendBody("PUT", path, body, "", error);
+}
+
+bool WebDavClient::PutRange(const RemotePath& remote_path, UploadBody* body,
+                            std::uint64_t offset, std::uint64_t total, std::string* error) {
+    std::string path = BuildRequestPath(remote_path);
+    std::string headers = "Content-Range: bytes " + std::to_string(offset) + "-" +
+                          std::to_string(offset + body->Size() - 1) + "/" +
+                          std::to_string(total) + "\r\n";
+    return SendBody("PUT", path, body, headers, error);
+}
+
+bool WebDavClient::Copy(const RemotePath& from, const RemotePath& to, bool overwrite,
+                        std::string* error) {
+    return Transfer("COPY", from, to, overwrite, error);
+}
+
+bool WebDavClient::Move(const RemotePath& from, const RemotePath& to, bool overwrite,
+                        std::string* error) {
+    return Transfer("MOVE", from, to, overwrite, error);
+}
+
+bool WebDavClient::Transfer(const char* method, const RemotePath& from, const RemotePath& to,
+                            bool overwrite, std::string* error) {
+    std::string path = BuildRequestPath(from);
+    std::string headers = "Destination: " + BuildUrl(to) + "\r\nOverwrite: " +
+                          (overwrite ? "T" : "F") + "\r\n";
+    WebDavResponse resp = SendRequest(method, path, "", headers, error);
+    if (resp.status == 201 || resp.status == 204) {
+        return true;
+    }
+    if (error && error->empty()) {
+        *error = std::string(method) + " failed with status " + std::to_string(resp.status);
+    }
+    return false;
 }
 
 RemoteItemInfo WebDavClient::GetInfo(const std::string& remote_path, std::string* error) {
+    return GetInfo(RemotePath{remote_path, UrlEncodePath(remote_path)}, error);
+}
+
+RemoteItemInfo WebDavClient::GetInfo(const RemotePath& remote_path, std::string* error) {
     RemoteItemInfo info;
     WebDavResponse resp = PropFind(remote_path, error);
     if (resp.status == 404) {
@@ -215,36 +536,59 @@ RemoteItemInfo WebDavClient::GetInfo(const std::string& remote_path, std::string
         return info;
     }
 
-    if (ContainsNotFoundStatus(resp.body)) {
-        info.exists = false;
-        return info;
-    }
-
-    info.exists = true;
-    info.is_dir = ContainsCollection(resp.body);
+    ParseItemInfo(resp.body, &info);
+    return info;
+}
 
-    if (auto size_value = ExtractXmlTagValue(resp.body, "getcontentlength")) {
-        try {
-            info.size = std::stoull(*size_value);
-            info.has_size = true;
-        } catch (...) {
-            info.has_size = false;
+bool WebDavClient::ListDirectory(const RemotePath& remote_path,
+                                 bool* exists,
+                                 std::vector<RemoteDirectoryEntry>* entries,
+                                 std::string* error) {
+    *exists = false;
+    entries->clear();
+    std::string send_error;
+    WebDavResponse resp = SendPropFind(remote_path, "1", &send_error);
+    if (!send_error.empty()) {
+        if (error) {
+            *error = send_error;
         }
+        return false;
     }
-
-    if (auto last_modified = ExtractXmlTagValue(resp.body, "getlastmodified")) {
-        auto parsed = ParseHttpDate(*last_modified);
-        if (parsed.has_value()) {
-            info.last_modified = *parsed;
-            info.has_last_modified = true;
+    if (resp.status == 404) {
+        return true;
+    }
+    if (resp.status != 207) {
+        if (error) {
+            *error = "PROPFIND failed with status " + std::to_string(resp.status);
         }
+        return false;
     }
 
-    if (auto etag = ExtractXmlTagValue(resp.body, "getetag")) {
-        info.etag = *etag;
+    std::string self = TrimTrailingSlashes(UrlDecode(BuildRequestPath(remote_path)));
+    bool self_seen = false;
+    for (const std::string& block : SplitMultiStatus(resp.body)) {
+        auto href = ExtractXmlTagValue(block, "href");
+        if (!href) {
+            continue;
+        }
+        std::string path = TrimTrailingSlashes(UrlDecode(StripUrlOrigin(*href)));
+        if (!self_seen && path == self) {
+            self_seen = true;
+            *exists = ParseItemInfo(block, nullptr);
+            continue;
+        }
+        RemoteDirectoryEntry entry;
+        entry.name = path.substr(path.rfind('/') + 1);
+        if (entry.name.empty() || !ParseItemInfo(block, &entry.info)) {
+            continue;
+        }
+        entries->push_back(std::move(entry));
     }
-
-    return info;
+    if (!self_seen) {
+        // A 207 is only sent for an existing collection.
+        *exists = true;
+    }
+    return true;
 }
 
 std::optional<BaseUrlParts> WebDavClient::ParseBaseUrl(const std::string& url,
@@ -288,107 +632,38 @@ std::optional<BaseUrlParts> WebDavClient::ParseBaseUrl(const std::string& url,
     return out;
 }
 
-WebDavResponse WebDavClient::SendRequest(const std::wstring& method,
-                                         const std::wstring& request_path,
+WebDavResponse WebDavClient::SendRequest(const char* method,
+                                         const std::string& request_path,
                                          const std::string& body,
                                          const std::string& extra_headers,
                                          std::string* error) {
+    MemoryBody request_body(body);
+    HttpRequest request{method, request_path, BuildAuthHeader() + extra_headers,
+                        body.empty() ? nullptr : &request_body};
     const int kMaxRetries = 3;
     for (int attempt = 0; attempt < kMaxRetries; ++attempt) {
         if (attempt > 0) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(300 * attempt));
+            BackOff(attempt);
+            request_body.Rewind(nullptr);
         }
-        WebDavResponse response;
+        SetState(WorkerState::Waiting);
         if (!IsReady()) {
             if (error) {
                 *error = "WinHTTP session not ready";
             }
-            return response;
+            return {};
         }
-
-        DWORD flags = base_url_.https ? WINHTTP_FLAG_SECURE : 0;
-        HINTERNET request = WinHttpOpenRequest(connection_, method.c_str(),
-                                               request_path.c_str(), nullptr,
-                                               WINHTTP_NO_REFERER,
-                                               WINHTTP_DEFAULT_ACCEPT_TYPES, flags);
-        if (!request) {
-            if (error) {
-                *error = "WinHttpOpenRequest failed: " + FormatWinError(GetLastError());
-            }
-            return response;
-        }
-
-        std::wstring auth_header = Utf8ToWide(BuildAuthHeader());
-        if (!auth_header.empty()) {
-            WinHttpAddRequestHeaders(request, auth_header.c_str(), -1,
-                                     WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE);
-        }
-        if (!extra_headers.empty()) {
-            std::wstring headers_w = Utf8ToWide(extra_headers);
-            WinHttpAddRequestHeaders(request, headers_w.c_str(), -1,
-                                     WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE);
-        }
-
-        BOOL ok = WinHttpSendRequest(request,
-                                     WINHTTP_NO_ADDITIONAL_HEADERS,
-                                     0,
-                                     body.empty() ? WINHTTP_NO_REQUEST_DATA
-                                                  : const_cast<char*>(body.data()),
-                                     static_cast<DWORD>(body.size()),
-                                     static_cast<DWORD>(body.size()),
-                                     0);
-        if (!ok) {
-            if (error) {
-                *error = "WinHttpSendRequest failed: " + FormatWinError(GetLastError());
-            }
-            WinHttpCloseHandle(request);
-            response.status = 0;
-        } else {
-            ok = WinHttpReceiveResponse(request, nullptr);
-            if (!ok) {
-                if (error) {
-                    *error = "WinHttpReceiveResponse failed: " + FormatWinError(GetLastError());
-                }
-                WinHttpCloseHandle(request);
-                response.status = 0;
-            } else {
-                DWORD status_code = 0;
-                DWORD status_size = sizeof(status_code);
-                WinHttpQueryHeaders(request,
-                                    WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
-                                    WINHTTP_HEADER_NAME_BY_INDEX, &status_code, &status_size,
-                                    WINHTTP_NO_HEADER_INDEX);
-                response.status = static_cast<long>(status_code);
-
-                std::string body_out;
-                DWORD data_size = 0;
-                do {
-                    data_size = 0;
-                    if (!WinHttpQueryDataAvailable(request, &data_size)) {
-                        break;
-                    }
-                    if (data_size == 0) {
-                        break;
-                    }
-                    std::vector<char> buffer(data_size);
-                    DWORD read = 0;
-                    if (!WinHttpReadData(request, buffer.data(), data_size, &read)) {
-                        break;
-                    }
-                    body_out.append(buffer.data(), buffer.data() + read);
-                } while (data_size > 0);
-
-                response.body = std::move(body_out);
-                WinHttpCloseHandle(request);
-            }
-        }
-
+        std::string send_error;
+        WebDavResponse response = transport_->Send(request, nullptr, nullptr, nullptr, &send_error);
         if (!IsRetryableStatus(response.status) && response.status != 0) {
             if (error) {
                 error->clear();
             }
             return response;
         }
+        if (error) {
+            *error = send_error;
+        }
         if (attempt == kMaxRetries - 1) {
             return response;
         }
@@ -397,145 +672,88 @@ WebDavResponse WebDavClient::SendRequest(const std::wstring& method,
     return {};
 }
 
-bool WebDavClient::SendFile(const std::wstring& method,
-                            const std::wstring& request_path,
-                            const std::filesystem::path& local_path,
+void WebDavClient::SetState(WorkerState state) {
+    if (status_) {
+        status_->SetState(state);
+    }
+}
+
+void WebDavClient::BackOff(int attempt) {
+    if (status_) {
+        status_->retries.fetch_add(1, std::memory_order_relaxed);
+    }
+    SetState(WorkerState::RetryWait);
+    std::this_thread::sleep_for(std::chrono::milliseconds(300 * attempt));
+}
+
+bool WebDavClient::SendBody(const char* method,
+                            const std::string& request_path,
+                            UploadBody* body,
                             const std::string& extra_headers,
                             std::string* error) {
+    HttpRequest request{method, request_path, BuildAuthHeader() + extra_headers, body};
     const int kMaxRetries = 3;
     for (int attempt = 0; attempt < kMaxRetries; ++attempt) {
         if (attempt > 0) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(300 * attempt));
-        }
-
-        if (!IsReady()) {
-            if (error) {
-                *error = "WinHTTP session not ready";
-            }
-            return false;
-        }
-
-        std::error_code ec;
-        auto file_size = std::filesystem::file_size(local_path, ec);
-        if (ec) {
-            if (error) {
-                *error = "Failed to get file size: " + ec.message();
-            }
-            return false;
-        }
-
-        DWORD flags = base_url_.https ? WINHTTP_FLAG_SECURE : 0;
-        HINTERNET request = WinHttpOpenRequest(connection_, method.c_str(),
-                                               request_path.c_str(), nullptr,
-                                               WINHTTP_NO_REFERER,
-                                               WINHTTP_DEFAULT_ACCEPT_TYPES, flags);
-        if (!request) {
-            if (error) {
-                *error = "WinHttpOpenRequest failed: " + FormatWinError(GetLastError());
-            }
-            return false;
-        }
-
-        std::wstring auth_header = Utf8ToWide(BuildAuthHeader());
-        if (!auth_header.empty()) {
-            WinHttpAddRequestHeaders(request, auth_header.c_str(), -1,
-                                     WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE);
-        }
-        if (!extra_headers.empty()) {
-            std::wstring headers_w = Utf8ToWide(extra_headers);
-            WinHttpAddRequestHeaders(request, headers_w.c_str(), -1,
-                                     WINHTTP_ADDREQ_FLAG_ADD | WINHTTP_ADDREQ_FLAG_REPLACE);
-        }
-
-        BOOL ok = WinHttpSendRequest(request,
-                                     WINHTTP_NO_ADDITIONAL_HEADERS, 0,
-                                     WINHTTP_NO_REQUEST_DATA, 0,
-                                     static_cast<DWORD>(file_size), 0);
-        if (!ok) {
-            if (error) {
-                *error = "WinHttpSendRequest failed: " + FormatWinError(GetLastError());
-            }
-            WinHttpCloseHandle(request);
-            continue;
-        }
-
-        HANDLE file = CreateFileW(local_path.wstring().c_str(), GENERIC_READ,
-                                  FILE_SHARE_READ, nullptr, OPEN_EXISTING,
-                                  FILE_ATTRIBUTE_NORMAL, nullptr);
-        if (file == INVALID_HANDLE_VALUE) {
-            if (error) {
-                *error = "Failed to open file for upload";
-            }
-            WinHttpCloseHandle(request);
-            return false;
-        }
-
-        const DWORD kBufferSize = 64 * 1024;
-        std::vector<char> buffer(kBufferSize);
-        DWORD read = 0;
-        bool success = true;
-        while (ReadFile(file, buffer.data(), kBufferSize, &read, nullptr) && read > 0) {
-            DWORD written = 0;
-            if (!WinHttpWriteData(request, buffer.data(), read, &written)) {
-                success = false;
+            BackOff(attempt);
+            std::string rewind_error;
+            if (!body->Rewind(&rewind_error)) {
                 if (error) {
-                    *error = "WinHttpWriteData failed: " + FormatWinError(GetLastError());
+                    *error = "Failed to rewind upload for retry: " + rewind_error;
                 }
                 break;
             }
         }
 
-        CloseHandle(file);
-
-        if (!success) {
-            WinHttpCloseHandle(request);
-            continue;
-        }
-
-        ok = WinHttpReceiveResponse(request, nullptr);
-        if (!ok) {
+        if (!IsReady()) {
             if (error) {
-                *error = "WinHttpReceiveResponse failed: " + FormatWinError(GetLastError());
+                *error = "WinHTTP session not ready";
             }
-            WinHttpCloseHandle(request);
-            continue;
+            break;
         }
 
-        DWORD status_code = 0;
-        DWORD status_size = sizeof(status_code);
-        WinHttpQueryHeaders(request,
-                            WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
-                            WINHTTP_HEADER_NAME_BY_INDEX, &status_code, &status_size,
-                            WINHTTP_NO_HEADER_INDEX);
-        WinHttpCloseHandle(request);
-
-        if (status_code >= 200 && status_code < 300) {
+        std::string send_error;
+        WebDavResponse response = transport_->Send(request, limiter_, status_, nullptr, &send_error);
+        if (response.status >= 200 && response.status < 300) {
             if (error) {
                 error->clear();
             }
             return true;
         }
-        if (!IsRetryableStatus(status_code) || attempt == kMaxRetries - 1) {
+        if (response.status == 0) {
             if (error) {
-                *error = "PUT failed with status " + std::to_string(status_code);
+                *error = send_error;
             }
-            return false;
+            continue;
+        }
+        if (!IsRetryableStatus(response.status) || attempt == kMaxRetries - 1) {
+            if (error) {
+                *error = "PUT failed with status " + std::to_string(response.status);
+            }
+            break;
         }
     }
-
     return false;
 }
 
-std::wstring WebDavClient::BuildRequestPath(const std::string& remote_path) const {
-    std::string encoded = UrlEncodePath(remote_path);
+std::string WebDavClient::BuildRequestPath(const RemotePath& remote_path) const {
+    std::string encoded = remote_path.encoded;
     std::string base = base_url_.base_path.empty() ? "/" : base_url_.base_path;
     if (base.back() == '/' && !encoded.empty() && encoded.front() == '/') {
         encoded.erase(encoded.begin());
     } else if (base.back() != '/' && (encoded.empty() || encoded.front() != '/')) {
         base.push_back('/');
     }
-    std::string full = base + encoded;
-    return Utf8ToWide(full);
+    return base + encoded;
+}
+
+std::string WebDavClient::BuildUrl(const RemotePath& remote_path) const {
+    std::string url = base_url_.https ? "https://" : "http://";
+    url += WideToUtf8(base_url_.host);
+    if (base_url_.port != (base_url_.https ? 443 : 80)) {
+        url += ":" + std::to_string(base_url_.port);
+    }
+    return url + BuildRequestPath(remote_path);
 }
 
 std::string WebDavClient::BuildAuthHeader() const {
@@ -546,3 +764,43 @@ std::string WebDavClient::BuildAuthHeader() const {
     std::string encoded = Base64Encode(token);
     return "Authorization: Basic " + encoded + "\r\n";
 }
+
+void WebDavClientReturn::operator()(WebDavClient* client) const {
+    pool->Release(client);
+}
+
+WebDavClientPool::WebDavClientPool(const BaseUrlParts& base_url, const WebDavCredentials& creds,
+                                   RateLimiter* limiter, TransportFactory transports)
+    : base_url_(base_url), creds_(creds), limiter_(limiter), transports_(std::move(transports)) {}
+
+PooledClient WebDavClientPool::Acquire() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!idle_.empty()) {
+            PooledClient client(idle_.back().release(), WebDavClientReturn{this});
+            idle_.pop_back();
+            return client;
+        }
+    }
+    auto client = transports_ ? std::make_unique<WebDavClient>(base_url_, creds_, transports_())
+                              : std::make_unique<WebDavClient>(base_url_, creds_);
+    if (!client->IsReady()) {
+        return PooledClient(nullptr, WebDavClientReturn{this});
+    }
+    client->SetRateLimiter(limiter_);
+    std::lock_guard<std::mutex> lock(mutex_);
+    created_++;
+    return PooledClient(client.release(), WebDavClientReturn{this});
+}
+
+std::size_t WebDavClientPool::Created() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return created_;
+}
+
+void WebDavClientPool::Release(WebDavClient* client) {
+    // The status it reported to belongs to the borrower.
+    client->SetStatus(nullptr);
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_.emplace_back(client);
+}
@@ -1,6 +1,8 @@
 import base64
 import http.server
 import os
+import re
+import shutil
 import threading
 import time
 import urllib.parse
@@ -16,7 +18,7 @@ def _safe_join(root, path):
     return full
 
 
-def _build_propfind_response(path, is_dir):
+def _build_propfind_entry(href, path, is_dir):
     stat = os.stat(path)
     size = 0 if is_dir else stat.st_size
     last_modified = formatdate(stat.st_mtime, usegmt=True)
@@ -25,11 +27,9 @@ def _build_propfind_response(path, is_dir):
         resource_type = "<d:resourcetype><d:collection/></d:resourcetype>"
     else:
         resource_type = "<d:resourcetype/>"
-    xml = (
-        "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
-        "<d:multistatus xmlns:d=\"DAV:\">"
+    return (
         "<d:response>"
-        f"<d:href>{urllib.parse.quote(path)}</d:href>"
+        f"<d:href>{urllib.parse.quote(href)}</d:href>"
         "<d:propstat>"
         "<d:prop>"
         f"<d:getcontentlength>{size}</d:getcontentlength>"
@@ -40,12 +40,26 @@ def _build_propfind_response(path, is_dir):
         "<d:status>HTTP/1.1 200 OK</d:status>"
         "</d:propstat>"
         "</d:response>"
-        "</d:multistatus>"
+    )
+
+
+def _build_propfind_response(href, path, is_dir, depth):
+    entries = [_build_propfind_entry(href, path, is_dir)]
+    if is_dir and depth == "1":
+        base = href.rstrip("/")
+        for name in sorted(os.listdir(path)):
+            child = os.path.join(path, name)
+            entries.append(_build_propfind_entry(f"{base}/{name}", child, os.path.isdir(child)))
+    xml = (
+        "<?xml version=\"1.0\" encoding=\"utf-8\"?>"
+        "<d:multistatus xmlns:d=\"DAV:\">"
+        + "".join(entries)
+        + "</d:multistatus>"
     )
     return xml.encode("utf-8")
 
 
-def make_handler(root, username, password, stats):
+def make_handler(root, username, password, stats, ranges=True, refused_offsets=()):
     auth_token = base64.b64encode(f"{username}:{password}".encode("utf-8")).decode("ascii")
 
     class WebDavHandler(http.server.BaseHTTPRequestHandler):
@@ -67,6 +81,9 @@ def make_handler(root, username, password, stats):
 
         def do_PROPFIND(self):
             stats["propfind_calls"] += 1
+            depth = self.headers.get("Depth", "0")
+            if depth == "1":
+                stats["propfind_depth1_calls"] += 1
             if not self._check_auth():
                 self._send_unauthorized()
                 return
@@ -84,7 +101,8 @@ def make_handler(root, username, password, stats):
                 return
 
             is_dir = os.path.isdir(fs_path)
-            body = _build_propfind_response(fs_path, is_dir)
+            href = urllib.parse.unquote(self.path)
+            body = _build_propfind_response(href, fs_path, is_dir, depth)
             self.send_response(207)
             self.send_header("Content-Type", "application/xml; charset=utf-8")
             self.send_header("Content-Length", str(len(body)))
@@ -140,11 +158,79 @@ def make_handler(root, username, password, stats):
 
             length = int(self.headers.get("Content-Length", "0"))
             data = self.rfile.read(length)
+            content_range = self.headers.get("Content-Range")
+            if content_range is not None:
+                # "bytes first-last/total" written into an existing file, as
+                # Apache mod_dav does; servers without it refuse the header.
+                stats["range_put_calls"] += 1
+                match = re.fullmatch(r"bytes (\d+)-(\d+)/(\d+|\*)", content_range.strip())
+                if (not ranges or not match or not os.path.isfile(fs_path) or
+                        int(match.group(2)) - int(match.group(1)) + 1 != len(data) or
+                        int(match.group(1)) in refused_offsets):
+                    self.send_response(400)
+                    self.end_headers()
+                    return
+                fd = os.open(fs_path, os.O_WRONLY | getattr(os, "O_BINARY", 0))
+                try:
+                    os.lseek(fd, int(match.group(1)), os.SEEK_SET)
+                    os.write(fd, data)
+                finally:
+                    os.close(fd)
+                self.send_response(204)
+                self.end_headers()
+                return
             with open(fs_path, "wb") as f:
                 f.write(data)
             self.send_response(201)
             self.end_headers()
 
+        def do_COPY(self):
+            stats["copy_calls"] += 1
+            self._transfer(move=False)
+
+        def do_MOVE(self):
+            stats["move_calls"] += 1
+            self._transfer(move=True)
+
+        def _transfer(self, move):
+            if not self._check_auth():
+                self._send_unauthorized()
+                return
+
+            destination = urllib.parse.urlparse(self.headers.get("Destination", "")).path
+            try:
+                fs_path = _safe_join(root, self.path)
+                dest_path = _safe_join(root, destination)
+            except ValueError:
+                self.send_response(400)
+                self.end_headers()
+                return
+
+            if not destination or not os.path.exists(fs_path):
+                self.send_response(404 if destination else 400)
+                self.end_headers()
+                return
+            if not os.path.isdir(os.path.dirname(dest_path)):
+                self.send_response(409)
+                self.end_headers()
+                return
+            existed = os.path.exists(dest_path)
+            if existed and self.headers.get("Overwrite", "T") == "F":
+                self.send_response(412)
+                self.end_headers()
+                return
+
+            if existed and os.path.isdir(dest_path):
+                shutil.rmtree(dest_path)
+            if move:
+                os.replace(fs_path, dest_path)
+            elif os.path.isdir(fs_path):
+                shutil.copytree(fs_path, dest_path)
+            else:
+                shutil.copyfile(fs_path, dest_path)
+            self.send_response(204 if existed else 201)
+            self.end_headers()
+
         def do_DELETE(self):
             stats["delete_calls"] += 1
             self.send_response(405)
@@ -154,23 +240,33 @@ def make_handler(root, username, password, stats):
 
 
 class WebDavTestServer:
-    def __init__(self, root, host="127.0.0.1", port=0, username="user", password="pass"):
+    def __init__(self, root, host="127.0.0.1", port=0, username="user", password="pass",
+                 ranges=True):
         self.root = os.path.abspath(root)
         self.host = host
         self.port = port
         self.username = username
         self.password = password
+        self.ranges = ranges
+        # Start offsets of Content-Range PUTs to refuse, e.g. to interrupt
+        # a chunked upload.
+        self.refused_offsets = set()
         self.stats = {
             "propfind_calls": 0,
+            "propfind_depth1_calls": 0,
             "mkcol_calls": 0,
             "put_calls": 0,
+            "range_put_calls": 0,
+            "copy_calls": 0,
+            "move_calls": 0,
             "delete_calls": 0,
         }
         self._server = None
         self._thread = None
 
     def start(self):
-        handler = make_handler(self.root, self.username, self.password, self.stats)
+        handler = make_handler(self.root, self.username, self.password, self.stats,
+                               self.ranges, self.refused_offsets)
         self._server = http.server.ThreadingHTTPServer((self.host, self.port), handler)
         self.port = self._server.server_address[1]
         self._thread = threading.Thread(target=self._server.serve_forever, daemon=True)
@@ -1,6 +1,10 @@
 import argparse
+import gzip
+import json
 import os
+import shutil
 import subprocess
+import tarfile
 import tempfile
 import time
 
@@ -61,6 +65,992 @@ def main():
         finally:
             server.stop()
 
+    check_plan_and_apply(args.uploader)
+    check_bundles(args.uploader)
+    check_compression(args.uploader)
+    check_dedup(args.uploader)
+    check_renames(args.uploader)
+    check_jobs(args.uploader)
+    check_shards(args.uploader)
+    check_space_pressure(args.uploader)
+    check_read_modes(args.uploader)
+    check_status_file(args.uploader)
+    check_rules(args.uploader)
+    check_chunked_uploads(args.uploader)
+    check_trace_replay(args.uploader)
+    check_connection_warmup(args.uploader)
+    check_append_uploads(args.uploader)
+    check_probe_threads(args.uploader)
+
+
+def check_plan_and_apply(uploader):
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        write_file(os.path.join(local_dir, "a", "one.txt"), b"one")
+        write_file(os.path.join(local_dir, "a", "b", "two.txt"), b"two")
+        write_file(os.path.join(local_dir, "big.bin"), b"x" * 4096)
+        write_file(os.path.join(local_dir, "changed.txt"), b"before")
+        plan_path = os.path.join(work_dir, "sync.plan")
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            base_cmd = [
+                uploader,
+                "--email",
+                "user",
+                "--app-password",
+                "pass",
+                "--base-url",
+                f"http://127.0.0.1:{server.port}",
+                "--probe-threads",
+                "2",
+            ]
+            plan_cmd = base_cmd + ["--source", local_dir, "--remote", "/RemoteRoot",
+                                   "--plan-out", plan_path]
+            result = subprocess.run(plan_cmd, capture_output=True, text=True)
+            if result.returncode != 0:
+                raise RuntimeError(f"Planning failed: {result.stderr}\n{result.stdout}")
+            assert os.path.isfile(plan_path)
+            assert server.stats["put_calls"] == 0
+            assert server.stats["mkcol_calls"] == 0
+            # One listing per directory and a warm-up request per connection,
+            # none per file.
+            assert server.stats["propfind_calls"] == server.stats["propfind_depth1_calls"] + 2
+            assert server.stats["propfind_depth1_calls"] <= 3
+
+            write_file(os.path.join(local_dir, "changed.txt"), b"after the plan")
+
+            apply_cmd = base_cmd + ["--apply", plan_path]
+            result = subprocess.run(apply_cmd, capture_output=True, text=True)
+            if result.returncode != 0:
+                raise RuntimeError(f"Apply failed: {result.stderr}\n{result.stdout}")
+
+            remote_root = os.path.join(remote_dir, "RemoteRoot")
+            assert os.path.isfile(os.path.join(remote_root, "a", "one.txt"))
+            assert os.path.isfile(os.path.join(remote_root, "a", "b", "two.txt"))
+            assert os.path.isfile(os.path.join(remote_root, "big.bin"))
+            assert not os.path.exists(os.path.join(remote_root, "changed.txt"))
+            assert server.stats["put_calls"] == 3
+        finally:
+            server.stop()
+
+
+def check_bundles(uploader):
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        for i in range(5):
+            write_file(os.path.join(local_dir, "thumbs", "x", f"{i}.txt"), f"thumb {i}".encode())
+        write_file(os.path.join(local_dir, "thumbs", "big.bin"), b"b" * 4096)
+        write_file(os.path.join(local_dir, "other.txt"), b"other")
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            cmd = [
+                uploader,
+                "--source",
+                local_dir,
+                "--remote",
+                "/RemoteRoot",
+                "--email",
+                "user",
+                "--app-password",
+                "pass",
+                "--base-url",
+                f"http://127.0.0.1:{server.port}",
+                "--bundle",
+                "thumbs",
+                "--bundle-max-file",
+                "1",
+                "--state-dir",
+                os.path.join(work_dir, "state"),
+            ]
+
+            def run():
+                result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+                if result.returncode != 0:
+                    raise RuntimeError(f"Bundled run failed: {result.stderr}\n{result.stdout}")
+
+            run()
+            remote_root = os.path.join(remote_dir, "RemoteRoot")
+            bundle_dir = os.path.join(remote_root, "thumbs", ".uploader-bundles")
+            tars = sorted(n for n in os.listdir(bundle_dir) if n.endswith(".tar"))
+            assert len(tars) == 1
+            assert os.path.isfile(os.path.join(bundle_dir, tars[0] + ".idx"))
+            with tarfile.open(os.path.join(bundle_dir, tars[0])) as tar:
+                assert sorted(tar.getnames()) == [f"x/{i}.txt" for i in range(5)]
+                assert tar.extractfile("x/3.txt").read() == b"thumb 3"
+            # Large files and files outside the bundle root go one by one.
+            assert os.path.isfile(os.path.join(remote_root, "thumbs", "big.bin"))
+            assert os.path.isfile(os.path.join(remote_root, "other.txt"))
+            assert not os.path.exists(os.path.join(remote_root, "thumbs", "x"))
+            assert server.stats["put_calls"] == 4
+
+            # The manifest makes the next run a no-op.
+            run()
+            assert server.stats["put_calls"] == 4
+
+            write_file(os.path.join(local_dir, "thumbs", "x", "1.txt"), b"thumb 1, edited")
+            run()
+            tars = sorted(n for n in os.listdir(bundle_dir) if n.endswith(".tar"))
+            assert len(tars) == 2
+            with tarfile.open(os.path.join(bundle_dir, tars[-1])) as tar:
+                assert tar.getnames() == ["x/1.txt"]
+            assert server.stats["put_calls"] == 6
+        finally:
+            server.stop()
+
+
+def check_compression(uploader):
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        log_data = "".join(f"{i} request served in {i % 17} ms\n" for i in range(2000)).encode()
+        write_file(os.path.join(local_dir, "app.log"), log_data)
+        write_file(os.path.join(local_dir, "packed.log"), os.urandom(8192))
+        write_file(os.path.join(local_dir, "readme.txt"), b"plain " * 200)
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            cmd = [
+                uploader,
+                "--source",
+                local_dir,
+                "--remote",
+                "/RemoteRoot",
+                "--email",
+                "user",
+                "--app-password",
+                "pass",
+                "--base-url",
+                f"http://127.0.0.1:{server.port}",
+                "--compress",
+                "*.log",
+                "--state-dir",
+                os.path.join(work_dir, "state"),
+            ]
+
+            def run():
+                result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+                if result.returncode != 0:
+                    raise RuntimeError(f"Compressed run failed: {result.stderr}\n{result.stdout}")
+
+            run()
+            remote_root = os.path.join(remote_dir, "RemoteRoot")
+            with gzip.open(os.path.join(remote_root, "app.log.gz")) as f:
+                assert f.read() == log_data
+            assert not os.path.exists(os.path.join(remote_root, "app.log"))
+            # Incompressible data and non-matching files are stored as they are.
+            assert os.path.isfile(os.path.join(remote_root, "packed.log"))
+            assert os.path.isfile(os.path.join(remote_root, "readme.txt"))
+            assert server.stats["put_calls"] == 3
+
+            # Compared against the compressed object, nothing is sent again.
+            run()
+            assert server.stats["put_calls"] == 3
+
+            # Without the state the compressed size is computed again.
+            shutil.rmtree(os.path.join(work_dir, "state"))
+            run()
+            assert server.stats["put_calls"] == 3
+        finally:
+            server.stop()
+
+
+def check_dedup(uploader):
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        attachment = os.urandom(100 * 1024)
+        for folder in ("a", "b", "c"):
+            write_file(os.path.join(local_dir, folder, "attachment.pdf"), attachment)
+        os.link(os.path.join(local_dir, "a", "attachment.pdf"), os.path.join(local_dir, "linked.pdf"))
+        # Same size, different content.
+        write_file(os.path.join(local_dir, "other.pdf"), os.urandom(100 * 1024))
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            cmd = [
+                uploader,
+                "--source",
+                local_dir,
+                "--remote",
+                "/RemoteRoot",
+                "--email",
+                "user",
+                "--app-password",
+                "pass",
+                "--base-url",
+                f"http://127.0.0.1:{server.port}",
+                "--threads",
+                "2",
+                "--dedup",
+            ]
+            result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Dedup run failed: {result.stderr}\n{result.stdout}")
+
+            remote_root = os.path.join(remote_dir, "RemoteRoot")
+            for rel in ("a/attachment.pdf", "b/attachment.pdf", "c/attachment.pdf", "linked.pdf"):
+                with open(os.path.join(remote_root, rel), "rb") as f:
+                    assert f.read() == attachment, rel
+            assert os.path.isfile(os.path.join(remote_root, "other.pdf"))
+            assert server.stats["put_calls"] == 2
+            assert server.stats["copy_calls"] == 3
+        finally:
+            server.stop()
+
+
+def check_renames(uploader):
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        files = {
+            "album/one.txt": os.urandom(2000),
+            "album/inner/two.txt": os.urandom(3000),
+            "notes.txt": os.urandom(500),
+        }
+        for rel, data in files.items():
+            write_file(os.path.join(local_dir, rel), data)
+        state_dir = os.path.join(work_dir, "state")
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            cmd = [
+                uploader,
+                "--source",
+                local_dir,
+                "--remote",
+                "/RemoteRoot",
+                "--email",
+                "user",
+                "--app-password",
+                "pass",
+                "--base-url",
+                f"http://127.0.0.1:{server.port}",
+                "--detect-renames",
+                "--rename-mode",
+                "move",
+                "--state-dir",
+                state_dir,
+            ]
+
+            def run(label):
+                result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+                if result.returncode != 0:
+                    raise RuntimeError(f"{label} failed: {result.stderr}\n{result.stdout}")
+
+            run("First rename run")
+            assert server.stats["put_calls"] == 3
+
+            # A renamed directory is one collection MOVE.
+            os.rename(os.path.join(local_dir, "album"), os.path.join(local_dir, "trip"))
+            run("Directory rename run")
+            remote_root = os.path.join(remote_dir, "RemoteRoot")
+            assert not os.path.exists(os.path.join(remote_root, "album"))
+            with open(os.path.join(remote_root, "trip", "inner", "two.txt"), "rb") as f:
+                assert f.read() == files["album/inner/two.txt"]
+            assert server.stats["put_calls"] == 3
+            assert server.stats["move_calls"] == 1
+
+            # A renamed file is moved on its own.
+            os.rename(os.path.join(local_dir, "notes.txt"), os.path.join(local_dir, "trip", "notes.txt"))
+            run("File rename run")
+            assert not os.path.exists(os.path.join(remote_root, "notes.txt"))
+            with open(os.path.join(remote_root, "trip", "notes.txt"), "rb") as f:
+                assert f.read() == files["notes.txt"]
+            assert server.stats["put_calls"] == 3
+            assert server.stats["move_calls"] == 2
+        finally:
+            server.stop()
+
+
+def check_jobs(uploader):
+    # uploader.conf is read from the executable's directory.
+    with tempfile.TemporaryDirectory() as exe_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        exe = os.path.join(exe_dir, os.path.basename(uploader))
+        shutil.copy2(uploader, exe)
+        for job in ("photos", "docs"):
+            for i in range(3):
+                write_file(os.path.join(exe_dir, job, f"{job}{i}.bin"), os.urandom(1000 + i))
+        write_file(os.path.join(exe_dir, "docs", "skip.tmp"), b"x")
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            with open(os.path.join(exe_dir, "uploader.conf"), "w") as f:
+                f.write(
+                    "email=user\n"
+                    "app_password=pass\n"
+                    f"base_url=http://127.0.0.1:{server.port}\n"
+                    "threads=2\n"
+                    "rate_limit=4096\n"
+                    "[job photos]\n"
+                    "source=photos\n"
+                    "remote=/Remote/photos\n"
+                    "weight=2\n"
+                    "[job docs]\n"
+                    "source=docs\n"
+                    "remote=/Remote/docs\n"
+                    "exclude=*.tmp\n"
+                )
+            result = subprocess.run([exe], capture_output=True, text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Jobs run failed: {result.stderr}\n{result.stdout}")
+
+            for job in ("photos", "docs"):
+                for i in range(3):
+                    assert os.path.isfile(os.path.join(remote_dir, "Remote", job, f"{job}{i}.bin"))
+            assert not os.path.exists(os.path.join(remote_dir, "Remote", "docs", "skip.tmp"))
+            assert server.stats["put_calls"] == 6
+            assert "Summary of job docs" in result.stdout
+            assert "Summary of all jobs" in result.stdout
+        finally:
+            server.stop()
+
+
+def check_shards(uploader):
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        files = {"root.txt": os.urandom(100)}
+        for i in range(8):
+            files[f"dir{i}/a.bin"] = os.urandom(1000 + i)
+            files[f"dir{i}/deep/b.bin"] = os.urandom(10 + i)
+        for rel, data in files.items():
+            write_file(os.path.join(local_dir, rel), data)
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            def run_shards():
+                # Both shards run at once, each from its own directory.
+                procs = []
+                for index in (1, 2):
+                    cwd = os.path.join(work_dir, f"shard{index}")
+                    os.makedirs(cwd, exist_ok=True)
+                    cmd = [
+                        uploader,
+                        "--source",
+                        local_dir,
+                        "--remote",
+                        "/Remote/Tree",
+                        "--email",
+                        "user",
+                        "--app-password",
+                        "pass",
+                        "--base-url",
+                        f"http://127.0.0.1:{server.port}",
+                        "--shard",
+                        f"{index}/2",
+                    ]
+                    procs.append(subprocess.Popen(cmd, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                                                  text=True, cwd=cwd))
+                outputs = []
+                for proc in procs:
+                    stdout, stderr = proc.communicate()
+                    if proc.returncode != 0:
+                        raise RuntimeError(f"Shard run failed: {stderr}\n{stdout}")
+                    outputs.append(stdout)
+                return outputs
+
+            outputs = run_shards()
+            for rel, data in files.items():
+                with open(os.path.join(remote_dir, "Remote", "Tree", rel), "rb") as f:
+                    assert f.read() == data, rel
+            # Every file is uploaded by exactly one shard.
+            assert server.stats["put_calls"] == len(files)
+            for stdout in outputs:
+                assert "Shard skew" in stdout
+
+            run_shards()
+            assert server.stats["put_calls"] == len(files)
+        finally:
+            server.stop()
+
+
+def check_space_pressure(uploader):
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        write_file(os.path.join(local_dir, "big.bin"), os.urandom(200 * 1024))
+        write_file(os.path.join(local_dir, "photo.jpg"), os.urandom(1024))
+        write_file(os.path.join(local_dir, "old.txt"), os.urandom(2048))
+        old_time = time.time() - 48 * 3600
+        os.utime(os.path.join(local_dir, "old.txt"), (old_time, old_time))
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            # Every volume is below 100% free, so the watermark is always hit.
+            cmd = [
+                uploader,
+                "--source",
+                local_dir,
+                "--remote",
+                "/RemoteRoot",
+                "--email",
+                "user",
+                "--app-password",
+                "pass",
+                "--base-url",
+                f"http://127.0.0.1:{server.port}",
+                "--threads",
+                "1",
+                "--low-space",
+                "100",
+            ]
+            result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Low space run failed: {result.stderr}\n{result.stdout}")
+
+            uploaded = [line.split("Uploaded ", 1)[1].strip()
+                        for line in result.stdout.splitlines() if "Uploaded " in line]
+            # Uploads that free space go first, largest first among them.
+            assert uploaded == ["old.txt", "photo.jpg", "big.bin"], uploaded
+            assert "uploads that delete local files now go first" in result.stdout
+            assert "Space reclaimed: 3072 bytes" in result.stdout
+            assert not os.path.exists(os.path.join(local_dir, "photo.jpg"))
+            assert os.path.exists(os.path.join(local_dir, "big.bin"))
+        finally:
+            server.stop()
+
+
+def check_read_modes(uploader):
+    for mode in ("drop-behind", "direct"):
+        with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+                tempfile.TemporaryDirectory() as work_dir:
+            files = {"large.bin": os.urandom(3 * 1024 * 1024 + 777), "small.txt": b"small"}
+            for rel, data in files.items():
+                write_file(os.path.join(local_dir, rel), data)
+
+            server = WebDavTestServer(remote_dir, username="user", password="pass")
+            server.start()
+            try:
+                cmd = [
+                    uploader,
+                    "--source",
+                    local_dir,
+                    "--remote",
+                    "/RemoteRoot",
+                    "--email",
+                    "user",
+                    "--app-password",
+                    "pass",
+                    "--base-url",
+                    f"http://127.0.0.1:{server.port}",
+                    "--read-mode",
+                    mode,
+                    "--direct-min",
+                    "1",
+                ]
+                result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+                if result.returncode != 0:
+                    raise RuntimeError(f"{mode} run failed: {result.stderr}\n{result.stdout}")
+                for rel, data in files.items():
+                    with open(os.path.join(remote_dir, "RemoteRoot", rel), "rb") as f:
+                        assert f.read() == data, (mode, rel)
+            finally:
+                server.stop()
+
+
+def check_status_file(uploader):
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        files = {"big.bin": os.urandom(2 * 1024 * 1024), "a/one.txt": b"one", "a/two.txt": b"two",
+                 "b/three.txt": b"three"}
+        for rel, data in files.items():
+            write_file(os.path.join(local_dir, rel), data)
+        status_path = os.path.join(work_dir, "status.json")
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            cmd = [
+                uploader,
+                "--source",
+                local_dir,
+                "--remote",
+                "/RemoteRoot",
+                "--email",
+                "user",
+                "--app-password",
+                "pass",
+                "--base-url",
+                f"http://127.0.0.1:{server.port}",
+                "--threads",
+                "2",
+                "--status-file",
+                status_path,
+            ]
+            result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Status run failed: {result.stderr}\n{result.stdout}")
+            assert "Status file: " in result.stdout, result.stdout
+            with open(status_path, "r", encoding="utf-8") as f:
+                status = json.load(f)
+            assert status["finished"] is True, status
+            assert status["files"] == {"done": 4, "total": 4}, status
+            total = sum(len(data) for data in files.values())
+            assert status["bytes"] == {"done": total, "total": total}, status
+            assert status["errors"] == 0, status
+            assert [w["state"] for w in status["workers"]] == ["done", "done"], status
+            assert not os.path.exists(status_path + ".tmp")
+        finally:
+            server.stop()
+
+
+def check_rules(uploader):
+    # uploader.conf is read from the executable's directory.
+    with tempfile.TemporaryDirectory() as exe_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        exe = os.path.join(exe_dir, os.path.basename(uploader))
+        shutil.copy2(uploader, exe)
+        source = os.path.join(exe_dir, "src")
+        raw = {"photos/a.RAW": os.urandom(1000), "photos/b.raw": os.urandom(2000)}
+        for rel, data in raw.items():
+            write_file(os.path.join(source, rel), data)
+        # Already on the server, but always uploaded anyway.
+        write_file(os.path.join(remote_dir, "Remote", "photos", "a.RAW"), raw["photos/a.RAW"])
+        write_file(os.path.join(source, "docs", "notes.txt"), b"notes")
+        write_file(os.path.join(source, "old.log"), b"log")
+        old_time = time.time() - 2 * 3600
+        os.utime(os.path.join(source, "old.log"), (old_time, old_time))
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            with open(os.path.join(exe_dir, "uploader.conf"), "w") as f:
+                f.write(
+                    "email=user\n"
+                    "app_password=pass\n"
+                    f"base_url=http://127.0.0.1:{server.port}\n"
+                    "source=src\n"
+                    "remote=/Remote\n"
+                    "[rule raw]\n"
+                    "match=*.raw\n"
+                    "upload=always\n"
+                    "delete=false\n"
+                    "[rule logs]\n"
+                    "match=*.log\n"
+                    "delete_age=1\n"
+                )
+            result = subprocess.run([exe], capture_output=True, text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Rules run failed: {result.stderr}\n{result.stdout}")
+            assert "Rule raw: *.raw -> upload always, keep" in result.stdout, result.stdout
+            # photos/ holds only always-uploaded files and is not listed.
+            assert "Skipped listing 1 directories" in result.stdout, result.stdout
+            assert server.stats["put_calls"] == 4
+            for rel in ("photos/a.RAW", "photos/b.raw", "docs/notes.txt", "old.log"):
+                assert os.path.isfile(os.path.join(remote_dir, "Remote", rel)), rel
+            for rel in raw:
+                assert os.path.isfile(os.path.join(source, rel)), rel
+            assert os.path.isfile(os.path.join(source, "docs", "notes.txt"))
+            assert not os.path.exists(os.path.join(source, "old.log"))
+
+            result = subprocess.run([exe], capture_output=True, text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Second rules run failed: {result.stderr}\n{result.stdout}")
+            assert server.stats["put_calls"] == 6
+            assert "Skip docs/notes.txt" in result.stdout, result.stdout
+        finally:
+            server.stop()
+
+
+def check_chunked_uploads(uploader):
+    chunk = 1024 * 1024
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        data = os.urandom(3 * chunk + 123)
+        write_file(os.path.join(local_dir, "media", "big.bin"), data)
+        write_file(os.path.join(local_dir, "small.txt"), b"small")
+        remote_file = os.path.join(remote_dir, "RemoteRoot", "media", "big.bin")
+        part_file = os.path.join(remote_dir, "RemoteRoot", "media", ".big.bin.part")
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            cmd = [
+                uploader,
+                "--source",
+                local_dir,
+                "--remote",
+                "/RemoteRoot",
+                "--email",
+                "user",
+                "--app-password",
+                "pass",
+                "--base-url",
+                f"http://127.0.0.1:{server.port}",
+                "--threads",
+                "3",
+                "--chunk-size",
+                "1",
+                "--chunked-min",
+                "2",
+                "--state-dir",
+                os.path.join(work_dir, "state"),
+            ]
+            # The chunk at 1 MB fails; the other three stay for the next run.
+            server.refused_offsets.add(chunk)
+            result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+            assert result.returncode != 0, result.stdout
+            assert "the server accepts Content-Range PUTs" in result.stdout, result.stdout
+            assert "is incomplete" in result.stderr, result.stderr
+            assert not os.path.exists(remote_file)
+            assert os.path.isfile(part_file)
+            # The probe, then four chunks.
+            assert server.stats["range_put_calls"] == 5, server.stats
+
+            server.refused_offsets.clear()
+            result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Resumed run failed: {result.stderr}\n{result.stdout}")
+            assert "Resuming chunked upload of media/big.bin: 3 of 4 chunks" in result.stdout, \
+                result.stdout
+            assert "Uploaded media/big.bin (4 chunks)" in result.stdout, result.stdout
+            assert server.stats["range_put_calls"] == 6, server.stats
+            assert server.stats["move_calls"] == 1, server.stats
+            with open(remote_file, "rb") as f:
+                assert f.read() == data
+            assert not os.path.exists(part_file)
+
+            # A part grown past the file, as one an earlier, larger version
+            # left, is replaced by the whole file rather than published.
+            data = os.urandom(3 * chunk + 321)
+            write_file(os.path.join(local_dir, "media", "big.bin"), data)
+            server.refused_offsets.add(chunk)
+            result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+            assert "is incomplete" in result.stderr, result.stderr
+            with open(part_file, "ab") as f:
+                f.write(b"stale" * 1000)
+            server.refused_offsets.clear()
+            result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Run over a stale part failed: {result.stderr}\n{result.stdout}")
+            assert "uploading media/big.bin whole" in result.stdout, result.stdout
+            with open(remote_file, "rb") as f:
+                assert f.read() == data
+            assert not os.path.exists(part_file)
+        finally:
+            server.stop()
+
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        files = {"one.bin": os.urandom(3 * chunk), "two.bin": os.urandom(2 * chunk + 5),
+                 os.path.join("media", "three.bin"): os.urandom(4 * chunk + 7)}
+        for rel, data in files.items():
+            write_file(os.path.join(local_dir, rel), data)
+        # A larger .part left from an earlier try is started afresh.
+        write_file(os.path.join(remote_dir, "RemoteRoot", ".one.bin.part"), b"x" * (5 * chunk))
+
+        # Several files go in chunks in one run, each into a .part of its
+        # own; only the first gets one from the probe.
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            cmd = [
+                uploader,
+                "--source",
+                local_dir,
+                "--remote",
+                "/RemoteRoot",
+                "--email",
+                "user",
+                "--app-password",
+                "pass",
+                "--base-url",
+                f"http://127.0.0.1:{server.port}",
+                "--threads",
+                "4",
+                "--chunk-size",
+                "1",
+                "--chunked-min",
+                "2",
+                "--state-dir",
+                os.path.join(work_dir, "state"),
+            ]
+            result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Chunked run failed: {result.stderr}\n{result.stdout}")
+            assert "the server accepts Content-Range PUTs" in result.stdout, result.stdout
+            # The probe, then 3 + 3 + 5 chunks.
+            assert server.stats["range_put_calls"] == 12, server.stats
+            assert server.stats["move_calls"] == 3, server.stats
+            for rel, data in files.items():
+                assert f"Uploaded {rel.replace(os.sep, '/')} (" in result.stdout, result.stdout
+                with open(os.path.join(remote_dir, "RemoteRoot", rel), "rb") as f:
+                    assert f.read() == data, rel
+            assert sorted(os.listdir(os.path.join(remote_dir, "RemoteRoot"))) == \
+                ["media", "one.bin", "two.bin"]
+            assert os.listdir(os.path.join(remote_dir, "RemoteRoot", "media")) == ["three.bin"]
+        finally:
+            server.stop()
+
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        files = {"one.bin": os.urandom(3 * chunk), "two.bin": os.urandom(3 * chunk + 1)}
+        for rel, data in files.items():
+            write_file(os.path.join(local_dir, rel), data)
+
+        # Without Content-Range support large files are uploaded whole; the
+        # probe object becomes the temporary object of the first one.
+        server = WebDavTestServer(remote_dir, username="user", password="pass", ranges=False)
+        server.start()
+        try:
+            cmd = [
+                uploader,
+                "--source",
+                local_dir,
+                "--remote",
+                "/RemoteRoot",
+                "--email",
+                "user",
+                "--app-password",
+                "pass",
+                "--base-url",
+                f"http://127.0.0.1:{server.port}",
+                "--chunk-size",
+                "1",
+                "--chunked-min",
+                "2",
+            ]
+            result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Fallback run failed: {result.stderr}\n{result.stdout}")
+            assert "does not accept Content-Range PUTs" in result.stdout, result.stdout
+            assert server.stats["range_put_calls"] == 1, server.stats
+            assert server.stats["move_calls"] == 1, server.stats
+            for rel, data in files.items():
+                with open(os.path.join(remote_dir, "RemoteRoot", rel), "rb") as f:
+                    assert f.read() == data, rel
+            assert sorted(os.listdir(os.path.join(remote_dir, "RemoteRoot"))) == sorted(files)
+        finally:
+            server.stop()
+
+
+def check_trace_replay(uploader):
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        write_file(os.path.join(local_dir, "photos", "old.jpg"), b"jpg" * 1000)
+        write_file(os.path.join(local_dir, "notes.txt"), b"notes")
+        old = time.time() - 3 * 24 * 3600
+        os.utime(os.path.join(local_dir, "photos", "old.jpg"), (old, old))
+        trace = os.path.join(work_dir, "run.trace")
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        port = server.port
+        # The recorded run deletes the old jpg, so it works on a copy.
+        recorded_dir = os.path.join(work_dir, "recorded")
+        shutil.copytree(local_dir, recorded_dir)
+        os.utime(os.path.join(recorded_dir, "photos", "old.jpg"), (old, old))
+
+        def command(source, *extra):
+            return [
+                uploader,
+                "--source",
+                source,
+                "--remote",
+                "/RemoteRoot",
+                "--email",
+                "user",
+                "--app-password",
+                "pass",
+                "--base-url",
+                f"http://127.0.0.1:{port}",
+                *extra,
+            ]
+
+        try:
+            result = subprocess.run(
+                command(recorded_dir, "--trace-record", trace, "--state-dir",
+                        os.path.join(work_dir, "s1")),
+                capture_output=True, text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Recorded run failed: {result.stderr}\n{result.stdout}")
+            assert "requests written to" in result.stdout, result.stdout
+            assert not os.path.exists(os.path.join(recorded_dir, "photos", "old.jpg"))
+            assert os.path.getsize(trace) > 0
+            with open(trace, "rb") as f:
+                raw = f.read()
+            # Paths are hashed and credentials are never kept.
+            assert b"old.jpg" not in raw and b"pass" not in raw
+        finally:
+            server.stop()
+
+        # The server is gone: every answer comes from the trace, and the
+        # local files stay even though the upload succeeded.
+        result = subprocess.run(
+            command(local_dir, "--trace-replay", trace, "--state-dir", os.path.join(work_dir, "s2")),
+            capture_output=True, text=True, cwd=work_dir)
+        if result.returncode != 0:
+            raise RuntimeError(f"Replayed run failed: {result.stderr}\n{result.stdout}")
+        assert "requests answered from the trace" in result.stdout, result.stdout
+        assert os.path.isfile(os.path.join(local_dir, "photos", "old.jpg"))
+        assert os.path.isfile(os.path.join(local_dir, "notes.txt"))
+
+
+def check_connection_warmup(uploader):
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        for i in range(50):
+            write_file(os.path.join(local_dir, f"d{i % 5}", f"f{i}.txt"), b"data")
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            cmd = [
+                uploader,
+                "--source",
+                local_dir,
+                "--remote",
+                "/RemoteRoot",
+                "--email",
+                "user",
+                "--base-url",
+                f"http://127.0.0.1:{server.port}",
+                "--threads",
+                "3",
+                "--probe-threads",
+                "3",
+                "--state-dir",
+                os.path.join(work_dir, "state"),
+            ]
+            # Refused credentials stop the run before anything is decided.
+            result = subprocess.run(cmd + ["--app-password", "wrong"], capture_output=True,
+                                    text=True, cwd=work_dir)
+            assert result.returncode != 0, result.stdout
+            assert "The server refused the credentials (status 401" in result.stderr, \
+                result.stderr
+            assert "Plan:" not in result.stdout, result.stdout
+            assert server.stats["propfind_depth1_calls"] == 0, server.stats
+            assert server.stats["put_calls"] == 0, server.stats
+
+            result = subprocess.run(cmd + ["--app-password", "pass"], capture_output=True,
+                                    text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Warm run failed: {result.stderr}\n{result.stdout}")
+            assert "Warm-up: 3 of 3 connections ready" in result.stdout, result.stdout
+            # The warmed clients serve the decision stage and the uploads.
+            assert "Connections: 3 WebDAV clients" in result.stdout, result.stdout
+            assert server.stats["put_calls"] == 50, server.stats
+        finally:
+            server.stop()
+
+
+def check_append_uploads(uploader):
+    for ranges in (True, False):
+        with tempfile.TemporaryDirectory() as local_dir, \
+                tempfile.TemporaryDirectory() as remote_dir, \
+                tempfile.TemporaryDirectory() as work_dir:
+            log_path = os.path.join(local_dir, "logs", "app.log")
+            remote_file = os.path.join(remote_dir, "RemoteRoot", "logs", "app.log")
+            write_file(log_path, os.urandom(200 * 1024))
+
+            server = WebDavTestServer(remote_dir, username="user", password="pass", ranges=ranges)
+            server.start()
+            try:
+                cmd = [
+                    uploader,
+                    "--source",
+                    local_dir,
+                    "--remote",
+                    "/RemoteRoot",
+                    "--email",
+                    "user",
+                    "--app-password",
+                    "pass",
+                    "--base-url",
+                    f"http://127.0.0.1:{server.port}",
+                    "--append",
+                    "*.log",
+                    "--state-dir",
+                    os.path.join(work_dir, "state"),
+                ]
+
+                def run_and_compare():
+                    result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+                    if result.returncode != 0:
+                        raise RuntimeError(f"Append run failed: {result.stderr}\n{result.stdout}")
+                    with open(log_path, "rb") as local, open(remote_file, "rb") as remote:
+                        assert local.read() == remote.read()
+                    return result
+
+                run_and_compare()
+                assert server.stats["range_put_calls"] == 0, server.stats
+
+                with open(log_path, "ab") as f:
+                    f.write(b"new line\n" * 500)
+                result = run_and_compare()
+                assert server.stats["range_put_calls"] == 1, server.stats
+                if ranges:
+                    assert "Appended 4500 bytes to logs/app.log (204800 already uploaded)" in \
+                        result.stdout, result.stdout
+                    assert "Files appended: 1" in result.stdout, result.stdout
+                else:
+                    assert "failed (PUT failed with status 400), uploading whole" in result.stdout, \
+                        result.stdout
+                    continue
+
+                # A rewritten prefix is uploaded whole.
+                with open(log_path, "r+b") as f:
+                    f.write(b"rewritten")
+                    f.seek(0, os.SEEK_END)
+                    f.write(b"more\n")
+                result = run_and_compare()
+                assert "changed within its last upload, uploading whole" in result.stdout, \
+                    result.stdout
+                assert server.stats["range_put_calls"] == 1, server.stats
+            finally:
+                server.stop()
+
+
+def check_probe_threads(uploader):
+    with tempfile.TemporaryDirectory() as local_dir, tempfile.TemporaryDirectory() as remote_dir, \
+            tempfile.TemporaryDirectory() as work_dir:
+        for i in range(40):
+            write_file(os.path.join(local_dir, f"d{i % 8}", f"f{i}.txt"), b"data")
+
+        server = WebDavTestServer(remote_dir, username="user", password="pass")
+        server.start()
+        try:
+            cmd = [
+                uploader,
+                "--source",
+                local_dir,
+                "--remote",
+                "/RemoteRoot",
+                "--email",
+                "user",
+                "--app-password",
+                "pass",
+                "--base-url",
+                f"http://127.0.0.1:{server.port}",
+                "--threads",
+                "1",
+                "--probe-threads",
+                "4",
+                "--state-dir",
+                os.path.join(work_dir, "state"),
+            ]
+            result = subprocess.run(cmd, capture_output=True, text=True, cwd=work_dir)
+            if result.returncode != 0:
+                raise RuntimeError(f"Probe threads run failed: {result.stderr}\n{result.stdout}")
+            # Four connections list the directories; one of them uploads.
+            assert "Probe threads: 4" in result.stdout, result.stdout
+            assert "Connections: 4 WebDAV clients" in result.stdout, result.stdout
+            assert server.stats["put_calls"] == 40, server.stats
+        finally:
+            server.stop()
+
+    # The setting is checked like --threads.
+    result = subprocess.run([uploader, "--dry-run", "--probe-threads", "0"], capture_output=True,
+                            text=True)
+    assert result.returncode != 0
+    assert "--probe-threads must be >= 1" in result.stderr + result.stdout
+
 
 if __name__ == "__main__":
     main()
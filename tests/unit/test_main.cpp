@@ -1,17 +1,44 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <filesystem>
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <iterator>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "app_config.h"
+#include "bundle.h"
 #include "cli.h"
 #include "decision.h"
+#include "dedup.h"
 #include "exclude.h"
+#include "fair_scheduler.h"
+#include "file_reader.h"
+#include "gzip_stream.h"
+#include "http_trace.h"
+#include "ignore_file.h"
+#include "local_deleter.h"
+#include "logger.h"
+#include "path_store.h"
 #include "path_utils.h"
+#include "plan.h"
+#include "rate_limiter.h"
+#include "renames.h"
+#include "rules.h"
+#include "run_model.h"
+#include "scanner.h"
+#include "sha256.h"
+#include "shard.h"
+#include "state_manifest.h"
+#include "status_board.h"
+#include "text_kernels.h"
 
 namespace {
 
@@ -146,10 +173,16 @@ TEST_CASE(ParseArgsConfigFile) {
     out << "remote=/ConfigRemote\n";
     out << "base_url=http://127.0.0.1:19000\n";
     out << "threads=3\n";
+    out << "probe-threads=16\n";
     out << "compare=size-only\n";
     out << "dry_run=true\n";
     out << "exclude=*.tmp\n";
     out << "exclude=build/*\n";
+    out << "ignore_file=.backupignore\n";
+    out << "async_log=true\n";
+    out << "log_level=warn\n";
+    out << "bundle=thumbs\n";
+    out << "bundle_size=8\n";
     out.close();
 
     AppConfig config;
@@ -162,9 +195,15 @@ TEST_CASE(ParseArgsConfigFile) {
     EXPECT_EQ(config.remote, "/ConfigRemote");
     EXPECT_EQ(config.base_url, "http://127.0.0.1:19000");
     EXPECT_EQ(config.threads, 3);
+    EXPECT_EQ(config.probe_threads, 16);
     EXPECT_EQ(config.compare_mode, CompareMode::SizeOnly);
     EXPECT_EQ(config.source, std::filesystem::absolute(data_dir));
     EXPECT_TRUE(!config.excludes.empty());
+    EXPECT_EQ(config.ignore_file, ".backupignore");
+    EXPECT_TRUE(config.async_log);
+    EXPECT_TRUE(config.log_level == LogLevel::Warn);
+    EXPECT_EQ(config.bundle_dirs.size(), static_cast<std::size_t>(1));
+    EXPECT_EQ(config.bundle_size, 8ULL << 20);
 
     if (had_email) {
         SetEnvValue("MAILRU_EMAIL", old_email);
@@ -178,6 +217,207 @@ TEST_CASE(ParseArgsConfigFile) {
     }
 }
 
+TEST_CASE(ParseArgsConfigJobs) {
+    std::filesystem::path root_dir = std::filesystem::temp_directory_path() / "uploader_jobs_cfg";
+    std::error_code ec;
+    std::filesystem::remove_all(root_dir, ec);
+    std::filesystem::create_directories(root_dir / "photos");
+    std::filesystem::create_directories(root_dir / "docs");
+
+    std::ofstream out(root_dir / "uploader.conf");
+    out << "email=user@mail.ru\n";
+    out << "compare=size-only\n";
+    out << "rate_limit=512\n";
+    out << "[job photos]\n";
+    out << "source=photos\n";
+    out << "remote=Backup/photos/\n";
+    out << "weight=3\n";
+    out << "[ job docs ]\n";
+    out << "source=docs\n";
+    out << "remote=/Backup/docs\n";
+    out << "compare=size-mtime\n";
+    out << "exclude=*.tmp\n";
+    out << "[rule raw]\n";
+    out << "match=*.CR2\n";
+    out << "match=raw/*.dng\n";
+    out << "upload=always\n";
+    out << "delete=no\n";
+    out << "[rule logs]\n";
+    out << "match=*.log\n";
+    out << "delete_age=72\n";
+    out << "compare=size-only\n";
+    out.close();
+
+    AppConfig config;
+    std::string error;
+    EXPECT_TRUE(ParseArgs({"--dry-run"}, root_dir, &config, &error));
+    EXPECT_EQ(config.rate_limit, 512ULL << 10);
+    EXPECT_EQ(config.rules.size(), static_cast<std::size_t>(2));
+    EXPECT_EQ(config.rules[0].name, "raw");
+    EXPECT_EQ(config.rules[0].patterns.size(), static_cast<std::size_t>(2));
+    EXPECT_TRUE(config.rules[0].always_upload && !config.rules[0].delete_after_upload);
+    EXPECT_EQ(config.rules[1].delete_age_hours, 72u);
+    EXPECT_TRUE(config.rules[1].has_compare && config.rules[1].compare_mode == CompareMode::SizeOnly);
+    EXPECT_EQ(config.jobs.size(), static_cast<std::size_t>(2));
+    EXPECT_EQ(config.jobs[0].name, "photos");
+    EXPECT_EQ(config.jobs[0].source, std::filesystem::absolute(root_dir / "photos"));
+    EXPECT_EQ(config.jobs[0].remote, "/Backup/photos");
+    EXPECT_EQ(config.jobs[0].weight, 3u);
+    EXPECT_TRUE(config.jobs[0].compare_mode == CompareMode::SizeOnly);
+    EXPECT_EQ(config.jobs[1].name, "docs");
+    EXPECT_TRUE(config.jobs[1].compare_mode == CompareMode::SizeMtime);
+    EXPECT_EQ(config.jobs[1].excludes.size(), static_cast<std::size_t>(1));
+    EXPECT_EQ(config.jobs[1].weight, 1u);
+
+    // Jobs replace the single mapping and cannot be written to one plan.
+    config = AppConfig();
+    EXPECT_TRUE(!ParseArgs({"--dry-run", "--source", root_dir.string()}, root_dir, &config, &error));
+    config = AppConfig();
+    EXPECT_TRUE(!ParseArgs({"--dry-run", "--plan-out", "plan.bin"}, root_dir, &config, &error));
+
+    // Shards split each job's tree; a plan is already one shard's.
+    config = AppConfig();
+    EXPECT_TRUE(ParseArgs({"--dry-run", "--shard", "2/4", "--shard-depth", "2"}, root_dir, &config,
+                          &error));
+    EXPECT_EQ(config.shard_index, 1u);
+    EXPECT_EQ(config.shard_count, 4u);
+    EXPECT_EQ(config.shard_depth, 2u);
+    config = AppConfig();
+    EXPECT_TRUE(!ParseArgs({"--dry-run", "--shard", "5/4"}, root_dir, &config, &error));
+    config = AppConfig();
+    EXPECT_TRUE(!ParseArgs({"--dry-run", "--shard-depth", "0"}, root_dir, &config, &error));
+
+    config = AppConfig();
+    EXPECT_TRUE(ParseArgs({"--dry-run", "--read-mode", "direct", "--direct-min", "64"}, root_dir,
+                          &config, &error));
+    EXPECT_TRUE(config.read_options.mode == ReadCacheMode::Direct);
+    EXPECT_EQ(config.read_options.direct_min, 64ULL << 20);
+    config = AppConfig();
+    EXPECT_TRUE(!ParseArgs({"--dry-run", "--read-mode", "mmap"}, root_dir, &config, &error));
+    config = AppConfig();
+    EXPECT_TRUE(ParseArgs({"--dry-run", "--chunked-min", "0", "--chunk-size", "8"}, root_dir,
+                          &config, &error));
+    EXPECT_EQ(config.chunked_min, 0u);
+    EXPECT_EQ(config.chunk_size, 8ULL << 20);
+    config = AppConfig();
+    EXPECT_TRUE(!ParseArgs({"--dry-run", "--chunk-size", "0"}, root_dir, &config, &error));
+    config = AppConfig();
+    EXPECT_TRUE(ParseArgs({"--dry-run", "--low-space", "20%", "--critical-space", "0"}, root_dir,
+                          &config, &error));
+    EXPECT_EQ(config.low_space_percent, 20u);
+    EXPECT_EQ(config.critical_space_percent, 0u);
+    config = AppConfig();
+    EXPECT_TRUE(!ParseArgs({"--dry-run", "--low-space", "5", "--critical-space", "8"}, root_dir,
+                           &config, &error));
+    config = AppConfig();
+    EXPECT_TRUE(!ParseArgs({"--dry-run", "--low-space", "101"}, root_dir, &config, &error));
+    config = AppConfig();
+    EXPECT_TRUE(ParseArgs({"--dry-run", "--no-progress", "--status-file", "status.json",
+                           "--status-interval", "5"},
+                          root_dir, &config, &error));
+    EXPECT_TRUE(!config.progress);
+    EXPECT_EQ(config.status_file.string(), "status.json");
+    EXPECT_EQ(config.status_interval, 5u);
+    config = AppConfig();
+    EXPECT_TRUE(!ParseArgs({"--dry-run", "--status-interval", "0"}, root_dir, &config, &error));
+
+    std::ofstream(root_dir / "uploader.conf") << "[job a]\nsource=photos\nthreads=2\n";
+    config = AppConfig();
+    EXPECT_TRUE(!ParseArgs({"--dry-run"}, root_dir, &config, &error));
+    std::ofstream(root_dir / "uploader.conf") << "[job a]\nsource=photos\n";
+    config = AppConfig();
+    EXPECT_TRUE(!ParseArgs({"--dry-run"}, root_dir, &config, &error));
+}
+
+TEST_CASE(FairSchedulerSharesByWeight) {
+    FairScheduler scheduler;
+    const std::uint64_t mb = 1 << 20;
+    scheduler.AddFlow(1, std::vector<std::uint64_t>(10, mb));
+    scheduler.AddFlow(2, std::vector<std::uint64_t>(10, mb));
+    // Small files are charged a minimum per request.
+    scheduler.AddFlow(1, std::vector<std::uint64_t>(40, 1));
+    EXPECT_EQ(scheduler.Items(), static_cast<std::size_t>(60));
+
+    std::vector<std::size_t> served(3, 0);
+    std::vector<std::size_t> next(3, 0);
+    FairScheduler::Pick pick;
+    for (int i = 0; i < 23; ++i) {
+        EXPECT_TRUE(scheduler.Next(&pick));
+        // Each flow keeps its own order.
+        EXPECT_EQ(pick.item, next[pick.flow]++);
+        served[pick.flow]++;
+    }
+    // 1 MB, 2 MB and 20 x 64 KB: bytes in proportion to the weights.
+    EXPECT_EQ(served[0], 1u);
+    EXPECT_EQ(served[1], 2u);
+    EXPECT_EQ(served[2], 20u);
+    std::size_t rest = 0;
+    while (scheduler.Next(&pick)) {
+        rest++;
+    }
+    EXPECT_EQ(rest, 37u);
+}
+
+TEST_CASE(FairSchedulerPromotesUrgentItems) {
+    const std::uint64_t mb = 1 << 20;
+    auto drain = [](FairScheduler* scheduler, std::size_t count) {
+        std::vector<FairScheduler::Pick> picks;
+        FairScheduler::Pick pick;
+        while (picks.size() < count && scheduler->Next(&pick)) {
+            picks.push_back(pick);
+        }
+        return picks;
+    };
+
+    // Without promotion urgent items keep their place.
+    FairScheduler plain;
+    plain.AddFlow(1, {3 * mb, 2 * mb, mb}, {0, 0, 1});
+    std::vector<FairScheduler::Pick> picks = drain(&plain, 3);
+    EXPECT_EQ(picks[0].item, 0u);
+    EXPECT_EQ(picks[2].item, 2u);
+
+    // Within a flow they go first, in their own order.
+    FairScheduler within;
+    within.AddFlow(1, {3 * mb, 2 * mb, mb, mb}, {0, 1, 0, 1});
+    within.SetPromotion(0, FairScheduler::Promotion::WithinFlow);
+    picks = drain(&within, 4);
+    EXPECT_EQ(picks[0].item, 1u);
+    EXPECT_EQ(picks[1].item, 3u);
+    EXPECT_EQ(picks[2].item, 0u);
+    // Promotion can change while items are handed out.
+    FairScheduler later;
+    later.AddFlow(1, {3 * mb, 2 * mb, mb}, {0, 0, 1});
+    EXPECT_EQ(drain(&later, 1)[0].item, 0u);
+    later.SetPromotion(0, FairScheduler::Promotion::WithinFlow);
+    EXPECT_EQ(drain(&later, 1)[0].item, 2u);
+    EXPECT_EQ(drain(&later, 1)[0].item, 1u);
+
+    // Globally promoted items go before the other flows regardless of
+    // weight; the flow still pays for them.
+    FairScheduler global;
+    global.AddFlow(1, std::vector<std::uint64_t>(3, mb), {1, 1, 0});
+    global.AddFlow(8, std::vector<std::uint64_t>(10, mb));
+    global.SetPromotion(0, FairScheduler::Promotion::Global);
+    picks = drain(&global, 3);
+    EXPECT_EQ(picks[0].flow, 0u);
+    EXPECT_EQ(picks[1].flow, 0u);
+    EXPECT_EQ(picks[2].flow, 1u);
+    std::size_t rest = drain(&global, 100).size();
+    EXPECT_EQ(rest, 10u);
+}
+
+TEST_CASE(RateLimiterPacesBytes) {
+    RateLimiter limiter(1 << 20);
+    auto start = std::chrono::steady_clock::now();
+    // A quarter second of burst, then the rest at 1 MB/s.
+    for (int i = 0; i < 8; ++i) {
+        limiter.Acquire(128 << 10);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_TRUE(elapsed >= std::chrono::milliseconds(700));
+    EXPECT_TRUE(elapsed < std::chrono::seconds(5));
+}
+
 TEST_CASE(ParseArgsDefaultSource) {
     std::filesystem::path root_dir = std::filesystem::temp_directory_path() / "uploader_default_root_test";
     std::error_code ec;
@@ -206,31 +446,147 @@ TEST_CASE(UrlEncoding) {
     EXPECT_EQ(UrlEncodePath("/A B"), "/A%20B");
 }
 
+TEST_CASE(TextKernelsMatchScalar) {
+    // Every length up to a few vector widths, with the unsafe byte at each
+    // position, so both the vector bodies and the scalar tails are covered.
+    const std::string safe = "AZaz09-_.~/Mixed_Case-Name.JPG/photo~1";
+    for (std::size_t length = 0; length < 80; ++length) {
+        std::string text;
+        for (std::size_t i = 0; i < length; ++i) {
+            text.push_back(safe[i % safe.size()]);
+        }
+        std::string lower = text;
+        LowerAsciiInPlace(lower.data(), lower.size());
+        std::string expected_lower = text;
+        for (char& c : expected_lower) {
+            c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        }
+        EXPECT_EQ(lower, expected_lower);
+        EXPECT_EQ(UrlSafePrefixLength(text.data(), text.size()), length);
+
+        for (std::size_t pos = 0; pos < length; ++pos) {
+            std::string probe = text;
+            probe[pos] = (pos % 3 == 0) ? ' ' : (pos % 3 == 1) ? '\xD0' : '@';
+            EXPECT_EQ(UrlSafePrefixLength(probe.data(), probe.size()), pos);
+        }
+    }
+    EXPECT_EQ(UrlEncodePath("/\xD0\x9F\xD1\x80\xD0\xB8/a+b%.txt"), "/%D0%9F%D1%80%D0%B8/a%2Bb%25.txt");
+}
+
+TEST_CASE(RemotePathTableEncodesOncePerDirectory) {
+    PathStore store;
+    DirId sub = store.AddDirectory(PathStore::kRootDir, "My Photos");
+    DirId deep = store.AddDirectory(sub, "2024");
+    FileId top = store.AddFile(PathStore::kRootDir, "a b.txt");
+    FileId nested = store.AddFile(deep, "IMG#1.jpg");
+
+    RemotePathTable table(store, "/Backup/p2/");
+    EXPECT_EQ(table.Directory(PathStore::kRootDir).plain, "/Backup/p2");
+    EXPECT_EQ(table.Directory(deep).plain, "/Backup/p2/My Photos/2024");
+    EXPECT_EQ(table.Directory(deep).encoded, "/Backup/p2/My%20Photos/2024");
+    RemotePath file = table.File(nested);
+    EXPECT_EQ(file.plain, store.FileRemotePath("/Backup/p2", nested));
+    EXPECT_EQ(file.encoded, UrlEncodePath(file.plain));
+    EXPECT_EQ(table.File(top).encoded, "/Backup/p2/a%20b.txt");
+
+    RemotePathTable root_table(store, "/");
+    EXPECT_EQ(root_table.File(top).plain, "/a b.txt");
+    EXPECT_EQ(root_table.File(nested).encoded, "/My%20Photos/2024/IMG%231.jpg");
+
+    // A rename source kept as UTF-8 text gets the URL its upload was sent to.
+    DirId cyrillic = store.AddDirectory(PathStore::kRootDir, "\xD0\xA4\xD0\xBE\xD1\x82\xD0\xBE");
+    FileId renamed = store.AddFile(cyrillic, "\xD0\xBB\xD0\xB5\xD1\x82\xD0\xBE.jpg");
+    RemotePathTable uploaded(store, "/Backup");
+    RemotePath source = AppendRemotePath(uploaded.Directory(PathStore::kRootDir),
+                                         store.FileRelativeUtf8(renamed));
+    EXPECT_EQ(source.plain, uploaded.File(renamed).plain);
+    EXPECT_EQ(source.encoded, uploaded.File(renamed).encoded);
+    EXPECT_EQ(source.encoded, "/Backup/%D0%A4%D0%BE%D1%82%D0%BE/%D0%BB%D0%B5%D1%82%D0%BE.jpg");
+}
+
+TEST_CASE(ShardsSplitTreeByPrefix) {
+    ShardSpec spec;
+    EXPECT_TRUE(ParseShardSpec("2/4", &spec));
+    EXPECT_EQ(spec.index, 1u);
+    EXPECT_EQ(spec.count, 4u);
+    EXPECT_TRUE(!ParseShardSpec("0/4", &spec));
+    EXPECT_TRUE(!ParseShardSpec("5/4", &spec));
+    EXPECT_TRUE(!ParseShardSpec("1/", &spec));
+    EXPECT_TRUE(!ParseShardSpec("-1/4", &spec));
+    EXPECT_TRUE(!ParseShardSpec("3", &spec));
+
+    PathStore full;
+    full.AddFile(PathStore::kRootDir, "top.txt", 5);
+    for (int i = 0; i < 12; ++i) {
+        DirId top = full.AddDirectory(PathStore::kRootDir, "d" + std::to_string(i));
+        DirId sub = full.AddDirectory(top, "sub");
+        full.AddFile(top, "a.bin", 100);
+        full.AddFile(sub, "b.bin", 10);
+    }
+    const std::uint32_t count = 3;
+
+    for (std::uint32_t depth = 1; depth <= 2; ++depth) {
+        std::vector<std::string> seen;
+        std::uint64_t bytes = 0;
+        for (std::uint32_t index = 0; index < count; ++index) {
+            PathStore store = full;
+            std::vector<std::uint8_t> shared;
+            ShardStats stats = SelectShard(&store, ShardSpec{index, count, depth}, &shared);
+            EXPECT_EQ(stats.files[index], static_cast<std::uint64_t>(store.FileCount()));
+            EXPECT_EQ(shared.size(), store.DirectoryCount());
+            bytes += stats.bytes[index];
+            for (FileId file = 0; file < store.FileCount(); ++file) {
+                seen.push_back(store.FileRelativeUtf8(file));
+                // A file's directory is never a pass-through one.
+                EXPECT_EQ(shared[store.FileDirectory(file)], 0);
+            }
+            for (DirId dir = 1; dir < store.DirectoryCount(); ++dir) {
+                // Subdirectories below the depth follow their prefix.
+                if (static_cast<std::uint32_t>(store.DirectoryDepth(dir)) > depth) {
+                    EXPECT_EQ(shared[dir], shared[store.DirectoryParent(dir)]);
+                }
+            }
+            if (depth == 1) {
+                EXPECT_EQ(stats.largest_prefix_bytes, 110u);
+                EXPECT_TRUE(stats.largest_prefix.rfind("d", 0) == 0);
+            }
+        }
+        // Every file lands in exactly one shard.
+        std::sort(seen.begin(), seen.end());
+        EXPECT_EQ(seen.size(), full.FileCount());
+        EXPECT_TRUE(std::adjacent_find(seen.begin(), seen.end()) == seen.end());
+        EXPECT_EQ(bytes, 12u * 110u + 5u);
+    }
+
+    // Every process computes the same split.
+    EXPECT_TRUE(AssignShards(full, ShardSpec{0, count, 1}) ==
+                AssignShards(PathStore(full), ShardSpec{2, count, 1}));
+    EXPECT_EQ(MaxOverMean({5, 5, 5}), 1.0);
+    EXPECT_EQ(MaxOverMean({9, 3, 0}), 2.25);
+}
+
 TEST_CASE(DecisionJpg) {
     LocalFileInfo local;
-    local.is_jpg = true;
     RemoteItemInfo remote;
     remote.exists = false;
-    auto decision = DecideFileAction(local, remote, CompareMode::SizeMtime,
+    auto decision = DecideFileAction(local, remote, DefaultSyncRules()[0], CompareMode::SizeMtime,
                                      std::chrono::system_clock::now());
     EXPECT_EQ(decision.action, FileActionType::UploadAndDelete);
 }
 
 TEST_CASE(DecisionNonJpgOld) {
     LocalFileInfo local;
-    local.is_jpg = false;
     local.size = 10;
     local.last_modified = std::chrono::system_clock::now() - std::chrono::hours(48);
     RemoteItemInfo remote;
     remote.exists = false;
-    auto decision = DecideFileAction(local, remote, CompareMode::SizeMtime,
+    auto decision = DecideFileAction(local, remote, FallbackSyncRule(), CompareMode::SizeMtime,
                                      std::chrono::system_clock::now());
     EXPECT_EQ(decision.action, FileActionType::UploadAndDelete);
 }
 
 TEST_CASE(DecisionNonJpgSame) {
     LocalFileInfo local;
-    local.is_jpg = false;
     local.size = 10;
     local.last_modified = std::chrono::system_clock::now();
 
@@ -241,11 +597,83 @@ TEST_CASE(DecisionNonJpgSame) {
     remote.has_last_modified = true;
     remote.last_modified = local.last_modified + std::chrono::seconds(5);
 
-    auto decision = DecideFileAction(local, remote, CompareMode::SizeMtime,
+    auto decision = DecideFileAction(local, remote, FallbackSyncRule(), CompareMode::SizeMtime,
                                      std::chrono::system_clock::now());
     EXPECT_EQ(decision.action, FileActionType::Skip);
 }
 
+TEST_CASE(RuleTableMatches) {
+    PathStore store;
+    DirId raw = store.AddDirectory(PathStore::kRootDir, "raw");
+    FileId photo = store.AddFile(PathStore::kRootDir, "IMG_1.JPG");
+    FileId hidden = store.AddFile(PathStore::kRootDir, ".jpg");
+    FileId dng = store.AddFile(raw, "a.dng");
+    FileId top_dng = store.AddFile(PathStore::kRootDir, "b.dng");
+    FileId log = store.AddFile(raw, "x.log");
+    FileId other = store.AddFile(raw, "notes.txt");
+
+    RuleTable defaults({});
+    EXPECT_EQ(defaults.Size(), static_cast<std::size_t>(2));
+    EXPECT_EQ(defaults.Match(store, photo), 0);
+    EXPECT_EQ(defaults.Match(store, hidden), 1);
+    EXPECT_TRUE(!defaults.NeedsRemote(0) && defaults.NeedsRemote(1));
+
+    std::vector<SyncRule> rules(3);
+    rules[0].patterns = {"raw/*.dng"};
+    rules[0].always_upload = true;
+    rules[1].patterns = {"*.log", "*.dng"};
+    rules[2].patterns = {"*.log", "*.jp?g", "*.JPG"};
+    RuleTable table(rules);
+    EXPECT_EQ(table.Match(store, dng), 0);
+    EXPECT_EQ(table.Match(store, top_dng), 1);
+    // The first rule wins over a later one with the same extension.
+    EXPECT_EQ(table.Match(store, log), 1);
+    EXPECT_EQ(table.Match(store, photo), 2);
+    EXPECT_EQ(table.Match(store, other), 3);
+    EXPECT_EQ(table.Rule(3).delete_age_hours, 24u);
+
+    // Many extensions still get a slot each.
+    std::vector<SyncRule> wide(1);
+    for (int i = 0; i < 500; ++i) {
+        wide[0].patterns.push_back("*.e" + std::to_string(i));
+    }
+    RuleTable wide_table(wide);
+    for (int i = 0; i < 500; ++i) {
+        FileId file = store.AddFile(PathStore::kRootDir, "f.E" + std::to_string(i));
+        EXPECT_EQ(wide_table.Match(store, file), 0);
+    }
+    EXPECT_EQ(wide_table.Match(store, other), 1);
+
+    LocalFileInfo local;
+    local.size = 10;
+    local.last_modified = std::chrono::system_clock::now() - std::chrono::hours(30);
+    RemoteItemInfo remote;
+    remote.exists = true;
+    remote.has_size = true;
+    remote.size = 10;
+    auto now = std::chrono::system_clock::now();
+    // Always uploaded, kept locally.
+    SyncRule keep;
+    keep.always_upload = true;
+    keep.delete_after_upload = false;
+    FileDecision decision = DecideFileAction(local, remote, keep, CompareMode::SizeMtime, now);
+    EXPECT_EQ(decision.action, FileActionType::Upload);
+    EXPECT_TRUE(decision.reason == DecisionReason::AlwaysOverwrite);
+    // The rule's compare mode overrides the job's; 30 hours is below its age.
+    SyncRule sized;
+    sized.has_compare = true;
+    sized.compare_mode = CompareMode::SizeOnly;
+    sized.delete_age_hours = 48;
+    decision = DecideFileAction(local, remote, sized, CompareMode::SizeMtime, now);
+    EXPECT_EQ(decision.action, FileActionType::Skip);
+    remote.size = 11;
+    decision = DecideFileAction(local, remote, sized, CompareMode::SizeMtime, now);
+    EXPECT_EQ(decision.action, FileActionType::Upload);
+    sized.delete_age_hours = 12;
+    decision = DecideFileAction(local, remote, sized, CompareMode::SizeMtime, now);
+    EXPECT_EQ(decision.action, FileActionType::UploadAndDelete);
+}
+
 TEST_CASE(ExcludeRulesTest) {
     ExcludeRules rules = BuildDefaultExcludeRules();
     EXPECT_TRUE(ShouldExclude(std::filesystem::path(".git") / "config", rules));
@@ -256,6 +684,1022 @@ TEST_CASE(ExcludeRulesTest) {
     EXPECT_TRUE(ShouldExclude(std::filesystem::path("build") / "out.bin", rules));
 }
 
+TEST_CASE(ExcludeMatcherChecksLeafOnly) {
+    ExcludeRules rules = BuildDefaultExcludeRules();
+    rules.patterns.push_back("cache-??");
+    rules.patterns.push_back("Build/*.OBJ");
+    rules.patterns.push_back("*.log.*");
+    ExcludeMatcher matcher(rules);
+
+    EXPECT_TRUE(matcher.Excludes("THUMBS.DB"));
+    EXPECT_TRUE(matcher.Excludes("docs/notes.txt~"));
+    EXPECT_TRUE(matcher.Excludes("a/cache-01/file.txt"));
+    EXPECT_TRUE(!matcher.Excludes("a/cache-001/file.txt"));
+    EXPECT_TRUE(matcher.Excludes("app.log.1"));
+    EXPECT_TRUE(matcher.Excludes("build/x.obj"));
+    EXPECT_TRUE(matcher.Excludes("build/sub/x.obj"));
+    EXPECT_TRUE(!matcher.Excludes("src/build/x.obj"));
+    EXPECT_TRUE(!matcher.Excludes("build/x.cpp"));
+
+    ExcludeMatcher::State build = 0;
+    EXPECT_TRUE(!matcher.ExcludesChild(matcher.RootState(), "build", &build));
+    ExcludeMatcher::State sub = 0;
+    EXPECT_TRUE(!matcher.ExcludesChild(build, "sub", &sub));
+    EXPECT_TRUE(matcher.ExcludesChild(sub, "y.obj", nullptr));
+    EXPECT_TRUE(!matcher.ExcludesChild(sub, "y.txt", nullptr));
+}
+
+TEST_CASE(IgnoreFileSemantics) {
+    IgnoreRuleSet rules("# build output\n"
+                        "*.o\n"
+                        "/dist\n"
+                        "cache/\n"
+                        "docs/**/*.pdf\n"
+                        "!keep.o\n");
+    EXPECT_EQ(rules.RuleCount(), static_cast<std::size_t>(5));
+    IgnoreChain root{{&rules, rules.Start()}};
+
+    IgnoreChain src;
+    EXPECT_TRUE(!IsIgnored(root, "src", true, &src));
+    EXPECT_TRUE(IsIgnored(src, "main.O", false, nullptr));
+    EXPECT_TRUE(!IsIgnored(src, "keep.o", false, nullptr));
+    EXPECT_TRUE(IsIgnored(root, "dist", true, nullptr));
+    EXPECT_TRUE(!IsIgnored(src, "dist", true, nullptr));
+    EXPECT_TRUE(IsIgnored(src, "cache", true, nullptr));
+    EXPECT_TRUE(!IsIgnored(src, "cache", false, nullptr));
+
+    IgnoreChain docs;
+    IgnoreChain deep;
+    EXPECT_TRUE(!IsIgnored(root, "docs", true, &docs));
+    EXPECT_TRUE(IsIgnored(docs, "a.pdf", false, nullptr));
+    EXPECT_TRUE(!IsIgnored(docs, "deep", true, &deep));
+    EXPECT_TRUE(IsIgnored(deep, "b.pdf", false, nullptr));
+    EXPECT_TRUE(!IsIgnored(src, "c.pdf", false, nullptr));
+
+    IgnoreRuleSet nested("!*.o\n");
+    src.push_back({&nested, nested.Start()});
+    EXPECT_TRUE(!IsIgnored(src, "main.o", false, nullptr));
+}
+
+TEST_CASE(PathStoreMaterialisesPaths) {
+    PathStore store;
+    DirId sub = store.AddDirectory(PathStore::kRootDir, "sub");
+    DirId deep = store.AddDirectory(sub, "deep");
+    FileId top = store.AddFile(PathStore::kRootDir, "new.txt");
+    FileId nested = store.AddFile(deep, "doc.txt");
+
+    EXPECT_EQ(store.DirectoryCount(), static_cast<std::size_t>(3));
+    EXPECT_EQ(store.FileCount(), static_cast<std::size_t>(2));
+    EXPECT_EQ(store.DirectoryDepth(deep), 2);
+    EXPECT_EQ(store.DirectoryRelativeUtf8(deep), "sub/deep");
+    EXPECT_EQ(store.FileRelativeUtf8(top), "new.txt");
+    EXPECT_EQ(store.FileRelativeUtf8(nested), "sub/deep/doc.txt");
+    EXPECT_EQ(store.FileRelativePath(nested),
+              std::filesystem::path("sub") / "deep" / "doc.txt");
+    EXPECT_EQ(store.DirectoryRemotePath("/Root/", PathStore::kRootDir), "/Root");
+    EXPECT_EQ(store.DirectoryRemotePath("/Root", deep), "/Root/sub/deep");
+    EXPECT_EQ(store.FileRemotePath("/", top), "/new.txt");
+    EXPECT_EQ(store.FileRemotePath("/Root", nested), "/Root/sub/deep/doc.txt");
+}
+
+TEST_CASE(PlanRoundTripAndOrder) {
+    SyncPlan plan;
+    plan.source = std::filesystem::path("src");
+    plan.remote_root = "/Root";
+    plan.compare_mode = CompareMode::SizeOnly;
+    plan.created_ns = 1700000000123456789LL;
+    DirId sub = plan.store.AddDirectory(PathStore::kRootDir, "sub");
+    plan.store.AddFile(sub, "small.txt", 10, 111);
+    plan.store.AddFile(PathStore::kRootDir, "same.txt", 500, 222);
+    plan.store.AddFile(sub, "large.jpg", 900, 333);
+    plan.store.AddFile(PathStore::kRootDir, "error.txt", 1000, 444);
+    plan.root_exists = true;
+    plan.dir_missing = {0, 1};
+    plan.action = {FileActionType::Upload, FileActionType::Skip,
+                   FileActionType::UploadAndDelete, FileActionType::Upload};
+    plan.reason = {static_cast<std::uint8_t>(DecisionReason::Missing),
+                   static_cast<std::uint8_t>(DecisionReason::Same),
+                   static_cast<std::uint8_t>(DecisionReason::AlwaysUpload), kReasonUndecided};
+    plan.bundle_roots = {"sub"};
+    plan.bundle = {1, 0, 0, 0};
+    plan.encoding = {FileEncoding::Plain, FileEncoding::Plain, FileEncoding::Gzip,
+                     FileEncoding::Plain};
+    plan.copy_from = {PathStore::kInvalidId, PathStore::kInvalidId, PathStore::kInvalidId,
+                      PathStore::kInvalidId};
+    plan.rename_sources = {"old"};
+    plan.rename_from = {PathStore::kInvalidId, PathStore::kInvalidId, PathStore::kInvalidId,
+                        PathStore::kInvalidId};
+    plan.dir_rename_from = {PathStore::kInvalidId, 0};
+
+    std::string data = SerializePlan(plan);
+    SyncPlan loaded;
+    std::string error;
+    EXPECT_TRUE(DeserializePlan(data, &loaded, &error));
+    EXPECT_EQ(loaded.source, plan.source);
+    EXPECT_EQ(loaded.remote_root, "/Root");
+    EXPECT_TRUE(loaded.compare_mode == CompareMode::SizeOnly);
+    EXPECT_EQ(loaded.created_ns, plan.created_ns);
+    EXPECT_TRUE(loaded.root_exists);
+    EXPECT_EQ(loaded.store.FileRelativeUtf8(2), "sub/large.jpg");
+    EXPECT_EQ(loaded.store.FileSize(2), 900u);
+    EXPECT_EQ(loaded.store.FileMtimeNs(2), 333);
+    EXPECT_TRUE(loaded.dir_missing == plan.dir_missing);
+    EXPECT_TRUE(loaded.action == plan.action);
+    EXPECT_TRUE(loaded.reason == plan.reason);
+    EXPECT_TRUE(loaded.bundle_roots == plan.bundle_roots);
+    EXPECT_TRUE(loaded.bundle == plan.bundle);
+    EXPECT_TRUE(loaded.encoding == plan.encoding);
+    EXPECT_TRUE(loaded.copy_from == plan.copy_from);
+    EXPECT_TRUE(loaded.rename_sources == plan.rename_sources);
+    EXPECT_TRUE(loaded.rename_from == plan.rename_from);
+    EXPECT_TRUE(loaded.dir_rename_from == plan.dir_rename_from);
+
+    // Largest first; skipped, undecided and bundled files are not scheduled.
+    std::vector<FileId> order = PlanExecutionOrder(loaded);
+    EXPECT_EQ(order.size(), static_cast<std::size_t>(1));
+    EXPECT_EQ(order[0], 2u);
+
+    PlanSummary summary = SummarizePlan(loaded);
+    EXPECT_EQ(summary.uploads, 2u);
+    EXPECT_EQ(summary.deletes, 1u);
+    EXPECT_EQ(summary.skips, 1u);
+    EXPECT_EQ(summary.undecided, 1u);
+    EXPECT_EQ(summary.upload_bytes, 910u);
+    EXPECT_EQ(summary.bundled, 1u);
+    EXPECT_EQ(summary.compressed, 1u);
+    EXPECT_EQ(summary.dir_renames, 1u);
+
+    // A copy of a skipped file is rejected.
+    SyncPlan bad_copy = plan;
+    bad_copy.copy_from[0] = 1;
+    EXPECT_TRUE(!DeserializePlan(SerializePlan(bad_copy), &loaded, &error));
+    SyncPlan bad_rename = plan;
+    bad_rename.rename_from[3] = 1;
+    EXPECT_TRUE(!DeserializePlan(SerializePlan(bad_rename), &loaded, &error));
+
+    EXPECT_TRUE(!DeserializePlan(data.substr(0, data.size() - 1), &loaded, &error));
+    EXPECT_TRUE(!DeserializePlan("not a plan", &loaded, &error));
+}
+
+TEST_CASE(RunModelPredictsLimits) {
+    auto near = [](double a, double b) { return std::abs(a - b) < 1e-6; };
+    AppConfig config;
+    config.threads = 4;
+    NetworkModel network;
+    network.rtt_ms = 100.0;
+    network.scan_files_per_second = 0.0;
+
+    // Small files on a fast link: one round trip each, spread over the
+    // workers.
+    RunWorkload workload;
+    std::string error;
+    EXPECT_TRUE(ParseSizeHistogram("1K:100", &workload.uploads, &error));
+    EXPECT_EQ(workload.uploads.size(), 100u);
+    EXPECT_EQ(workload.uploads.front().bytes, 1024u);
+    RunPrediction p = SimulateRun(workload, network, config);
+    EXPECT_TRUE(near(p.execute, 2.5));
+    EXPECT_EQ(p.puts, 100u);
+    EXPECT_EQ(p.upload_workers, 4);
+    EXPECT_EQ(p.bottleneck, std::string("round trips"));
+
+    // A server serving two requests at once halves that, whatever the
+    // thread count.
+    network.server_concurrency = 2;
+    config.threads = 16;
+    p = SimulateRun(workload, network, config);
+    EXPECT_TRUE(near(p.execute, 5.0));
+    EXPECT_EQ(p.bottleneck, std::string("server concurrency"));
+    network.server_concurrency = 0;
+
+    // A saturated link takes as long with one thread as with eight.
+    RunWorkload large;
+    EXPECT_TRUE(ParseSizeHistogram("1M:8", &large.uploads, &error));
+    network.rtt_ms = 0.0;
+    network.link_bandwidth = 1048576.0;
+    config.threads = 1;
+    RunPrediction one = SimulateRun(large, network, config);
+    config.threads = 8;
+    RunPrediction eight = SimulateRun(large, network, config);
+    EXPECT_TRUE(near(one.execute, 8.0));
+    EXPECT_TRUE(near(eight.execute, 8.0));
+    EXPECT_TRUE(eight.link_busy > 0.99);
+    EXPECT_EQ(eight.bottleneck, std::string("bandwidth"));
+
+    // The rate limiter lets its burst through ahead of the limit.
+    network.link_bandwidth = 0.0;
+    config.rate_limit = 1ULL << 20;
+    p = SimulateRun(large, network, config);
+    EXPECT_TRUE(near(p.execute, 7.75));
+    config.rate_limit = 0;
+    network.link_bandwidth = 1048576.0;
+
+    // Large files go in chunks after the probe and the empty temporary
+    // object, and are moved into place.
+    config.chunked_min = 2ULL << 20;
+    config.chunk_size = 1ULL << 20;
+    RunWorkload chunked;
+    EXPECT_TRUE(ParseSizeHistogram("3M:1", &chunked.uploads, &error));
+    p = SimulateRun(chunked, network, config);
+    EXPECT_EQ(p.puts, 6u);
+    EXPECT_EQ(p.transfers, 1u);
+    EXPECT_TRUE(near(p.execute, 3.0));
+
+    // Errors add retries and back-off, the same ones every time.
+    network.rtt_ms = 100.0;
+    network.link_bandwidth = 0.0;
+    network.error_rate = 0.3;
+    p = SimulateRun(workload, network, config);
+    RunPrediction again = SimulateRun(workload, network, config);
+    EXPECT_TRUE(p.retries > 0);
+    EXPECT_EQ(p.retries, again.retries);
+    EXPECT_TRUE(near(p.total, again.total));
+    EXPECT_TRUE(p.execute > 100 * 0.1 / 8);
+
+    EXPECT_TRUE(!ParseSizeHistogram("1X:3", &workload.uploads, &error));
+    EXPECT_TRUE(!ParseSizeHistogram("4K", &workload.uploads, &error));
+
+    // A plan's first run lists the root only and creates the rest.
+    SyncPlan plan;
+    DirId sub = plan.store.AddDirectory(PathStore::kRootDir, "sub");
+    plan.store.AddFile(sub, "a.txt", 10, 1);
+    plan.store.AddFile(sub, "b.txt", 10, 1);
+    plan.store.AddFile(PathStore::kRootDir, "c.txt", 30, 1);
+    plan.root_exists = false;
+    plan.dir_missing = {1, 1};
+    plan.action.assign(3, FileActionType::Upload);
+    plan.reason.assign(3, static_cast<std::uint8_t>(DecisionReason::Missing));
+    plan.bundle.assign(3, 0);
+    plan.encoding.assign(3, FileEncoding::Plain);
+    plan.copy_from = {PathStore::kInvalidId, 0, PathStore::kInvalidId};
+    plan.rename_from.assign(3, PathStore::kInvalidId);
+    plan.dir_rename_from.assign(2, PathStore::kInvalidId);
+    RunWorkload from_plan = WorkloadFromPlan(plan, 64ULL << 20);
+    EXPECT_EQ(from_plan.listings, 1u);
+    EXPECT_EQ(from_plan.collections, 2u);
+    EXPECT_EQ(from_plan.uploads.size(), 2u);
+    EXPECT_EQ(from_plan.uploads[0].bytes, 30u);
+    EXPECT_EQ(from_plan.uploads[1].copies, 1u);
+
+    // Directories past a short dir_missing column count as missing, parents
+    // included.
+    plan.dir_missing.clear();
+    from_plan = WorkloadFromPlan(plan, 64ULL << 20);
+    EXPECT_EQ(from_plan.listings, 1u);
+    EXPECT_EQ(from_plan.collections, 2u);
+}
+
+TEST_CASE(LocalDeleterStreamsDeletedPaths) {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "uploader_delete_test";
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    std::filesystem::create_directories(root / "sub");
+    std::ofstream(root / "a.jpg") << "1";
+    std::ofstream(root / "sub" / "b.txt") << "2";
+    std::ofstream(root / "sub" / "c.txt") << "3";
+
+    PathStore store;
+    DirId sub = store.AddDirectory(PathStore::kRootDir, "sub");
+    FileId jpg = store.AddFile(PathStore::kRootDir, "a.jpg", 1);
+    FileId old_file = store.AddFile(sub, "b.txt", 1);
+    FileId gone = store.AddFile(sub, "missing.txt");
+    FileId kept = store.AddFile(sub, "c.txt");
+    (void)kept;
+
+    LoggerOptions options;
+    options.console = false;
+    Logger logger(root / "logs", options);
+    std::filesystem::path journal = root / "deleted.txt";
+    LocalDeleter deleter(store, root, journal, logger);
+    deleter.Enqueue(old_file, false);
+    deleter.Enqueue(jpg, true);
+    deleter.Enqueue(gone, false);
+    DeletionStats stats = deleter.Finish();
+
+    EXPECT_EQ(stats.deleted_jpg, 1u);
+    EXPECT_EQ(stats.deleted_old, 1u);
+    EXPECT_EQ(stats.errors, 1u);
+    EXPECT_TRUE(!std::filesystem::exists(root / "a.jpg"));
+    EXPECT_TRUE(!std::filesystem::exists(root / "sub" / "b.txt"));
+    EXPECT_TRUE(std::filesystem::exists(root / "sub" / "c.txt"));
+    std::uint64_t reclaimed = 0;
+    for (const ReclaimSample& sample : stats.reclaimed) {
+        EXPECT_TRUE(sample.seconds >= 0.0);
+        reclaimed += sample.bytes;
+    }
+    EXPECT_EQ(reclaimed, 2u);
+
+    std::ifstream in(journal);
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(in, line);) {
+        lines.push_back(line);
+    }
+    EXPECT_EQ(lines.size(), static_cast<std::size_t>(2));
+    EXPECT_TRUE(std::find(lines.begin(), lines.end(), (root / "a.jpg").u8string()) != lines.end());
+    EXPECT_TRUE(std::find(lines.begin(), lines.end(), (root / "sub" / "b.txt").u8string()) !=
+                lines.end());
+}
+
+TEST_CASE(StatusBoardTracksWorkers) {
+    StatusBoard board(1);
+    board.AddPlanned(3, 1000);
+    board.AddPlanned(1, 3000);
+    board.SetWorkers(2);
+    WorkerStatus& first = board.Worker(0);
+    WorkerStatus& second = board.Worker(1);
+
+    board.Begin(first, 1, 3000);
+    first.SetState(WorkerState::Sending);
+    first.sent = 1000;
+    board.Begin(second, 2, 1000);
+    second.SetState(WorkerState::RetryWait);
+    second.retries = 2;
+    StatusSnapshot status = board.Read();
+    EXPECT_EQ(status.files_total, 4u);
+    EXPECT_EQ(status.bytes_total, 4000u);
+    EXPECT_EQ(status.files_done, 0u);
+    EXPECT_EQ(status.bytes_done, 1000u);
+    EXPECT_EQ(status.errors, 1u);
+    EXPECT_EQ(status.retries, 2u);
+    EXPECT_TRUE(status.workers[1].state == WorkerState::RetryWait);
+    EXPECT_EQ(FormatStatusLine(status, 500.0),
+              " 25% | 0/4 files | 1000 B/3.9 KB | 500 B/s | ETA 0:00:06 | 1 errors | "
+              "1 sending, 1 retry-wait");
+
+    // A body larger than planned, e.g. with tar headers, counts as the plan.
+    second.sent = 5000;
+    EXPECT_EQ(board.Read().bytes_done, 2000u);
+    board.Finish(second, 3);
+    board.AddErrors(1);
+    status = board.Read();
+    EXPECT_EQ(status.files_done, 3u);
+    EXPECT_EQ(status.bytes_done, 2000u);
+    EXPECT_EQ(status.errors, 2u);
+    EXPECT_TRUE(status.workers[1].state == WorkerState::Idle);
+    EXPECT_EQ(status.workers[1].item, 0u);
+
+    std::string json = FormatStatusJson(status, 0.0, {"big \"one\".bin", ""}, false);
+    EXPECT_TRUE(json.find("\"files\": {\"done\": 3, \"total\": 4}") != std::string::npos);
+    EXPECT_TRUE(json.find("\"eta_seconds\": null") != std::string::npos);
+    EXPECT_TRUE(json.find("\"item\": \"big \\\"one\\\".bin\"") != std::string::npos);
+    EXPECT_TRUE(json.find("\"state\": \"idle\", \"state_seconds\"") != std::string::npos);
+}
+
+TEST_CASE(RateWindowIgnoresRetriedBytes) {
+    RateWindow window;
+    EXPECT_EQ(window.Add(0.0, 1000), 0.0);
+    EXPECT_EQ(window.Add(1.0, 3000), 2000.0);
+    // A retry starts its body over, so fewer bytes are done than before.
+    EXPECT_EQ(window.Add(2.0, 500), 0.0);
+    EXPECT_EQ(window.Add(4.0, 5000), 1000.0);
+    // Samples older than the window drop out, the low one too.
+    EXPECT_EQ(window.Add(12.0, 5000), 450.0);
+    EXPECT_EQ(window.Add(14.0, 9000), 400.0);
+}
+
+TEST_CASE(FileReaderModesReadSameBytes) {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "uploader_reader_test.bin";
+    std::string data(3 * 1024 * 1024 + 12345, '\0');
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        data[i] = static_cast<char>((i * 131) ^ (i >> 11));
+    }
+    std::ofstream(path, std::ios::binary) << data;
+
+    ReadCacheMode mode = ReadCacheMode::Buffered;
+    EXPECT_TRUE(ParseReadCacheMode("drop-behind", &mode));
+    EXPECT_TRUE(mode == ReadCacheMode::DropBehind);
+    EXPECT_EQ(std::string(ReadCacheModeName(mode)), "drop-behind");
+    EXPECT_TRUE(!ParseReadCacheMode("fadvise", &mode));
+
+    for (ReadCacheMode m : {ReadCacheMode::Buffered, ReadCacheMode::DropBehind,
+                            ReadCacheMode::Direct}) {
+        // Direct for everything from 1 MB; file systems without O_DIRECT
+        // fall back to drop-behind.
+        FileReader reader(ReadOptions{m, 1 << 20});
+        std::string error;
+        EXPECT_TRUE(reader.Open(path, &error));
+        EXPECT_EQ(reader.Size(), static_cast<std::uint64_t>(data.size()));
+        for (int pass = 0; pass < 2; ++pass) {
+            std::string got;
+            std::vector<char> buffer(70001);
+            std::size_t read = 0;
+            do {
+                EXPECT_TRUE(reader.Read(buffer.data(), buffer.size(), &read, &error));
+                got.append(buffer.data(), read);
+            } while (read > 0);
+            EXPECT_TRUE(got == data);
+            EXPECT_TRUE(reader.Rewind(&error));
+        }
+
+        // Chunks of a chunked upload, the last one running to the end.
+        for (std::uint64_t offset : {std::uint64_t{1} << 20, std::uint64_t{3} << 20}) {
+            std::uint64_t length = (std::min)(std::uint64_t{1} << 20, data.size() - offset - 5);
+            EXPECT_TRUE(reader.SetRange(offset, length, &error));
+            EXPECT_EQ(reader.Size(), length);
+            EXPECT_EQ(reader.FileSize(), static_cast<std::uint64_t>(data.size()));
+            std::string got;
+            std::vector<char> buffer(70001);
+            std::size_t read = 0;
+            do {
+                EXPECT_TRUE(reader.Read(buffer.data(), buffer.size(), &read, &error));
+                got.append(buffer.data(), read);
+            } while (read > 0);
+            EXPECT_TRUE(got == data.substr(offset, length));
+        }
+        EXPECT_TRUE(!reader.SetRange(3 << 20, data.size(), &error));
+    }
+
+    FileReader missing{ReadOptions{}};
+    std::string error;
+    EXPECT_TRUE(!missing.Open(path.string() + ".missing", &error));
+    EXPECT_TRUE(!error.empty());
+}
+
+TEST_CASE(TarBundleBodyStreamsMembers) {
+    EXPECT_EQ(NormalizeBundleRoot(".\\thumbs\\small/"), "thumbs/small");
+    EXPECT_EQ(NormalizeBundleRoot("."), "");
+
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "uploader_bundle_test";
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    std::string long_name(120, 'n');
+    std::filesystem::create_directories(root / "thumbs" / "a");
+    std::ofstream(root / "thumbs" / "a" / "one.txt") << "hello";
+    std::ofstream(root / "thumbs" / long_name) << std::string(700, 'x');
+    std::ofstream(root / "thumbs" / "changed.txt") << "old";
+
+    PathStore store;
+    DirId thumbs = store.AddDirectory(PathStore::kRootDir, "thumbs");
+    DirId a = store.AddDirectory(thumbs, "a");
+    auto add_scanned = [&](DirId dir, const std::string& name, const std::filesystem::path& path) {
+        std::uint64_t size = 0;
+        std::int64_t mtime_ns = 0;
+        StatLocalFile(path, &size, &mtime_ns);
+        return store.AddFile(dir, name, size, mtime_ns);
+    };
+    std::vector<FileId> files = {
+        add_scanned(a, "one.txt", root / "thumbs" / "a" / "one.txt"),
+        add_scanned(thumbs, long_name, root / "thumbs" / long_name),
+        // Recorded with a size the file does not have.
+        store.AddFile(thumbs, "changed.txt", 4, 0)};
+
+    BundleGroups groups = AssignBundleGroups(store, {"thumbs"});
+    EXPECT_EQ(groups.dir_group[PathStore::kRootDir], 0);
+    EXPECT_EQ(groups.dir_group[a], 1);
+    EXPECT_EQ(groups.root_dir[0], thumbs);
+
+    TarBundleBody body(store, root, files, "thumbs");
+    std::string tar;
+    for (int pass = 0; pass < 2; ++pass) {
+        std::string error;
+        EXPECT_TRUE(body.Rewind(&error));
+        tar.clear();
+        char buffer[100];
+        std::size_t read = 0;
+        do {
+            EXPECT_TRUE(body.Read(buffer, sizeof(buffer), &read, &error));
+            tar.append(buffer, read);
+        } while (read > 0);
+    }
+    EXPECT_EQ(tar.size(), body.Size());
+    EXPECT_EQ(tar.size() % 512, static_cast<std::size_t>(0));
+    EXPECT_EQ(tar.substr(0, 9), "a/one.txt");
+    EXPECT_EQ(tar.substr(257, 5), "ustar");
+    EXPECT_EQ(tar.substr(512, 5), "hello");
+    // The long name travels in a PAX header.
+    EXPECT_EQ(tar[1024 + 156], 'x');
+    EXPECT_TRUE(tar.find("path=thumbs") == std::string::npos);
+    EXPECT_TRUE(tar.find("path=" + long_name + "\n") != std::string::npos);
+    EXPECT_TRUE(body.MemberIntact(0));
+    EXPECT_TRUE(body.MemberIntact(1));
+    EXPECT_TRUE(!body.MemberIntact(2));
+
+    std::string index = body.BuildIndex();
+    EXPECT_EQ(index.substr(0, index.find('\n')),
+              "512\t5\t" + std::to_string(store.FileMtimeNs(files[0])) + "\ta/one.txt");
+    EXPECT_TRUE(index.find("changed.txt") == std::string::npos);
+
+}
+
+TEST_CASE(StateManifestRoundTrip) {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "uploader_state_test";
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    std::filesystem::create_directories(root);
+
+    std::filesystem::path path = StateManifestPath(root, "gzip", "/Root");
+    EXPECT_TRUE(path != StateManifestPath(root, "gzip", "/Other"));
+    EXPECT_EQ(path.filename().string().substr(0, 5), "gzip-");
+
+    StateManifest manifest;
+    std::string error;
+    EXPECT_TRUE(manifest.Load(path, &error));
+    EXPECT_EQ(manifest.Size(), static_cast<std::size_t>(0));
+    manifest.Set("a/one.txt", {5, 42, 5});
+    StateManifest::Entry log{9000, 7, 310, 3, 0x100000002ULL};
+    Sha256 hash;
+    hash.Update("log", 3);
+    log.digest = hash.Finish();
+    manifest.Set("log.txt", log);
+    EXPECT_TRUE(manifest.Save(path, &error));
+    StateManifest loaded;
+    EXPECT_TRUE(loaded.Load(path, &error));
+    EXPECT_EQ(loaded.Size(), static_cast<std::size_t>(2));
+    EXPECT_TRUE(loaded.Find("a/one.txt") != nullptr);
+    EXPECT_EQ(loaded.Find("a/one.txt")->mtime_ns, 42);
+    EXPECT_EQ(loaded.Find("log.txt")->stored_size, 310u);
+    EXPECT_EQ(loaded.Find("log.txt")->file_index, 0x100000002ULL);
+    EXPECT_EQ(loaded.Find("a/one.txt")->device, 0u);
+    EXPECT_TRUE(loaded.Find("log.txt")->digest == log.digest);
+    EXPECT_TRUE(loaded.Find("a/one.txt")->digest == Sha256Digest{});
+    loaded.Erase("a/one.txt");
+    EXPECT_EQ(loaded.Size(), static_cast<std::size_t>(1));
+    EXPECT_TRUE(loaded.Find("missing") == nullptr);
+
+    std::ofstream(root / "bad.manifest") << "garbage";
+    EXPECT_TRUE(!loaded.Load(root / "bad.manifest", &error));
+}
+
+// Answers every request with `status` and fixed timings.
+class FixedTransport : public WebDavTransport {
+public:
+    explicit FixedTransport(long status) : status_(status) {}
+    bool IsReady() const override { return true; }
+    WebDavResponse Send(const HttpRequest& request, RateLimiter*, WorkerStatus*,
+                        HttpTimings* timings, std::string*) override {
+        if (request.body) {
+            std::string ignored;
+            std::vector<char> buffer(4096);
+            std::size_t read = 0;
+            while (request.body->Read(buffer.data(), buffer.size(), &read, &ignored) && read > 0) {
+            }
+        }
+        if (timings) {
+            *timings = {100, 2000, 300};
+        }
+        WebDavResponse response;
+        response.status = status_;
+        response.body = "ok";
+        return response;
+    }
+
+private:
+    long status_;
+};
+
+TEST_CASE(HttpTraceRecordsAndReplays) {
+    EXPECT_TRUE(TraceMethodOf("MKCOL") == TraceMethod::Mkcol);
+    EXPECT_TRUE(TraceMethodOf("LOCK") == TraceMethod::Other);
+    EXPECT_EQ(std::string(TraceMethodName(TraceMethod::Propfind)), "PROPFIND");
+
+    TraceRecorder recorder;
+    std::unique_ptr<WebDavTransport> first = recorder.Wrap(std::make_unique<FixedTransport>(201));
+    std::unique_ptr<WebDavTransport> second = recorder.Wrap(std::make_unique<FixedTransport>(503));
+    MemoryBody body(std::string(10000, 'x'));
+    HttpRequest put{"PUT", "/Root/a.bin", "Authorization: secret\r\n", &body};
+    HttpTimings timings;
+    std::string error;
+    EXPECT_EQ(second->Send(put, nullptr, nullptr, &timings, &error).status, 503);
+    body.Rewind(&error);
+    EXPECT_EQ(first->Send(put, nullptr, nullptr, &timings, &error).status, 201);
+    EXPECT_EQ(timings.transfer_us, 2000u);
+    EXPECT_EQ(first->Send(HttpRequest{"MKCOL", "/Root", "", nullptr}, nullptr, nullptr, nullptr,
+                          &error)
+                  .status,
+              201);
+
+    std::filesystem::path path = std::filesystem::temp_directory_path() / "uploader_trace_test.bin";
+    EXPECT_TRUE(recorder.Save(path, &error));
+    std::vector<TraceRecord> records;
+    EXPECT_TRUE(ReadTraceFile(path, &records, &error));
+    EXPECT_EQ(records.size(), static_cast<std::size_t>(3));
+    EXPECT_TRUE(records[0].start_us <= records[1].start_us);
+    EXPECT_EQ(records[0].client, 1u);
+    EXPECT_EQ(records[0].status, 503u);
+    EXPECT_EQ(records[0].request_bytes, 10000u);
+    EXPECT_EQ(records[0].response_bytes, 2u);
+    EXPECT_EQ(records[0].path_hash, TracePathHash("/Root/a.bin"));
+    EXPECT_TRUE(records[2].method == TraceMethod::Mkcol);
+    std::string raw;
+    {
+        std::ifstream in(path, std::ios::binary);
+        raw.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+    EXPECT_TRUE(raw.find("secret") == std::string::npos);
+    EXPECT_TRUE(raw.find("a.bin") == std::string::npos);
+
+    // The same path replays its recorded attempts in order, then falls back
+    // to the typical PUT, scaled by size: 10000 bytes in 2000 us.
+    TraceReplayer replayer(records);
+    std::unique_ptr<WebDavTransport> replay = replayer.MakeTransport();
+    body.Rewind(&error);
+    EXPECT_EQ(replay->Send(put, nullptr, nullptr, &timings, &error).status, 503);
+    body.Rewind(&error);
+    EXPECT_EQ(replay->Send(put, nullptr, nullptr, &timings, &error).status, 201);
+    EXPECT_EQ(replayer.Matched(), 2u);
+    bool matched = true;
+    TraceRecord modelled = replayer.Next(TraceMethod::Put, TracePathHash("/Root/b.bin"), 5000,
+                                         &matched);
+    EXPECT_TRUE(!matched);
+    EXPECT_EQ(modelled.status, 201u);
+    EXPECT_EQ(modelled.timings.transfer_us, 1000u);
+    EXPECT_EQ(modelled.timings.ttfb_us, 300u);
+    // Methods the trace lacks answer as a server usually does.
+    EXPECT_EQ(replayer.Next(TraceMethod::Move, 1, 0, &matched).status, 201u);
+    WebDavResponse listing =
+        replay->Send(HttpRequest{"PROPFIND", "/Root", "Depth: 1\r\n", nullptr}, nullptr, nullptr,
+                     nullptr, &error);
+    EXPECT_EQ(listing.status, 207);
+    EXPECT_TRUE(listing.body.find("404") != std::string::npos);
+
+    std::ofstream(path, std::ios::binary) << "garbage";
+    EXPECT_TRUE(!ReadTraceFile(path, &records, &error));
+}
+
+TEST_CASE(GzipStreamIsSplitIndependent) {
+    const char check[] = "123456789";
+    EXPECT_EQ(Crc32(0, reinterpret_cast<const unsigned char*>(check), 9), 0xCBF43926u);
+
+    std::string text;
+    for (int i = 0; i < 5000; ++i) {
+        text += "line " + std::to_string(i % 97) + " of a repetitive log file\n";
+    }
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(text.data());
+    GzipEncoder encoder;
+    std::string whole;
+    encoder.Write(data, text.size(), &whole);
+    encoder.Finish(&whole);
+
+    encoder.Reset();
+    std::string pieces;
+    for (std::size_t pos = 0; pos < text.size(); pos += 777) {
+        encoder.Write(data + pos, std::min<std::size_t>(777, text.size() - pos), &pieces);
+    }
+    encoder.Finish(&pieces);
+    EXPECT_TRUE(whole == pieces);
+    EXPECT_TRUE(whole.size() < text.size() / 4);
+    EXPECT_EQ(static_cast<unsigned char>(whole[0]), 0x1Fu);
+    EXPECT_EQ(static_cast<unsigned char>(whole[1]), 0x8Bu);
+    // The trailer carries the CRC and the input size, little-endian.
+    auto trailer = [&](std::size_t at) {
+        std::uint32_t value = 0;
+        for (int i = 3; i >= 0; --i) {
+            value = (value << 8) | static_cast<unsigned char>(whole[whole.size() - at + i]);
+        }
+        return value;
+    };
+    EXPECT_EQ(trailer(8), Crc32(0, data, text.size()));
+    EXPECT_EQ(trailer(4), static_cast<std::uint32_t>(text.size()));
+
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "uploader_gzip_test";
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    std::filesystem::create_directories(root);
+    std::ofstream(root / "app.log", std::ios::binary) << text;
+    std::string noise;
+    std::uint32_t state = 12345;
+    for (int i = 0; i < 64 * 1024; ++i) {
+        state = state * 1103515245u + 12345u;
+        noise.push_back(static_cast<char>(state >> 24));
+    }
+    std::ofstream(root / "photo.jpg", std::ios::binary) << noise;
+    EXPECT_TRUE(LooksCompressible(root / "app.log", text.size()));
+    EXPECT_TRUE(!LooksCompressible(root / "photo.jpg", noise.size()));
+
+    GzipFileBody body(root / "app.log");
+    std::string error;
+    EXPECT_TRUE(body.Open(&error));
+    EXPECT_EQ(body.SourceSize(), static_cast<std::uint64_t>(text.size()));
+    EXPECT_EQ(body.Size(), static_cast<std::uint64_t>(whole.size()));
+    std::string streamed;
+    char buffer[1000];
+    std::size_t read = 0;
+    do {
+        EXPECT_TRUE(body.Read(buffer, sizeof(buffer), &read, &error));
+        streamed.append(buffer, read);
+    } while (read > 0);
+    EXPECT_TRUE(streamed == whole);
+    std::uint64_t size = 0;
+    EXPECT_TRUE(GzipCompressedSize(root / "app.log", &size, &error));
+    EXPECT_EQ(size, static_cast<std::uint64_t>(whole.size()));
+}
+
+TEST_CASE(DedupGroupsIdenticalUploads) {
+    auto hex = [](const std::string& text) {
+        Sha256 hash;
+        hash.Update(text.data(), text.size());
+        return Sha256Hex(hash.Finish());
+    };
+    EXPECT_EQ(hex(""), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+    EXPECT_EQ(hex("abc"), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+    EXPECT_EQ(hex(std::string(1000, 'a')),
+              "41edece42d63e8d9bf515a9ba6932e1c20cbc9f5a5d134645adb5db1b9737ea3");
+
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "uploader_dedup_test";
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    std::filesystem::create_directories(root / "a");
+    std::filesystem::create_directories(root / "b");
+    std::string content(kMinDedupSize, 'x');
+    std::string other = content;
+    other.back() = 'y';
+    std::ofstream(root / "a" / "doc.bin", std::ios::binary) << content;
+    std::ofstream(root / "b" / "doc.bin", std::ios::binary) << content;
+    std::ofstream(root / "other.bin", std::ios::binary) << other;
+    std::ofstream(root / "small.bin", std::ios::binary) << "tiny";
+    std::ofstream(root / "small2.bin", std::ios::binary) << "tiny";
+    std::filesystem::create_hard_link(root / "a" / "doc.bin", root / "link.bin", ec);
+    bool linked = !ec;
+
+    Logger logger(std::filesystem::temp_directory_path() / "uploader_dedup_logs");
+    SyncPlan plan;
+    plan.source = root;
+    ScanSource(root, ExcludeMatcher(ExcludeRules{}), logger, &plan.store);
+    std::size_t count = plan.store.FileCount();
+    plan.action.assign(count, FileActionType::Upload);
+    plan.reason.assign(count, static_cast<std::uint8_t>(DecisionReason::Missing));
+    plan.bundle.assign(count, 0);
+    plan.encoding.assign(count, FileEncoding::Plain);
+    plan.rename_from.assign(count, PathStore::kInvalidId);
+    plan.dir_rename_from.assign(plan.store.DirectoryCount(), PathStore::kInvalidId);
+
+    DedupStats stats = FindDuplicateUploads(&plan, 2, logger);
+    auto find = [&](const std::string& rel) {
+        for (FileId file = 0; file < count; ++file) {
+            if (plan.store.FileRelativeUtf8(file) == rel) {
+                return file;
+            }
+        }
+        return PathStore::kInvalidId;
+    };
+    // One file of the group is uploaded, the rest point at it.
+    std::vector<FileId> group = {find("a/doc.bin"), find("b/doc.bin")};
+    if (linked) {
+        group.push_back(find("link.bin"));
+    }
+    FileId source = *std::min_element(group.begin(), group.end());
+    for (FileId file : group) {
+        EXPECT_EQ(plan.copy_from[file], file == source ? PathStore::kInvalidId : source);
+    }
+    EXPECT_EQ(plan.copy_from[find("other.bin")], PathStore::kInvalidId);
+    EXPECT_EQ(plan.copy_from[find("small2.bin")], PathStore::kInvalidId);
+    EXPECT_EQ(stats.errors, 0u);
+    EXPECT_EQ(stats.copies, static_cast<std::uint64_t>(group.size() - 1));
+    EXPECT_EQ(stats.hard_links, linked ? 1u : 0u);
+    // Hard links are hashed once.
+    EXPECT_EQ(stats.hashed, 3u);
+
+    std::vector<FileId> order = PlanExecutionOrder(plan);
+    EXPECT_EQ(order.size(), static_cast<std::size_t>(count - group.size() + 1));
+    EXPECT_EQ(SummarizePlan(plan).copies, stats.copies);
+}
+
+TEST_CASE(RenamesMatchEarlierUploads) {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "uploader_rename_test";
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    std::filesystem::create_directories(root / "new" / "sub");
+    std::ofstream(root / "new" / "a.bin") << "aaa";
+    std::ofstream(root / "new" / "sub" / "b.bin") << "bb";
+    std::ofstream(root / "moved.txt") << "m";
+    std::ofstream(root / "fresh.txt") << "f";
+
+    Logger logger(std::filesystem::temp_directory_path() / "uploader_rename_logs");
+    SyncPlan plan;
+    plan.source = root;
+    ScanSource(root, ExcludeMatcher(ExcludeRules{}), logger, &plan.store);
+    std::size_t count = plan.store.FileCount();
+    plan.dir_missing.assign(plan.store.DirectoryCount(), 1);
+    plan.dir_missing[PathStore::kRootDir] = 0;
+    plan.action.assign(count, FileActionType::Upload);
+    plan.reason.assign(count, static_cast<std::uint8_t>(DecisionReason::Missing));
+    plan.bundle.assign(count, 0);
+    plan.encoding.assign(count, FileEncoding::Plain);
+    plan.copy_from.assign(count, PathStore::kInvalidId);
+    auto find = [&](const std::string& rel) {
+        for (FileId file = 0; file < count; ++file) {
+            if (plan.store.FileRelativeUtf8(file) == rel) {
+                return file;
+            }
+        }
+        return PathStore::kInvalidId;
+    };
+
+    // Record the local files as uploaded under their old paths.
+    StateManifest uploads;
+    auto record = [&](const std::string& local, const std::string& old) {
+        FileId file = find(local);
+        LocalFileId id;
+        EXPECT_TRUE(LocalFileIdentity(root / local, &id));
+        uploads.Set(old, {plan.store.FileSize(file), plan.store.FileMtimeNs(file),
+                          plan.store.FileSize(file), id.device, id.index});
+    };
+    record("new/a.bin", "old/a.bin");
+    record("new/sub/b.bin", "old/sub/b.bin");
+    record("moved.txt", "before.txt");
+    uploads.Set("gone.txt", {1, 1, 1, 0, 0});
+    uploads.Set("fresh.txt", {1, 1, 1, 0, 0});
+
+    RenameStats stats = FindRenamedUploads(&plan, &uploads);
+    EXPECT_EQ(stats.files, 3u);
+    EXPECT_EQ(stats.dirs, 1u);
+    FileId moved = find("moved.txt");
+    EXPECT_EQ(plan.rename_sources[plan.rename_from[moved]], "before.txt");
+    EXPECT_EQ(plan.rename_sources[plan.rename_from[find("new/sub/b.bin")]], "old/sub/b.bin");
+    EXPECT_EQ(plan.rename_from[find("fresh.txt")], PathStore::kInvalidId);
+    // Only the topmost directory of the renamed subtree is moved.
+    for (DirId dir = 1; dir < plan.store.DirectoryCount(); ++dir) {
+        if (plan.store.DirectoryRelativeUtf8(dir) == "new") {
+            EXPECT_EQ(plan.rename_sources[plan.dir_rename_from[dir]], "old");
+        } else {
+            EXPECT_EQ(plan.dir_rename_from[dir], PathStore::kInvalidId);
+        }
+    }
+    // Entries of vanished files are dropped; renamed ones stay until reused.
+    EXPECT_TRUE(uploads.Find("gone.txt") == nullptr);
+    EXPECT_TRUE(uploads.Find("before.txt") != nullptr);
+    EXPECT_TRUE(uploads.Find("fresh.txt") != nullptr);
+    EXPECT_EQ(SummarizePlan(plan).renames, 3u);
+
+    // A file recorded in the old directory but gone now keeps it from moving
+    // whole; its subdirectory still does.
+    uploads.Set("old/extra.bin", {1, 1, 1, 0, 0});
+    stats = FindRenamedUploads(&plan, &uploads);
+    EXPECT_EQ(stats.files, 3u);
+    EXPECT_EQ(stats.dirs, 1u);
+    for (DirId dir = 1; dir < plan.store.DirectoryCount(); ++dir) {
+        bool sub = plan.store.DirectoryRelativeUtf8(dir) == "new/sub";
+        EXPECT_EQ(plan.dir_rename_from[dir] != PathStore::kInvalidId, sub);
+    }
+}
+
+TEST_CASE(ScanSourceCapturesMetadata) {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "uploader_scan_test";
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    std::filesystem::create_directories(root / "sub" / "deep");
+    std::filesystem::create_directories(root / ".git" / "objects");
+    std::ofstream(root / "top.txt") << "12345";
+    std::ofstream(root / "sub" / "deep" / "doc.txt") << "abc";
+    std::ofstream(root / "sub" / "skip.tmp") << "x";
+    std::ofstream(root / ".git" / "objects" / "blob") << "x";
+
+    Logger logger(std::filesystem::temp_directory_path() / "uploader_scan_logs");
+    PathStore store;
+    ExcludeMatcher excludes(BuildDefaultExcludeRules());
+    ScanStats stats = ScanSource(root / "sub", excludes, logger, &store);
+    EXPECT_EQ(stats.errors, 0u);
+    EXPECT_EQ(stats.files, 1u);
+    EXPECT_EQ(stats.excluded, 1u);
+    EXPECT_EQ(store.FileRelativeUtf8(0), "deep/doc.txt");
+    EXPECT_EQ(store.FileSize(0), 3u);
+
+    auto expected = std::filesystem::last_write_time(root / "sub" / "deep" / "doc.txt");
+    auto delta = store.FileModified(0) - std::chrono::system_clock::now();
+    auto file_delta = expected - std::filesystem::file_time_type::clock::now();
+    EXPECT_TRUE(std::chrono::abs(delta - file_delta) < std::chrono::seconds(2));
+
+    PathStore full;
+    stats = ScanSource(root, excludes, logger, &full);
+    EXPECT_EQ(stats.files, 2u);
+    EXPECT_EQ(stats.directories, 2u);
+    for (FileId f = 0; f < full.FileCount(); ++f) {
+        EXPECT_TRUE(full.FileRelativeUtf8(f).rfind(".git", 0) != 0);
+    }
+
+    std::atomic<bool> stop{true};
+    PathStore stopped;
+    stats = ScanSource(root, excludes, logger, &stopped, std::string(), &stop);
+    EXPECT_TRUE(stats.stopped);
+    EXPECT_EQ(stats.files, 0u);
+}
+
+TEST_CASE(ScanSourceAppliesIgnoreFiles) {
+    std::filesystem::path root = std::filesystem::temp_directory_path() / "uploader_ignore_test";
+    std::error_code ec;
+    std::filesystem::remove_all(root, ec);
+    std::filesystem::create_directories(root / "app" / "build" / "obj");
+    std::filesystem::create_directories(root / "app" / "src");
+    std::ofstream(root / ".uploaderignore") << "*.log\n";
+    std::ofstream(root / "app" / ".uploaderignore") << "build/\n!important.log\n";
+    std::ofstream(root / "run.log") << "x";
+    std::ofstream(root / "app" / "important.log") << "x";
+    std::ofstream(root / "app" / "other.log") << "x";
+    std::ofstream(root / "app" / "src" / "main.cpp") << "x";
+    std::ofstream(root / "app" / "build" / "obj" / "main.o") << "x";
+
+    Logger logger(std::filesystem::temp_directory_path() / "uploader_scan_logs");
+    ExcludeMatcher excludes(BuildDefaultExcludeRules());
+    PathStore store;
+    ScanStats stats = ScanSource(root, excludes, logger, &store, ".uploaderignore");
+    EXPECT_EQ(stats.errors, 0u);
+    EXPECT_EQ(stats.ignore_files, 2u);
+    EXPECT_EQ(stats.excluded, 3u);
+    std::vector<std::string> files;
+    for (FileId f = 0; f < store.FileCount(); ++f) {
+        files.push_back(store.FileRelativeUtf8(f));
+    }
+    std::sort(files.begin(), files.end());
+    std::vector<std::string> expected = {".uploaderignore", "app/.uploaderignore",
+                                         "app/important.log", "app/src/main.cpp"};
+    EXPECT_TRUE(files == expected);
+
+    PathStore unfiltered;
+    stats = ScanSource(root, excludes, logger, &unfiltered);
+    EXPECT_EQ(stats.ignore_files, 0u);
+    EXPECT_EQ(unfiltered.FileCount(), static_cast<std::size_t>(7));
+}
+
+TEST_CASE(AsyncLoggerDrainsAllThreads) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "uploader_async_logs";
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+
+    std::filesystem::path log_path;
+    {
+        LoggerOptions options;
+        options.async = true;
+        options.console = false;
+        options.min_level = LogLevel::Info;
+        Logger logger(dir, options);
+        log_path = logger.LogPath();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; ++t) {
+            threads.emplace_back([&logger, t]() {
+                for (int i = 0; i < 3000; ++i) {
+                    logger.Skip("t" + std::to_string(t) + "/" + std::to_string(i), "same");
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        logger.Error("last");
+        logger.Flush();
+
+        std::ifstream in(log_path);
+        std::string line;
+        std::size_t lines = 0;
+        while (std::getline(in, line)) {
+            lines++;
+        }
+        EXPECT_EQ(lines, static_cast<std::size_t>(12001));
+        logger.Info("after flush");
+    }
+
+    // Destruction drains what was logged after the last Flush.
+    std::ifstream in(log_path);
+    std::string line;
+    std::string last;
+    std::vector<int> next(4, 0);
+    bool ordered = true;
+    while (std::getline(in, line)) {
+        std::size_t pos = line.find("Skip t");
+        if (pos != std::string::npos) {
+            int t = line[pos + 6] - '0';
+            int i = std::stoi(line.substr(pos + 8));
+            ordered = ordered && i == next[t]++;
+            EXPECT_TRUE(line.find("] Skip t") != std::string::npos &&
+                        line.find(" (same)") != std::string::npos);
+        }
+        last = line;
+    }
+    EXPECT_TRUE(ordered);
+    EXPECT_TRUE(last.find("[INFO] after flush") != std::string::npos);
+}
+
+TEST_CASE(LoggerFiltersAndRateLimits) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "uploader_filter_logs";
+    std::error_code ec;
+    std::filesystem::remove_all(dir, ec);
+
+    LoggerOptions options;
+    options.console = false;
+    options.skip_lines_per_second = 5;
+    {
+        Logger logger(dir, options);
+        for (int i = 0; i < 50; ++i) {
+            logger.Skip("file" + std::to_string(i), "same");
+        }
+        EXPECT_TRUE(logger.SuppressedSkipLines() >= 40u);
+    }
+
+    options.min_level = LogLevel::Warn;
+    options.async = true;
+    std::filesystem::path log_path;
+    {
+        Logger logger(dir, options);
+        log_path = logger.LogPath();
+        logger.Info("hidden info");
+        logger.Skip("hidden", "skip");
+        logger.Warn("visible warn");
+    }
+    std::ifstream in(log_path);
+    std::string content((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    EXPECT_TRUE(content.find("hidden") == std::string::npos);
+    EXPECT_TRUE(content.find("[WARN] visible warn") != std::string::npos);
+    EXPECT_TRUE(content.find("Skip lines suppressed") != std::string::npos);
+}
+
 int main() {
     int failed = 0;
     for (const auto& test : Registry()) {